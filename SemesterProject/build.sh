@@ -2,4 +2,5 @@ mkdir bin
 cd src
 make
 cp smarthomed ../bin
+cp sample_export ../bin
 cd ..
\ No newline at end of file
@@ -1,2 +1,2 @@
 nohup homebridge > /dev/null 2>&1 &
-nohup ./bin/smarthomed > /dev/null 2>&1 &
+SMARTHOMED_LOG_DIR=./log SMARTHOMED_RT_CPU=3 SMARTHOMED_RT_LOCK=1 nohup ./bin/smarthomed > /dev/null 2>&1 &
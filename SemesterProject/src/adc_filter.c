@@ -0,0 +1,408 @@
+/**
+ * @file adc_filter.c
+ * @brief streaming filter bank over ADC samples, implementation.
+ *        Every channel of one MCP3208 is filtered at once, two 4-lane
+ *        vectors cover the 8 channels (NEON on the Raspberrypi, SSE on x86).
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adc_filter.h"
+
+#define LANES               (4)     /**< Floats per vector */
+
+/* ==================================
+    4-lane float vector abstraction
+   ================================== */
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+typedef float32x4_t vec4_t;
+#define vec4_load(p)        vld1q_f32(p)
+#define vec4_store(p, v)    vst1q_f32(p, v)
+#define vec4_dup(x)         vdupq_n_f32(x)
+#define vec4_add(a, b)      vaddq_f32(a, b)
+#define vec4_sub(a, b)      vsubq_f32(a, b)
+#define vec4_mul(a, b)      vmulq_f32(a, b)
+#define vec4_min(a, b)      vminq_f32(a, b)
+#define vec4_max(a, b)      vmaxq_f32(a, b)
+
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+
+typedef __m128 vec4_t;
+#define vec4_load(p)        _mm_loadu_ps(p)
+#define vec4_store(p, v)    _mm_storeu_ps(p, v)
+#define vec4_dup(x)         _mm_set1_ps(x)
+#define vec4_add(a, b)      _mm_add_ps(a, b)
+#define vec4_sub(a, b)      _mm_sub_ps(a, b)
+#define vec4_mul(a, b)      _mm_mul_ps(a, b)
+#define vec4_min(a, b)      _mm_min_ps(a, b)
+#define vec4_max(a, b)      _mm_max_ps(a, b)
+
+#else
+/* Plain vector extension, the compiler picks whatever the target offers. */
+typedef float vec4_t __attribute__((vector_size(16)));
+
+static inline vec4_t vec4_load(const float *p) {
+    vec4_t v; memcpy(&v, p, sizeof(v)); return v;
+}
+static inline void vec4_store(float *p, vec4_t v) { memcpy(p, &v, sizeof(v)); }
+static inline vec4_t vec4_dup(float x) { vec4_t v = {x, x, x, x}; return v; }
+#define vec4_add(a, b)      ((a) + (b))
+#define vec4_sub(a, b)      ((a) - (b))
+#define vec4_mul(a, b)      ((a) * (b))
+static inline vec4_t vec4_min(vec4_t a, vec4_t b) {
+    int i; for (i = 0; i < 4; ++i) a[i] = a[i] < b[i] ? a[i] : b[i]; return a;
+}
+static inline vec4_t vec4_max(vec4_t a, vec4_t b) {
+    int i; for (i = 0; i < 4; ++i) a[i] = a[i] > b[i] ? a[i] : b[i]; return a;
+}
+#endif
+
+/**
+ * @brief window of raw samples, running state and published output.
+ */
+struct adc_filter
+{
+    int type;                                               /**< ADC_FILTER_* */
+    int length;                                             /**< window length */
+    int head;                                               /**< newest sample */
+    int primed;                                             /**< got first sample */
+    float alpha;                                            /**< EWMA weight */
+    float coeffs[ADC_FILTER_MAX_TAPS];                      /**< FIR taps */
+    float window[ADC_FILTER_MAX_TAPS][ADC_FILTER_CHANNELS]; /**< sample history */
+    float sum[ADC_FILTER_CHANNELS];                         /**< moving sum */
+    float out[ADC_FILTER_CHANNELS];                         /**< published values */
+};
+
+/**
+ * @brief Store one sample into the window, priming it on the first call.
+ * @param filter a valid filter bank.
+ * @param samples ADC_FILTER_CHANNELS raw samples.
+ * @param evicted [out] ADC_FILTER_CHANNELS samples leaving the window.
+ * @return the window slot holding the newest sample.
+ */
+static float *s_adc_filter_store(adc_filter_st *filter, const int *samples,
+                                 float *evicted);
+
+/* =====================
+    filter initializing
+   ===================== */
+/**
+ * @brief Initialize one filter bank over ADC_FILTER_CHANNELS channels.
+ * @param type one of ADC_FILTER_*.
+ * @param length window length[1-16], rounded up to odd for the median.
+ * @return a initialized filter bank.
+ */
+adc_filter_st *adc_filter_init(int type, int length) {
+    int i;
+    adc_filter_st *filter;
+
+    if (length < 1)
+        length = 1;
+    if (length > ADC_FILTER_MAX_TAPS)
+        length = ADC_FILTER_MAX_TAPS;
+    if (type == ADC_FILTER_MEDIAN && (length & 1) == 0)
+        length = length == ADC_FILTER_MAX_TAPS ? length - 1 : length + 1;
+
+    filter = (adc_filter_st *)calloc(1, sizeof(adc_filter_st));
+    if (filter == NULL)
+        exit(ENOMEM);
+
+    filter->type = type;
+    filter->length = length;
+    filter->alpha = 2.0f / (length + 1);
+    for (i = 0; i < length; ++i)
+        filter->coeffs[i] = 1.0f / length;
+
+    return filter;
+}
+
+/**
+ * @brief Clean up the filter bank.
+ * @param filter a valid filter bank.
+ */
+void adc_filter_fini(adc_filter_st *filter) {
+    free(filter);
+}
+
+/**
+ * @brief Set FIR coefficients, by default every tap weights 1/N.
+ * @param filter a valid filter bank.
+ * @param coeffs N coefficients, coeffs[0] applies to the newest sample.
+ */
+void adc_filter_set_coefficients(adc_filter_st *filter, const float *coeffs) {
+    if (filter == NULL || coeffs == NULL)
+        return;
+    memcpy(filter->coeffs, coeffs, sizeof(float) * filter->length);
+}
+
+/**
+ * @brief Push one sample per channel, vectorized across all channels.
+ * @param filter a valid filter bank.
+ * @param samples ADC_FILTER_CHANNELS raw samples, indexed by channel.
+ */
+void adc_filter_push(adc_filter_st *filter, const int *samples) {
+    float evicted[ADC_FILTER_CHANNELS];
+    float *newest;
+    vec4_t acc, sorted[ADC_FILTER_MAX_TAPS], lo, hi;
+    int v, i, k, pass, slot, n;
+
+    if (filter == NULL || samples == NULL)
+        return;
+
+    newest = s_adc_filter_store(filter, samples, evicted);
+    n = filter->length;
+
+    for (v = 0; v < ADC_FILTER_CHANNELS; v += LANES) {
+        switch (filter->type) {
+        case ADC_FILTER_MOVING_AVERAGE:
+            acc = vec4_add(vec4_load(filter->sum + v),
+                           vec4_sub(vec4_load(newest + v),
+                                    vec4_load(evicted + v)));
+            vec4_store(filter->sum + v, acc);
+            vec4_store(filter->out + v, vec4_mul(acc, vec4_dup(1.0f / n)));
+            break;
+        case ADC_FILTER_EWMA:
+            acc = vec4_load(filter->out + v);
+            acc = vec4_add(acc, vec4_mul(vec4_dup(filter->alpha),
+                                vec4_sub(vec4_load(newest + v), acc)));
+            vec4_store(filter->out + v, acc);
+            break;
+        case ADC_FILTER_MEDIAN:
+            for (i = 0; i < n; ++i)
+                sorted[i] = vec4_load(filter->window[i] + v);
+            // odd-even transposition network, n passes sort n lanes-wide.
+            for (pass = 0; pass < n; ++pass) {
+                for (i = pass & 1; i + 1 < n; i += 2) {
+                    lo = vec4_min(sorted[i], sorted[i + 1]);
+                    hi = vec4_max(sorted[i], sorted[i + 1]);
+                    sorted[i] = lo;
+                    sorted[i + 1] = hi;
+                }
+            }
+            vec4_store(filter->out + v, sorted[n >> 1]);
+            break;
+        case ADC_FILTER_FIR:
+            acc = vec4_dup(0.0f);
+            for (k = 0, slot = filter->head; k < n; ++k) {
+                acc = vec4_add(acc, vec4_mul(vec4_dup(filter->coeffs[k]),
+                                        vec4_load(filter->window[slot] + v)));
+                slot = slot == 0 ? n - 1 : slot - 1;
+            }
+            vec4_store(filter->out + v, acc);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Scalar reference of adc_filter_push, one channel at a time.
+ * @param filter a valid filter bank.
+ * @param samples ADC_FILTER_CHANNELS raw samples, indexed by channel.
+ */
+void adc_filter_push_scalar(adc_filter_st *filter, const int *samples) {
+    float evicted[ADC_FILTER_CHANNELS];
+    float sorted[ADC_FILTER_MAX_TAPS], value, acc;
+    float *newest;
+    int c, i, j, k, slot, n;
+
+    if (filter == NULL || samples == NULL)
+        return;
+
+    newest = s_adc_filter_store(filter, samples, evicted);
+    n = filter->length;
+
+    for (c = 0; c < ADC_FILTER_CHANNELS; ++c) {
+        switch (filter->type) {
+        case ADC_FILTER_MOVING_AVERAGE:
+            filter->sum[c] = filter->sum[c] + (newest[c] - evicted[c]);
+            filter->out[c] = filter->sum[c] * (1.0f / n);
+            break;
+        case ADC_FILTER_EWMA:
+            filter->out[c] = filter->out[c] +
+                             filter->alpha * (newest[c] - filter->out[c]);
+            break;
+        case ADC_FILTER_MEDIAN:
+            // insertion sort, independent from the vector network.
+            for (i = 0; i < n; ++i) {
+                value = filter->window[i][c];
+                for (j = i; j > 0 && sorted[j - 1] > value; --j)
+                    sorted[j] = sorted[j - 1];
+                sorted[j] = value;
+            }
+            filter->out[c] = sorted[n >> 1];
+            break;
+        case ADC_FILTER_FIR:
+            acc = 0.0f;
+            for (k = 0, slot = filter->head; k < n; ++k) {
+                acc = acc + filter->coeffs[k] * filter->window[slot][c];
+                slot = slot == 0 ? n - 1 : slot - 1;
+            }
+            filter->out[c] = acc;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Get the filtered value published on one channel.
+ * @param filter a valid filter bank.
+ * @param channel channel number[0-7].
+ * @return the latest filtered value, 0 before the first sample.
+ */
+double adc_filter_get(adc_filter_st *filter, unsigned int channel) {
+    if (filter == NULL)
+        return 0;
+    return filter->out[channel % ADC_FILTER_CHANNELS];
+}
+
+static float *s_adc_filter_store(adc_filter_st *filter, const int *samples,
+                                 float *evicted) {
+    int i, c;
+    float *slot;
+
+    // fill the whole window with the first sample, so every filter
+    // publishes a settled value from the very first push.
+    if (!filter->primed) {
+        for (i = 0; i < filter->length; ++i)
+            for (c = 0; c < ADC_FILTER_CHANNELS; ++c)
+                filter->window[i][c] = samples[c];
+        for (c = 0; c < ADC_FILTER_CHANNELS; ++c) {
+            filter->sum[c] = (float)samples[c] * filter->length;
+            filter->out[c] = samples[c];
+        }
+        filter->primed = 1;
+    }
+
+    filter->head = (filter->head + 1) % filter->length;
+    slot = filter->window[filter->head];
+    for (c = 0; c < ADC_FILTER_CHANNELS; ++c) {
+        evicted[c] = slot[c];
+        slot[c] = samples[c];
+    }
+    return slot;
+}
+
+#if defined(XTEST) || defined(BENCH)
+
+#include <time.h>
+#include <math.h>
+
+#define TEST_SAMPLES        (4096)      /**< Samples per channel */
+#define TEST_NOISE          (64)        /**< Noise amplitude in LSB */
+#define TEST_TOLERANCE      (0.01)      /**< Vector vs scalar difference */
+
+static const char *g_names[] = {"moving average", "ewma", "median", "fir"};
+
+/**
+ * @brief Make a noisy ramp, with spikes, on every channel.
+ * @param samples [out] TEST_SAMPLES * ADC_FILTER_CHANNELS samples.
+ */
+static void s_make_samples(int *samples) {
+    int i, c;
+    srand(3208);
+    for (i = 0; i < TEST_SAMPLES; ++i) {
+        for (c = 0; c < ADC_FILTER_CHANNELS; ++c) {
+            samples[i * ADC_FILTER_CHANNELS + c] = (i + c * 512) % 4096 / 2 +
+                                    rand() % TEST_NOISE + (i % 97 == 0) * 1000;
+        }
+    }
+}
+
+#endif
+
+#ifdef XTEST
+
+int main() {
+    static int samples[TEST_SAMPLES * ADC_FILTER_CHANNELS];
+    static const float fir[5] = {0.4f, 0.25f, 0.15f, 0.12f, 0.08f};
+    adc_filter_st *vector, *scalar;
+    int type, i, c, type_failed, failed = 0;
+    double diff;
+
+    s_make_samples(samples);
+
+    for (type = ADC_FILTER_MOVING_AVERAGE; type <= ADC_FILTER_FIR; ++type) {
+        type_failed = 0;
+        vector = adc_filter_init(type, 5);
+        scalar = adc_filter_init(type, 5);
+        if (type == ADC_FILTER_FIR) {
+            adc_filter_set_coefficients(vector, fir);
+            adc_filter_set_coefficients(scalar, fir);
+        }
+
+        for (i = 0; i < TEST_SAMPLES; ++i) {
+            adc_filter_push(vector, samples + i * ADC_FILTER_CHANNELS);
+            adc_filter_push_scalar(scalar, samples + i * ADC_FILTER_CHANNELS);
+            for (c = 0; c < ADC_FILTER_CHANNELS; ++c) {
+                diff = adc_filter_get(vector, c) - adc_filter_get(scalar, c);
+                if (fabs(diff) > TEST_TOLERANCE) {
+                    printf("%s: sample %d channel %d differs by %f\n",
+                            g_names[type], i, c, diff);
+                    type_failed = 1;
+                    i = TEST_SAMPLES;
+                    break;
+                }
+            }
+        }
+        printf("%s: %s\n", g_names[type], type_failed ? "FAILED" : "SUCCESS!");
+        failed |= type_failed;
+
+        adc_filter_fini(vector);
+        adc_filter_fini(scalar);
+    }
+    return failed;
+}
+
+#endif
+
+#ifdef BENCH
+
+#define BENCH_ROUNDS        (256)       /**< Passes over the samples */
+
+/**
+ * @brief Time one push function over all the samples.
+ * @return channel samples per second.
+ */
+static double s_bench(int type, const int *samples,
+                      void (*push)(adc_filter_st *, const int *)) {
+    struct timespec start, end;
+    adc_filter_st *filter = adc_filter_init(type, 9);
+    volatile double sink = 0;
+    double seconds;
+    int r, i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < BENCH_ROUNDS; ++r) {
+        for (i = 0; i < TEST_SAMPLES; ++i)
+            push(filter, samples + i * ADC_FILTER_CHANNELS);
+        sink += adc_filter_get(filter, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    adc_filter_fini(filter);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return (double)BENCH_ROUNDS * TEST_SAMPLES * ADC_FILTER_CHANNELS / seconds;
+}
+
+int main() {
+    static int samples[TEST_SAMPLES * ADC_FILTER_CHANNELS];
+    int type;
+
+    s_make_samples(samples);
+
+    printf("%-16s %18s %18s\n", "filter(N=9)", "vector ch*S/s", "scalar ch*S/s");
+    for (type = ADC_FILTER_MOVING_AVERAGE; type <= ADC_FILTER_FIR; ++type) {
+        printf("%-16s %18.0f %18.0f\n", g_names[type],
+                s_bench(type, samples, adc_filter_push),
+                s_bench(type, samples, adc_filter_push_scalar));
+    }
+    return 0;
+}
+
+#endif
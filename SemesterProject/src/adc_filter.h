@@ -0,0 +1,72 @@
+/**
+ * @file adc_filter.h
+ * @brief streaming filter bank over ADC samples, declaration.
+ * @author Xiangyu Guo
+ */
+#ifndef __ADC_FILTER_H__
+#define __ADC_FILTER_H__
+
+#define ADC_FILTER_CHANNELS         (8)     /**< Channels filtered together */
+#define ADC_FILTER_MAX_TAPS         (16)    /**< Longest window of a filter */
+
+#define ADC_FILTER_MOVING_AVERAGE   (0)     /**< Mean of the last N samples */
+#define ADC_FILTER_EWMA             (1)     /**< Exponentially weighted, alpha = 2/(N+1) */
+#define ADC_FILTER_MEDIAN           (2)     /**< Median of the last N samples, N odd */
+#define ADC_FILTER_FIR              (3)     /**< FIR with N coefficients */
+
+/**
+ * @brief module structure, hiding the detail to the public
+ */
+typedef struct adc_filter adc_filter_st;
+struct adc_filter;
+
+/* ==============================================
+	filter initialize and finish function 
+   ============================================== */
+/**
+ * @brief Initialize one filter bank over ADC_FILTER_CHANNELS channels.
+ * @param type one of ADC_FILTER_*.
+ * @param length window length[1-16], rounded up to odd for the median.
+ * @return a initialized filter bank.
+ */
+adc_filter_st *adc_filter_init(int type, int length);
+
+/**
+ * @brief Clean up the filter bank.
+ * @param filter a valid filter bank.
+ */
+void adc_filter_fini(adc_filter_st *filter);
+
+/* =================
+    filter function 
+   ================= */
+/**
+ * @brief Set FIR coefficients, by default every tap weights 1/N.
+ * @param filter a valid filter bank.
+ * @param coeffs N coefficients, coeffs[0] applies to the newest sample.
+ */
+void adc_filter_set_coefficients(adc_filter_st *filter, const float *coeffs);
+
+/**
+ * @brief Push one sample per channel, vectorized across all channels.
+ * @param filter a valid filter bank.
+ * @param samples ADC_FILTER_CHANNELS raw samples, indexed by channel.
+ */
+void adc_filter_push(adc_filter_st *filter, const int *samples);
+
+/**
+ * @brief Scalar reference of adc_filter_push, one channel at a time.
+ * @param filter a valid filter bank.
+ * @param samples ADC_FILTER_CHANNELS raw samples, indexed by channel.
+ */
+void adc_filter_push_scalar(adc_filter_st *filter, const int *samples);
+
+/**
+ * @brief Get the filtered value published on one channel.
+ * @param filter a valid filter bank.
+ * @param channel channel number[0-7].
+ * @return the latest filtered value, 0 before the first sample.
+ */
+double adc_filter_get(adc_filter_st *filter, unsigned int channel);
+
+#endif
@@ -0,0 +1,228 @@
+/**
+ * @file bench.c
+ * @brief microbenchmark harness, implementation.
+ *        malloc, calloc and realloc are defined here and forwarded to the
+ *        glibc allocator, so the allocations of libevent are counted too.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define BENCH_TIME_MS           (200)       /**< Default time per case */
+#define BENCH_MAX_ITERATIONS    (1000000000L) /**< Cap of a fast case */
+#define BENCH_MAX_GROWTH        (100)       /**< Iterations grow at most so */
+#define NSEC_PER_MSEC           (1000000)   /**< Nanoseconds per millisecond */
+#define NSEC_PER_SEC            (1000000000) /**< Nanoseconds per second */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long g_allocs = 0;          /**< Allocations since start */
+static unsigned long g_bytes = 0;           /**< Bytes asked since start */
+
+/**
+ * @brief Count one allocation.
+ */
+static void s_bench_count(size_t size);
+
+/**
+ * @brief Append one result to BENCH_RESULTS, if set.
+ */
+static void s_bench_store(const char *suite, const char *name,
+                          const bench_result_st *result);
+
+/**
+ * @brief CLOCK_MONOTONIC in ns.
+ */
+static long long s_bench_now_ns();
+
+/* ====================
+    benchmark function
+   ==================== */
+/**
+ * @brief Measure one case, print and store its result.
+ * @param suite module measured, e.g. "bmp180".
+ * @param name case in the suite.
+ * @param fn the case.
+ * @param arg argument of the case.
+ * @param result [out] may be NULL.
+ */
+void bench_run(const char *suite, const char *name, bench_fn fn, void *arg,
+               bench_result_st *result) {
+    static int header = 0;
+    const char *env = getenv(BENCH_TIME_ENV);
+    long long target_ns, start, elapsed;
+    unsigned long allocs, bytes;
+    bench_result_st local;
+    long n = 1, next;
+
+    if (result == NULL)
+        result = &local;
+    target_ns = (long long)(env != NULL ? atoi(env) : BENCH_TIME_MS) * NSEC_PER_MSEC;
+
+    // grow the count from the last run until one run lasts long enough.
+    for (;;) {
+        allocs = __atomic_load_n(&g_allocs, __ATOMIC_RELAXED);
+        bytes = __atomic_load_n(&g_bytes, __ATOMIC_RELAXED);
+        start = s_bench_now_ns();
+        fn(arg, n);
+        elapsed = s_bench_now_ns() - start;
+        allocs = __atomic_load_n(&g_allocs, __ATOMIC_RELAXED) - allocs;
+        bytes = __atomic_load_n(&g_bytes, __ATOMIC_RELAXED) - bytes;
+
+        if (elapsed >= target_ns || n >= BENCH_MAX_ITERATIONS)
+            break;
+        next = elapsed > 0 ? n * 1.2 * target_ns / elapsed : n * BENCH_MAX_GROWTH;
+        if (next > n * BENCH_MAX_GROWTH)
+            next = n * BENCH_MAX_GROWTH;
+        n = next > n ? (next < BENCH_MAX_ITERATIONS ? next : BENCH_MAX_ITERATIONS) : n + 1;
+    }
+
+    result->iterations = n;
+    result->ns_per_op = (double)elapsed / n;
+    result->allocs_per_op = (double)allocs / n;
+    result->bytes_per_op = (double)bytes / n;
+
+    if (!header) {
+        printf("%-10s %-28s %12s %12s %10s %10s\n", "suite", "case",
+               "iterations", "ns/op", "allocs/op", "B/op");
+        header = 1;
+    }
+    printf("%-10s %-28s %12ld %12.1f %10.2f %10.1f\n", suite, name,
+           result->iterations, result->ns_per_op, result->allocs_per_op,
+           result->bytes_per_op);
+    s_bench_store(suite, name, result);
+}
+
+/* ===================
+    memory allocation
+   =================== */
+void *malloc(size_t size) {
+    s_bench_count(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    s_bench_count(nmemb * size);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    s_bench_count(size);
+    return __libc_realloc(ptr, size);
+}
+
+/* ================
+    inner function
+   ================ */
+static void s_bench_count(size_t size) {
+    __atomic_add_fetch(&g_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_bytes, size, __ATOMIC_RELAXED);
+}
+
+static void s_bench_store(const char *suite, const char *name,
+                          const bench_result_st *result) {
+    const char *path = getenv(BENCH_RESULTS_ENV);
+    const char *label = getenv(BENCH_LABEL_ENV);
+    size_t len;
+    FILE *fp;
+
+    if (path == NULL || *path == '\0')
+        return;
+    if (label == NULL)
+        label = "dev";
+    if ((fp = fopen(path, "a")) == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(errno);
+    }
+
+    len = strlen(path);
+    if (len > 5 && strcmp(path + len - 5, ".json") == 0) {
+        fprintf(fp, "{\"label\": \"%s\", \"suite\": \"%s\", \"case\": \"%s\", "
+                "\"iterations\": %ld, \"ns_per_op\": %.2f, "
+                "\"allocs_per_op\": %.3f, \"bytes_per_op\": %.1f}\n",
+                label, suite, name, result->iterations, result->ns_per_op,
+                result->allocs_per_op, result->bytes_per_op);
+    } else {
+        // a new file starts with the column names.
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) == 0)
+            fprintf(fp, "label,suite,case,iterations,ns_per_op,allocs_per_op,bytes_per_op\n");
+        fprintf(fp, "%s,%s,%s,%ld,%.2f,%.3f,%.1f\n", label, suite, name,
+                result->iterations, result->ns_per_op, result->allocs_per_op,
+                result->bytes_per_op);
+    }
+    fclose(fp);
+}
+
+static long long s_bench_now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+#ifdef XTEST
+
+#define TEST_FILE           "/tmp/bench_test.json"  /**< Results written */
+
+/**
+ * @brief one allocation of 64 bytes per operation.
+ */
+static void s_test_alloc(void *arg, long n) {
+    void *p;
+
+    while (n-- > 0) {
+        p = malloc(64);
+        bench_keep(p);
+        free(p);
+    }
+}
+
+/**
+ * @brief no allocation at all.
+ */
+static void s_test_add(void *arg, long n) {
+    long sum = 0;
+
+    while (n-- > 0) {
+        sum += n;
+        bench_keep(&sum);
+    }
+}
+
+int main() {
+    bench_result_st result;
+    char line[256];
+    int failed = 0, lines = 0;
+    FILE *fp;
+
+    setenv(BENCH_TIME_ENV, "20", 1);
+    setenv(BENCH_RESULTS_ENV, TEST_FILE, 1);
+    unlink(TEST_FILE);
+
+    bench_run("bench", "malloc 64", s_test_alloc, NULL, &result);
+    failed |= result.allocs_per_op != 1.0 || result.bytes_per_op != 64.0;
+    bench_run("bench", "add", s_test_add, NULL, &result);
+    failed |= result.allocs_per_op != 0 || result.iterations < 1000;
+
+    if ((fp = fopen(TEST_FILE, "r")) != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL)
+            lines += strstr(line, "\"suite\": \"bench\"") != NULL;
+        fclose(fp);
+    }
+    failed |= lines != 2;
+    unlink(TEST_FILE);
+
+    printf("%s\n", failed ? "FAILED" : "SUCCESS!");
+    return failed;
+}
+
+#endif
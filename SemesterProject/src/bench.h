@@ -0,0 +1,60 @@
+/**
+ * @file bench.h
+ * @brief microbenchmark harness, declaration.
+ *        A case is run with a growing number of iterations until it takes
+ *        BENCH_TIME_MS, then ns/op, heap allocations/op and bytes/op are
+ *        printed. Linked into the benchmarks only: it counts allocations
+ *        by taking over malloc, calloc and realloc of the whole process.
+ *
+ *        BENCH_RESULTS=file appends every result to file, as CSV, or as one
+ *        JSON object per line when the name ends with ".json", tagged with
+ *        BENCH_LABEL (e.g. a release) so runs can be compared.
+ * @author Xiangyu Guo
+ */
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#define BENCH_TIME_ENV          "BENCH_TIME_MS"     /**< Time per case */
+#define BENCH_RESULTS_ENV       "BENCH_RESULTS"     /**< File of the results */
+#define BENCH_LABEL_ENV         "BENCH_LABEL"       /**< Tag of the results */
+
+/**
+ * @brief a case, runs the measured operation n times.
+ * @param arg argument given to bench_run.
+ * @param n number of operations.
+ */
+typedef void (*bench_fn)(void *arg, long n);
+
+/**
+ * @brief result of one case.
+ */
+typedef struct bench_result {
+    long iterations;                /**< operations measured */
+    double ns_per_op;               /**< wall time */
+    double allocs_per_op;           /**< malloc, calloc and realloc calls */
+    double bytes_per_op;            /**< bytes asked for */
+} bench_result_st;
+
+/* ====================
+    benchmark function
+   ==================== */
+/**
+ * @brief Measure one case, print and store its result.
+ * @param suite module measured, e.g. "bmp180".
+ * @param name case in the suite.
+ * @param fn the case.
+ * @param arg argument of the case.
+ * @param result [out] may be NULL.
+ */
+void bench_run(const char *suite, const char *name, bench_fn fn, void *arg,
+               bench_result_st *result);
+
+/**
+ * @brief Keep the compiler from dropping a result nobody reads.
+ * @param p the result.
+ */
+static inline void bench_keep(const void *p) {
+    __asm__ __volatile__("" : : "g"(p) : "memory");
+}
+
+#endif
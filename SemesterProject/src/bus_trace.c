@@ -0,0 +1,625 @@
+/**
+ * @file bus_trace.c
+ * @brief record and replay of bus transactions, implementation.
+ *        A trace is an 8 bytes header followed by the transactions in the
+ *        order they finished: the op byte, then key, arg, value, start
+ *        delta, duration and data length as LEB128 varints (signed ones
+ *        zigzag encoded), then the data. A register read takes 6 bytes.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "bus_trace.h"
+
+#define BUS_TRACE_MAGIC         "SHBT"  /**< File magic */
+#define BUS_TRACE_VERSION       (1)     /**< File format */
+#define BUS_TRACE_HEADER_SIZE   (8)     /**< Magic, version, reserved */
+#define BUS_TRACE_MAX_FDS       (16)    /**< Open devices remembered */
+#define BUS_TRACE_MAX_STREAMS   (16)    /**< Devices replayed */
+#define BUS_TRACE_VARINT_MAX    (10)    /**< Bytes of a 64 bits varint */
+#define BUS_TRACE_FLUSH_US      (1000000) /**< Recording flushed this often */
+#define BUS_TRACE_BUFFER_SIZE   (65536) /**< stdio buffer of the recording */
+
+#define USEC_PER_SEC            (1000000) /**< Microseconds per second */
+#define NSEC_PER_USEC           (1000)  /**< Nanoseconds per microsecond */
+
+/**
+ * @brief stream of one device: its bus and key.
+ */
+#define BUS_TRACE_STREAM(op, key)   (((op) >> 4) << 16 | ((key) & 0xFFFF))
+
+/**
+ * @brief a descriptor and the device behind it.
+ */
+typedef struct bus_trace_fd {
+    int fd;                             /**< file descriptor */
+    int key;                            /**< I2C address or SPI chip */
+} bus_trace_fd_st;
+
+/**
+ * @brief replay position of one device.
+ */
+typedef struct bus_trace_stream {
+    int stream;                         /**< BUS_TRACE_STREAM */
+    unsigned long cursor;               /**< next item to look at */
+} bus_trace_stream_st;
+
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;   /**< Environment read */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER; /**< File and cursors */
+static int g_mode = BUS_TRACE_OFF;                  /**< Current mode */
+
+static bus_trace_fd_st g_fds[BUS_TRACE_MAX_FDS];    /**< Open devices */
+static int g_fd_count = 0;                          /**< Slots used */
+
+static FILE *g_file = NULL;                         /**< Recording */
+static uint64_t g_origin_us = 0;                    /**< Recording started at */
+static uint64_t g_last_start_us = 0;                /**< Start of the last record */
+static uint64_t g_flushed_us = 0;                   /**< Last flush */
+
+static unsigned char *g_trace = NULL;               /**< Replayed file */
+static bus_trace_item_st *g_items = NULL;           /**< Replayed transactions */
+static unsigned long g_item_count = 0;              /**< Number of items */
+static bus_trace_stream_st g_streams[BUS_TRACE_MAX_STREAMS]; /**< Cursors */
+static int g_stream_count = 0;                      /**< Streams used */
+static double g_scale = 1.0;                        /**< Replay timing factor */
+
+/**
+ * @brief Select the mode from the environment, once.
+ */
+static void s_bus_trace_env();
+
+/**
+ * @brief Open a trace without looking at the environment.
+ */
+static int s_bus_trace_open(const char *path, int mode, double scale);
+
+/**
+ * @brief Load a whole trace file and split it into items.
+ * @param path trace file.
+ * @param buffer [out] file content, items point into it.
+ * @param items [out] transactions, to free.
+ * @param count [out] number of transactions.
+ * @return 0 on success; otherwise an errno.
+ */
+static int s_bus_trace_load(const char *path, unsigned char **buffer,
+                            bus_trace_item_st **items, unsigned long *count);
+
+/**
+ * @brief Current CLOCK_MONOTONIC time, in us.
+ */
+static uint64_t s_bus_trace_now_us();
+
+/**
+ * @brief Append an unsigned varint.
+ * @return bytes written.
+ */
+static int s_bus_trace_put(unsigned char *buf, uint64_t value);
+
+/**
+ * @brief Append a signed varint, zigzag encoded.
+ * @return bytes written.
+ */
+static int s_bus_trace_put_signed(unsigned char *buf, int64_t value);
+
+/**
+ * @brief Read an unsigned varint.
+ * @param pos [in/out] read position, moved past the varint.
+ * @param end end of the buffer.
+ * @param value [out] the value.
+ * @return 0 on success; EILSEQ when truncated.
+ */
+static int s_bus_trace_get(const unsigned char **pos, const unsigned char *end,
+                           uint64_t *value);
+
+/* ==============================================
+	trace initialize and finish function
+   ============================================== */
+/**
+ * @brief Record into or replay from a file, in place of the environment.
+ * @param path trace file.
+ * @param mode BUS_TRACE_RECORD or BUS_TRACE_REPLAY.
+ * @param scale replay only, factor applied to the recorded durations.
+ * @return 0 on success; otherwise an errno.
+ */
+int bus_trace_open(const char *path, int mode, double scale) {
+    pthread_once(&g_once, s_bus_trace_env);
+    return s_bus_trace_open(path, mode, scale);
+}
+
+/**
+ * @brief Flush and close the trace, the hardware is used again.
+ */
+void bus_trace_close() {
+    pthread_mutex_lock(&g_lock);
+    __atomic_store_n(&g_mode, BUS_TRACE_OFF, __ATOMIC_RELEASE);
+    if (g_file != NULL) {
+        fclose(g_file);
+        g_file = NULL;
+    }
+    free(g_items);
+    free(g_trace);
+    g_items = NULL;
+    g_trace = NULL;
+    g_item_count = 0;
+    g_stream_count = 0;
+    pthread_mutex_unlock(&g_lock);
+}
+
+/* =================
+    trace function
+   ================= */
+/**
+ * @brief Current mode, read from the environment on the first call.
+ * @return BUS_TRACE_OFF, _RECORD or _REPLAY.
+ */
+int bus_trace_mode() {
+    pthread_once(&g_once, s_bus_trace_env);
+    return __atomic_load_n(&g_mode, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Remember the device behind a descriptor.
+ * @param fd file descriptor returned by the setup.
+ * @param key I2C address or SPI chip enable.
+ */
+void bus_trace_bind(int fd, int key) {
+    int i;
+
+    pthread_mutex_lock(&g_lock);
+    // a closed descriptor comes back with the next open, take its slot.
+    for (i = 0; i < g_fd_count && g_fds[i].fd != fd; ++i)
+        ;
+    if (i < BUS_TRACE_MAX_FDS) {
+        g_fds[i].fd = fd;
+        g_fds[i].key = key;
+        if (i == g_fd_count)
+            g_fd_count++;
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+/**
+ * @brief Device behind a descriptor.
+ * @param fd file descriptor.
+ * @return key given to bus_trace_bind, -1 if unknown.
+ */
+int bus_trace_key(int fd) {
+    int i, key = -1;
+
+    pthread_mutex_lock(&g_lock);
+    for (i = 0; i < g_fd_count; ++i) {
+        if (g_fds[i].fd == fd) {
+            key = g_fds[i].key;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    return key;
+}
+
+/**
+ * @brief Time a transaction starts at.
+ * @return CLOCK_MONOTONIC in us when recording, otherwise 0.
+ */
+uint64_t bus_trace_start() {
+    return bus_trace_mode() == BUS_TRACE_RECORD ? s_bus_trace_now_us() : 0;
+}
+
+/**
+ * @brief Append one finished transaction, when recording.
+ * @param start_us returned by bus_trace_start.
+ * @param op BUS_TRACE_* transaction.
+ * @param key device on the bus.
+ * @param arg register, mask or length.
+ * @param value value read or written.
+ * @param data bytes received, may be NULL.
+ * @param len number of bytes received.
+ */
+void bus_trace_record(uint64_t start_us, int op, int key, int64_t arg,
+                      int64_t value, const void *data, int len) {
+    unsigned char buf[1 + 6 * BUS_TRACE_VARINT_MAX];
+    uint64_t end_us;
+    int n = 0;
+
+    if (start_us == 0 || bus_trace_mode() != BUS_TRACE_RECORD)
+        return;
+    end_us = s_bus_trace_now_us();
+    if (data == NULL)
+        len = 0;
+
+    pthread_mutex_lock(&g_lock);
+    if (g_file == NULL) {
+        pthread_mutex_unlock(&g_lock);
+        return;
+    }
+
+    // threads finish out of order, the start delta may be negative.
+    buf[n++] = op;
+    n += s_bus_trace_put(buf + n, key);
+    n += s_bus_trace_put_signed(buf + n, arg);
+    n += s_bus_trace_put_signed(buf + n, value);
+    n += s_bus_trace_put_signed(buf + n, (int64_t)(start_us - g_last_start_us));
+    n += s_bus_trace_put(buf + n, end_us - start_us);
+    n += s_bus_trace_put(buf + n, len);
+    g_last_start_us = start_us;
+
+    fwrite(buf, 1, n, g_file);
+    if (len > 0)
+        fwrite(data, 1, len, g_file);
+
+    // a daemon is usually killed, keep at most a second in the buffer.
+    if (end_us - g_flushed_us >= BUS_TRACE_FLUSH_US) {
+        fflush(g_file);
+        g_flushed_us = end_us;
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+/**
+ * @brief Answer one transaction from the trace, taking its scaled time.
+ *        Each device follows its own order, so threads using different
+ *        devices may interleave differently than when recorded.
+ *        Opening a device returns a new descriptor bound to the key.
+ * @param op BUS_TRACE_* transaction.
+ * @param key device on the bus.
+ * @param arg register, mask or length, must match the recording.
+ * @param data [out] bytes received, may be NULL.
+ * @param len size of data.
+ * @return the recorded value.
+ * @note  exits with EPROTO when the drivers diverge from the recording,
+ *        and with 0 once the trace of a device is over.
+ */
+int64_t bus_trace_replay(int op, int key, int64_t arg, void *data, int len) {
+    int stream = BUS_TRACE_STREAM(op, key);
+    bus_trace_stream_st *cursor = NULL;
+    bus_trace_item_st *item;
+    struct timespec ts;
+    uint64_t wait_us;
+    unsigned long i;
+    int64_t value;
+    int s;
+
+    pthread_mutex_lock(&g_lock);
+    for (s = 0; s < g_stream_count; ++s) {
+        if (g_streams[s].stream == stream) {
+            cursor = &g_streams[s];
+            break;
+        }
+    }
+    if (cursor == NULL) {
+        if (g_stream_count >= BUS_TRACE_MAX_STREAMS) {
+            fprintf(stderr, "bus trace: too many devices\n");
+            exit(ENOSPC);
+        }
+        cursor = &g_streams[g_stream_count++];
+        cursor->stream = stream;
+        cursor->cursor = 0;
+    }
+
+    for (i = cursor->cursor; i < g_item_count &&
+            BUS_TRACE_STREAM(g_items[i].op, g_items[i].key) != stream; ++i)
+        ;
+    if (i >= g_item_count) {
+        printf("bus trace: replay of device 0x%x over\n", stream);
+        exit(0);
+    }
+
+    item = &g_items[i];
+    if (item->op != op || item->arg != arg) {
+        fprintf(stderr, "bus trace: transaction %lu diverged, op 0x%02x arg %lld,"
+                " recorded op 0x%02x arg %lld\n", i, op, (long long)arg,
+                item->op, (long long)item->arg);
+        exit(EPROTO);
+    }
+    cursor->cursor = i + 1;
+
+    if (data != NULL && item->len > 0)
+        memcpy(data, item->data, item->len < len ? item->len : len);
+    value = item->value;
+    wait_us = item->duration_us * g_scale;
+    pthread_mutex_unlock(&g_lock);
+
+    // a device is opened again for real, the drivers close what they get.
+    if ((op & 0x0F) == 0) {
+        if ((value = open("/dev/null", O_RDWR | O_CLOEXEC)) < 0)
+            exit(errno);
+        bus_trace_bind(value, key);
+    }
+
+    if (wait_us > 0) {
+        ts.tv_sec = wait_us / USEC_PER_SEC;
+        ts.tv_nsec = wait_us % USEC_PER_SEC * NSEC_PER_USEC;
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+            ;
+    }
+    return value;
+}
+
+/**
+ * @brief Read every transaction of a trace file, in recorded order.
+ * @param path trace file.
+ * @param cb called for each transaction, a non 0 return stops.
+ * @param arg argument of the call back.
+ * @return 0 on success; otherwise an errno.
+ */
+int bus_trace_read(const char *path,
+                   int (*cb)(const bus_trace_item_st *item, void *arg), void *arg) {
+    bus_trace_item_st *items;
+    unsigned char *buffer;
+    unsigned long count, i;
+    int ret_val;
+
+    if ((ret_val = s_bus_trace_load(path, &buffer, &items, &count)) != 0)
+        return ret_val;
+
+    for (i = 0; i < count; ++i) {
+        if (cb(&items[i], arg) != 0)
+            break;
+    }
+
+    free(items);
+    free(buffer);
+    return 0;
+}
+
+/* ================
+    inner function
+   ================ */
+static void s_bus_trace_env() {
+    const char *record = getenv(BUS_TRACE_RECORD_ENV);
+    const char *replay = getenv(BUS_TRACE_REPLAY_ENV);
+    const char *scale = getenv(BUS_TRACE_SCALE_ENV);
+    const char *path = NULL;
+    int ret_val = 0;
+
+    if (replay != NULL && *replay != '\0')
+        ret_val = s_bus_trace_open(path = replay, BUS_TRACE_REPLAY,
+                                   scale != NULL ? atof(scale) : 1.0);
+    else if (record != NULL && *record != '\0')
+        ret_val = s_bus_trace_open(path = record, BUS_TRACE_RECORD, 0);
+
+    if (ret_val != 0) {
+        fprintf(stderr, "bus trace: %s: %s\n", path, strerror(ret_val));
+        exit(ret_val);
+    }
+}
+
+static int s_bus_trace_open(const char *path, int mode, double scale) {
+    static int registered = 0;
+    unsigned char header[BUS_TRACE_HEADER_SIZE] = BUS_TRACE_MAGIC;
+    int ret_val = 0;
+
+    bus_trace_close();
+
+    pthread_mutex_lock(&g_lock);
+    if (mode == BUS_TRACE_RECORD) {
+        if ((g_file = fopen(path, "wb")) == NULL) {
+            ret_val = errno;
+        } else {
+            setvbuf(g_file, NULL, _IOFBF, BUS_TRACE_BUFFER_SIZE);
+            header[4] = BUS_TRACE_VERSION;
+            fwrite(header, 1, sizeof(header), g_file);
+            fflush(g_file);
+            g_origin_us = s_bus_trace_now_us();
+            g_last_start_us = g_origin_us;
+            g_flushed_us = g_origin_us;
+        }
+    } else if (mode == BUS_TRACE_REPLAY) {
+        ret_val = s_bus_trace_load(path, &g_trace, &g_items, &g_item_count);
+        g_scale = scale < 0 ? 0 : scale;
+    } else {
+        ret_val = EINVAL;
+    }
+
+    if (ret_val == 0) {
+        __atomic_store_n(&g_mode, mode, __ATOMIC_RELEASE);
+        if (!registered)
+            registered = atexit(bus_trace_close) == 0;
+    }
+    pthread_mutex_unlock(&g_lock);
+    return ret_val;
+}
+
+static int s_bus_trace_load(const char *path, unsigned char **buffer,
+                            bus_trace_item_st **items, unsigned long *count) {
+    const unsigned char *pos, *end;
+    bus_trace_item_st *item;
+    uint64_t field[6], start;
+    unsigned long capacity = 0;
+    long size;
+    FILE *fp;
+    int i;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+        return errno;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+
+    *buffer = (unsigned char *)malloc(size > 0 ? size : 1);
+    if (*buffer == NULL)
+        exit(ENOMEM);
+    if (size < BUS_TRACE_HEADER_SIZE || fread(*buffer, 1, size, fp) != size ||
+            memcmp(*buffer, BUS_TRACE_MAGIC, strlen(BUS_TRACE_MAGIC)) != 0 ||
+            (*buffer)[4] != BUS_TRACE_VERSION) {
+        fclose(fp);
+        free(*buffer);
+        *buffer = NULL;
+        return EILSEQ;
+    }
+    fclose(fp);
+
+    *items = NULL;
+    *count = 0;
+    start = 0;
+    pos = *buffer + BUS_TRACE_HEADER_SIZE;
+    end = *buffer + size;
+    while (pos < end) {
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            *items = (bus_trace_item_st *)realloc(*items, capacity * sizeof(**items));
+            if (*items == NULL)
+                exit(ENOMEM);
+        }
+        item = &(*items)[*count];
+        item->op = *pos++;
+        for (i = 0; i < 6; ++i) {
+            if (s_bus_trace_get(&pos, end, &field[i]) != 0)
+                break;
+        }
+        // a recording cut short keeps the transactions before the cut.
+        if (i < 6 || field[5] > (uint64_t)(end - pos))
+            break;
+
+        item->key = field[0];
+        item->arg = (int64_t)(field[1] >> 1) ^ -(int64_t)(field[1] & 1);
+        item->value = (int64_t)(field[2] >> 1) ^ -(int64_t)(field[2] & 1);
+        start += (int64_t)(field[3] >> 1) ^ -(int64_t)(field[3] & 1);
+        item->start_us = start;
+        item->duration_us = field[4];
+        item->len = field[5];
+        item->data = item->len > 0 ? pos : NULL;
+        pos += item->len;
+        (*count)++;
+    }
+    return 0;
+}
+
+static uint64_t s_bus_trace_now_us() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * USEC_PER_SEC + ts.tv_nsec / NSEC_PER_USEC;
+}
+
+static int s_bus_trace_put(unsigned char *buf, uint64_t value) {
+    int n = 0;
+
+    while (value >= 0x80) {
+        buf[n++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buf[n++] = value;
+    return n;
+}
+
+static int s_bus_trace_put_signed(unsigned char *buf, int64_t value) {
+    return s_bus_trace_put(buf, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static int s_bus_trace_get(const unsigned char **pos, const unsigned char *end,
+                           uint64_t *value) {
+    int shift = 0;
+
+    *value = 0;
+    while (*pos < end && shift < 64) {
+        *value |= (uint64_t)(**pos & 0x7F) << shift;
+        if (!(*(*pos)++ & 0x80))
+            return 0;
+        shift += 7;
+    }
+    return EILSEQ;
+}
+
+#ifdef XTEST
+
+#define TEST_FILE           "/tmp/bus_trace_test"   /**< Trace written and read */
+#define TEST_SLOW_US        (20000)                 /**< A slow conversion */
+
+static int g_failed = 0;                /**< Failed checks */
+
+/**
+ * @brief compare one value.
+ */
+static void s_test_check(const char *what, int64_t got, int64_t expected) {
+    printf("%-24s %lld (expected %lld)\n", what, (long long)got, (long long)expected);
+    if (got != expected)
+        g_failed++;
+}
+
+/**
+ * @brief count the transactions of the file and check the first ones.
+ */
+static int s_test_item(const bus_trace_item_st *item, void *arg) {
+    int *count = (int *)arg;
+
+    if (*count == 1 && (item->op != BUS_TRACE_I2C_READ_REG || item->key != 0x77 ||
+                        item->arg != 0xAA || item->value != 0x1B))
+        g_failed++;
+    if (*count == 3 && (item->len != 3 || item->data[2] != 0xCD))
+        g_failed++;
+    (*count)++;
+    return 0;
+}
+
+int main() {
+    static const unsigned char rx[] = {0x00, 0x0A, 0xCD};
+    unsigned char buf[3] = {0};
+    uint64_t start, begin;
+    int count = 0, fd;
+    FILE *fp;
+
+    // record what a BMP180, an MCP3208 and a DHT11 would answer.
+    s_test_check("open record", bus_trace_open(TEST_FILE, BUS_TRACE_RECORD, 0), 0);
+    start = bus_trace_start();
+    bus_trace_record(start, BUS_TRACE_I2C_SETUP, 0x77, 0x77, 5, NULL, 0);
+    bus_trace_bind(5, 0x77);
+    start = bus_trace_start();
+    bus_trace_record(start, BUS_TRACE_I2C_READ_REG, bus_trace_key(5), 0xAA, 0x1B, NULL, 0);
+    start = bus_trace_start();
+    usleep(TEST_SLOW_US);
+    bus_trace_record(start, BUS_TRACE_I2C_READ_REG, 0x77, 0xF6, 0x6C, NULL, 0);
+    start = bus_trace_start();
+    bus_trace_record(start, BUS_TRACE_SPI_TRANSFER, 0, 3, 0, rx, sizeof(rx));
+    start = bus_trace_start();
+    bus_trace_record(start, BUS_TRACE_GPIO_READ, 0, 0xFFFFFFFF, 0x80000000u, NULL, 0);
+    bus_trace_close();
+
+    fp = fopen(TEST_FILE, "rb");
+    fseek(fp, 0, SEEK_END);
+    printf("%ld bytes for 5 transactions\n", ftell(fp));
+    fclose(fp);
+
+    s_test_check("read", bus_trace_read(TEST_FILE, s_test_item, &count), 0);
+    s_test_check("transactions", count, 5);
+
+    // replay the devices in another order, each keeps its own.
+    s_test_check("open replay", bus_trace_open(TEST_FILE, BUS_TRACE_REPLAY, 1.0), 0);
+    s_test_check("mode", bus_trace_mode(), BUS_TRACE_REPLAY);
+    s_test_check("spi transfer",
+                 bus_trace_replay(BUS_TRACE_SPI_TRANSFER, 0, 3, buf, sizeof(buf)), 0);
+    s_test_check("spi data", buf[1] << 8 | buf[2], 0x0ACD);
+    s_test_check("gpio read",
+                 bus_trace_replay(BUS_TRACE_GPIO_READ, 0, 0xFFFFFFFF, NULL, 0), 0x80000000u);
+    fd = bus_trace_replay(BUS_TRACE_I2C_SETUP, 0x77, 0x77, NULL, 0);
+    s_test_check("i2c key", bus_trace_key(fd), 0x77);
+    s_test_check("i2c calibration",
+                 bus_trace_replay(BUS_TRACE_I2C_READ_REG, 0x77, 0xAA, NULL, 0), 0x1B);
+    begin = s_bus_trace_now_us();
+    s_test_check("i2c conversion",
+                 bus_trace_replay(BUS_TRACE_I2C_READ_REG, 0x77, 0xF6, NULL, 0), 0x6C);
+    s_test_check("original timing", s_bus_trace_now_us() - begin >= TEST_SLOW_US, 1);
+    close(fd);
+
+    // at scale 0 the slow transaction is answered at once.
+    bus_trace_open(TEST_FILE, BUS_TRACE_REPLAY, 0);
+    bus_trace_replay(BUS_TRACE_I2C_SETUP, 0x77, 0x77, NULL, 0);
+    bus_trace_replay(BUS_TRACE_I2C_READ_REG, 0x77, 0xAA, NULL, 0);
+    begin = s_bus_trace_now_us();
+    bus_trace_replay(BUS_TRACE_I2C_READ_REG, 0x77, 0xF6, NULL, 0);
+    s_test_check("no timing", s_bus_trace_now_us() - begin < TEST_SLOW_US, 1);
+    bus_trace_close();
+
+    unlink(TEST_FILE);
+    printf("%s\n", g_failed ? "FAILED" : "SUCCESS!");
+    return g_failed;
+}
+
+#endif
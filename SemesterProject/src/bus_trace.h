@@ -0,0 +1,147 @@
+/**
+ * @file bus_trace.h
+ * @brief record and replay of bus transactions, declaration.
+ *        The I2C, SPI, GPIO and DHT11 drivers report every transaction
+ *        here. Recording appends it, with its time and result, to a compact
+ *        binary file; replaying answers from the file instead of the
+ *        hardware, taking the recorded time scaled by a factor.
+ *
+ *        Selected from the environment on first use:
+ *        SMARTHOMED_BUS_RECORD=file records,
+ *        SMARTHOMED_BUS_REPLAY=file replays, with
+ *        SMARTHOMED_BUS_REPLAY_SCALE=factor (1 original timing, 0 none).
+ * @author Xiangyu Guo
+ */
+#ifndef __BUS_TRACE_H__
+#define __BUS_TRACE_H__
+
+#include <stdint.h>
+
+#define BUS_TRACE_OFF           (0)     /**< Hardware only */
+#define BUS_TRACE_RECORD        (1)     /**< Hardware, transactions logged */
+#define BUS_TRACE_REPLAY        (2)     /**< Answers from a recorded file */
+
+#define BUS_TRACE_RECORD_ENV    "SMARTHOMED_BUS_RECORD"         /**< File to record */
+#define BUS_TRACE_REPLAY_ENV    "SMARTHOMED_BUS_REPLAY"         /**< File to replay */
+#define BUS_TRACE_SCALE_ENV     "SMARTHOMED_BUS_REPLAY_SCALE"   /**< Timing factor */
+
+/* =====================================================================
+    transactions, the high nibble is the bus, a low nibble of 0 opens a
+    device: key is the I2C address, the SPI chip enable, or 0
+   ===================================================================== */
+#define BUS_TRACE_I2C_SETUP     (0x10)  /**< arg address, value fd */
+#define BUS_TRACE_I2C_READ      (0x11)  /**< value byte read */
+#define BUS_TRACE_I2C_WRITE     (0x12)  /**< value byte written */
+#define BUS_TRACE_I2C_READ_REG  (0x13)  /**< arg register, value read */
+#define BUS_TRACE_I2C_WRITE_REG (0x14)  /**< arg register, value written */
+#define BUS_TRACE_I2C_WRITE_BLOCK (0x15) /**< arg length */
+#define BUS_TRACE_SPI_SETUP     (0x20)  /**< arg speed, value fd */
+#define BUS_TRACE_SPI_TRANSFER  (0x21)  /**< arg length, data received */
+#define BUS_TRACE_SPI_BATCH     (0x22)  /**< arg frame length, value frames, data received */
+#define BUS_TRACE_GPIO_MODE     (0x31)  /**< arg mask, value mode */
+#define BUS_TRACE_GPIO_SET      (0x32)  /**< arg mask */
+#define BUS_TRACE_GPIO_CLEAR    (0x33)  /**< arg mask */
+#define BUS_TRACE_GPIO_WRITE    (0x34)  /**< arg mask, value levels */
+#define BUS_TRACE_GPIO_READ     (0x35)  /**< arg mask, value levels read */
+#define BUS_TRACE_DHT11_READ    (0x41)  /**< value bits read, data the 5 bytes */
+
+/**
+ * @brief one transaction, as found in a trace file.
+ */
+typedef struct bus_trace_item {
+    int op;                         /**< BUS_TRACE_* transaction */
+    int key;                        /**< device on the bus */
+    int64_t arg;                    /**< register, mask or length */
+    int64_t value;                  /**< value read or written */
+    uint64_t start_us;              /**< since the start of the recording */
+    uint32_t duration_us;           /**< time the transaction took */
+    const unsigned char *data;      /**< bytes received, may be NULL */
+    int len;                        /**< number of bytes received */
+} bus_trace_item_st;
+
+/* ==============================================
+	trace initialize and finish function
+   ============================================== */
+/**
+ * @brief Record into or replay from a file, in place of the environment.
+ * @param path trace file.
+ * @param mode BUS_TRACE_RECORD or BUS_TRACE_REPLAY.
+ * @param scale replay only, factor applied to the recorded durations.
+ * @return 0 on success; otherwise an errno.
+ */
+int bus_trace_open(const char *path, int mode, double scale);
+
+/**
+ * @brief Flush and close the trace, the hardware is used again.
+ */
+void bus_trace_close();
+
+/* =================
+    trace function
+   ================= */
+/**
+ * @brief Current mode, read from the environment on the first call.
+ * @return BUS_TRACE_OFF, _RECORD or _REPLAY.
+ */
+int bus_trace_mode();
+
+/**
+ * @brief Remember the device behind a descriptor.
+ * @param fd file descriptor returned by the setup.
+ * @param key I2C address or SPI chip enable.
+ */
+void bus_trace_bind(int fd, int key);
+
+/**
+ * @brief Device behind a descriptor.
+ * @param fd file descriptor.
+ * @return key given to bus_trace_bind, -1 if unknown.
+ */
+int bus_trace_key(int fd);
+
+/**
+ * @brief Time a transaction starts at.
+ * @return CLOCK_MONOTONIC in us when recording, otherwise 0.
+ */
+uint64_t bus_trace_start();
+
+/**
+ * @brief Append one finished transaction, when recording.
+ * @param start_us returned by bus_trace_start.
+ * @param op BUS_TRACE_* transaction.
+ * @param key device on the bus.
+ * @param arg register, mask or length.
+ * @param value value read or written.
+ * @param data bytes received, may be NULL.
+ * @param len number of bytes received.
+ */
+void bus_trace_record(uint64_t start_us, int op, int key, int64_t arg,
+                      int64_t value, const void *data, int len);
+
+/**
+ * @brief Answer one transaction from the trace, taking its scaled time.
+ *        Each device follows its own order, so threads using different
+ *        devices may interleave differently than when recorded.
+ *        Opening a device returns a new descriptor bound to the key.
+ * @param op BUS_TRACE_* transaction.
+ * @param key device on the bus.
+ * @param arg register, mask or length, must match the recording.
+ * @param data [out] bytes received, may be NULL.
+ * @param len size of data.
+ * @return the recorded value.
+ * @note  exits with EPROTO when the drivers diverge from the recording,
+ *        and with 0 once the trace of a device is over.
+ */
+int64_t bus_trace_replay(int op, int key, int64_t arg, void *data, int len);
+
+/**
+ * @brief Read every transaction of a trace file, in recorded order.
+ * @param path trace file.
+ * @param cb called for each transaction, a non 0 return stops.
+ * @param arg argument of the call back.
+ * @return 0 on success; otherwise an errno.
+ */
+int bus_trace_read(const char *path,
+                   int (*cb)(const bus_trace_item_st *item, void *arg), void *arg);
+
+#endif
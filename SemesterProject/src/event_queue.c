@@ -0,0 +1,220 @@
+/**
+ * @file event_queue.c
+ * @brief lock-free queue of timestamped input events, implementation.
+ *        Bounded multi-producer single-consumer ring, every slot carries
+ *        a sequence number telling whose turn it is (D. Vyukov's design).
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "event_queue.h"
+
+/**
+ * @brief one slot of the ring.
+ */
+typedef struct event_queue_slot {
+    unsigned int sequence;          /**< position this slot waits for */
+    event_queue_item_st item;       /**< the event */
+} event_queue_slot_st;
+
+struct event_queue {
+    int fd;                         /**< eventfd waking the consumer */
+    unsigned int mask;              /**< capacity - 1 */
+    unsigned int head;              /**< next position to push */
+    unsigned int tail;              /**< next position to pop */
+    event_queue_slot_st *slots;     /**< the ring */
+};
+
+/**
+ * @brief Initialize a bounded queue and its eventfd.
+ * @param capacity number of slots, rounded up to a power of two.
+ * @return a initialized queue.
+ */
+event_queue_st *event_queue_init(unsigned int capacity) {
+    unsigned int size = 2, i;
+    event_queue_st *queue;
+
+    while (size < capacity)
+        size <<= 1;
+
+    queue = (event_queue_st *)malloc(sizeof(event_queue_st));
+    if (queue == NULL)
+        exit(ENOMEM);
+
+    queue->slots = (event_queue_slot_st *)malloc(sizeof(event_queue_slot_st) * size);
+    if (queue->slots == NULL)
+        exit(ENOMEM);
+
+    for (i = 0; i < size; ++i)
+        queue->slots[i].sequence = i;
+
+    queue->mask = size - 1;
+    queue->head = 0;
+    queue->tail = 0;
+
+    if ((queue->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        exit(errno);
+
+    return queue;
+}
+
+/**
+ * @brief Clean up the queue.
+ * @param queue a valid queue.
+ */
+void event_queue_fini(event_queue_st *queue) {
+    if (queue != NULL) {
+        close(queue->fd);
+        free(queue->slots);
+        free(queue);
+    }
+}
+
+/**
+ * @brief Get the eventfd to watch, readable while events are pending.
+ * @param queue a valid queue.
+ * @return file descriptor of the eventfd.
+ */
+int event_queue_fd(event_queue_st *queue) {
+    return queue->fd;
+}
+
+/**
+ * @brief Push one event, lock-free, safe from several threads at once.
+ * @param queue a valid queue.
+ * @param type event type.
+ * @param value auxiliary value.
+ * @return 0 on success; ENOSPC when the queue is full.
+ */
+int event_queue_push(event_queue_st *queue, int type, int value) {
+    event_queue_slot_st *slot;
+    unsigned int pos, sequence;
+    uint64_t one = 1;
+    int diff;
+
+    pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = &queue->slots[pos & queue->mask];
+        sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        diff = (int)(sequence - pos);
+        if (diff == 0) {
+            // slot is free, claim the position.
+            if (__atomic_compare_exchange_n(&queue->head, &pos, pos + 1, 1,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return ENOSPC;
+        } else {
+            pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->item.type = type;
+    slot->item.value = value;
+    slot->item.timestamp_us = event_queue_now_us();
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    // write(2) on an eventfd is a single atomic add, safe from any thread.
+    if (write(queue->fd, &one, sizeof(one)) != sizeof(one))
+        return errno;
+    return 0;
+}
+
+/**
+ * @brief Pop the oldest event, only one thread may pop.
+ * @param queue a valid queue.
+ * @param item [out] the event.
+ * @return 0 on success; EAGAIN when the queue is empty.
+ */
+int event_queue_pop(event_queue_st *queue, event_queue_item_st *item) {
+    event_queue_slot_st *slot;
+    unsigned int pos = queue->tail;
+
+    slot = &queue->slots[pos & queue->mask];
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != pos + 1)
+        return EAGAIN;
+
+    *item = slot->item;
+    // hand the slot back to producers, one lap later.
+    __atomic_store_n(&slot->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE);
+    queue->tail = pos + 1;
+    return 0;
+}
+
+/**
+ * @brief Reset the eventfd once woken up, before popping the events.
+ * @param queue a valid queue.
+ */
+void event_queue_ack(event_queue_st *queue) {
+    uint64_t count;
+
+    if (read(queue->fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        fprintf(stderr, "Event queue read failed: %s\n", strerror(errno));
+}
+
+/**
+ * @brief Current CLOCK_MONOTONIC time, in us.
+ * @return time in us.
+ */
+uint64_t event_queue_now_us() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+#ifdef XTEST
+
+#include <sched.h>
+#include <pthread.h>
+
+#define TEST_PRODUCERS      (4)         /**< Threads pushing at once */
+#define TEST_EVENTS         (10000)     /**< Events per producer */
+
+static event_queue_st *g_queue = NULL;
+
+static void *s_producer(void *arg) {
+    int i, type = (int)(long)arg;
+
+    for (i = 0; i < TEST_EVENTS; ++i) {
+        while (event_queue_push(g_queue, type, i) == ENOSPC)
+            sched_yield();
+    }
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[TEST_PRODUCERS];
+    int next[TEST_PRODUCERS] = { 0 };
+    event_queue_item_st item;
+    long i, received = 0, failed = 0;
+
+    g_queue = event_queue_init(64);
+    for (i = 0; i < TEST_PRODUCERS; ++i)
+        pthread_create(&threads[i], NULL, s_producer, (void *)i);
+
+    while (received < TEST_PRODUCERS * TEST_EVENTS) {
+        event_queue_ack(g_queue);
+        while (event_queue_pop(g_queue, &item) == 0) {
+            // events of one producer must come out in order.
+            if (item.value != next[item.type]++)
+                failed = 1;
+            received++;
+        }
+    }
+
+    for (i = 0; i < TEST_PRODUCERS; ++i)
+        pthread_join(threads[i], NULL);
+
+    printf("%s: %ld events\n", failed ? "FAILED" : "SUCCESS!", received);
+    event_queue_fini(g_queue);
+    return failed;
+}
+
+#endif
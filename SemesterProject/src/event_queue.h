@@ -0,0 +1,77 @@
+/**
+ * @file event_queue.h
+ * @brief lock-free queue of timestamped input events, declaration.
+ *        Interrupt threads push, the event loop pops when the eventfd
+ *        becomes readable.
+ * @author Xiangyu Guo
+ */
+#ifndef __EVENT_QUEUE_H__
+#define __EVENT_QUEUE_H__
+
+#include <stdint.h>
+
+/**
+ * @brief one input event.
+ */
+typedef struct event_queue_item {
+    int type;                       /**< event type, defined by the user */
+    int value;                      /**< auxiliary value */
+    uint64_t timestamp_us;          /**< CLOCK_MONOTONIC when pushed, in us */
+} event_queue_item_st;
+
+/**
+ * @brief module structure, hiding the detail to the public
+ */
+typedef struct event_queue event_queue_st;
+struct event_queue;
+
+/**
+ * @brief Initialize a bounded queue and its eventfd.
+ * @param capacity number of slots, rounded up to a power of two.
+ * @return a initialized queue.
+ */
+event_queue_st *event_queue_init(unsigned int capacity);
+
+/**
+ * @brief Clean up the queue.
+ * @param queue a valid queue.
+ */
+void event_queue_fini(event_queue_st *queue);
+
+/**
+ * @brief Get the eventfd to watch, readable while events are pending.
+ * @param queue a valid queue.
+ * @return file descriptor of the eventfd.
+ */
+int event_queue_fd(event_queue_st *queue);
+
+/**
+ * @brief Push one event, lock-free, safe from several threads at once.
+ * @param queue a valid queue.
+ * @param type event type.
+ * @param value auxiliary value.
+ * @return 0 on success; ENOSPC when the queue is full.
+ */
+int event_queue_push(event_queue_st *queue, int type, int value);
+
+/**
+ * @brief Pop the oldest event, only one thread may pop.
+ * @param queue a valid queue.
+ * @param item [out] the event.
+ * @return 0 on success; EAGAIN when the queue is empty.
+ */
+int event_queue_pop(event_queue_st *queue, event_queue_item_st *item);
+
+/**
+ * @brief Reset the eventfd once woken up, before popping the events.
+ * @param queue a valid queue.
+ */
+void event_queue_ack(event_queue_st *queue);
+
+/**
+ * @brief Current CLOCK_MONOTONIC time, in us.
+ * @return time in us.
+ */
+uint64_t event_queue_now_us();
+
+#endif
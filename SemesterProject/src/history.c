@@ -0,0 +1,657 @@
+/**
+ * @file history.c
+ * @brief in-memory multi-resolution sensor history, implementation.
+ *        A bucket slot is picked by its start time modulo the ring size.
+ *        When a ring moves on to a newer bucket the slots skipped over are
+ *        emptied, so a ring always holds just its last slots buckets.
+ *        Over each ring a summary tree (count, sum, min, max of every pair
+ *        of nodes below) is kept up to date as samples come, a range of
+ *        buckets is aggregated from O(log slots) nodes.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "history.h"
+
+/**
+ * @brief one bucket as stored, 24 bytes.
+ */
+typedef struct history_bucket {
+    uint32_t start;                 /**< unix time the bucket starts at */
+    uint32_t count;                 /**< samples folded in, 0 when empty */
+    float min;                      /**< smallest sample */
+    float max;                      /**< largest sample */
+    double sum;                     /**< sum of the samples */
+} history_bucket_st;
+
+/**
+ * @brief summary of the buckets below one tree node, 24 bytes.
+ */
+typedef struct history_summary {
+    uint32_t count;                 /**< samples, 0 when empty */
+    float min;                      /**< smallest sample */
+    float max;                      /**< largest sample */
+    double sum;                     /**< sum of the samples */
+} history_summary_st;
+
+/**
+ * @brief one resolution, a ring of slots per series and its tree.
+ *        Node 1 is the root, node n has children 2n and 2n + 1, the
+ *        children from slots on are the buckets.
+ */
+typedef struct history_level {
+    int resolution;                 /**< seconds per bucket */
+    int slots;                      /**< buckets per series */
+    history_bucket_st *buckets;     /**< HISTORY_SERIES rings */
+    history_summary_st *nodes;      /**< HISTORY_SERIES trees */
+    time_t *newest;                 /**< newest bucket start, per series */
+} history_level_st;
+
+/**
+ * @brief the newest sample of a series.
+ */
+typedef struct history_sample {
+    time_t time;                    /**< unix time, 0 while empty */
+    double value;                   /**< the sample */
+} history_sample_st;
+
+static history_bucket_st g_seconds[HISTORY_SERIES * HISTORY_SECOND_SLOTS];
+static history_bucket_st g_minutes[HISTORY_SERIES * HISTORY_MINUTE_SLOTS];
+static history_bucket_st g_hours[HISTORY_SERIES * HISTORY_HOUR_SLOTS];
+
+static history_summary_st g_second_nodes[HISTORY_SERIES * HISTORY_SECOND_SLOTS];
+static history_summary_st g_minute_nodes[HISTORY_SERIES * HISTORY_MINUTE_SLOTS];
+static history_summary_st g_hour_nodes[HISTORY_SERIES * HISTORY_HOUR_SLOTS];
+
+static time_t g_newest[HISTORY_LEVELS][HISTORY_SERIES]; /**< 0 while empty */
+static history_sample_st g_latest[HISTORY_SERIES];      /**< Newest samples */
+
+static const history_level_st g_levels[HISTORY_LEVELS] = {
+    {1, HISTORY_SECOND_SLOTS, g_seconds, g_second_nodes, g_newest[0]},
+    {60, HISTORY_MINUTE_SLOTS, g_minutes, g_minute_nodes, g_newest[1]},
+    {3600, HISTORY_HOUR_SLOTS, g_hours, g_hour_nodes, g_newest[2]},
+};
+
+static const char *g_names[HISTORY_SERIES] = {
+    "dht11_temperature", "dht11_humidity",
+    "bmp180_temperature", "bmp180_pressure", "bmp180_altitude",
+    "mcp3208_0", "mcp3208_1", "mcp3208_2", "mcp3208_3",
+    "mcp3208_4", "mcp3208_5", "mcp3208_6", "mcp3208_7",
+    "mcp3208_8", "mcp3208_9", "mcp3208_10", "mcp3208_11",
+    "mcp3208_12", "mcp3208_13", "mcp3208_14", "mcp3208_15",
+};
+
+/**
+ * @brief Empty the slots of the buckets between the newest and a newer one.
+ */
+static void s_history_expire(const history_level_st *level, int series,
+                             time_t start);
+
+/**
+ * @brief Recompute the tree nodes above one slot.
+ */
+static void s_history_update(const history_level_st *level, int series,
+                             int slot);
+
+/**
+ * @brief Add the summary of tree node n to sum.
+ */
+static void s_history_add(const history_level_st *level, int series, int n,
+                          history_summary_st *sum);
+
+/**
+ * @brief Add the summary of the slots [lo, hi) to sum, bottom up.
+ */
+static void s_history_range(const history_level_st *level, int series,
+                            int lo, int hi, history_summary_st *sum);
+
+/* ==================
+    history function
+   ================== */
+/**
+ * @brief Fold one sample into every resolution of a series.
+ *        A sample older than what a ring still holds is ignored there.
+ * @param series HISTORY_* series.
+ * @param time unix time of the sample.
+ * @param value the sample.
+ */
+void history_push(int series, time_t time, double value) {
+    const history_level_st *level;
+    history_bucket_st *bucket;
+    time_t start;
+    int i, slot;
+
+    if (series < 0 || series >= HISTORY_SERIES || time < 0)
+        return;
+
+    if (time >= g_latest[series].time) {
+        g_latest[series].time = time;
+        g_latest[series].value = value;
+    }
+
+    for (i = 0; i < HISTORY_LEVELS; ++i) {
+        level = &g_levels[i];
+        start = time - time % level->resolution;
+        if (level->newest[series] != 0 && start <= level->newest[series] -
+                (time_t)level->slots * level->resolution)
+            continue;
+        if (start > level->newest[series]) {
+            s_history_expire(level, series, start);
+            level->newest[series] = start;
+        }
+
+        slot = time / level->resolution % level->slots;
+        bucket = &level->buckets[series * level->slots + slot];
+        if (bucket->count == 0 || bucket->start != start) {
+            bucket->start = start;
+            bucket->count = 0;
+            bucket->sum = 0;
+            bucket->min = value;
+            bucket->max = value;
+        }
+        bucket->count++;
+        bucket->sum += value;
+        if (value < bucket->min)
+            bucket->min = value;
+        if (value > bucket->max)
+            bucket->max = value;
+        s_history_update(level, series, slot);
+    }
+}
+
+/**
+ * @brief Newest sample of a series, as pushed.
+ * @param series HISTORY_* series.
+ * @param time [out] unix time of the sample.
+ * @param value [out] the sample.
+ * @return 1 when the series holds a sample, 0 otherwise.
+ */
+int history_latest(int series, time_t *time, double *value) {
+    if (series < 0 || series >= HISTORY_SERIES || g_latest[series].time == 0)
+        return 0;
+    *time = g_latest[series].time;
+    *value = g_latest[series].value;
+    return 1;
+}
+
+/**
+ * @brief Non empty buckets of one resolution in [from, to], oldest first.
+ * @param series HISTORY_* series.
+ * @param level HISTORY_SECOND, _MINUTE or _HOUR.
+ * @param from unix time, rounded down to its bucket.
+ * @param to unix time, inclusive.
+ * @param points [out] the buckets.
+ * @param max size of points, the newest buckets past it are left out.
+ * @return number of buckets written.
+ */
+int history_query(int series, int level, time_t from, time_t to,
+                  history_point_st *points, int max) {
+    const history_level_st *l;
+    const history_bucket_st *ring, *bucket;
+    time_t start, last, oldest;
+    int n = 0;
+
+    if (series < 0 || series >= HISTORY_SERIES ||
+            level < 0 || level >= HISTORY_LEVELS || from < 0 || from > to)
+        return 0;
+
+    l = &g_levels[level];
+    ring = &l->buckets[series * l->slots];
+    start = from - from % l->resolution;
+    last = to - to % l->resolution;
+    // the ring holds the buckets from oldest to newest, nothing else.
+    oldest = l->newest[series] - (time_t)(l->slots - 1) * l->resolution;
+    if (last > l->newest[series])
+        last = l->newest[series];
+    if (start < oldest)
+        start = oldest;
+
+    for (; start <= last && n < max; start += l->resolution) {
+        bucket = &ring[start / l->resolution % l->slots];
+        if (bucket->count == 0 || bucket->start != start)
+            continue;
+        points[n].start = start;
+        points[n].count = bucket->count;
+        points[n].min = bucket->min;
+        points[n].max = bucket->max;
+        points[n].avg = bucket->sum / bucket->count;
+        ++n;
+    }
+    return n;
+}
+
+/**
+ * @brief Aggregate of one resolution over [from, to], from the summary tree.
+ * @param series HISTORY_* series.
+ * @param level HISTORY_SECOND, _MINUTE or _HOUR.
+ * @param from unix time, rounded down to its bucket.
+ * @param to unix time, inclusive.
+ * @param point [out] count, min, max and avg of the samples, start is from.
+ * @return number of samples, 0 when none is held in the range.
+ */
+int history_aggregate(int series, int level, time_t from, time_t to,
+                      history_point_st *point) {
+    const history_level_st *l;
+    history_summary_st sum = {0, 0, 0, 0};
+    time_t first, last, oldest;
+    int a, b;
+
+    memset(point, 0, sizeof(*point));
+    point->start = from;
+    if (series < 0 || series >= HISTORY_SERIES ||
+            level < 0 || level >= HISTORY_LEVELS || from < 0 || from > to)
+        return 0;
+
+    l = &g_levels[level];
+    if (l->newest[series] == 0)
+        return 0;
+    // the ring holds the buckets from oldest to newest, nothing else.
+    first = from - from % l->resolution;
+    last = to - to % l->resolution;
+    oldest = l->newest[series] - (time_t)(l->slots - 1) * l->resolution;
+    if (last > l->newest[series])
+        last = l->newest[series];
+    if (first < oldest)
+        first = oldest;
+    if (first > last)
+        return 0;
+
+    // the slots from a to b, in two parts when the range wraps.
+    a = first / l->resolution % l->slots;
+    b = last / l->resolution % l->slots;
+    if (a <= b) {
+        s_history_range(l, series, a, b + 1, &sum);
+    } else {
+        s_history_range(l, series, a, l->slots, &sum);
+        s_history_range(l, series, 0, b + 1, &sum);
+    }
+
+    point->count = sum.count;
+    point->min = sum.min;
+    point->max = sum.max;
+    point->avg = sum.count ? sum.sum / sum.count : 0;
+    return sum.count;
+}
+
+/**
+ * @brief Finest resolution covering [from, to] in at most max buckets.
+ * @param from unix time.
+ * @param to unix time.
+ * @param max buckets wanted at most.
+ * @return HISTORY_SECOND, _MINUTE or _HOUR, the hours when nothing fits.
+ */
+int history_level(time_t from, time_t to, int max) {
+    time_t buckets;
+    int i;
+
+    for (i = 0; i < HISTORY_LEVELS; ++i) {
+        buckets = (to - from) / g_levels[i].resolution + 1;
+        if (buckets <= max && buckets <= g_levels[i].slots)
+            return i;
+    }
+    return HISTORY_HOUR;
+}
+
+/**
+ * @brief Resolution to aggregate windows of a given width from: the
+ *        coarsest one dividing it, which also reaches back the furthest.
+ * @param window seconds.
+ * @return HISTORY_SECOND, _MINUTE or _HOUR.
+ */
+int history_window_level(int window) {
+    int i;
+
+    for (i = HISTORY_LEVELS - 1; i > HISTORY_SECOND; --i) {
+        if (window > 0 && window % g_levels[i].resolution == 0)
+            return i;
+    }
+    return HISTORY_SECOND;
+}
+
+/**
+ * @brief Width of the buckets of one resolution.
+ * @param level HISTORY_SECOND, _MINUTE or _HOUR.
+ * @return seconds.
+ */
+int history_resolution(int level) {
+    if (level < 0 || level >= HISTORY_LEVELS)
+        return 0;
+    return g_levels[level].resolution;
+}
+
+/**
+ * @brief Name of a series, e.g. "dht11_temperature" or "mcp3208_7".
+ * @param series HISTORY_* series.
+ * @return the name, NULL if out of range.
+ */
+const char *history_series_name(int series) {
+    if (series < 0 || series >= HISTORY_SERIES)
+        return NULL;
+    return g_names[series];
+}
+
+/**
+ * @brief Series of a name.
+ * @param name as given by history_series_name.
+ * @return HISTORY_* series, -1 if unknown.
+ */
+int history_series_find(const char *name) {
+    int i;
+
+    for (i = 0; name != NULL && i < HISTORY_SERIES; ++i) {
+        if (strcmp(name, g_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Forget every sample.
+ */
+void history_clear() {
+    memset(g_seconds, 0, sizeof(g_seconds));
+    memset(g_minutes, 0, sizeof(g_minutes));
+    memset(g_hours, 0, sizeof(g_hours));
+    memset(g_second_nodes, 0, sizeof(g_second_nodes));
+    memset(g_minute_nodes, 0, sizeof(g_minute_nodes));
+    memset(g_hour_nodes, 0, sizeof(g_hour_nodes));
+    memset(g_newest, 0, sizeof(g_newest));
+    memset(g_latest, 0, sizeof(g_latest));
+}
+
+/* ================
+    inner function
+   ================ */
+static void s_history_expire(const history_level_st *level, int series,
+                             time_t start) {
+    history_bucket_st *ring = &level->buckets[series * level->slots];
+    time_t newest = level->newest[series], skipped;
+    int slot;
+
+    if (newest == 0)
+        return;
+    skipped = (start - newest) / level->resolution - 1;
+    if (skipped > level->slots)
+        skipped = level->slots;
+    for (slot = newest / level->resolution % level->slots; skipped > 0; --skipped) {
+        slot = (slot + 1) % level->slots;
+        if (ring[slot].count != 0) {
+            ring[slot].count = 0;
+            s_history_update(level, series, slot);
+        }
+    }
+}
+
+static void s_history_update(const history_level_st *level, int series,
+                             int slot) {
+    history_summary_st *nodes = &level->nodes[series * level->slots];
+    int n;
+
+    for (n = (slot + level->slots) >> 1; n >= 1; n >>= 1) {
+        nodes[n].count = 0;
+        nodes[n].sum = 0;
+        s_history_add(level, series, 2 * n, &nodes[n]);
+        s_history_add(level, series, 2 * n + 1, &nodes[n]);
+    }
+}
+
+static void s_history_add(const history_level_st *level, int series, int n,
+                          history_summary_st *sum) {
+    const history_bucket_st *bucket;
+    const history_summary_st *node;
+    uint32_t count;
+    float min, max;
+
+    if (n >= level->slots) {
+        bucket = &level->buckets[series * level->slots + n - level->slots];
+        count = bucket->count;
+        min = bucket->min;
+        max = bucket->max;
+        if (count == 0)
+            return;
+        sum->sum += bucket->sum;
+    } else {
+        node = &level->nodes[series * level->slots + n];
+        count = node->count;
+        min = node->min;
+        max = node->max;
+        if (count == 0)
+            return;
+        sum->sum += node->sum;
+    }
+    if (sum->count == 0 || min < sum->min)
+        sum->min = min;
+    if (sum->count == 0 || max > sum->max)
+        sum->max = max;
+    sum->count += count;
+}
+
+static void s_history_range(const history_level_st *level, int series,
+                            int lo, int hi, history_summary_st *sum) {
+    for (lo += level->slots, hi += level->slots; lo < hi; lo >>= 1, hi >>= 1) {
+        if (lo & 1)
+            s_history_add(level, series, lo++, sum);
+        if (hi & 1)
+            s_history_add(level, series, --hi, sum);
+    }
+}
+
+#if defined(XTEST) || defined(BENCH)
+
+#define TEST_START          (1700002800)    /**< An hour boundary */
+#define TEST_SECONDS        (2 * 3600)      /**< Two hours, one sample a second */
+
+static history_point_st g_points[HISTORY_SECOND_SLOTS]; /**< Query results */
+
+/**
+ * @brief A sample a second on one series, i % 60 at second i.
+ */
+static void s_fill(int series) {
+    int i;
+
+    for (i = 0; i < TEST_SECONDS; ++i)
+        history_push(series, TEST_START + i, i % 60);
+}
+
+#endif
+
+#ifdef XTEST
+
+#include <stdlib.h>
+#include <math.h>
+
+/**
+ * @brief Check the tree against the buckets, over random ranges.
+ * @return number of ranges aggregated wrong.
+ */
+static int s_test_aggregate(int series, time_t first, time_t span) {
+    history_point_st got, want;
+    time_t from, to;
+    double sum;
+    int level, r, i, n, wrong = 0;
+
+    srand(180);
+    for (level = HISTORY_SECOND; level <= HISTORY_HOUR; ++level) {
+        for (r = 0; r < 500; ++r) {
+            from = first + rand() % span;
+            to = from + rand() % (span / (r % 2 ? 1 : 50) + 1);
+            n = history_query(series, level, from, to, g_points, HISTORY_SECOND_SLOTS);
+            memset(&want, 0, sizeof(want));
+            for (i = 0, sum = 0; i < n; ++i) {
+                if (i == 0 || g_points[i].min < want.min)
+                    want.min = g_points[i].min;
+                if (i == 0 || g_points[i].max > want.max)
+                    want.max = g_points[i].max;
+                want.count += g_points[i].count;
+                sum += g_points[i].avg * g_points[i].count;
+            }
+            history_aggregate(series, level, from, to, &got);
+            if (got.count != want.count || (want.count &&
+                    (got.min != want.min || got.max != want.max ||
+                     fabs(got.avg * got.count - sum) > 1e-6 * want.count)))
+                wrong++;
+        }
+    }
+    return wrong;
+}
+
+int main() {
+    const time_t end = TEST_START + TEST_SECONDS - 1;
+    double value;
+    time_t at;
+    int n, i, failed = 0;
+
+    s_fill(HISTORY_DHT11_TEMPERATURE);
+
+    // by the second, only the last hour is left.
+    n = history_query(HISTORY_DHT11_TEMPERATURE, HISTORY_SECOND,
+                      TEST_START, end, g_points, HISTORY_SECOND_SLOTS);
+    failed |= n != HISTORY_SECOND_SLOTS || g_points[0].start != end - 3599 ||
+              g_points[n - 1].start != end || g_points[0].count != 1;
+    printf("seconds: %d buckets from %ld\n", n, (long)g_points[0].start);
+
+    // by the minute, every minute is 0 to 59.
+    n = history_query(HISTORY_DHT11_TEMPERATURE, HISTORY_MINUTE,
+                      TEST_START, end, g_points, HISTORY_SECOND_SLOTS);
+    failed |= n != TEST_SECONDS / 60;
+    for (i = 0; i < n; ++i) {
+        failed |= g_points[i].count != 60 || g_points[i].min != 0 ||
+                  g_points[i].max != 59 || g_points[i].avg != 29.5;
+    }
+    printf("minutes: %d buckets, avg %.1f\n", n, g_points[0].avg);
+
+    n = history_query(HISTORY_DHT11_TEMPERATURE, HISTORY_HOUR,
+                      TEST_START, end, g_points, HISTORY_SECOND_SLOTS);
+    failed |= n != 2 || g_points[1].count != 3600 || g_points[1].avg != 29.5;
+    printf("hours: %d buckets\n", n);
+
+    // the tree gives what adding up the buckets gives.
+    n = history_aggregate(HISTORY_DHT11_TEMPERATURE, HISTORY_MINUTE,
+                          TEST_START, end, g_points);
+    failed |= n != TEST_SECONDS || g_points[0].avg != 29.5 ||
+              g_points[0].min != 0 || g_points[0].max != 59;
+    i = s_test_aggregate(HISTORY_DHT11_TEMPERATURE, TEST_START - 3600,
+                         TEST_SECONDS + 7200);
+    failed |= i != 0;
+    printf("aggregate: %d wrong ranges\n", i);
+
+    // a ring moving on empties the slots it skipped.
+    history_push(HISTORY_BMP180_ALTITUDE, TEST_START, 1);
+    history_push(HISTORY_BMP180_ALTITUDE, TEST_START + 1, 2);
+    history_push(HISTORY_BMP180_ALTITUDE, TEST_START + 3601, 3);
+    n = history_aggregate(HISTORY_BMP180_ALTITUDE, HISTORY_SECOND,
+                          TEST_START, TEST_START + 3601, g_points);
+    failed |= n != 1 || g_points[0].max != 3;
+    n = history_aggregate(HISTORY_BMP180_ALTITUDE, HISTORY_HOUR,
+                          TEST_START, TEST_START + 3601, g_points);
+    failed |= n != 3 || g_points[0].avg != 2;
+
+    failed |= history_window_level(86400) != HISTORY_HOUR ||
+              history_window_level(300) != HISTORY_MINUTE ||
+              history_window_level(90) != HISTORY_SECOND;
+
+    // a late sample only lands where its bucket is still held.
+    history_push(HISTORY_DHT11_TEMPERATURE, TEST_START, 100);
+    n = history_query(HISTORY_DHT11_TEMPERATURE, HISTORY_SECOND,
+                      TEST_START, TEST_START, g_points, 1);
+    failed |= n != 0;
+    n = history_query(HISTORY_DHT11_TEMPERATURE, HISTORY_MINUTE,
+                      TEST_START, TEST_START, g_points, 1);
+    failed |= n != 1 || g_points[0].count != 61 || g_points[0].max != 100;
+
+    // nor does it replace the newest sample.
+    failed |= !history_latest(HISTORY_DHT11_TEMPERATURE, &at, &value) ||
+              at != end || value != (TEST_SECONDS - 1) % 60;
+    failed |= history_latest(HISTORY_DHT11_HUMIDITY, &at, &value);
+
+    // the other series are untouched, the size limit is kept.
+    failed |= history_query(HISTORY_DHT11_HUMIDITY, HISTORY_HOUR,
+                            TEST_START, end, g_points, 10) != 0;
+    failed |= history_query(HISTORY_DHT11_TEMPERATURE, HISTORY_SECOND,
+                            TEST_START, end, g_points, 10) != 10;
+
+    failed |= history_level(end - 3599, end, HISTORY_SECOND_SLOTS) != HISTORY_SECOND;
+    failed |= history_level(end - 86399, end, HISTORY_SECOND_SLOTS) != HISTORY_MINUTE;
+    failed |= history_level(end - 7 * 86400, end, HISTORY_SECOND_SLOTS) != HISTORY_HOUR;
+
+    for (i = 0; i < HISTORY_SERIES; ++i)
+        failed |= history_series_find(history_series_name(i)) != i;
+    failed |= history_series_find("mcp3208_16") != -1;
+
+    history_clear();
+    failed |= history_query(HISTORY_DHT11_TEMPERATURE, HISTORY_HOUR,
+                            TEST_START, end, g_points, 10) != 0;
+    failed |= history_latest(HISTORY_DHT11_TEMPERATURE, &at, &value);
+
+    printf("%s\n", failed ? "FAILED" : "SUCCESS!");
+    return failed;
+}
+
+#endif
+
+#ifdef BENCH
+#include "bench.h"
+
+/**
+ * @brief one sample, folded into the three resolutions.
+ */
+static void s_bench_push(void *arg, long n) {
+    while (n-- > 0)
+        history_push(HISTORY_BMP180_PRESSURE, TEST_START + n, n & 1023);
+}
+
+/**
+ * @brief a range of one resolution.
+ */
+typedef struct bench_range {
+    int level;                      /**< HISTORY_SECOND, _MINUTE or _HOUR */
+    time_t span;                    /**< seconds back from the last sample */
+} bench_range_st;
+
+/**
+ * @brief one range, answered from the buckets.
+ */
+static void s_bench_query(void *arg, long n) {
+    const bench_range_st *range = arg;
+    const time_t end = TEST_START + TEST_SECONDS - 1;
+    int got;
+
+    while (n-- > 0) {
+        got = history_query(HISTORY_DHT11_TEMPERATURE, range->level,
+                            end - range->span + 1, end, g_points,
+                            HISTORY_SECOND_SLOTS);
+        bench_keep(&got);
+    }
+}
+
+/**
+ * @brief one range, aggregated from the summary tree.
+ */
+static void s_bench_aggregate(void *arg, long n) {
+    const bench_range_st *range = arg;
+    const time_t end = TEST_START + TEST_SECONDS - 1;
+    history_point_st point;
+
+    while (n-- > 0) {
+        history_aggregate(HISTORY_DHT11_TEMPERATURE, range->level,
+                          end - range->span + 1 - (n & 63), end - (n & 63), &point);
+        bench_keep(&point);
+    }
+}
+
+int main() {
+    static const bench_range_st hour = {HISTORY_SECOND, 3600};
+    static const bench_range_st day = {HISTORY_MINUTE, 86400};
+
+    s_fill(HISTORY_DHT11_TEMPERATURE);
+    bench_run("history", "push", s_bench_push, NULL, NULL);
+    bench_run("history", "query hour by second", s_bench_query, (void *)&hour, NULL);
+    bench_run("history", "query day by minute", s_bench_query, (void *)&day, NULL);
+    bench_run("history", "aggregate hour by second", s_bench_aggregate, (void *)&hour, NULL);
+    bench_run("history", "aggregate day by minute", s_bench_aggregate, (void *)&day, NULL);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,141 @@
+/**
+ * @file history.h
+ * @brief in-memory multi-resolution sensor history, declaration.
+ *        Every series keeps one ring of buckets per resolution: seconds,
+ *        minutes and hours. A sample is folded into its bucket of each ring
+ *        as it arrives (count, sum, min, max), so a range is answered from
+ *        the buckets of one resolution, raw samples are never kept.
+ *        Aggregates over a range come from a summary tree per ring, in
+ *        logarithmic time whatever the length of the range.
+ *        The memory is fixed, the oldest buckets are overwritten.
+ * @author Xiangyu Guo
+ */
+#ifndef __HISTORY_H__
+#define __HISTORY_H__
+
+#include <time.h>
+
+/* ========
+    series
+   ======== */
+#define HISTORY_DHT11_TEMPERATURE   (0)     /**< DHT11, degree Celsius */
+#define HISTORY_DHT11_HUMIDITY      (1)     /**< DHT11, percent */
+#define HISTORY_BMP180_TEMPERATURE  (2)     /**< BMP180, degree Celsius */
+#define HISTORY_BMP180_PRESSURE     (3)     /**< BMP180, Pa */
+#define HISTORY_BMP180_ALTITUDE     (4)     /**< BMP180, m */
+#define HISTORY_MCP3208_CHANNEL_0   (5)     /**< MCP3208 filtered, channel n is + n, 8-15 on CE1 */
+#define HISTORY_SERIES              (21)    /**< Number of series */
+
+/* ============
+    resolution
+   ============ */
+#define HISTORY_SECOND              (0)     /**< 1 s buckets */
+#define HISTORY_MINUTE              (1)     /**< 1 min buckets */
+#define HISTORY_HOUR                (2)     /**< 1 h buckets */
+#define HISTORY_LEVELS              (3)     /**< Number of resolutions */
+
+#define HISTORY_SECOND_SLOTS        (3600)  /**< An hour by the second */
+#define HISTORY_MINUTE_SLOTS        (1440)  /**< A day by the minute */
+#define HISTORY_HOUR_SLOTS          (720)   /**< 30 days by the hour */
+
+/**
+ * @brief one bucket of a series.
+ */
+typedef struct history_point {
+    time_t start;                   /**< unix time the bucket starts at */
+    unsigned int count;             /**< samples folded in */
+    double min;                     /**< smallest sample */
+    double max;                     /**< largest sample */
+    double avg;                     /**< mean of the samples */
+} history_point_st;
+
+/* ==================
+    history function
+   ================== */
+/**
+ * @brief Fold one sample into every resolution of a series.
+ *        A sample older than what a ring still holds is ignored there.
+ * @param series HISTORY_* series.
+ * @param time unix time of the sample.
+ * @param value the sample.
+ */
+void history_push(int series, time_t time, double value);
+
+/**
+ * @brief Newest sample of a series, as pushed.
+ * @param series HISTORY_* series.
+ * @param time [out] unix time of the sample.
+ * @param value [out] the sample.
+ * @return 1 when the series holds a sample, 0 otherwise.
+ */
+int history_latest(int series, time_t *time, double *value);
+
+/**
+ * @brief Non empty buckets of one resolution in [from, to], oldest first.
+ * @param series HISTORY_* series.
+ * @param level HISTORY_SECOND, _MINUTE or _HOUR.
+ * @param from unix time, rounded down to its bucket.
+ * @param to unix time, inclusive.
+ * @param points [out] the buckets.
+ * @param max size of points, the newest buckets past it are left out.
+ * @return number of buckets written.
+ */
+int history_query(int series, int level, time_t from, time_t to,
+                  history_point_st *points, int max);
+
+/**
+ * @brief Aggregate of one resolution over [from, to], from the summary tree.
+ * @param series HISTORY_* series.
+ * @param level HISTORY_SECOND, _MINUTE or _HOUR.
+ * @param from unix time, rounded down to its bucket.
+ * @param to unix time, inclusive.
+ * @param point [out] count, min, max and avg of the samples, start is from.
+ * @return number of samples, 0 when none is held in the range.
+ */
+int history_aggregate(int series, int level, time_t from, time_t to,
+                      history_point_st *point);
+
+/**
+ * @brief Resolution to aggregate windows of a given width from: the
+ *        coarsest one dividing it, which also reaches back the furthest.
+ * @param window seconds.
+ * @return HISTORY_SECOND, _MINUTE or _HOUR.
+ */
+int history_window_level(int window);
+
+/**
+ * @brief Finest resolution covering [from, to] in at most max buckets.
+ * @param from unix time.
+ * @param to unix time.
+ * @param max buckets wanted at most.
+ * @return HISTORY_SECOND, _MINUTE or _HOUR, the hours when nothing fits.
+ */
+int history_level(time_t from, time_t to, int max);
+
+/**
+ * @brief Width of the buckets of one resolution.
+ * @param level HISTORY_SECOND, _MINUTE or _HOUR.
+ * @return seconds.
+ */
+int history_resolution(int level);
+
+/**
+ * @brief Name of a series, e.g. "dht11_temperature" or "mcp3208_7".
+ * @param series HISTORY_* series.
+ * @return the name, NULL if out of range.
+ */
+const char *history_series_name(int series);
+
+/**
+ * @brief Series of a name.
+ * @param name as given by history_series_name.
+ * @return HISTORY_* series, -1 if unknown.
+ */
+int history_series_find(const char *name);
+
+/**
+ * @brief Forget every sample.
+ */
+void history_clear();
+
+#endif
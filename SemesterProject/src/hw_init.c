@@ -0,0 +1,335 @@
+/**
+ * @file hw_init.c
+ * @brief hardware bring-up, implementation.
+ *        A device up is pushed on an event queue by the thread of its bus,
+ *        the event loop pops it and calls its ready call back.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <event2/event.h>
+#include <wiringPi.h>
+
+#include "pin/pin_gpio.h"
+#include "event_queue.h"
+#include "scheduler.h"
+#include "tracing.h"
+#include "loop_lag.h"
+#include "hw_init.h"
+
+#define USEC_PER_MSEC           (1000)      /**< Microseconds per millisecond */
+#define HW_INIT_STACK_SIZE      (128 * 1024)/**< Stack of a bring-up thread, may be locked */
+
+/**
+ * @brief one device.
+ */
+typedef struct hw_init_device {
+    const char *name;               /**< shown in the log */
+    int bus;                        /**< SCHEDULER_BUS_* */
+    hw_init_fn probe;               /**< on the thread of the bus */
+    hw_init_fn ready;               /**< on the event loop */
+    void *arg;                      /**< argument of both */
+    uint64_t probe_us;              /**< time the probe took */
+} hw_init_device_st;
+
+/**
+ * @brief the thread of one bus.
+ */
+typedef struct hw_init_bus {
+    hw_init_st *hw;                 /**< its bring-up */
+    int bus;                        /**< SCHEDULER_BUS_* */
+    int started;                    /**< thread to join */
+    pthread_t thread;               /**< the thread */
+} hw_init_bus_st;
+
+struct hw_init {
+    struct event *ready_event;      /**< devices up, on the event loop */
+    event_queue_st *queue;          /**< device numbers, from the bus threads */
+    int count;                      /**< devices added */
+    int pending;                    /**< devices not up yet */
+    hw_init_device_st devices[HW_INIT_MAX_DEVICES]; /**< devices */
+    hw_init_bus_st buses[SCHEDULER_BUSES];          /**< bus threads */
+};
+
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;   /**< Platform set up */
+static uint64_t g_started_us = 0;                   /**< When it was */
+
+/**
+ * @brief Set up wiringPi and the GPIO registers.
+ */
+static void s_hw_init_platform();
+
+/**
+ * @brief Probe the devices of one bus, in order.
+ */
+static void *s_hw_init_bus_thread(void *arg);
+
+/**
+ * @brief Hand the devices up to their ready call back, on the event loop.
+ */
+static void s_hw_init_ready_cb(evutil_socket_t fd, short flags, void *arg);
+
+/**
+ * @brief Wait for the bus threads.
+ */
+static void s_hw_init_join(hw_init_st *hw);
+
+/* ==============================================
+	hw_init initialize and finish function
+   ============================================== */
+/**
+ * @brief Set up the platform, calling it again does nothing.
+ */
+void hw_init_platform() {
+    pthread_once(&g_once, s_hw_init_platform);
+}
+
+/**
+ * @brief Initialize a bring-up, the devices are added then started.
+ * @param base event loop the devices are handed back to.
+ * @return a initialized bring-up.
+ */
+hw_init_st *hw_init_init(struct event_base *base) {
+    hw_init_st *hw = calloc(1, sizeof(hw_init_st));
+    int i;
+
+    if (hw == NULL)
+        exit(ENOMEM);
+
+    hw->queue = event_queue_init(HW_INIT_MAX_DEVICES);
+    hw->ready_event = event_new(base, event_queue_fd(hw->queue),
+                                EV_READ | EV_PERSIST, s_hw_init_ready_cb, hw);
+    if (hw->ready_event == NULL)
+        exit(ENOMEM);
+    event_add(hw->ready_event, NULL);
+
+    for (i = 0; i < SCHEDULER_BUSES; ++i) {
+        hw->buses[i].hw = hw;
+        hw->buses[i].bus = i;
+    }
+    return hw;
+}
+
+/**
+ * @brief Clean up, waiting for the probes still running.
+ * @param hw a valid bring-up.
+ */
+void hw_init_fini(hw_init_st *hw) {
+    if (hw == NULL)
+        return;
+    s_hw_init_join(hw);
+    event_free(hw->ready_event);
+    event_queue_fini(hw->queue);
+    free(hw);
+}
+
+/* ==================
+    hw_init function
+   ================== */
+/**
+ * @brief Add a device, before hw_init_start.
+ * @param hw a valid bring-up.
+ * @param name shown in the log, kept as given.
+ * @param bus SCHEDULER_BUS_*, the devices of a bus are probed in order.
+ * @param probe brings the device up, on the thread of its bus.
+ * @param ready called on the event loop once it is up, may be NULL.
+ * @param arg argument of both.
+ * @return 0 on success; ENOSPC with too many devices, EINVAL on a bad bus.
+ */
+int hw_init_add(hw_init_st *hw, const char *name, int bus,
+                hw_init_fn probe, hw_init_fn ready, void *arg) {
+    hw_init_device_st *device;
+
+    if (hw->count == HW_INIT_MAX_DEVICES)
+        return ENOSPC;
+    if (bus < 0 || bus >= SCHEDULER_BUSES || probe == NULL)
+        return EINVAL;
+
+    device = &hw->devices[hw->count++];
+    device->name = name;
+    device->bus = bus;
+    device->probe = probe;
+    device->ready = ready;
+    device->arg = arg;
+    hw->pending++;
+    return 0;
+}
+
+/**
+ * @brief Start probing, returns at once.
+ * @param hw a valid bring-up.
+ * @return 0 on success; errno when a thread could not be created.
+ */
+int hw_init_start(hw_init_st *hw) {
+    int used[SCHEDULER_BUSES] = { 0 };
+    pthread_attr_t attr;
+    int i, err = 0;
+
+    for (i = 0; i < hw->count; ++i)
+        used[hw->devices[i].bus] = 1;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, HW_INIT_STACK_SIZE);
+    for (i = 0; i < SCHEDULER_BUSES && err == 0; ++i) {
+        if (!used[i])
+            continue;
+        err = pthread_create(&hw->buses[i].thread, &attr, s_hw_init_bus_thread,
+                             &hw->buses[i]);
+        if (err == 0)
+            hw->buses[i].started = 1;
+    }
+    pthread_attr_destroy(&attr);
+    return err;
+}
+
+/**
+ * @brief Number of devices not up yet.
+ * @param hw a valid bring-up.
+ */
+int hw_init_pending(hw_init_st *hw) {
+    return hw->pending;
+}
+
+/**
+ * @brief CLOCK_MONOTONIC when the platform was set up, the start of the
+ *        daemon for the logs; 0 before.
+ * @return time in us.
+ */
+uint64_t hw_init_started_us() {
+    return g_started_us;
+}
+
+/* ================
+    inner function
+   ================ */
+static void s_hw_init_platform() {
+    g_started_us = event_queue_now_us();
+    // every driver goes through wiringPi, it is set up here and only here.
+    if (wiringPiSetup() == -1)
+        exit(errno);
+    pin_gpio_setup();
+}
+
+static void *s_hw_init_bus_thread(void *arg) {
+    hw_init_bus_st *bus = arg;
+    hw_init_st *hw = bus->hw;
+    hw_init_device_st *device;
+    char name[TRACING_NAME_SIZE];
+    uint64_t start;
+    int i;
+
+    snprintf(name, sizeof(name), "hw %s", scheduler_bus_name(bus->bus));
+    tracing_name_thread(name);
+    for (i = 0; i < hw->count; ++i) {
+        device = &hw->devices[i];
+        if (device->bus != bus->bus)
+            continue;
+        start = event_queue_now_us();
+        tracing_begin(device->name, "hw");
+        device->probe(device->arg);
+        tracing_end();
+        device->probe_us = event_queue_now_us() - start;
+        event_queue_push(hw->queue, i, 0);
+    }
+    return NULL;
+}
+
+static void s_hw_init_ready_cb(evutil_socket_t fd, short flags, void *arg) {
+    hw_init_st *hw = arg;
+    hw_init_device_st *device;
+    event_queue_item_st item;
+    uint64_t start = g_started_us;
+
+    event_queue_ack(hw->queue);
+    while (event_queue_pop(hw->queue, &item) == 0) {
+        device = &hw->devices[item.type];
+        printf("hw: %s (%s) up in %lu ms, %lu ms after start\n", device->name,
+               scheduler_bus_name(device->bus),
+               (unsigned long)(device->probe_us / USEC_PER_MSEC),
+               start ? (unsigned long)((item.timestamp_us - start) / USEC_PER_MSEC) : 0);
+        if (device->ready != NULL) {
+            loop_lag_enter(device->name);
+            device->ready(device->arg);
+            loop_lag_leave();
+        }
+        if (--hw->pending == 0) {
+            printf("hw: %d devices up\n", hw->count);
+            s_hw_init_join(hw);
+        }
+    }
+}
+
+static void s_hw_init_join(hw_init_st *hw) {
+    int i;
+
+    for (i = 0; i < SCHEDULER_BUSES; ++i) {
+        if (hw->buses[i].started) {
+            pthread_join(hw->buses[i].thread, NULL);
+            hw->buses[i].started = 0;
+        }
+    }
+}
+
+#ifdef XTEST
+
+#include <unistd.h>
+
+#define TEST_PROBE_MS       (100)       /**< Time of one probe */
+
+static pthread_t g_loop_thread;
+static int g_order[HW_INIT_MAX_DEVICES];    /**< Devices in the order up */
+static int g_ready = 0;
+static int g_failed = 0;
+
+static void s_test_probe(void *arg) {
+    g_failed |= pthread_equal(pthread_self(), g_loop_thread);
+    usleep(TEST_PROBE_MS * USEC_PER_MSEC);
+}
+
+static void s_test_ready(void *arg) {
+    g_failed |= !pthread_equal(pthread_self(), g_loop_thread);
+    g_order[g_ready++] = (int)(long)arg;
+}
+
+int main() {
+    struct event_base *base = event_base_new();
+    hw_init_st *hw = hw_init_init(base);
+    uint64_t start, took;
+    int i, lcd = -1, bmp = -1;
+
+    g_loop_thread = pthread_self();
+    // two devices on the I2C bus, one on each of the others.
+    hw_init_add(hw, "lcd", SCHEDULER_BUS_I2C, s_test_probe, s_test_ready, (void *)0);
+    hw_init_add(hw, "bmp180", SCHEDULER_BUS_I2C, s_test_probe, s_test_ready, (void *)1);
+    hw_init_add(hw, "mcp3208", SCHEDULER_BUS_SPI, s_test_probe, s_test_ready, (void *)2);
+    hw_init_add(hw, "dht11", SCHEDULER_BUS_GPIO, s_test_probe, s_test_ready, (void *)3);
+    g_failed |= hw_init_add(hw, "bad", SCHEDULER_BUSES, s_test_probe, NULL, NULL) != EINVAL;
+
+    start = event_queue_now_us();
+    g_failed |= hw_init_start(hw) != 0;
+    while (hw_init_pending(hw) > 0)
+        event_base_loop(base, EVLOOP_ONCE);
+    took = (event_queue_now_us() - start) / USEC_PER_MSEC;
+
+    for (i = 0; i < g_ready; ++i) {
+        if (g_order[i] == 0)
+            lcd = i;
+        if (g_order[i] == 1)
+            bmp = i;
+    }
+    printf("4 probes of %d ms up in %lu ms\n", TEST_PROBE_MS, (unsigned long)took);
+    // the buses in parallel, the devices of one bus in order.
+    g_failed |= g_ready != 4 || lcd < 0 || bmp < lcd;
+    g_failed |= took >= 3 * TEST_PROBE_MS || took < 2 * TEST_PROBE_MS;
+
+    hw_init_fini(hw);
+    event_base_free(base);
+    printf("%s\n", g_failed ? "FAILED" : "SUCCESS!");
+    return g_failed;
+}
+
+#endif
@@ -0,0 +1,88 @@
+/**
+ * @file hw_init.h
+ * @brief hardware bring-up, declaration.
+ *        The platform (wiringPi and the GPIO registers) is set up once, then
+ *        the devices are probed by one thread per bus: the devices of a bus
+ *        one after the other, the buses in parallel. Each device is handed
+ *        back to the event loop as soon as it is up, which keeps serving
+ *        meanwhile, so a slow LCD no longer holds back the web server.
+ * @author Xiangyu Guo
+ */
+#ifndef __HW_INIT_H__
+#define __HW_INIT_H__
+
+#include <stdint.h>
+
+#define HW_INIT_MAX_DEVICES     (16)        /**< Devices of one bring-up */
+
+/**
+ * @brief module structure, hiding the detail to the public
+ */
+typedef struct hw_init hw_init_st;
+struct hw_init;
+struct event_base;
+
+/**
+ * @brief probe or ready call back of a device.
+ * @param arg argument given to hw_init_add.
+ */
+typedef void (*hw_init_fn)(void *arg);
+
+/* ==============================================
+	hw_init initialize and finish function
+   ============================================== */
+/**
+ * @brief Set up the platform, calling it again does nothing.
+ */
+void hw_init_platform();
+
+/**
+ * @brief Initialize a bring-up, the devices are added then started.
+ * @param base event loop the devices are handed back to.
+ * @return a initialized bring-up.
+ */
+hw_init_st *hw_init_init(struct event_base *base);
+
+/**
+ * @brief Clean up, waiting for the probes still running.
+ * @param hw a valid bring-up.
+ */
+void hw_init_fini(hw_init_st *hw);
+
+/* ==================
+    hw_init function
+   ================== */
+/**
+ * @brief Add a device, before hw_init_start.
+ * @param hw a valid bring-up.
+ * @param name shown in the log, kept as given.
+ * @param bus SCHEDULER_BUS_*, the devices of a bus are probed in order.
+ * @param probe brings the device up, on the thread of its bus.
+ * @param ready called on the event loop once it is up, may be NULL.
+ * @param arg argument of both.
+ * @return 0 on success; ENOSPC with too many devices, EINVAL on a bad bus.
+ */
+int hw_init_add(hw_init_st *hw, const char *name, int bus,
+                hw_init_fn probe, hw_init_fn ready, void *arg);
+
+/**
+ * @brief Start probing, returns at once.
+ * @param hw a valid bring-up.
+ * @return 0 on success; errno when a thread could not be created.
+ */
+int hw_init_start(hw_init_st *hw);
+
+/**
+ * @brief Number of devices not up yet.
+ * @param hw a valid bring-up.
+ */
+int hw_init_pending(hw_init_st *hw);
+
+/**
+ * @brief CLOCK_MONOTONIC when the platform was set up, the start of the
+ *        daemon for the logs; 0 before.
+ * @return time in us.
+ */
+uint64_t hw_init_started_us();
+
+#endif
@@ -20,12 +20,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <wiringPiI2C.h>
+#include <wiringPi.h>
 
 #include "i2c_lib.h"
 #include "i2c_bmp180.h"
 #include "i2c_bmp180_macro.h"
 
+#ifdef BENCH
+#include "../bench.h"
+#endif
+
 /** 
  * @brief calibration data, file descriptor, and OSS
  * 
@@ -54,19 +58,19 @@ static int s_get_conversion_time(short OSS);
 static void s_read_calibration_data(int fd, bmp180_module_st *bmp180);
 static long s_read_raw_temperature(bmp180_module_st *bmp180);
 static long s_read_raw_pressure(bmp180_module_st *bmp180);
+static void s_compensate(const bmp180_module_st *bmp180, long UT, long UP,
+                         bmp180_data_st *data);
 
 /**
- * @brief Calculate true values from uncompensated values.
+ * @brief Read the uncompensated values and calculate the true values.
  * @param bmp180 [in] a initialized module
  * @param data [out] a valid data struct needs to be filled.
  * @return 0 on success; otherwise an errno will be return.
  * @note See Figure 4 in the datasheet for reference.
  */
 int bmp180_read_data(bmp180_module_st *bmp180, bmp180_data_st *data) {
-    long UT, UP, temp;
-    long X1, X2, X3, B3, B5, B6, p;
-    unsigned long B4, B7;
-    
+    long UT, UP;
+
     // check parameters, invalid address will return EFAULT(14) bad address.
     if (bmp180 == NULL || data == NULL)
         return EFAULT;
@@ -76,35 +80,7 @@ int bmp180_read_data(bmp180_module_st *bmp180, bmp180_data_st *data) {
     // read uncompensated pressure
     UP = s_read_raw_pressure(bmp180);
 
-    // calculate true temperature value
-    X1 = ((UT - bmp180->A6) * bmp180->A5) >> SHIFT_15BITS;
-    X2 = (bmp180->MC << SHIFT_11BITS) / (X1 + bmp180->MD);
-    B5 = X1 + X2;
-    temp = (B5 + BMP180_CALCULATE_TRUE_T) >> SHIFT_04BITS;
-    data->temperature = (double)temp/BASE_OF_TEN;
-
-    // calculate true pressure value
-    B6 = B5 - 4000;
-    X1 = (bmp180->B2 * ((B6 * B6) >> SHIFT_12BITS)) >> SHIFT_11BITS;
-    X2 = (bmp180->A2 * B6) >> SHIFT_11BITS;
-    X3 = X1 + X2;
-    B3 = ((((bmp180->A1 << SHIFT_02BITS)+X3) << bmp180->OSS) + 2) >> SHIFT_02BITS;
-    X1 = (bmp180->A3 * B6) >> SHIFT_13BITS;
-    X2 = (bmp180->B1 * (B6 * B6 >> SHIFT_12BITS)) >> SHIFT_16BITS;
-    X3 = ((X1 + X2) + 2) >> SHIFT_02BITS;
-    B4 = (bmp180->A4 * (unsigned long)(X3 + (1 << SHIFT_15BITS))) >> SHIFT_15BITS;
-    B7 = ((unsigned long)UP - B3) * (50000 >> bmp180->OSS);
-    p = B7 < OVERFLOW_BIT ? (B7 << SHIFT_01BITS) / B4 : (B7 / B4) << SHIFT_01BITS;
-
-    X1 = (p >> SHIFT_08BITS) * (p >> SHIFT_08BITS);
-    X1 = (X1 * BMP180_PARAM_MG) >> SHIFT_16BITS;
-    X2 = (BMP180_PARAM_MH * p) >> SHIFT_16BITS;
-    data->pressure = p + ((X1 + X2 + BMP180_PARAM_MI) >> SHIFT_04BITS);
-
-    // convert pressure to altitude
-    data->altitude = PRESSURE_TO_ALTITUDE_CONSTANT * 
-                        (1.0 - pow(((double)data->pressure/STANDARD_PRESSURE), 
-                                    PRESSURE_TO_ALTITUDE_INDEX));
+    s_compensate(bmp180, UT, UP, data);
     return 0;
 }
 
@@ -120,8 +96,7 @@ bmp180_module_st *bmp180_module_init(short OSS) {
     if (OSS < BMP180_ULTRA_LOW_POWER || OSS > BMP180_ULTRA_HIGH_RESOLUTION)
         OSS = BMP180_ULTRA_LOW_POWER;
 
-    if ((fd = wiringPiI2CSetup(DEVICE_ADDRESS)) < 0)
-        exit(errno);
+    fd = i2c_setup(DEVICE_ADDRESS);
 
     bmp180_module_st *bmp180 = (bmp180_module_st *)malloc(sizeof(bmp180_module_st));
     if (bmp180 == NULL)
@@ -196,7 +171,7 @@ static long s_read_raw_temperature(bmp180_module_st *bmp180) {
     long UT;
     // read uncompensated temperature value.
     i2c_write_8bits(bmp180->fd, BMP180_CTRL_MSG_REG, BMP180_READ_TEMPERATURE);    
-    usleep(OVERSAMPLING_TIME_0);
+    delayMicroseconds(OVERSAMPLING_TIME_0);
     MSB = i2c_read_8bits(bmp180->fd, BMP180_ADC_OUT_MSB_REG);
     LSB = i2c_read_8bits(bmp180->fd, BMP180_ADC_OUT_LSB_REG);
     UT = (MSB << SHIFT_08BITS) + LSB;
@@ -216,7 +191,7 @@ static long s_read_raw_pressure(bmp180_module_st *bmp180) {
     timing = s_get_conversion_time(bmp180->OSS);
     i2c_write_8bits(bmp180->fd, BMP180_CTRL_MSG_REG, 
                     BMP180_READ_PRESSURE + (bmp180->OSS << SHIFT_06BITS));
-    usleep(timing);
+    delayMicroseconds(timing);
     MSB  = i2c_read_8bits(bmp180->fd, BMP180_ADC_OUT_MSB_REG);
     LSB  = i2c_read_8bits(bmp180->fd, BMP180_ADC_OUT_LSB_REG);
     XLSB = i2c_read_8bits(bmp180->fd, BMP180_ADC_OUT_XLSB_REG);
@@ -225,21 +200,128 @@ static long s_read_raw_pressure(bmp180_module_st *bmp180) {
     return UP;
 }
 
+/**
+ * @brief Calculate true values from uncompensated values.
+ * @param bmp180 [in] module holding the calibration data.
+ * @param UT uncompensated temperature.
+ * @param UP uncompensated pressure.
+ * @param data [out] true temperature, pressure and altitude.
+ * @note See Figure 4 in the datasheet for reference.
+ */
+static void s_compensate(const bmp180_module_st *bmp180, long UT, long UP,
+                         bmp180_data_st *data) {
+    long X1, X2, X3, B3, B5, B6, p, temp;
+    unsigned long B4, B7;
+
+    // calculate true temperature value
+    X1 = ((UT - bmp180->A6) * bmp180->A5) >> SHIFT_15BITS;
+    X2 = (bmp180->MC << SHIFT_11BITS) / (X1 + bmp180->MD);
+    B5 = X1 + X2;
+    temp = (B5 + BMP180_CALCULATE_TRUE_T) >> SHIFT_04BITS;
+    data->temperature = (double)temp/BASE_OF_TEN;
+
+    // calculate true pressure value
+    B6 = B5 - 4000;
+    X1 = (bmp180->B2 * ((B6 * B6) >> SHIFT_12BITS)) >> SHIFT_11BITS;
+    X2 = (bmp180->A2 * B6) >> SHIFT_11BITS;
+    X3 = X1 + X2;
+    B3 = ((((bmp180->A1 << SHIFT_02BITS)+X3) << bmp180->OSS) + 2) >> SHIFT_02BITS;
+    X1 = (bmp180->A3 * B6) >> SHIFT_13BITS;
+    X2 = (bmp180->B1 * (B6 * B6 >> SHIFT_12BITS)) >> SHIFT_16BITS;
+    X3 = ((X1 + X2) + 2) >> SHIFT_02BITS;
+    B4 = (bmp180->A4 * (unsigned long)(X3 + (1 << SHIFT_15BITS))) >> SHIFT_15BITS;
+    B7 = ((unsigned long)UP - B3) * (50000 >> bmp180->OSS);
+    p = B7 < OVERFLOW_BIT ? (B7 << SHIFT_01BITS) / B4 : (B7 / B4) << SHIFT_01BITS;
+
+    X1 = (p >> SHIFT_08BITS) * (p >> SHIFT_08BITS);
+    X1 = (X1 * BMP180_PARAM_MG) >> SHIFT_16BITS;
+    X2 = (BMP180_PARAM_MH * p) >> SHIFT_16BITS;
+    data->pressure = p + ((X1 + X2 + BMP180_PARAM_MI) >> SHIFT_04BITS);
+
+    // convert pressure to altitude
+    data->altitude = PRESSURE_TO_ALTITUDE_CONSTANT * 
+                        (1.0 - pow(((double)data->pressure/STANDARD_PRESSURE), 
+                                    PRESSURE_TO_ALTITUDE_INDEX));
+}
+
 #ifdef XTEST
 
+#ifdef SIM
+#include "../sim/sim.h"
+
+#define BUDGET_INIT         (22)        /**< One access per calibration byte */
+#define BUDGET_READ         (7)         /**< 2 commands, 2 + 3 result bytes */
+#endif
+
 int main() {
-    bmp180_data_st value;
+    bmp180_data_st value = { 0 };
+    int failed = 0;
+#ifdef SIM
+    bmp180_module_st *bmp180;
+    sim_usage_st mark;
+
+    // the calibration is read once, a read must not come back for it.
+    sim_usage_mark(&mark);
+#endif
     bmp180_module_st *test_bmp180 = bmp180_module_init(0);
-    if (bmp180_read_data(test_bmp180, &value) == 0) {
-        printf("SUCCESS!\n");
-        printf("Temperature: %.2f\nAltitude: %.2f\nPressure: %.2f\n",
-            value.temperature, value.altitude, value.pressure);
-    } else {
-        printf("FAILED\n");
-    }
+#ifdef SIM
+    failed |= sim_usage_check("bmp180 init", &mark, SIM_BUS_I2C, BUDGET_INIT, 0);
+#endif
+
+    failed |= bmp180_read_data(test_bmp180, &value) != 0;
+#ifdef SIM
+    // the simulated sensor answers with the example of the datasheet.
+    failed |= value.temperature != 15.0 || value.pressure != 69964;
+
+    sim_usage_mark(&mark);
+    bmp180_read_data(test_bmp180, &value);
+    failed |= sim_usage_check("bmp180 read oss 0", &mark, SIM_BUS_I2C, BUDGET_READ,
+                              OVERSAMPLING_TIME_0 + OVERSAMPLING_TIME_0);
+
+    bmp180 = bmp180_module_init(BMP180_ULTRA_HIGH_RESOLUTION);
+    sim_usage_mark(&mark);
+    bmp180_read_data(bmp180, &value);
+    failed |= sim_usage_check("bmp180 read oss 3", &mark, SIM_BUS_I2C, BUDGET_READ,
+                              OVERSAMPLING_TIME_0 + OVERSAMPLING_TIME_3);
+    bmp180_module_fini(bmp180);
+#endif
+    printf("%s\n", failed ? "FAILED" : "SUCCESS!");
+    printf("Temperature: %.2f\nAltitude: %.2f\nPressure: %.2f\n",
+        value.temperature, value.altitude, value.pressure);
 
     bmp180_module_fini(test_bmp180);
 
+    return failed;
+}
+
+#endif
+
+#ifdef BENCH
+
+/**
+ * @brief the calibration and readings of the datasheet example.
+ */
+static const bmp180_module_st g_bench_bmp180 = {
+    -1, 408, -72, -14383, 32741, 32757, 23153, 6190, 4, -32768, -8711, 2868, 0
+};
+
+#define BENCH_UT            (27898)     /**< Datasheet uncompensated temperature */
+#define BENCH_UP            (23843)     /**< Datasheet uncompensated pressure */
+
+/**
+ * @brief temperature, pressure and altitude from one reading.
+ */
+static void s_bench_compensate(void *arg, long n) {
+    bmp180_data_st data;
+
+    while (n-- > 0) {
+        s_compensate(&g_bench_bmp180, BENCH_UT, BENCH_UP + (n & 7), &data);
+        bench_keep(&data);
+    }
+}
+
+int main() {
+    bench_run("bmp180", "compensate", s_bench_compensate, NULL, NULL);
     return 0;
 }
 
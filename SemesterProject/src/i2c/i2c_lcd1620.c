@@ -11,22 +11,51 @@
 #include <string.h>
 #include <unistd.h>
 #include <wiringPi.h>
-#include <wiringPiI2C.h>
 
 #include "i2c_lib.h"
 #include "i2c_lcd1620.h"
 #include "i2c_lcd1620_macro.h"
+#include "../tracing.h"
+#include "../probes.h"
+
+#ifdef BENCH
+#include "../bench.h"
+#endif
+
+#define LCD1620_LINES       (2)         /**< Lines on the display */
+#define LCD1620_LINE_OFFSET (0x40)      /**< DDRAM address of the second line */
+#define LCD1620_BLANK       (' ')       /**< Character of an empty cell */
+#define LCD1620_NIBBLE_BYTES (2)        /**< PCF8574 writes per nibble, En high and low */
+#define LCD1620_BYTE_WRITES (2 * LCD1620_NIBBLE_BYTES)  /**< PCF8574 writes per byte */
+#define LCD1620_STREAM_BYTES (LCD1620_BYTE_WRITES * LCD1620_LINES * \
+                              LCD1620_CHARS_PER_LINE * 2) /**< A full frame with moves */
 
 struct lcd1620_module
 {
     int fd;
+    int cursor;                                         /**< DDRAM address counter */
+    int streamed;                                       /**< Bytes waiting in stream */
+    int wait_us;                                        /**< Execution time of the last one */
+    unsigned char stream[LCD1620_STREAM_BYTES];         /**< PCF8574 output, in order */
+    char frame[LCD1620_LINES][LCD1620_CHARS_PER_LINE];  /**< Next frame */
+    char glass[LCD1620_LINES][LCD1620_CHARS_PER_LINE];  /**< What is on the glass */
 };
 
 /**
- * @brief write one word to the device
+ * @brief queue one byte as two enable-strobed nibbles, nothing is sent.
+ *        Clear and home are committed right away, to wait for them.
  * @param data the data going to send out.
+ * @param rs indicate it's data(1) or command(0)
  */
-static void s_lcd1620_write_word(lcd1620_module_st *lcd1620, int data);
+static void s_lcd1620_queue_data(lcd1620_module_st *lcd1620, int data, int rs);
+
+/**
+ * @brief send the queued stream in one i2c write, then wait for the
+ *        execution time of the last byte.
+ * @note  at 100 kHz each PCF8574 write takes about 90us, so the 37us an
+ *        instruction needs is already over before the next nibble lands.
+ */
+static void s_lcd1620_commit(lcd1620_module_st *lcd1620);
 
 /**
  * @brief send data to the device
@@ -35,6 +64,18 @@ static void s_lcd1620_write_word(lcd1620_module_st *lcd1620, int data);
  */
 static void s_lcd1620_send_data(lcd1620_module_st *lcd1620, int data, int rs);
 
+/**
+ * @brief send the upper nibble only, used while initializing in 8 bits mode.
+ * @param data the nibble in bits 4-7.
+ */
+static void s_lcd1620_send_nibble(lcd1620_module_st *lcd1620, int data);
+
+/**
+ * @brief reset both frames to blank, after the display itself was cleared.
+ * @param lcd1620 a valid module
+ */
+static void s_lcd1620_reset_frames(lcd1620_module_st *lcd1620);
+
 /* =================
     device function 
    ================= */
@@ -43,32 +84,92 @@ static void s_lcd1620_send_data(lcd1620_module_st *lcd1620, int data, int rs);
  * @param lcd1620 a valid module
  */
 void lcd1620_module_clear(lcd1620_module_st *lcd1620) {
-    i2c_write(lcd1620->fd, LCD_CLEARDISPLAY);
-    i2c_write(lcd1620->fd, LCD_RETURNHOME);
     s_lcd1620_send_data(lcd1620, LCD_CLEARDISPLAY, 0);
+    s_lcd1620_reset_frames(lcd1620);
 }
 
 /**
- * @brief write strinng to the screen
+ * @brief draw string into the next frame, nothing is sent.
  * @param lcd1620 a valid module
  * @param x column number
  * @param y line number
- * @param string the string going to output.
+ * @param str the string going to output.
  * @param length the length of the output string.
- * @return the length successfully write to the display.
+ * @return the length drawn into the frame.
  */
-int lcd1620_module_write_string(lcd1620_module_st *lcd1620, 
-                                int x, int y, char *str, int length) {
-    int addr, i = 0;
+int lcd1620_module_draw_string(lcd1620_module_st *lcd1620,
+                               int x, int y, const char *str, int length) {
+    int i;
     x = x & 15;
     y = y & 1;
 
-    addr = LCD_SETDDRAMADDR + LCD_SETCGRAMADDR * y + x;
-    s_lcd1620_send_data(lcd1620, addr, 0);
+    for (i = 0; i < length && x + i < LCD1620_CHARS_PER_LINE; ++i)
+        lcd1620->frame[y][x + i] = str[i];
+    return i;
+}
+
+/**
+ * @brief draw a whole line into the next frame, blanking the rest of it.
+ * @param lcd1620 a valid module
+ * @param y line number
+ * @param str null terminated string going to output.
+ */
+void lcd1620_module_draw_line(lcd1620_module_st *lcd1620, int y, const char *str) {
+    int length = lcd1620_module_draw_string(lcd1620, 0, y, str, strlen(str));
 
-    for (i = 0; i < length && i <= 15; ++i) {
-        s_lcd1620_send_data(lcd1620, (int)str[i], Rs);
+    memset(&lcd1620->frame[y & 1][length], LCD1620_BLANK,
+           LCD1620_CHARS_PER_LINE - length);
+}
+
+/**
+ * @brief send the cells that differ between the next frame and the glass.
+ * @param lcd1620 a valid module
+ * @return the number of bytes sent, address moves and characters.
+ * @note  the DDRAM address counter increments after every character, so
+ *        an address move is only sent when a changed cell doesn't follow
+ *        the last one written. Bridging a gap instead costs one character
+ *        per skipped cell, never less than the single move.
+ *        The whole frame goes out in one i2c write.
+ */
+int lcd1620_module_flush(lcd1620_module_st *lcd1620) {
+    int x, y, addr, sent = 0;
+
+    tracing_begin("lcd1620_module_flush", "lcd");
+    for (y = 0; y < LCD1620_LINES; ++y) {
+        for (x = 0; x < LCD1620_CHARS_PER_LINE; ++x) {
+            if (lcd1620->frame[y][x] == lcd1620->glass[y][x])
+                continue;
+
+            addr = LCD1620_LINE_OFFSET * y + x;
+            if (lcd1620->cursor != addr) {
+                s_lcd1620_queue_data(lcd1620, LCD_SETDDRAMADDR | addr, 0);
+                sent++;
+            }
+            s_lcd1620_queue_data(lcd1620, lcd1620->frame[y][x], Rs);
+            lcd1620->glass[y][x] = lcd1620->frame[y][x];
+            lcd1620->cursor = addr + 1;
+            sent++;
+        }
     }
+    s_lcd1620_commit(lcd1620);
+    tracing_end();
+    return sent;
+}
+
+/**
+ * @brief write strinng to the screen, only changed cells are sent.
+ * @param lcd1620 a valid module
+ * @param x column number
+ * @param y line number
+ * @param string the string going to output.
+ * @param length the length of the output string.
+ * @return the length successfully write to the display.
+ */
+int lcd1620_module_write_string(lcd1620_module_st *lcd1620, 
+                                int x, int y, char *str, int length) {
+    int i = lcd1620_module_draw_string(lcd1620, x, y, str, length);
+
+    lcd1620_module_flush(lcd1620);
     return i;
 }
 
@@ -80,25 +181,31 @@ int lcd1620_module_write_string(lcd1620_module_st *lcd1620,
  * @return a valid module
  */
 lcd1620_module_st *lcd1620_module_init() {
-    int fd;
-
-    if ((fd = wiringPiI2CSetup(LCD_ADDRESS)) < 0)
-        exit(errno);
+    int fd = i2c_setup(LCD_ADDRESS);
 
     lcd1620_module_st *lcd1620 = (lcd1620_module_st *)malloc(sizeof(lcd1620_module_st));
     if (lcd1620 == NULL)
         exit(ENOMEM);
 
     lcd1620->fd = fd;
+    lcd1620->streamed = 0;
+    lcd1620->wait_us = 0;
 
-    s_lcd1620_send_data(lcd1620, 0x33, 0);
-    s_lcd1620_send_data(lcd1620, 0x32, 0);
-    s_lcd1620_send_data(lcd1620, LCD_FUNCTIONSET | LCD_2LINE | LCD_5x8DOTS | LCD_4BITMODE, 0);
-    s_lcd1620_send_data(lcd1620, LCD_DISPLAYCONTROL | LCD_DISPLAYON, 0);
-    s_lcd1620_send_data(lcd1620, LCD_CLEARDISPLAY, 0);
-    //i2c_write(fd, 0x08);
+    // initializing by instruction, the interface starts in 8 bits mode.
+    delay(LCD_POWER_ON_MS);
+    s_lcd1620_send_nibble(lcd1620, LCD_FUNCTIONSET | LCD_8BITMODE);
+    delayMicroseconds(LCD_INIT_WAIT_1_US);
+    s_lcd1620_send_nibble(lcd1620, LCD_FUNCTIONSET | LCD_8BITMODE);
+    delayMicroseconds(LCD_INIT_WAIT_2_US);
+    s_lcd1620_send_nibble(lcd1620, LCD_FUNCTIONSET | LCD_8BITMODE);
+    s_lcd1620_send_nibble(lcd1620, LCD_FUNCTIONSET | LCD_4BITMODE);
+
+    s_lcd1620_queue_data(lcd1620, LCD_FUNCTIONSET | LCD_2LINE | LCD_5x8DOTS | LCD_4BITMODE, 0);
+    s_lcd1620_queue_data(lcd1620, LCD_DISPLAYCONTROL | LCD_DISPLAYON, 0);
+    s_lcd1620_queue_data(lcd1620, LCD_ENTRYMODESET | LCD_ENTRYLEFT, 0);
+    s_lcd1620_queue_data(lcd1620, LCD_CLEARDISPLAY, 0);
 
-    delay(200);
+    s_lcd1620_reset_frames(lcd1620);
 
     return lcd1620;
 }
@@ -114,35 +221,217 @@ void lcd1620_module_fini(lcd1620_module_st *lcd1620) {
     }
 }
 
-static void s_lcd1620_write_word(lcd1620_module_st *lcd1620, int data) {
-    data |= LCD_BACKLIGHT;
-    i2c_write(lcd1620->fd, data);
+static void s_lcd1620_queue_data(lcd1620_module_st *lcd1620, int data, int rs) {
+    unsigned char *buf;
+    int high, low;
+
+    if (lcd1620->streamed + LCD1620_BYTE_WRITES > LCD1620_STREAM_BYTES)
+        s_lcd1620_commit(lcd1620);
+
+    high = (data & 0xF0) | rs | LCD_BACKLIGHT;
+    low = ((data & 0x0F) << 4) | rs | LCD_BACKLIGHT;
+
+    // data is latched on the falling edge of En.
+    buf = lcd1620->stream + lcd1620->streamed;
+    buf[0] = high | En;
+    buf[1] = high;
+    buf[2] = low | En;
+    buf[3] = low;
+    lcd1620->streamed += LCD1620_BYTE_WRITES;
+
+    if (rs == 0 && (data == LCD_CLEARDISPLAY || (data & ~1) == LCD_RETURNHOME)) {
+        lcd1620->wait_us = LCD_EXEC_TIME_LONG_US;
+        s_lcd1620_commit(lcd1620);
+    } else {
+        lcd1620->wait_us = rs ? LCD_EXEC_TIME_DATA_US : LCD_EXEC_TIME_US;
+    }
+}
+
+static void s_lcd1620_commit(lcd1620_module_st *lcd1620) {
+    if (lcd1620->streamed == 0)
+        return;
+
+    PROBE1(lcd_commit_start, lcd1620->streamed);
+    i2c_write_block(lcd1620->fd, lcd1620->stream, lcd1620->streamed);
+    delayMicroseconds(lcd1620->wait_us);
+    PROBE0(lcd_commit_done);
+
+    lcd1620->streamed = 0;
+    lcd1620->wait_us = 0;
 }
 
 static void s_lcd1620_send_data(lcd1620_module_st *lcd1620, int data, int rs) {
-    int buf;
+    PROBE2(lcd_send_start, data, rs);
+    s_lcd1620_queue_data(lcd1620, data, rs);
+    s_lcd1620_commit(lcd1620);
+    PROBE0(lcd_send_done);
+}
 
-    buf = data & 0xF0;
-    buf |= En | rs;
-    s_lcd1620_write_word(lcd1620, buf);
-    delay(2);
-    buf &= (~En);
-    s_lcd1620_write_word(lcd1620, buf);
+static void s_lcd1620_send_nibble(lcd1620_module_st *lcd1620, int data) {
+    unsigned char buf[LCD1620_NIBBLE_BYTES];
 
-    buf = (data & 0x0F) << 4;
-    buf |= En | rs;
-    s_lcd1620_write_word(lcd1620, buf);
-    delay(2);
-    buf &= (~En);
-    s_lcd1620_write_word(lcd1620, buf);
+    buf[0] = (data & 0xF0) | En | LCD_BACKLIGHT;
+    buf[1] = (data & 0xF0) | LCD_BACKLIGHT;
+    i2c_write_block(lcd1620->fd, buf, LCD1620_NIBBLE_BYTES);
+    delayMicroseconds(LCD_EXEC_TIME_US);
+}
+
+static void s_lcd1620_reset_frames(lcd1620_module_st *lcd1620) {
+    memset(lcd1620->frame, LCD1620_BLANK, sizeof(lcd1620->frame));
+    memset(lcd1620->glass, LCD1620_BLANK, sizeof(lcd1620->glass));
+    lcd1620->cursor = 0;
 }
 
 #ifdef XTEST
 
+#ifdef SIM
+#include "../sim/sim.h"
+
+#define BUDGET_FRAME        (1)         /**< A frame is one i2c write */
+#endif
+
 int main() {
+    int failed = 0;
+#ifdef SIM
+    char line[SIM_LCD_COLUMNS + 1];
+    sim_usage_st mark;
+#endif
     lcd1620_module_st *lcd1620 = lcd1620_module_init();
     lcd1620_module_write_string(lcd1620, 0, 0, "Hello:", strlen("Hello:"));
     lcd1620_module_write_string(lcd1620, 3, 1, "World!", strlen("World!"));
+
+    lcd1620_module_draw_line(lcd1620, 0, "Time:12:34:56");
+    lcd1620_module_draw_line(lcd1620, 1, "Date:10/18/2026");
+    printf("Full frame: %d bytes\n", lcd1620_module_flush(lcd1620));
+#ifdef SIM
+    sim_usage_mark(&mark);
+#endif
+    lcd1620_module_draw_line(lcd1620, 0, "Time:12:34:57");
+    lcd1620_module_draw_line(lcd1620, 1, "Date:10/18/2026");
+    printf("Clock tick: %d bytes\n", lcd1620_module_flush(lcd1620));
+#ifdef SIM
+    // the last byte written is waited for once, not every byte.
+    failed |= sim_usage_check("lcd1620 clock tick", &mark, SIM_BUS_I2C,
+                              BUDGET_FRAME, LCD_EXEC_TIME_DATA_US);
+    sim_usage_mark(&mark);
+    lcd1620_module_flush(lcd1620);
+    failed |= sim_usage_check("lcd1620 same frame", &mark, SIM_BUS_I2C, 0, 0);
+
+    // the simulated display decodes the nibbles, the glass must match.
+    sim_lcd_line(0, line);
+    printf("Line 0: [%s]\n", line);
+    failed |= strcmp(line, "Time:12:34:57   ") != 0;
+    sim_lcd_line(1, line);
+    printf("Line 1: [%s]\n", line);
+    failed |= strcmp(line, "Date:10/18/2026 ") != 0;
+
+    sim_usage_mark(&mark);
+    lcd1620_module_draw_line(lcd1620, 0, "Temperature:");
+    lcd1620_module_draw_line(lcd1620, 1, "23.40 *C");
+    lcd1620_module_flush(lcd1620);
+    failed |= sim_usage_check("lcd1620 page change", &mark, SIM_BUS_I2C,
+                              BUDGET_FRAME, LCD_EXEC_TIME_DATA_US);
+    printf("%s\n", failed ? "FAILED" : "SUCCESS!");
+#endif
+    lcd1620_module_fini(lcd1620);
+    return failed;
+}
+
+#endif
+
+#ifdef BENCH
+
+#define BENCH_FRAMES        (100)       /**< Frames per measurement */
+#define BENCH_BUS_HZ        (100000)    /**< Standard mode i2c clock */
+#define BENCH_BITS_PER_BYTE (9)         /**< 8 bits and the ack */
+
+static long g_bench_bytes = 0;          /**< bytes written to the fake bus */
+static long g_bench_writes = 0;         /**< transactions on the fake bus */
+
+static const char *g_bench_clock[2][LCD1620_LINES] = {
+    {"Time:12:34:56", "Date:10/18/2026"}, {"Time:12:34:57", "Date:10/18/2026"}};
+static const char *g_bench_pages[2][LCD1620_LINES] = {
+    {"Time:12:34:56", "Date:10/18/2026"}, {"Temperature:", "23.40 *C"}};
+
+static int s_bench_setup(int address) { return dup(STDOUT_FILENO); }
+static int s_bench_read(int fd) { return 0; }
+static int s_bench_write(int fd, int value) {
+    g_bench_bytes++; g_bench_writes++; return 0;
+}
+static int s_bench_read_8bits(int fd, int reg) { return 0; }
+static int s_bench_write_8bits(int fd, int reg, int value) {
+    g_bench_bytes += 2; g_bench_writes++; return 0;
+}
+static int s_bench_write_block(int fd, const unsigned char *buf, int len) {
+    g_bench_bytes += len; g_bench_writes++; return 0;
+}
+
+static const i2c_adapter_st g_bench_adapter = {
+    s_bench_setup, s_bench_read, s_bench_write,
+    s_bench_read_8bits, s_bench_write_8bits, s_bench_write_block
+};
+
+/**
+ * @brief Alternate two frames on the fake bus, report the cost of one frame.
+ * @param frames two frames of two lines each.
+ */
+static void s_bench_frames(lcd1620_module_st *lcd1620, const char *name,
+                           const char *frames[2][LCD1620_LINES]) {
+    struct timespec start, end;
+    double wall_us, bus_us;
+    int i;
+
+    g_bench_bytes = g_bench_writes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < BENCH_FRAMES; ++i) {
+        lcd1620_module_draw_line(lcd1620, 0, frames[i & 1][0]);
+        lcd1620_module_draw_line(lcd1620, 1, frames[i & 1][1]);
+        lcd1620_module_flush(lcd1620);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    wall_us = ((end.tv_sec - start.tv_sec) * 1e6 +
+               (end.tv_nsec - start.tv_nsec) / 1e3) / BENCH_FRAMES;
+    // one address byte per transaction on top of the payload.
+    bus_us = (double)(g_bench_bytes + g_bench_writes) * BENCH_BITS_PER_BYTE *
+             1e6 / BENCH_BUS_HZ / BENCH_FRAMES;
+    printf("%-12s %10.1f %10.1f %12.1f %12.1f\n", name,
+            (double)g_bench_bytes / BENCH_FRAMES,
+            (double)g_bench_writes / BENCH_FRAMES, wall_us, bus_us);
+}
+
+/**
+ * @brief nibbles of a cursor move and one line of text, bus left out.
+ */
+static void s_bench_encode(void *arg, long n) {
+    lcd1620_module_st *lcd1620 = (lcd1620_module_st *)arg;
+    const char *text = g_bench_clock[0][1];
+    int i;
+
+    while (n-- > 0) {
+        lcd1620->streamed = 0;
+        s_lcd1620_queue_data(lcd1620, LCD_SETDDRAMADDR | LCD1620_LINE_OFFSET, 0);
+        for (i = 0; text[i] != '\0'; ++i)
+            s_lcd1620_queue_data(lcd1620, text[i], Rs);
+        bench_keep(lcd1620->stream);
+    }
+    lcd1620->streamed = 0;
+}
+
+int main() {
+    lcd1620_module_st *lcd1620;
+
+    i2c_set_adapter(&g_bench_adapter);
+    lcd1620 = lcd1620_module_init();
+
+    bench_run("lcd1620", "encode line", s_bench_encode, lcd1620, NULL);
+    printf("\n");
+
+    printf("%-12s %10s %10s %12s %12s\n", "frame", "bytes", "writes",
+            "wall us", "bus us");
+    s_bench_frames(lcd1620, "clock tick", g_bench_clock);
+    s_bench_frames(lcd1620, "page change", g_bench_pages);
+
     lcd1620_module_fini(lcd1620);
     return 0;
 }
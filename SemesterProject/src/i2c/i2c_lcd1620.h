@@ -33,7 +33,7 @@ void lcd1620_module_fini(lcd1620_module_st *lcd1620);
     device function 
    ================= */
 /**
- * @brief write strinng to the screen
+ * @brief write strinng to the screen, only changed cells are sent.
  * @param lcd1620 a valid module
  * @param x column number
  * @param y line number
@@ -44,6 +44,33 @@ void lcd1620_module_fini(lcd1620_module_st *lcd1620);
 int lcd1620_module_write_string(lcd1620_module_st *lcd1620,
 						int x, int y, char *string, int length);
 
+/**
+ * @brief draw string into the next frame, nothing is sent.
+ * @param lcd1620 a valid module
+ * @param x column number
+ * @param y line number
+ * @param str the string going to output.
+ * @param length the length of the output string.
+ * @return the length drawn into the frame.
+ */
+int lcd1620_module_draw_string(lcd1620_module_st *lcd1620,
+						int x, int y, const char *str, int length);
+
+/**
+ * @brief draw a whole line into the next frame, blanking the rest of it.
+ * @param lcd1620 a valid module
+ * @param y line number
+ * @param str null terminated string going to output.
+ */
+void lcd1620_module_draw_line(lcd1620_module_st *lcd1620, int y, const char *str);
+
+/**
+ * @brief send the cells that differ between the next frame and the glass.
+ * @param lcd1620 a valid module
+ * @return the number of bytes sent, address moves and characters.
+ */
+int lcd1620_module_flush(lcd1620_module_st *lcd1620);
+
 /**
  * @brief clear the display
  * @param lcd1620 a valid module
@@ -50,6 +50,16 @@
 #define LCD_BACKLIGHT   (0x08)
 #define LCD_NOBACKLIGHT (0x00)
 
+// execution times, HD44780U datasheet Table 6 (fosc = 270 kHz)
+#define LCD_EXEC_TIME_US        (37)    // most instructions
+#define LCD_EXEC_TIME_DATA_US   (41)    // write data to RAM, 37 + tADD 4
+#define LCD_EXEC_TIME_LONG_US   (1520)  // clear display and return home
+
+// initializing by instruction, HD44780U datasheet Figure 24
+#define LCD_POWER_ON_MS         (40)    // after Vcc rises to 2.7 V
+#define LCD_INIT_WAIT_1_US      (4100)  // after the first function set
+#define LCD_INIT_WAIT_2_US      (100)   // after the second function set
+
 #define En (0x04) // Enable bit
 #define Rw (0x02) // Read/Write bit
 #define Rs (0x01) // Register select bit
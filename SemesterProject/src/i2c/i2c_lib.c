@@ -11,6 +11,70 @@
 #include <wiringPiI2C.h>
 
 #include "i2c_lib.h"
+#include "../bus_trace.h"
+#include "../tracing.h"
+#include "../probes.h"
+
+#ifdef SIM
+#include "../sim/sim.h"
+#define I2C_WRITE(fd, buf, len)     sim_i2c_write(fd, buf, len)
+#else
+#define I2C_WRITE(fd, buf, len)     write(fd, buf, len)
+#endif
+
+/**
+ * @brief Write several bytes with one write(2) on the i2c-dev device,
+ *        the kernel sends them in a single transaction.
+ */
+static int s_i2c_write_block(int fd, const unsigned char *buf, int len) {
+    return I2C_WRITE(fd, buf, len) == len ? 0 : -1;
+}
+
+static const i2c_adapter_st g_wiringpi_adapter = {
+    .setup = wiringPiI2CSetup,
+    .read = wiringPiI2CRead,
+    .write = wiringPiI2CWrite,
+    .read_8bits = wiringPiI2CReadReg8,
+    .write_8bits = wiringPiI2CWriteReg8,
+    .write_block = s_i2c_write_block,
+};
+
+static const i2c_adapter_st *g_adapter = &g_wiringpi_adapter; /**< bus operations */
+
+/**
+ * @brief Replace the bus operations, for tests and benchmarks.
+ * @param adapter the new operations, NULL restores wiringPi.
+ */
+void i2c_set_adapter(const i2c_adapter_st *adapter) {
+    g_adapter = adapter != NULL ? adapter : &g_wiringpi_adapter;
+}
+
+/**
+ * @brief Open the i2c device on the given address.
+ * @param address 7 bits device address.
+ * @return fd file descriptor to the device.
+ * @note  exit with an error number when the device can't be opened.
+ */
+int i2c_setup(int address) {
+    uint64_t start;
+    int fd;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY)
+        return bus_trace_replay(BUS_TRACE_I2C_SETUP, address, address, NULL, 0);
+
+    tracing_begin("i2c_setup", "i2c");
+    start = bus_trace_start();
+    if ((fd = g_adapter->setup(address)) < 0) {
+        printf("Setup Failed: %s\n", strerror(errno));
+        exit(errno);
+    }
+    if (start != 0) {
+        bus_trace_bind(fd, address);
+        bus_trace_record(start, BUS_TRACE_I2C_SETUP, address, address, fd, NULL, 0);
+    }
+    tracing_end();
+    return fd;
+}
 
 /**
  * @brief Write value to a 8bits register in i2c device 
@@ -22,10 +86,49 @@
  *        otherwise non-zero means fail.
  */
 void i2c_write(int fd, int value) {
-    if (wiringPiI2CWrite(fd, value) == -1) {
+    uint64_t start;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        bus_trace_replay(BUS_TRACE_I2C_WRITE, bus_trace_key(fd), value, NULL, 0);
+        return;
+    }
+
+    tracing_begin("i2c_write", "i2c");
+    start = bus_trace_start();
+    if (g_adapter->write(fd, value) == -1) {
+        printf("Write Failed: %s\n", strerror(errno));
+        exit(errno);
+    }
+    if (start != 0)
+        bus_trace_record(start, BUS_TRACE_I2C_WRITE, bus_trace_key(fd), value, value, NULL, 0);
+    tracing_end();
+}
+
+/**
+ * @brief Write several bytes in a single i2c transaction
+ *        without specified register address.
+ * @param fd file descriptor to the device.
+ * @param buf the bytes going to write.
+ * @param len the number of bytes.
+ * @note  exit with an error number when the write fails.
+ */
+void i2c_write_block(int fd, const unsigned char *buf, int len) {
+    uint64_t start;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        bus_trace_replay(BUS_TRACE_I2C_WRITE_BLOCK, bus_trace_key(fd), len, NULL, 0);
+        return;
+    }
+
+    tracing_begin("i2c_write_block", "i2c");
+    start = bus_trace_start();
+    if (g_adapter->write_block(fd, buf, len) == -1) {
         printf("Write Failed: %s\n", strerror(errno));
         exit(errno);
     }
+    if (start != 0)
+        bus_trace_record(start, BUS_TRACE_I2C_WRITE_BLOCK, bus_trace_key(fd), len, 0, NULL, 0);
+    tracing_end();
 }
 
 /**
@@ -38,12 +141,21 @@ void i2c_write(int fd, int value) {
  *        and return -1 indicate fail, otherwise means success.
  */
 int i2c_read(int fd) {
+    uint64_t start;
     int ret_val;
 
-    if ((ret_val = wiringPiI2CRead(fd)) == -1) {
+    if (bus_trace_mode() == BUS_TRACE_REPLAY)
+        return bus_trace_replay(BUS_TRACE_I2C_READ, bus_trace_key(fd), 0, NULL, 0);
+
+    tracing_begin("i2c_read", "i2c");
+    start = bus_trace_start();
+    if ((ret_val = g_adapter->read(fd)) == -1) {
         printf("Read Failed: %s\n", strerror(errno));
         exit(errno);
     }
+    if (start != 0)
+        bus_trace_record(start, BUS_TRACE_I2C_READ, bus_trace_key(fd), 0, ret_val, NULL, 0);
+    tracing_end();
     return ret_val;
 }
 
@@ -57,10 +169,24 @@ int i2c_read(int fd) {
  *        otherwise non-zero means fail.
  */
 void i2c_write_8bits(int fd, int reg, int value) {
-    if (wiringPiI2CWriteReg8(fd, reg, value) == -1) {
+    uint64_t start;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        bus_trace_replay(BUS_TRACE_I2C_WRITE_REG, bus_trace_key(fd), reg, NULL, 0);
+        return;
+    }
+
+    tracing_begin("i2c_write_8bits", "i2c");
+    start = bus_trace_start();
+    PROBE3(i2c_write_reg_start, fd, reg, value);
+    if (g_adapter->write_8bits(fd, reg, value) == -1) {
         printf("Write Failed: %s\n", strerror(errno));
         exit(errno);
     }
+    PROBE2(i2c_write_reg_done, fd, reg);
+    if (start != 0)
+        bus_trace_record(start, BUS_TRACE_I2C_WRITE_REG, bus_trace_key(fd), reg, value, NULL, 0);
+    tracing_end();
 }
 
 /**
@@ -72,11 +198,22 @@ void i2c_write_8bits(int fd, int reg, int value) {
  *        and return -1 indicate fail, otherwise means success.
  */
 int i2c_read_8bits(int fd, int reg) {
+    uint64_t start;
     int ret_val;
 
-    if ((ret_val = wiringPiI2CReadReg8(fd, reg)) == -1) {
+    if (bus_trace_mode() == BUS_TRACE_REPLAY)
+        return bus_trace_replay(BUS_TRACE_I2C_READ_REG, bus_trace_key(fd), reg, NULL, 0);
+
+    tracing_begin("i2c_read_8bits", "i2c");
+    start = bus_trace_start();
+    PROBE2(i2c_read_reg_start, fd, reg);
+    if ((ret_val = g_adapter->read_8bits(fd, reg)) == -1) {
         printf("Read Failed: %s\n", strerror(errno));
         exit(errno);
     }
+    PROBE3(i2c_read_reg_done, fd, reg, ret_val);
+    if (start != 0)
+        bus_trace_record(start, BUS_TRACE_I2C_READ_REG, bus_trace_key(fd), reg, ret_val, NULL, 0);
+    tracing_end();
     return ret_val;
-}
\ No newline at end of file
+}
@@ -6,6 +6,34 @@
 #ifndef __I2C_LIB_H__
 #define __I2C_LIB_H__
 
+/**
+ * @brief bus operations behind the I2C library, wiringPi by default.
+ *
+ * Every operation returns -1 on failure, like the wiringPi functions.
+ */
+typedef struct i2c_adapter {
+    int (*setup)(int address);                                  /**< open a device */
+    int (*read)(int fd);                                        /**< read a byte */
+    int (*write)(int fd, int value);                            /**< write a byte */
+    int (*read_8bits)(int fd, int reg);                         /**< read a register */
+    int (*write_8bits)(int fd, int reg, int value);             /**< write a register */
+    int (*write_block)(int fd, const unsigned char *buf, int len); /**< write bytes */
+} i2c_adapter_st;
+
+/**
+ * @brief Replace the bus operations, for tests and benchmarks.
+ * @param adapter the new operations, NULL restores wiringPi.
+ */
+void i2c_set_adapter(const i2c_adapter_st *adapter);
+
+/**
+ * @brief Open the i2c device on the given address.
+ * @param address 7 bits device address.
+ * @return fd file descriptor to the device.
+ * @note  exit with an error number when the device can't be opened.
+ */
+int i2c_setup(int address);
+
 /**
  * @brief Write value to a 8bits register in i2c device 
  *        without specified register address.
@@ -17,6 +45,16 @@
  */
 void i2c_write(int fd, int value);
 
+/**
+ * @brief Write several bytes in a single i2c transaction
+ *        without specified register address.
+ * @param fd file descriptor to the device.
+ * @param buf the bytes going to write.
+ * @param len the number of bytes.
+ * @note  exit with an error number when the write fails.
+ */
+void i2c_write_block(int fd, const unsigned char *buf, int len);
+
 /**
  * @brief Read value from a 8bits register in i2c device
  *        without specified register address.
@@ -49,4 +87,4 @@ void i2c_write_8bits(int fd, int reg, int value);
  */
 int i2c_read_8bits(int fd, int reg);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,329 @@
+/**
+ * @file loop_lag.c
+ * @brief event loop lag monitor, implementation.
+ *        Everything but the thread check runs on the loop thread, no lock.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <event2/event.h>
+
+#include "loop_lag.h"
+
+#define USEC_PER_MSEC           (1000)                      /**< Microseconds per millisecond */
+#define OTHER                   (LOOP_LAG_CALLBACKS)        /**< Labels past the table */
+#define UNLABELLED              (LOOP_LAG_CALLBACKS + 1)    /**< No labelled run to blame */
+
+static struct event *g_timer = NULL;    /**< The tick */
+static pthread_t g_loop_thread;         /**< Thread running the loop */
+static int g_started = 0;               /**< Monitoring */
+static uint64_t g_expected_us = 0;      /**< When the tick is due */
+static loop_lag_stats_st g_stats;       /**< Lag so far */
+
+static loop_lag_callback_st g_callbacks[LOOP_LAG_CALLBACKS + 2]; /**< Labels */
+static int g_count = 0;                 /**< Labels in the table */
+
+static const char *g_running = NULL;    /**< Label running */
+static uint64_t g_running_us = 0;       /**< Since when */
+static int g_depth = 0;                 /**< Nested runs */
+static loop_lag_callback_st *g_worst = NULL; /**< Longest run since the tick */
+static uint64_t g_worst_us = 0;         /**< Its length */
+
+/**
+ * @brief Measure the lag of the tick and set the next one.
+ */
+static void s_loop_lag_tick(evutil_socket_t fd, short flags, void *arg);
+
+/**
+ * @brief Entry of a label, "other" once the table is full.
+ */
+static loop_lag_callback_st *s_loop_lag_find(const char *name);
+
+/**
+ * @brief Most stall time first, then longest run.
+ */
+static int s_loop_lag_compare(const void *a, const void *b);
+
+/**
+ * @brief CLOCK_MONOTONIC in us.
+ */
+static uint64_t s_loop_lag_now_us();
+
+/* ===========================================
+	loop_lag initialize and finish function
+   =========================================== */
+/**
+ * @brief Start monitoring the loop, from the thread running it.
+ * @param base the event loop, made with EVENT_BASE_FLAG_PRECISE_TIMER:
+ *        the coarse clock it uses otherwise adds a few ms to every lag.
+ */
+void loop_lag_init(struct event_base *base) {
+    struct timeval period = { 0, LOOP_LAG_PERIOD_MS * USEC_PER_MSEC };
+
+    memset(&g_stats, 0, sizeof(g_stats));
+    memset(g_callbacks, 0, sizeof(g_callbacks));
+    g_callbacks[OTHER].name = "other";
+    g_callbacks[UNLABELLED].name = "unlabelled";
+    g_count = 0;
+    g_depth = 0;
+    g_worst = NULL;
+    g_worst_us = 0;
+
+    g_timer = evtimer_new(base, s_loop_lag_tick, NULL);
+    if (g_timer == NULL)
+        exit(ENOMEM);
+    g_loop_thread = pthread_self();
+    g_started = 1;
+    g_expected_us = s_loop_lag_now_us() + LOOP_LAG_PERIOD_MS * USEC_PER_MSEC;
+    evtimer_add(g_timer, &period);
+}
+
+/**
+ * @brief Stop monitoring.
+ */
+void loop_lag_fini() {
+    if (g_timer == NULL)
+        return;
+    g_started = 0;
+    event_free(g_timer);
+    g_timer = NULL;
+}
+
+/* ===================
+    loop_lag function
+   =================== */
+/**
+ * @brief A labelled callback starts running. Does nothing off the loop
+ *        thread, or before loop_lag_init; nested runs count as one.
+ * @param name a literal.
+ */
+void loop_lag_enter(const char *name) {
+    if (!g_started || !pthread_equal(pthread_self(), g_loop_thread))
+        return;
+    if (g_depth++ > 0)
+        return;
+    g_running = name;
+    g_running_us = s_loop_lag_now_us();
+}
+
+/**
+ * @brief The labelled callback returns.
+ */
+void loop_lag_leave() {
+    loop_lag_callback_st *callback;
+    uint64_t run;
+
+    if (!g_started || !pthread_equal(pthread_self(), g_loop_thread))
+        return;
+    if (g_depth == 0 || --g_depth > 0)
+        return;
+
+    run = s_loop_lag_now_us() - g_running_us;
+    callback = s_loop_lag_find(g_running);
+    callback->runs++;
+    callback->run_sum_us += run;
+    if (run > callback->run_max_us)
+        callback->run_max_us = run;
+    if (run > g_worst_us) {
+        g_worst = callback;
+        g_worst_us = run;
+    }
+}
+
+/**
+ * @brief Lag of the loop so far.
+ * @param stats [out] the lag.
+ */
+void loop_lag_get_stats(loop_lag_stats_st *stats) {
+    *stats = g_stats;
+}
+
+/**
+ * @brief Labelled callbacks, most stall time first, then longest run.
+ * @param callbacks [out] room for max callbacks.
+ * @param max LOOP_LAG_CALLBACKS + 2 holds every label, "other" and
+ *        "unlabelled".
+ * @return number of callbacks written.
+ */
+int loop_lag_get_callbacks(loop_lag_callback_st *callbacks, int max) {
+    loop_lag_callback_st all[LOOP_LAG_CALLBACKS + 2];
+    int i, n = 0;
+
+    for (i = 0; i < g_count; ++i)
+        all[n++] = g_callbacks[i];
+    for (i = OTHER; i <= UNLABELLED; ++i) {
+        if (g_callbacks[i].runs > 0 || g_callbacks[i].stalls > 0)
+            all[n++] = g_callbacks[i];
+    }
+    qsort(all, n, sizeof(loop_lag_callback_st), s_loop_lag_compare);
+
+    if (n > max)
+        n = max;
+    memcpy(callbacks, all, n * sizeof(loop_lag_callback_st));
+    return n;
+}
+
+/**
+ * @brief Upper bound of a bucket of the histogram.
+ * @param bucket 0 to LOOP_LAG_BUCKETS - 1.
+ * @return lag in us, 0 for the last bucket, which has none.
+ */
+uint64_t loop_lag_bucket_us(int bucket) {
+    return bucket < LOOP_LAG_BUCKETS - 1 ? 1ULL << bucket : 0;
+}
+
+/* ================
+    inner function
+   ================ */
+static void s_loop_lag_tick(evutil_socket_t fd, short flags, void *arg) {
+    struct timeval period = { 0, LOOP_LAG_PERIOD_MS * USEC_PER_MSEC };
+    loop_lag_callback_st *blamed;
+    uint64_t now = s_loop_lag_now_us();
+    uint64_t lag = now > g_expected_us ? now - g_expected_us : 0;
+    int bucket = 0;
+
+    while (bucket < LOOP_LAG_BUCKETS - 1 && lag >= loop_lag_bucket_us(bucket))
+        bucket++;
+    g_stats.histogram[bucket]++;
+    g_stats.ticks++;
+    g_stats.lag_sum_us += lag;
+
+    if (lag >= LOOP_LAG_STALL_US) {
+        // a run that long made at least half of the lag, or nobody is known.
+        blamed = g_worst != NULL && g_worst_us * 2 >= lag ?
+                        g_worst : &g_callbacks[UNLABELLED];
+        blamed->stalls++;
+        blamed->stall_sum_us += lag;
+        g_stats.stalls++;
+        if (lag > g_stats.lag_max_us)
+            printf("loop: %lu ms late, blamed on %s\n",
+                   (unsigned long)(lag / USEC_PER_MSEC), blamed->name);
+    }
+    if (lag > g_stats.lag_max_us)
+        g_stats.lag_max_us = lag;
+
+    g_worst = NULL;
+    g_worst_us = 0;
+    g_expected_us = now + LOOP_LAG_PERIOD_MS * USEC_PER_MSEC;
+    evtimer_add(g_timer, &period);
+}
+
+static loop_lag_callback_st *s_loop_lag_find(const char *name) {
+    int i;
+
+    for (i = 0; i < g_count; ++i) {
+        if (g_callbacks[i].name == name || strcmp(g_callbacks[i].name, name) == 0)
+            return &g_callbacks[i];
+    }
+    if (g_count == LOOP_LAG_CALLBACKS)
+        return &g_callbacks[OTHER];
+    g_callbacks[g_count].name = name;
+    return &g_callbacks[g_count++];
+}
+
+static int s_loop_lag_compare(const void *a, const void *b) {
+    const loop_lag_callback_st *x = a, *y = b;
+
+    if (x->stall_sum_us != y->stall_sum_us)
+        return x->stall_sum_us < y->stall_sum_us ? 1 : -1;
+    if (x->run_max_us != y->run_max_us)
+        return x->run_max_us < y->run_max_us ? 1 : -1;
+    return 0;
+}
+
+static uint64_t s_loop_lag_now_us() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+#ifdef XTEST
+
+#include <unistd.h>
+
+#define TEST_SLOW_MS        (50)        /**< Labelled callback blocking */
+#define TEST_HIDDEN_MS      (40)        /**< Unlabelled callback blocking */
+
+static void s_test_slow(evutil_socket_t fd, short flags, void *arg) {
+    loop_lag_enter("slow");
+    usleep(TEST_SLOW_MS * USEC_PER_MSEC);
+    loop_lag_leave();
+}
+
+static void s_test_fast(evutil_socket_t fd, short flags, void *arg) {
+    loop_lag_enter("fast");
+    loop_lag_enter("nested");
+    loop_lag_leave();
+    loop_lag_leave();
+}
+
+static void s_test_hidden(evutil_socket_t fd, short flags, void *arg) {
+    usleep(TEST_HIDDEN_MS * USEC_PER_MSEC);
+}
+
+static void *s_test_other_thread(void *arg) {
+    // off the loop thread, ignored.
+    loop_lag_enter("thread");
+    usleep(TEST_SLOW_MS * USEC_PER_MSEC);
+    loop_lag_leave();
+    return NULL;
+}
+
+int main() {
+    struct timeval slow = { 0, 100000 }, fast = { 0, 150000 },
+                   hidden = { 0, 300000 }, stop = { 0, 600000 };
+    struct event_config *config = event_config_new();
+    struct event_base *base;
+    loop_lag_callback_st callbacks[LOOP_LAG_CALLBACKS + 2];
+    loop_lag_stats_st stats;
+    unsigned long sum = 0;
+    pthread_t thread;
+    int i, n, failed = 0;
+
+    event_config_set_flag(config, EVENT_BASE_FLAG_PRECISE_TIMER);
+    base = event_base_new_with_config(config);
+    event_config_free(config);
+    loop_lag_init(base);
+    event_base_once(base, -1, EV_TIMEOUT, s_test_slow, NULL, &slow);
+    event_base_once(base, -1, EV_TIMEOUT, s_test_fast, NULL, &fast);
+    event_base_once(base, -1, EV_TIMEOUT, s_test_hidden, NULL, &hidden);
+    pthread_create(&thread, NULL, s_test_other_thread, NULL);
+    event_base_loopexit(base, &stop);
+    event_base_dispatch(base);
+    pthread_join(thread, NULL);
+
+    loop_lag_get_stats(&stats);
+    for (i = 0; i < LOOP_LAG_BUCKETS; ++i)
+        sum += stats.histogram[i];
+    printf("%lu ticks, %lu stalls, max %lu us\n", stats.ticks, stats.stalls,
+           (unsigned long)stats.lag_max_us);
+    failed |= sum != stats.ticks || stats.ticks < 20;
+    failed |= stats.stalls < 2 || stats.lag_max_us < (TEST_SLOW_MS - 10) * USEC_PER_MSEC;
+
+    // the labelled stall first, the unlabelled one next, then the runs.
+    n = loop_lag_get_callbacks(callbacks, LOOP_LAG_CALLBACKS + 2);
+    for (i = 0; i < n; ++i)
+        printf("%s: %lu runs, max %lu us, %lu stalls\n", callbacks[i].name,
+               callbacks[i].runs, (unsigned long)callbacks[i].run_max_us,
+               callbacks[i].stalls);
+    failed |= n != 3;
+    failed |= n > 0 && (strcmp(callbacks[0].name, "slow") != 0 ||
+                        callbacks[0].stalls != 1 || callbacks[0].runs != 1);
+    failed |= n > 1 && (strcmp(callbacks[1].name, "unlabelled") != 0 ||
+                        callbacks[1].stalls != 1);
+    failed |= n > 2 && (strcmp(callbacks[2].name, "fast") != 0 ||
+                        callbacks[2].runs != 1 || callbacks[2].stalls != 0);
+
+    loop_lag_fini();
+    event_base_free(base);
+    printf("%s\n", failed ? "FAILED" : "SUCCESS!");
+    return failed;
+}
+
+#endif
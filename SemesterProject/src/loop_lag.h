@@ -0,0 +1,101 @@
+/**
+ * @file loop_lag.h
+ * @brief event loop lag monitor, declaration.
+ *        A timer on the event loop measures how late it fires, every
+ *        LOOP_LAG_PERIOD_MS, into a histogram: a callback blocking the loop
+ *        delays every other one, the timer included. The callbacks of the
+ *        daemon are labelled with loop_lag_enter and loop_lag_leave, which
+ *        time each run; a tick later than LOOP_LAG_STALL_US is blamed on
+ *        the longest labelled run since the previous tick when it makes at
+ *        least half of the lag, on "unlabelled" otherwise. Callbacks are
+ *        then ranked by the total stall time blamed on them.
+ * @author Xiangyu Guo
+ */
+#ifndef __LOOP_LAG_H__
+#define __LOOP_LAG_H__
+
+#include <stdint.h>
+
+struct event_base;
+
+#define LOOP_LAG_PERIOD_MS      (10)        /**< Tick of the monitor */
+#define LOOP_LAG_STALL_US       (20000)     /**< Lag counted as a stall */
+#define LOOP_LAG_BUCKETS        (20)        /**< Bucket n holds lags below 2^n us */
+#define LOOP_LAG_CALLBACKS      (32)        /**< Labels tracked, the rest is "other" */
+
+/**
+ * @brief the lag of the loop.
+ */
+typedef struct loop_lag_stats {
+    unsigned long ticks;            /**< lags measured */
+    uint64_t lag_sum_us;            /**< their sum */
+    uint64_t lag_max_us;            /**< the largest */
+    unsigned long stalls;           /**< ticks past LOOP_LAG_STALL_US */
+    unsigned long histogram[LOOP_LAG_BUCKETS]; /**< the last one holds the rest */
+} loop_lag_stats_st;
+
+/**
+ * @brief the runs of one labelled callback.
+ */
+typedef struct loop_lag_callback {
+    const char *name;               /**< label */
+    unsigned long runs;             /**< runs */
+    uint64_t run_sum_us;            /**< time run */
+    uint64_t run_max_us;            /**< longest run */
+    unsigned long stalls;           /**< stalls blamed on it */
+    uint64_t stall_sum_us;          /**< lag of those stalls */
+} loop_lag_callback_st;
+
+/* ===========================================
+	loop_lag initialize and finish function
+   =========================================== */
+/**
+ * @brief Start monitoring the loop, from the thread running it.
+ * @param base the event loop, made with EVENT_BASE_FLAG_PRECISE_TIMER:
+ *        the coarse clock it uses otherwise adds a few ms to every lag.
+ */
+void loop_lag_init(struct event_base *base);
+
+/**
+ * @brief Stop monitoring.
+ */
+void loop_lag_fini();
+
+/* ===================
+    loop_lag function
+   =================== */
+/**
+ * @brief A labelled callback starts running. Does nothing off the loop
+ *        thread, or before loop_lag_init; nested runs count as one.
+ * @param name a literal.
+ */
+void loop_lag_enter(const char *name);
+
+/**
+ * @brief The labelled callback returns.
+ */
+void loop_lag_leave();
+
+/**
+ * @brief Lag of the loop so far.
+ * @param stats [out] the lag.
+ */
+void loop_lag_get_stats(loop_lag_stats_st *stats);
+
+/**
+ * @brief Labelled callbacks, most stall time first, then longest run.
+ * @param callbacks [out] room for max callbacks.
+ * @param max LOOP_LAG_CALLBACKS + 2 holds every label, "other" and
+ *        "unlabelled".
+ * @return number of callbacks written.
+ */
+int loop_lag_get_callbacks(loop_lag_callback_st *callbacks, int max);
+
+/**
+ * @brief Upper bound of a bucket of the histogram.
+ * @param bucket 0 to LOOP_LAG_BUCKETS - 1.
+ * @return lag in us, 0 for the last bucket, which has none.
+ */
+uint64_t loop_lag_bucket_us(int bucket);
+
+#endif
@@ -0,0 +1,399 @@
+/**
+ * @file notifier.c
+ * @brief outbound webhook notifier, implementation.
+ *        Every target keeps one keep-alive connection and a bounded queue
+ *        of events. One request is in flight per target; events arriving
+ *        meanwhile are coalesced and go out with the next request.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <event2/event.h>
+#include <event2/http.h>
+
+#include "notifier.h"
+#include "loop_lag.h"
+
+#define NOTIFIER_NAME_SIZE      (16)    /**< Longest event name */
+#define NOTIFIER_HOST_SIZE      (64)    /**< Longest host name */
+#define NOTIFIER_PATH_SIZE      (128)   /**< Longest request path */
+#define NOTIFIER_COUNT_SIZE     (16)    /**< Digits of the event count */
+#define NOTIFIER_HTTP_PORT      (80)    /**< Port when the url has none */
+#define NOTIFIER_BACKOFF_MS     (250)   /**< First retry delay */
+#define NOTIFIER_BACKOFF_MAX_MS (30000) /**< Longest retry delay */
+#define MSEC_PER_SEC            (1000)  /**< Milliseconds per second */
+#define USEC_PER_MSEC           (1000)  /**< Microseconds per millisecond */
+
+/**
+ * @brief one queued event, with the number of times it happened.
+ */
+typedef struct notifier_event {
+    char name[NOTIFIER_NAME_SIZE];  /**< event name */
+    unsigned int count;             /**< coalesced occurrences */
+} notifier_event_st;
+
+/**
+ * @brief one webhook target and its connection.
+ */
+typedef struct notifier_target {
+    struct notifier *notifier;                  /**< owner */
+    char host[NOTIFIER_HOST_SIZE];              /**< target host */
+    char path[NOTIFIER_PATH_SIZE];              /**< requested path */
+    int port;                                   /**< target port */
+    struct evhttp_connection *conn;             /**< keep-alive connection */
+    struct event *retry_event;                  /**< backoff timer */
+    notifier_event_st queue[NOTIFIER_QUEUE_SIZE]; /**< pending events */
+    int head;                                   /**< oldest pending event */
+    int length;                                 /**< pending events */
+    int in_flight;                              /**< head event is being sent */
+    int attempt;                                /**< failed attempts of head */
+    notifier_stats_st stats;                    /**< delivery counters */
+} notifier_target_st;
+
+struct notifier {
+    struct event_base *base;                    /**< event loop */
+    int timeout_sec;                            /**< request timeout */
+    int retries;                                /**< attempts after the first */
+    int targets;                                /**< targets in use */
+    notifier_target_st target[NOTIFIER_MAX_TARGETS]; /**< webhook targets */
+};
+
+/**
+ * @brief Send the head event of a target, if any and none is in flight.
+ * @param target a valid target.
+ */
+static void s_notifier_send(notifier_target_st *target);
+
+/**
+ * @brief Request finished, successfully or not.
+ * @param req the request, NULL when the connection failed.
+ * @param arg the target.
+ */
+static void s_notifier_done(struct evhttp_request *req, void *arg);
+
+/**
+ * @brief Backoff timer expired, send the head event again.
+ */
+static void s_notifier_retry(evutil_socket_t fd, short flags, void *arg);
+
+/**
+ * @brief Remove the head event of a target.
+ * @param target a valid target.
+ */
+static void s_notifier_pop(notifier_target_st *target);
+
+/**
+ * @brief Initialize a notifier on the event loop.
+ * @param base event base.
+ * @return a initialized notifier.
+ */
+notifier_st *notifier_init(struct event_base *base) {
+    notifier_st *notifier = (notifier_st *)calloc(1, sizeof(notifier_st));
+    if (notifier == NULL)
+        exit(ENOMEM);
+
+    notifier->base = base;
+    notifier->timeout_sec = NOTIFIER_TIMEOUT_SEC;
+    notifier->retries = NOTIFIER_MAX_RETRIES;
+    return notifier;
+}
+
+/**
+ * @brief Clean up the notifier, pending events are dropped.
+ * @param notifier a valid notifier.
+ */
+void notifier_fini(notifier_st *notifier) {
+    int i;
+
+    if (notifier == NULL)
+        return;
+
+    for (i = 0; i < notifier->targets; ++i) {
+        event_free(notifier->target[i].retry_event);
+        evhttp_connection_free(notifier->target[i].conn);
+    }
+    free(notifier);
+}
+
+/**
+ * @brief Add one webhook target, it keeps one keep-alive connection.
+ * @param notifier a valid notifier.
+ * @param url http url, the path is requested with GET.
+ * @return 0 on success; EINVAL on a bad url, ENOSPC with too many targets.
+ */
+int notifier_add_target(notifier_st *notifier, const char *url) {
+    struct evhttp_uri *uri;
+    notifier_target_st *target;
+    const char *host, *path;
+
+    if (notifier->targets >= NOTIFIER_MAX_TARGETS)
+        return ENOSPC;
+
+    // parse the url once, not on every event.
+    uri = evhttp_uri_parse(url);
+    if (uri == NULL || (host = evhttp_uri_get_host(uri)) == NULL) {
+        if (uri != NULL)
+            evhttp_uri_free(uri);
+        return EINVAL;
+    }
+
+    target = &notifier->target[notifier->targets];
+    memset(target, 0, sizeof(notifier_target_st));
+    target->notifier = notifier;
+    snprintf(target->host, NOTIFIER_HOST_SIZE, "%s", host);
+    path = evhttp_uri_get_path(uri);
+    snprintf(target->path, NOTIFIER_PATH_SIZE, "%s",
+             path != NULL && path[0] != '\0' ? path : "/");
+    target->port = evhttp_uri_get_port(uri);
+    if (target->port < 0)
+        target->port = NOTIFIER_HTTP_PORT;
+    evhttp_uri_free(uri);
+
+    target->conn = evhttp_connection_base_new(notifier->base, NULL,
+                                              target->host, target->port);
+    target->retry_event = evtimer_new(notifier->base, s_notifier_retry, target);
+    if (target->conn == NULL || target->retry_event == NULL)
+        exit(ENOMEM);
+    evhttp_connection_set_timeout(target->conn, notifier->timeout_sec);
+
+    notifier->targets++;
+    return 0;
+}
+
+/**
+ * @brief Set the request timeout and how many times a request is retried.
+ * @param notifier a valid notifier.
+ * @param timeout_sec request timeout, in seconds.
+ * @param retries attempts after the first one, with doubling backoff.
+ */
+void notifier_set_policy(notifier_st *notifier, int timeout_sec, int retries) {
+    int i;
+
+    notifier->timeout_sec = timeout_sec;
+    notifier->retries = retries;
+    for (i = 0; i < notifier->targets; ++i)
+        evhttp_connection_set_timeout(notifier->target[i].conn, timeout_sec);
+}
+
+/**
+ * @brief Notify every target of one event, never blocks.
+ *        Repeated events waiting to be sent are coalesced into one request.
+ * @param notifier a valid notifier.
+ * @param event event name, sent in the X-Event header.
+ */
+void notifier_notify(notifier_st *notifier, const char *event) {
+    notifier_target_st *target;
+    notifier_event_st *last;
+    int i, tail;
+
+    for (i = 0; i < notifier->targets; ++i) {
+        target = &notifier->target[i];
+        target->stats.notified++;
+
+        tail = (target->head + target->length + NOTIFIER_QUEUE_SIZE - 1) %
+               NOTIFIER_QUEUE_SIZE;
+        last = &target->queue[tail];
+
+        // the head event may already be on the wire, don't touch it then.
+        if (target->length > 0 && !(tail == target->head && target->in_flight) &&
+                strncmp(last->name, event, NOTIFIER_NAME_SIZE - 1) == 0) {
+            last->count++;
+            target->stats.coalesced++;
+        } else if (target->length < NOTIFIER_QUEUE_SIZE) {
+            tail = (target->head + target->length) % NOTIFIER_QUEUE_SIZE;
+            snprintf(target->queue[tail].name, NOTIFIER_NAME_SIZE, "%s", event);
+            target->queue[tail].count = 1;
+            target->length++;
+        } else {
+            target->stats.dropped++;
+        }
+
+        s_notifier_send(target);
+    }
+}
+
+/**
+ * @brief Get the delivery counters of one target.
+ * @param notifier a valid notifier.
+ * @param target index in the order the targets were added.
+ * @param stats [out] the counters.
+ * @return 0 on success; EINVAL on a bad target.
+ */
+int notifier_get_stats(notifier_st *notifier, int target,
+                       notifier_stats_st *stats) {
+    if (target < 0 || target >= notifier->targets || stats == NULL)
+        return EINVAL;
+    *stats = notifier->target[target].stats;
+    return 0;
+}
+
+static void s_notifier_send(notifier_target_st *target) {
+    struct evhttp_request *req;
+    struct evkeyvalq *headers;
+    notifier_event_st *event;
+    char count[NOTIFIER_COUNT_SIZE];
+
+    if (target->length == 0 || target->in_flight ||
+            evtimer_pending(target->retry_event, NULL))
+        return;
+
+    event = &target->queue[target->head];
+    req = evhttp_request_new(s_notifier_done, target);
+    if (req == NULL)
+        exit(ENOMEM);
+
+    headers = evhttp_request_get_output_headers(req);
+    snprintf(count, NOTIFIER_COUNT_SIZE, "%u", event->count);
+    evhttp_add_header(headers, "Host", target->host);
+    evhttp_add_header(headers, "X-Event", event->name);
+    evhttp_add_header(headers, "X-Event-Count", count);
+
+    target->in_flight = 1;
+    // on failure libevent already freed the request, and won't call back.
+    if (evhttp_make_request(target->conn, req, EVHTTP_REQ_GET, target->path) != 0)
+        s_notifier_done(NULL, target);
+}
+
+static void s_notifier_done(struct evhttp_request *req, void *arg) {
+    notifier_target_st *target = (notifier_target_st *)arg;
+    int code = req != NULL ? evhttp_request_get_response_code(req) : 0;
+    struct timeval tv;
+    long backoff_ms;
+
+    loop_lag_enter("notifier");
+    target->in_flight = 0;
+
+    if (code >= 200 && code < 300) {
+        target->stats.sent++;
+        s_notifier_pop(target);
+    } else if (target->attempt < target->notifier->retries) {
+        // doubling backoff, capped, before sending the same event again.
+        backoff_ms = (long)NOTIFIER_BACKOFF_MS << target->attempt;
+        if (backoff_ms > NOTIFIER_BACKOFF_MAX_MS)
+            backoff_ms = NOTIFIER_BACKOFF_MAX_MS;
+        target->attempt++;
+        target->stats.retried++;
+
+        tv.tv_sec = backoff_ms / MSEC_PER_SEC;
+        tv.tv_usec = backoff_ms % MSEC_PER_SEC * USEC_PER_MSEC;
+        evtimer_add(target->retry_event, &tv);
+        loop_lag_leave();
+        return;
+    } else {
+        fprintf(stderr, "Notify %s:%d failed, giving up\n",
+                target->host, target->port);
+        target->stats.dropped += target->queue[target->head].count;
+        s_notifier_pop(target);
+    }
+
+    s_notifier_send(target);
+    loop_lag_leave();
+}
+
+static void s_notifier_retry(evutil_socket_t fd, short flags, void *arg) {
+    loop_lag_enter("notifier");
+    s_notifier_send((notifier_target_st *)arg);
+    loop_lag_leave();
+}
+
+static void s_notifier_pop(notifier_target_st *target) {
+    target->head = (target->head + 1) % NOTIFIER_QUEUE_SIZE;
+    target->length--;
+    target->attempt = 0;
+}
+
+#ifdef XTEST
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define TEST_EVENTS         (5)         /**< Motion events in one burst */
+#define TEST_RUN_SEC        (1)         /**< Time given to the deliveries */
+#define TEST_TIMEOUT_SEC    (3)         /**< Longer than a run, the idle connection stays */
+#define TEST_URL_SIZE       (64)        /**< Url of the stand-in receiver */
+
+static int g_requests = 0;              /**< requests received */
+static int g_events = 0;                /**< events received, counts summed */
+static int g_peer_port = -1;            /**< client port of the first request */
+static int g_connections = 0;           /**< distinct client ports seen */
+
+/**
+ * @brief stand-in webhook receiver.
+ */
+static void s_test_receiver(struct evhttp_request *req, void *arg) {
+    struct evkeyvalq *headers = evhttp_request_get_input_headers(req);
+    const char *count = evhttp_find_header(headers, "X-Event-Count");
+    char *address;
+    ev_uint16_t port;
+
+    evhttp_connection_get_peer(evhttp_request_get_connection(req),
+                               &address, &port);
+    if (port != g_peer_port) {
+        g_peer_port = port;
+        g_connections++;
+    }
+
+    g_requests++;
+    g_events += count != NULL ? atoi(count) : 0;
+    evhttp_send_reply(req, 200, "OK", NULL);
+}
+
+int main() {
+    struct event_base *base = event_base_new();
+    struct evhttp *http = evhttp_new(base);
+    struct evhttp_bound_socket *handle;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    struct timeval run = {TEST_RUN_SEC, 0};
+    char url[TEST_URL_SIZE];
+    notifier_stats_st good = {0}, bad = {0};
+    notifier_st *notifier;
+    int i, failed;
+
+    evhttp_set_gencb(http, s_test_receiver, NULL);
+    handle = evhttp_bind_socket_with_handle(http, "127.0.0.1", 0);
+    getsockname(evhttp_bound_socket_get_fd(handle), (struct sockaddr *)&addr, &len);
+    snprintf(url, TEST_URL_SIZE, "http://127.0.0.1:%d/", ntohs(addr.sin_port));
+
+    notifier = notifier_init(base);
+    notifier_add_target(notifier, url);
+    // nothing listens on port 1, every attempt fails.
+    notifier_add_target(notifier, "http://127.0.0.1:1/");
+    notifier_set_policy(notifier, TEST_TIMEOUT_SEC, 2);
+
+    for (i = 0; i < TEST_EVENTS; ++i)
+        notifier_notify(notifier, "motion");
+
+    event_base_loopexit(base, &run);
+    event_base_dispatch(base);
+
+    // one more event, on the same connection.
+    notifier_notify(notifier, "motion");
+    event_base_loopexit(base, &run);
+    event_base_dispatch(base);
+
+    notifier_get_stats(notifier, 0, &good);
+    notifier_get_stats(notifier, 1, &bad);
+    printf("receiver: %d requests, %d events, %d connections\n",
+            g_requests, g_events, g_connections);
+    printf("target 0: sent %lu coalesced %lu dropped %lu\n",
+            good.sent, good.coalesced, good.dropped);
+    printf("target 1: sent %lu retried %lu dropped %lu\n",
+            bad.sent, bad.retried, bad.dropped);
+
+    failed = g_events != TEST_EVENTS + 1 || g_requests > 3 ||
+             g_connections != 1 || bad.sent != 0 || bad.retried < 2 ||
+             bad.dropped == 0;
+    printf("%s\n", failed ? "FAILED" : "SUCCESS!");
+
+    notifier_fini(notifier);
+    evhttp_free(http);
+    event_base_free(base);
+    return failed;
+}
+
+#endif
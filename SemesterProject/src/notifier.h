@@ -0,0 +1,87 @@
+/**
+ * @file notifier.h
+ * @brief outbound webhook notifier, declaration.
+ * @author Xiangyu Guo
+ */
+#ifndef __NOTIFIER_H__
+#define __NOTIFIER_H__
+
+#define NOTIFIER_MAX_TARGETS    (4)     /**< Webhook targets */
+#define NOTIFIER_QUEUE_SIZE     (8)     /**< Pending events per target */
+#define NOTIFIER_TIMEOUT_SEC    (5)     /**< Default request timeout */
+#define NOTIFIER_MAX_RETRIES    (5)     /**< Default attempts after the first */
+
+/**
+ * @brief module structure, hiding the detail to the public
+ */
+typedef struct notifier notifier_st;
+struct notifier;
+struct event_base;
+
+/**
+ * @brief delivery counters of one target.
+ */
+typedef struct notifier_stats {
+    unsigned long notified;         /**< events handed to the notifier */
+    unsigned long coalesced;        /**< events merged into a pending one */
+    unsigned long dropped;          /**< events lost, queue full or retries out */
+    unsigned long sent;             /**< requests answered with 2xx */
+    unsigned long retried;          /**< requests sent again after a failure */
+} notifier_stats_st;
+
+/* ==============================================
+	notifier initialize and finish function
+   ============================================== */
+/**
+ * @brief Initialize a notifier on the event loop.
+ * @param base event base.
+ * @return a initialized notifier.
+ */
+notifier_st *notifier_init(struct event_base *base);
+
+/**
+ * @brief Clean up the notifier, pending events are dropped.
+ * @param notifier a valid notifier.
+ */
+void notifier_fini(notifier_st *notifier);
+
+/**
+ * @brief Add one webhook target, it keeps one keep-alive connection.
+ *        An idle connection is closed after the timeout and reopened on
+ *        the next event.
+ * @param notifier a valid notifier.
+ * @param url http url, the path is requested with GET.
+ * @return 0 on success; EINVAL on a bad url, ENOSPC with too many targets.
+ */
+int notifier_add_target(notifier_st *notifier, const char *url);
+
+/**
+ * @brief Set the request timeout and how many times a request is retried.
+ * @param notifier a valid notifier.
+ * @param timeout_sec request timeout, in seconds.
+ * @param retries attempts after the first one, with doubling backoff.
+ */
+void notifier_set_policy(notifier_st *notifier, int timeout_sec, int retries);
+
+/* =================
+    notifier function
+   ================= */
+/**
+ * @brief Notify every target of one event, never blocks.
+ *        Repeated events waiting to be sent are coalesced into one request.
+ * @param notifier a valid notifier.
+ * @param event event name, sent in the X-Event header.
+ */
+void notifier_notify(notifier_st *notifier, const char *event);
+
+/**
+ * @brief Get the delivery counters of one target.
+ * @param notifier a valid notifier.
+ * @param target index in the order the targets were added.
+ * @param stats [out] the counters.
+ * @return 0 on success; EINVAL on a bad target.
+ */
+int notifier_get_stats(notifier_st *notifier, int target,
+                       notifier_stats_st *stats);
+
+#endif
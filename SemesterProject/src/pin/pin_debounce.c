@@ -0,0 +1,557 @@
+/**
+ * @file pin_debounce.c
+ * @brief input filter of digital pins, implementation.
+ *        Every mode works on edge timestamps only, the pin is never
+ *        sampled: a pending change is decided when the next edge comes
+ *        or at the deadline, whichever is first.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <event2/event.h>
+
+#include "../event_queue.h"
+#include "pin_gpio.h"
+#include "pin_debounce.h"
+
+#define USEC_PER_SEC        (1000000)   /**< Microseconds per second */
+
+/**
+ * @brief one filtered pin, on the event loop.
+ */
+typedef struct pin_debounce_watch {
+    int pin;                            /**< wiringPi pin number */
+    pin_debounce_st debounce;           /**< filter state */
+    pin_debounce_cb cb;                 /**< call back on the events */
+    void *arg;                          /**< argument of the call back */
+    struct event *timer;                /**< fires at the filter deadline */
+} pin_debounce_watch_st;
+
+static pin_debounce_watch_st g_watches[PIN_GPIO_MAX_WATCHES]; /**< Filtered pins */
+static int g_watch_count = 0;           /**< Filtered pins in use */
+
+/**
+ * @brief Report a change of the filtered state.
+ * @param debounce a valid filter.
+ * @param pressed new state.
+ * @param at time of the change.
+ * @return PIN_DEBOUNCE_PRESS or PIN_DEBOUNCE_RELEASE.
+ */
+static int s_pin_debounce_report(pin_debounce_st *debounce, int pressed, uint64_t at);
+
+/**
+ * @brief Decide the change pending on the current raw level, up to now.
+ * @param debounce a valid filter.
+ * @param now_us current time.
+ * @return reported events.
+ */
+static int s_pin_debounce_settle(pin_debounce_st *debounce, uint64_t now_us);
+
+/**
+ * @brief Long press and repeat, while pressed.
+ * @param debounce a valid filter.
+ * @param now_us current time.
+ * @return reported events.
+ */
+static int s_pin_debounce_long(pin_debounce_st *debounce, uint64_t now_us);
+
+/**
+ * @brief Call back, then arm the timer on the next deadline.
+ * @param watch a filtered pin.
+ * @param events reported events.
+ * @param now_us current time.
+ */
+static void s_pin_debounce_dispatch(pin_debounce_watch_st *watch, int events,
+                                    uint64_t now_us);
+
+/**
+ * @brief Edge of a filtered pin.
+ */
+static void s_pin_debounce_edge(int pin, int level, uint64_t timestamp_us, void *arg);
+
+/**
+ * @brief Deadline of a filtered pin.
+ */
+static void s_pin_debounce_timer(evutil_socket_t fd, short flags, void *arg);
+
+/**
+ * @brief Initialize the filter of one pin, released.
+ * @param debounce [out] filter state.
+ * @param config settings, copied.
+ * @param now_us current time.
+ */
+void pin_debounce_init(pin_debounce_st *debounce,
+                       const pin_debounce_config_st *config, uint64_t now_us) {
+    memset(debounce, 0, sizeof(pin_debounce_st));
+    debounce->config = *config;
+    debounce->raw_us = now_us;
+    debounce->update_us = now_us;
+    debounce->lock_us = now_us;
+    debounce->event_us = now_us;
+}
+
+/**
+ * @brief Feed one edge.
+ *        Polled at its deadlines, one call reports at most one change.
+ * @param debounce a valid filter.
+ * @param level level after the edge.
+ * @param timestamp_us time of the edge, never before the previous edge,
+ *        it may be before the last poll.
+ * @return reported events, 0 if none.
+ */
+int pin_debounce_edge(pin_debounce_st *debounce, int level, uint64_t timestamp_us) {
+    int raw = level == debounce->config.active_level;
+    int events;
+
+    // what the previous level led to, before it changes.
+    events = s_pin_debounce_settle(debounce, timestamp_us);
+    events |= s_pin_debounce_long(debounce, timestamp_us);
+
+    if (raw != debounce->raw) {
+        debounce->raw = raw;
+        debounce->raw_us = timestamp_us;
+        events |= s_pin_debounce_settle(debounce, timestamp_us);
+    }
+    return events;
+}
+
+/**
+ * @brief Let the time pass without an edge.
+ * @param debounce a valid filter.
+ * @param now_us current time, never going back.
+ * @return reported events, 0 if none.
+ */
+int pin_debounce_poll(pin_debounce_st *debounce, uint64_t now_us) {
+    int events = s_pin_debounce_settle(debounce, now_us);
+    return events | s_pin_debounce_long(debounce, now_us);
+}
+
+/**
+ * @brief Time the filter has to be polled at.
+ * @param debounce a valid filter.
+ * @return deadline, 0 if nothing is pending.
+ */
+uint64_t pin_debounce_deadline(const pin_debounce_st *debounce) {
+    uint64_t deadline = 0;
+
+    switch (debounce->config.mode) {
+    case PIN_DEBOUNCE_LOCKOUT:
+        if (debounce->raw != debounce->pressed)
+            deadline = debounce->lock_us;
+        break;
+    case PIN_DEBOUNCE_INTEGRATOR:
+        if (debounce->raw && !debounce->pressed)
+            deadline = debounce->update_us + debounce->config.debounce_us -
+                       debounce->integral;
+        else if (!debounce->raw && debounce->pressed)
+            deadline = debounce->update_us + debounce->integral;
+        break;
+    default:
+        if (debounce->raw != debounce->pressed)
+            deadline = debounce->raw_us + debounce->config.debounce_us;
+        break;
+    }
+
+    if (debounce->pressed && debounce->long_us != 0 &&
+            (deadline == 0 || debounce->long_us < deadline))
+        deadline = debounce->long_us;
+    return deadline;
+}
+
+/**
+ * @brief Filter the edges of an input pin on the event loop.
+ * @param base event base.
+ * @param pin wiringPi pin number.
+ * @param config settings, copied.
+ * @param cb call back on the reported events.
+ * @param arg argument of the call back.
+ */
+void pin_debounce_watch(struct event_base *base, int pin,
+                        const pin_debounce_config_st *config,
+                        pin_debounce_cb cb, void *arg) {
+    pin_debounce_watch_st *watch;
+    pin_debounce_st *debounce;
+
+    if (g_watch_count >= PIN_GPIO_MAX_WATCHES)
+        exit(EINVAL);
+
+    watch = &g_watches[g_watch_count++];
+    watch->pin = pin;
+    watch->cb = cb;
+    watch->arg = arg;
+    watch->timer = evtimer_new(base, s_pin_debounce_timer, watch);
+    if (watch->timer == NULL)
+        exit(ENOMEM);
+
+    // both edges, the filter has to see the releases.
+    pin_gpio_watch_edge(pin, PIN_GPIO_EDGE_BOTH, s_pin_debounce_edge, watch);
+    pin_gpio_edge_start(base);
+
+    // start from the level the pin has now, without reporting it.
+    debounce = &watch->debounce;
+    pin_debounce_init(debounce, config, event_queue_now_us());
+    debounce->raw = (pin_gpio_read(pin_gpio_mask(&pin, 1)) != 0) ==
+                    (config->active_level != 0);
+    debounce->pressed = debounce->raw;
+    debounce->integral = debounce->raw ? config->debounce_us : 0;
+}
+
+static int s_pin_debounce_report(pin_debounce_st *debounce, int pressed, uint64_t at) {
+    debounce->pressed = pressed;
+    debounce->event_us = at;
+    debounce->long_fired = 0;
+    debounce->long_us = 0;
+    if (!pressed)
+        return PIN_DEBOUNCE_RELEASE;
+
+    if (debounce->config.long_press_us != 0)
+        debounce->long_us = at + debounce->config.long_press_us;
+    return PIN_DEBOUNCE_PRESS;
+}
+
+static int s_pin_debounce_settle(pin_debounce_st *debounce, uint64_t now_us) {
+    uint32_t max = debounce->config.debounce_us;
+    uint64_t elapsed, at;
+
+    switch (debounce->config.mode) {
+    case PIN_DEBOUNCE_LOCKOUT:
+        // the first edge counts right away, the bounces after it don't.
+        if (debounce->raw == debounce->pressed || now_us < debounce->lock_us)
+            return 0;
+        at = debounce->raw_us > debounce->lock_us ? debounce->raw_us :
+                                                    debounce->lock_us;
+        debounce->lock_us = at + max;
+        return s_pin_debounce_report(debounce, debounce->raw, at);
+
+    case PIN_DEBOUNCE_INTEGRATOR:
+        // up while active, down while not, the state flips at the bounds.
+        // an edge queued before a poll is older than it, no time passed.
+        if (now_us < debounce->update_us)
+            now_us = debounce->update_us;
+        elapsed = now_us - debounce->update_us;
+        at = debounce->update_us;
+        debounce->update_us = now_us;
+        if (debounce->raw) {
+            if (debounce->integral + elapsed < max) {
+                debounce->integral += elapsed;
+                return 0;
+            }
+            at += max - debounce->integral;
+            debounce->integral = max;
+            return debounce->pressed ? 0 : s_pin_debounce_report(debounce, 1, at);
+        }
+        if (elapsed < debounce->integral) {
+            debounce->integral -= elapsed;
+            return 0;
+        }
+        at += debounce->integral;
+        debounce->integral = 0;
+        return debounce->pressed ? s_pin_debounce_report(debounce, 0, at) : 0;
+
+    default:
+        // a change counts once the level stayed the same long enough.
+        if (debounce->raw == debounce->pressed ||
+                now_us - debounce->raw_us < max)
+            return 0;
+        return s_pin_debounce_report(debounce, debounce->raw,
+                                     debounce->raw_us + max);
+    }
+}
+
+static int s_pin_debounce_long(pin_debounce_st *debounce, uint64_t now_us) {
+    uint32_t repeat = debounce->config.repeat_us;
+    int event;
+
+    if (!debounce->pressed || debounce->long_us == 0 || now_us < debounce->long_us)
+        return 0;
+
+    event = debounce->long_fired ? PIN_DEBOUNCE_REPEAT : PIN_DEBOUNCE_LONG_PRESS;
+    debounce->long_fired = 1;
+    debounce->event_us = debounce->long_us;
+
+    if (repeat == 0) {
+        debounce->long_us = 0;
+    } else {
+        // late polls skip the missed repeats, they don't pile up.
+        debounce->long_us += repeat;
+        if (debounce->long_us <= now_us)
+            debounce->long_us += ((now_us - debounce->long_us) / repeat + 1) * repeat;
+    }
+    return event;
+}
+
+static void s_pin_debounce_dispatch(pin_debounce_watch_st *watch, int events,
+                                    uint64_t now_us) {
+    uint64_t deadline;
+    struct timeval tv;
+
+    if (events)
+        watch->cb(watch->pin, events, watch->debounce.event_us, watch->arg);
+
+    deadline = pin_debounce_deadline(&watch->debounce);
+    if (deadline == 0) {
+        evtimer_del(watch->timer);
+        return;
+    }
+    deadline = deadline > now_us ? deadline - now_us : 0;
+    tv.tv_sec = deadline / USEC_PER_SEC;
+    tv.tv_usec = deadline % USEC_PER_SEC;
+    evtimer_add(watch->timer, &tv);
+}
+
+static void s_pin_debounce_edge(int pin, int level, uint64_t timestamp_us, void *arg) {
+    pin_debounce_watch_st *watch = (pin_debounce_watch_st *)arg;
+    int events = pin_debounce_edge(&watch->debounce, level, timestamp_us);
+
+    s_pin_debounce_dispatch(watch, events, event_queue_now_us());
+}
+
+static void s_pin_debounce_timer(evutil_socket_t fd, short flags, void *arg) {
+    pin_debounce_watch_st *watch = (pin_debounce_watch_st *)arg;
+    uint64_t now = event_queue_now_us();
+
+    s_pin_debounce_dispatch(watch, pin_debounce_poll(&watch->debounce, now), now);
+}
+
+#if defined(XTEST) || defined(BENCH)
+
+#include <time.h>
+
+#define TRACE_MAX_EDGES     (16)        /**< Edges of one trace */
+
+/**
+ * @brief one edge of a recorded trace, button wired to a pull-up.
+ */
+typedef struct trace_edge {
+    int level;                          /**< level after the edge */
+    uint64_t at_us;                     /**< time of the edge */
+} trace_edge_st;
+
+/**
+ * @brief a recorded bounce trace and what a user did.
+ */
+typedef struct trace {
+    const char *name;                   /**< trace name */
+    int presses;                        /**< presses the user made */
+    int edges;                          /**< edges in the trace */
+    trace_edge_st edge[TRACE_MAX_EDGES];/**< the edges */
+} trace_st;
+
+/**
+ * @brief what a filter reported on one trace.
+ */
+typedef struct trace_result {
+    int presses;                        /**< PIN_DEBOUNCE_PRESS */
+    int releases;                       /**< PIN_DEBOUNCE_RELEASE */
+    int longs;                          /**< PIN_DEBOUNCE_LONG_PRESS */
+    int repeats;                        /**< PIN_DEBOUNCE_REPEAT */
+    uint64_t latency_us;                /**< first edge to first press */
+} trace_result_st;
+
+/**
+ * @brief tactile switches of the screen board, captured on a scope.
+ */
+static const trace_st g_traces[] = {
+    { "clean", 1, 2, {
+        {0, 1000}, {1, 101000} } },
+    { "bounce", 1, 10, {
+        {0, 1000}, {1, 1150}, {0, 1300}, {1, 1900}, {0, 2100},
+        {1, 120000}, {0, 120400}, {1, 120700}, {0, 121500}, {1, 122000} } },
+    { "glitch", 1, 8, {
+        {0, 50000}, {1, 50040},
+        {0, 200000}, {1, 200300}, {0, 200900},
+        {1, 300000}, {0, 300600}, {1, 301200} } },
+    { "fast", 2, 10, {
+        {0, 1000}, {1, 1200}, {0, 1400},
+        {1, 40000}, {0, 40300}, {1, 40500},
+        {0, 81000}, {1, 81300}, {0, 81500},
+        {1, 120000} } },
+    { "hold", 1, 6, {
+        {0, 1000}, {1, 1400}, {0, 1700},
+        {1, 1500000}, {0, 1500500}, {1, 1501000} } },
+};
+
+#define TRACES  (sizeof(g_traces) / sizeof(g_traces[0]))    /**< Number of traces */
+
+/**
+ * @brief the filters compared, the first one is the former 200 ms lockout.
+ */
+static const pin_debounce_config_st g_configs[] = {
+    { PIN_DEBOUNCE_LOCKOUT,    0, 200000, 800000, 150000 },
+    { PIN_DEBOUNCE_LOCKOUT,    0,  10000, 800000, 150000 },
+    { PIN_DEBOUNCE_INTEGRATOR, 0,  10000, 800000, 150000 },
+    { PIN_DEBOUNCE_STABLE,     0,  10000, 800000, 150000 },
+};
+
+static const char *g_config_names[] = {
+    "lockout 200ms", "lockout 10ms", "integrator 10ms", "stable 10ms"
+};
+
+#define CONFIGS (sizeof(g_configs) / sizeof(g_configs[0]))  /**< Number of filters */
+
+/**
+ * @brief count the reported events.
+ */
+static void s_trace_count(trace_result_st *result, const pin_debounce_st *debounce,
+                          int events, uint64_t first_us) {
+    if ((events & PIN_DEBOUNCE_PRESS) && result->presses++ == 0)
+        result->latency_us = debounce->event_us - first_us;
+    if (events & PIN_DEBOUNCE_RELEASE)
+        result->releases++;
+    if (events & PIN_DEBOUNCE_LONG_PRESS)
+        result->longs++;
+    if (events & PIN_DEBOUNCE_REPEAT)
+        result->repeats++;
+}
+
+/**
+ * @brief Replay a trace, polling at every deadline like the timer does.
+ * @return number of engine calls.
+ */
+static int s_trace_replay(const trace_st *trace, const pin_debounce_config_st *config,
+                          trace_result_st *result) {
+    uint64_t first = trace->edge[0].at_us, deadline;
+    pin_debounce_st debounce;
+    int i, events, calls = 0;
+
+    memset(result, 0, sizeof(trace_result_st));
+    pin_debounce_init(&debounce, config, 0);
+
+    for (i = 0; i < trace->edges; ++i) {
+        while ((deadline = pin_debounce_deadline(&debounce)) != 0 &&
+                deadline <= trace->edge[i].at_us) {
+            events = pin_debounce_poll(&debounce, deadline);
+            s_trace_count(result, &debounce, events, first);
+            calls++;
+        }
+        events = pin_debounce_edge(&debounce, trace->edge[i].level,
+                                   trace->edge[i].at_us);
+        s_trace_count(result, &debounce, events, first);
+        calls++;
+    }
+    // the last edge settles, released buttons have no deadline left.
+    while ((deadline = pin_debounce_deadline(&debounce)) != 0) {
+        events = pin_debounce_poll(&debounce, deadline);
+        s_trace_count(result, &debounce, events, first);
+        calls++;
+    }
+    return calls;
+}
+
+#endif
+
+#ifdef XTEST
+
+/**
+ * @brief presses each filter has to report, per trace. A lockout takes
+ *        the glitch for a press, the 200 ms one also merges fast presses.
+ */
+static const int g_expected[TRACES][CONFIGS] = {
+    {1, 1, 1, 1},   /* clean */
+    {1, 1, 1, 1},   /* bounce */
+    {1, 2, 1, 1},   /* glitch */
+    {1, 2, 2, 2},   /* fast */
+    {1, 1, 1, 1},   /* hold */
+};
+
+/**
+ * @brief A held button glitching open, the edge closing it again comes
+ *        after a poll later than it, as an edge queued by the ISR can
+ *        reach pin_debounce_watch after its timer polled.
+ * @return presses and releases reported, only the first press is expected.
+ */
+static int s_test_late_edge(const pin_debounce_config_st *config) {
+    pin_debounce_st debounce;
+    uint64_t deadline;
+    int events, reported = 0;
+
+    pin_debounce_init(&debounce, config, 0);
+    events = pin_debounce_edge(&debounce, 0, 1000);
+    events |= pin_debounce_poll(&debounce, pin_debounce_deadline(&debounce));
+    reported += (events & PIN_DEBOUNCE_PRESS) != 0;
+
+    events = pin_debounce_edge(&debounce, 1, 50000);
+    events |= pin_debounce_poll(&debounce, 50500);
+    events |= pin_debounce_edge(&debounce, 0, 50200);
+    // still held past the long press, let it settle there.
+    while ((deadline = pin_debounce_deadline(&debounce)) != 0 && deadline < 700000)
+        events |= pin_debounce_poll(&debounce, deadline);
+    reported += (events & (PIN_DEBOUNCE_PRESS | PIN_DEBOUNCE_RELEASE)) != 0;
+    return reported;
+}
+
+int main() {
+    trace_result_st result;
+    unsigned int t, c;
+    int failed = 0, expected;
+
+    printf("%-8s %-16s %7s %8s %5s %7s %10s\n", "trace", "filter",
+           "presses", "releases", "long", "repeat", "latency us");
+    for (t = 0; t < TRACES; ++t) {
+        for (c = 0; c < CONFIGS; ++c) {
+            s_trace_replay(&g_traces[t], &g_configs[c], &result);
+            printf("%-8s %-16s %7d %8d %5d %7d %10llu\n", g_traces[t].name,
+                   g_config_names[c], result.presses, result.releases,
+                   result.longs, result.repeats,
+                   (unsigned long long)result.latency_us);
+
+            expected = g_expected[t][c];
+            if (result.presses != expected || result.releases != expected)
+                failed++;
+            // held 1.5 s: long press at 0.8 s, then every 150 ms.
+            if (strcmp(g_traces[t].name, "hold") == 0 &&
+                    (result.longs != 1 || result.repeats != 4))
+                failed++;
+        }
+    }
+
+    // a lockout takes the first edge for a press anyway.
+    for (c = 0; c < CONFIGS; ++c) {
+        if (g_configs[c].mode != PIN_DEBOUNCE_LOCKOUT &&
+                s_test_late_edge(&g_configs[c]) != 1) {
+            printf("%s: late edge reported\n", g_config_names[c]);
+            failed++;
+        }
+    }
+
+    printf("%s\n", failed ? "FAILED" : "SUCCESS!");
+    return failed;
+}
+
+#endif
+
+#ifdef BENCH
+
+#define BENCH_ROUNDS        (200000)    /**< Replays of every trace */
+
+int main() {
+    struct timespec start, end;
+    trace_result_st result;
+    unsigned int t, c;
+    long calls;
+    int r;
+    double ns;
+
+    printf("%-8s %-16s %7s %10s %10s\n", "trace", "filter", "presses",
+           "latency us", "ns/call");
+    for (t = 0; t < TRACES; ++t) {
+        for (c = 0; c < CONFIGS; ++c) {
+            calls = 0;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (r = 0; r < BENCH_ROUNDS; ++r)
+                calls += s_trace_replay(&g_traces[t], &g_configs[c], &result);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+            printf("%-8s %-16s %4d/%-2d %10llu %10.1f\n", g_traces[t].name,
+                   g_config_names[c], result.presses, g_traces[t].presses,
+                   (unsigned long long)result.latency_us, ns / calls);
+        }
+    }
+    return 0;
+}
+
+#endif
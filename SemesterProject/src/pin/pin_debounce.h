@@ -0,0 +1,115 @@
+/**
+ * @file pin_debounce.h
+ * @brief input filter of digital pins, declaration.
+ *        The engine is a pure function of (level, timestamp) edges plus
+ *        polls at the deadline it asks for; pin_debounce_watch wires it
+ *        to a GPIO pin and a timer on the event loop.
+ * @author Xiangyu Guo
+ */
+#ifndef __PIN_DEBOUNCE_H__
+#define __PIN_DEBOUNCE_H__
+
+#include <stdint.h>
+
+#define PIN_DEBOUNCE_LOCKOUT        (0)     /**< Report at once, ignore edges for a while */
+#define PIN_DEBOUNCE_INTEGRATOR     (1)     /**< Integrate the time spent at each level */
+#define PIN_DEBOUNCE_STABLE         (2)     /**< Report once the level stayed unchanged */
+
+#define PIN_DEBOUNCE_PRESS          (0x01)  /**< Became active */
+#define PIN_DEBOUNCE_RELEASE        (0x02)  /**< Became inactive */
+#define PIN_DEBOUNCE_LONG_PRESS     (0x04)  /**< Active for long_press_us */
+#define PIN_DEBOUNCE_REPEAT         (0x08)  /**< Still active, every repeat_us */
+
+/**
+ * @brief filter settings of one pin.
+ */
+typedef struct pin_debounce_config {
+    int mode;                       /**< PIN_DEBOUNCE_LOCKOUT, _INTEGRATOR or _STABLE */
+    int active_level;               /**< level while pressed, 0 with a pull-up */
+    uint32_t debounce_us;           /**< lockout, integration or settle time */
+    uint32_t long_press_us;         /**< long press after, 0 disables */
+    uint32_t repeat_us;             /**< repeat period after a long press, 0 disables */
+} pin_debounce_config_st;
+
+/**
+ * @brief filter state of one pin, kept by the caller.
+ */
+typedef struct pin_debounce {
+    pin_debounce_config_st config;  /**< settings */
+    int raw;                        /**< last level seen, 1 active */
+    int pressed;                    /**< reported state */
+    uint64_t raw_us;                /**< time of the last raw change */
+    uint64_t update_us;             /**< integrator: last update */
+    uint32_t integral;              /**< integrator: time active, 0 to debounce_us */
+    uint64_t lock_us;               /**< lockout: edges ignored until */
+    uint64_t event_us;              /**< time of the last reported event */
+    uint64_t long_us;               /**< next long press or repeat */
+    int long_fired;                 /**< long press reported */
+} pin_debounce_st;
+
+/**
+ * @brief call back of a watched pin, runs on the event loop.
+ * @param pin wiringPi pin number.
+ * @param events PIN_DEBOUNCE_PRESS, _RELEASE, _LONG_PRESS, _REPEAT.
+ * @param timestamp_us time of the reported event, CLOCK_MONOTONIC.
+ * @param arg the argument given when watching.
+ */
+typedef void (*pin_debounce_cb)(int pin, int events, uint64_t timestamp_us,
+                                void *arg);
+
+struct event_base;
+
+/* =================
+    engine function
+   ================= */
+/**
+ * @brief Initialize the filter of one pin, released.
+ * @param debounce [out] filter state.
+ * @param config settings, copied.
+ * @param now_us current time.
+ */
+void pin_debounce_init(pin_debounce_st *debounce,
+                       const pin_debounce_config_st *config, uint64_t now_us);
+
+/**
+ * @brief Feed one edge.
+ *        Polled at its deadlines, one call reports at most one change.
+ * @param debounce a valid filter.
+ * @param level level after the edge.
+ * @param timestamp_us time of the edge, never before the previous edge,
+ *        it may be before the last poll.
+ * @return reported events, 0 if none.
+ */
+int pin_debounce_edge(pin_debounce_st *debounce, int level, uint64_t timestamp_us);
+
+/**
+ * @brief Let the time pass without an edge.
+ * @param debounce a valid filter.
+ * @param now_us current time, never going back.
+ * @return reported events, 0 if none.
+ */
+int pin_debounce_poll(pin_debounce_st *debounce, uint64_t now_us);
+
+/**
+ * @brief Time the filter has to be polled at.
+ * @param debounce a valid filter.
+ * @return deadline, 0 if nothing is pending.
+ */
+uint64_t pin_debounce_deadline(const pin_debounce_st *debounce);
+
+/* =================
+    watch function
+   ================= */
+/**
+ * @brief Filter the edges of an input pin on the event loop.
+ * @param base event base.
+ * @param pin wiringPi pin number.
+ * @param config settings, copied.
+ * @param cb call back on the reported events.
+ * @param arg argument of the call back.
+ */
+void pin_debounce_watch(struct event_base *base, int pin,
+                        const pin_debounce_config_st *config,
+                        pin_debounce_cb cb, void *arg);
+
+#endif
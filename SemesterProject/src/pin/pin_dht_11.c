@@ -12,6 +12,13 @@
 #include <wiringPi.h>
 
 #include "pin_dht_11.h"
+#include "../bus_trace.h"
+#include "../tracing.h"
+#include "../probes.h"
+
+#ifdef BENCH
+#include "../bench.h"
+#endif
 
 #define MAXTIMINGS      (85)            /**< Time required to receive 43 bytes */
 
@@ -21,8 +28,17 @@
 
 #define ONE_BYTE        (8)             /**< Size of one byte */
 #define CHECK_MASK      (0xFF)          /**< Mask of one byte */
+#define DHT_BYTES       (5)             /**< Humidity, temperature, checksum */
+#define DHT_BITS        (40)            /**< Bits in the answer */
+#define ONE_THRESHOLD   (16)            /**< Loop turns of a high 1 bit */
 
 static int pin_dht_11_inner_read(dht_data_st *data);
+static int pin_dht_11_sample(uint8_t *dht_bytes);
+static int pin_dht_11_capture(uint8_t *counts);
+static int pin_dht_11_decode(const uint8_t *counts, int transitions,
+                             uint8_t *dht_bytes);
+static int pin_dht_11_convert(const uint8_t *dht_bytes, int bits,
+                              dht_data_st *data);
 
 /**
  * @brief read data from the module.
@@ -30,9 +46,11 @@ static int pin_dht_11_inner_read(dht_data_st *data);
  * @return 0 success
  */
 int pin_dht_11_read(dht_data_st *data) {
-    while (pin_dht_11_inner_read(data) == ENODATA) { 
-        printf("Failed to read data\n");       
-    }
+    tracing_begin("pin_dht_11_read", "dht11");
+    // each failed attempt shows as a dht11_read_fail probe.
+    while (pin_dht_11_inner_read(data) == ENODATA)
+        ;
+    tracing_end();
     return 0;
 }
 
@@ -43,16 +61,61 @@ int pin_dht_11_read(dht_data_st *data) {
  */
 static int pin_dht_11_inner_read(dht_data_st *data)
 {
-    uint8_t laststate   = HIGH;
-    uint8_t counter     = 0;
-    uint8_t i, j        = 0;
     int32_t result      = ENODATA;
-    int32_t dht_bytes[5] = { 0, 0, 0, 0, 0 };
+    uint8_t dht_bytes[DHT_BYTES] = { 0, 0, 0, 0, 0 };
+    uint64_t start;
+    int j;
 
     if (data == NULL)
         return result;
 
-    memset(dht_bytes, 0, sizeof(dht_bytes));
+    PROBE0(dht11_read_start);
+    /* the whole exchange is one transaction of the trace */
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        j = bus_trace_replay(BUS_TRACE_DHT11_READ, 0, 0, dht_bytes, DHT_BYTES);
+    } else {
+        // one span per attempt, the retries show.
+        tracing_begin("pin_dht_11_sample", "dht11");
+        start = bus_trace_start();
+        j = pin_dht_11_sample(dht_bytes);
+        bus_trace_record(start, BUS_TRACE_DHT11_READ, 0, 0, j, dht_bytes, DHT_BYTES);
+        tracing_end();
+    }
+
+    // reads run on the I/O thread, which must not wait on stdout.
+    if (pin_dht_11_convert(dht_bytes, j, data) == 0) {
+        PROBE2(dht11_read_ok, dht_bytes[0], dht_bytes[2]);
+        result = 0;
+    } else {
+        PROBE1(dht11_read_fail, j);
+        result = ENODATA;
+    }
+
+    return result;
+}
+
+/**
+ * @brief send the start signal and decode the answer.
+ * @param dht_bytes [out] the 5 bytes received.
+ * @return number of bits received.
+ */
+static int pin_dht_11_sample(uint8_t *dht_bytes)
+{
+    uint8_t counts[MAXTIMINGS];
+
+    return pin_dht_11_decode(counts, pin_dht_11_capture(counts), dht_bytes);
+}
+
+/**
+ * @brief send the start signal and time the answer.
+ * @param counts [out] loop turns spent before each transition.
+ * @return number of transitions seen.
+ */
+static int pin_dht_11_capture(uint8_t *counts)
+{
+    uint8_t laststate   = HIGH;
+    uint8_t counter     = 0;
+    uint8_t i;
 
     /* pull pin down for 18 milliseconds */
     pinMode(DHT_DATA_PIN, OUTPUT);
@@ -64,7 +127,7 @@ static int pin_dht_11_inner_read(dht_data_st *data)
     /* prepare to read the pin */
     pinMode(DHT_DATA_PIN, INPUT);
 
-    /* detect change and read data */
+    /* detect change, the bits are decoded once the line is quiet */
     for (i = 0; i < MAXTIMINGS; i++) {
         counter = 0;
         while (digitalRead(DHT_DATA_PIN) == laststate) {
@@ -78,60 +141,168 @@ static int pin_dht_11_inner_read(dht_data_st *data)
             break;
 
         laststate = digitalRead(DHT_DATA_PIN);
+        counts[i] = counter;
+    }
+    return i;
+}
 
-        /* ignore first 3 transitions */
-        if (i < 3)
-            continue;
+/**
+ * @brief turn the length of the high pulses into bits.
+ * @param counts loop turns before each transition.
+ * @param transitions number of counts.
+ * @param dht_bytes [out] the 5 bytes received.
+ * @return number of bits received.
+ */
+static int pin_dht_11_decode(const uint8_t *counts, int transitions,
+                             uint8_t *dht_bytes)
+{
+    int i, j = 0;
 
-        if ((i % 2 == 0)) {
-            /* shove each bit into the storage bytes */
-            dht_bytes[j / ONE_BYTE] <<= 1;
-            if (counter > 16)
-                dht_bytes[j / ONE_BYTE] |= 1;
-            j++;
-        }
-    }
+    memset(dht_bytes, 0, DHT_BYTES);
 
-    /*
-     * check we read 40 bits (8bit x 5 ) + verify checksum in the last byte
-     * print it out if data is good
-     */
-    if ((j >= 40) &&
-        (dht_bytes[4] == ((dht_bytes[0] + dht_bytes[1] + 
-                           dht_bytes[2] + dht_bytes[3]) & CHECK_MASK))) {
-        data->humidity = dht_bytes[0];
-        data->humidity += dht_bytes[1] / 10.0;
-
-        data->temperature = dht_bytes[2];
-        data->temperature += dht_bytes[3] / 10.0;
-
-        printf( "Humidity = %d.%d %% Temperature = %d.%d *C\n",
-            dht_bytes[0], dht_bytes[1], dht_bytes[2], dht_bytes[3]);
-        result = 0;
-    } else {
-        printf( "Data not good, skip\n" );
-        result = ENODATA;
+    /* ignore first 3 transitions, and a stray edge after the 40 bits */
+    for (i = 4; i < transitions && j < DHT_BITS; i += 2) {
+        /* shove each bit into the storage bytes */
+        dht_bytes[j / ONE_BYTE] <<= 1;
+        if (counts[i] > ONE_THRESHOLD)
+            dht_bytes[j / ONE_BYTE] |= 1;
+        j++;
     }
+    return j;
+}
 
-    return result;
+/**
+ * @brief check we read 40 bits (8bit x 5 ) + verify checksum in the last byte
+ * @param dht_bytes the 5 bytes received.
+ * @param bits number of bits received.
+ * @param data [out] humidity and temperature.
+ * @return 0 success, otherwise ENODATA
+ */
+static int pin_dht_11_convert(const uint8_t *dht_bytes, int bits,
+                              dht_data_st *data)
+{
+    if ((bits < DHT_BITS) ||
+        (dht_bytes[4] != ((dht_bytes[0] + dht_bytes[1] +
+                           dht_bytes[2] + dht_bytes[3]) & CHECK_MASK)))
+        return ENODATA;
+
+    data->humidity = dht_bytes[0];
+    data->humidity += dht_bytes[1] / 10.0;
+
+    data->temperature = dht_bytes[2];
+    data->temperature += dht_bytes[3] / 10.0;
+    return 0;
 }
 
 /**
- * @brief initialize the module.
+ * @brief initialize the module, the line idles high between reads.
+ *        wiringPi is set up by the caller.
  */
 void pin_dht_11_init() {
-    if (wiringPiSetup() == -1)
-        exit(errno);
+    if (bus_trace_mode() == BUS_TRACE_REPLAY)
+        return;
+    pinMode(DHT_DATA_PIN, OUTPUT);
+    digitalWrite(DHT_DATA_PIN, HIGH);
 }
 
 #ifdef XTEST
 
+#ifdef SIM
+#include "../sim/sim.h"
+
+/* a loop turn is a 1 us delay and a 1 us read on the simulated board */
+#define ANSWER_US       (4960)          /**< Response and 40 bits of 1 */
+#define LOOP_TURN_US    (2)             /**< Delay and read of one turn */
+#define BUDGET_READS    (ANSWER_US / LOOP_TURN_US + 2 * MAXTIMINGS)
+#define BUDGET_SLEEP_US (DOWN_TIME * 1000 + UP_TIME + ANSWER_US / LOOP_TURN_US)
+#endif
+
 int main() {
     dht_data_st value;
+    int failed = 0;
+#ifdef SIM
+    sim_usage_st mark;
+#endif
+    if (wiringPiSetup() == -1)
+        exit(errno);
     pin_dht_11_init();
+#ifdef SIM
+    sim_dht11_set(553, 214);
+    sim_usage_mark(&mark);
+#endif
     pin_dht_11_read(&value);
+#ifdef SIM
+    // one good answer, not a retry.
+    failed |= sim_usage_check("dht11 read", &mark, SIM_BUS_GPIO,
+                              BUDGET_READS, BUDGET_SLEEP_US);
+#endif
     printf("Temperature: %.2f\nHumidity: %.2f\n", 
             value.temperature, value.humidity);
+#ifdef SIM
+    // the waveform is decoded by counting loop turns, on the virtual clock.
+    failed = value.humidity != 55.3 || value.temperature != 21.4;
+    printf("%s\n", failed ? "FAILED" : "SUCCESS!");
+#endif
+    return failed;
+}
+
+#endif
+
+#ifdef BENCH
+
+#define BENCH_SHORT     (8)             /**< Loop turns of a 0 or a gap */
+#define BENCH_LONG      (24)            /**< Loop turns of a 1 */
+
+/**
+ * @brief the pulses of 55.3 % and 21.4 *C, as counted by the capture.
+ */
+static int s_bench_waveform(uint8_t *counts) {
+    static const uint8_t bytes[DHT_BYTES] = { 55, 3, 21, 4, 83 };
+    int i, bit;
+
+    counts[0] = counts[1] = counts[2] = counts[3] = BENCH_SHORT;
+    for (i = 4, bit = 0; bit < DHT_BITS; i += 2, ++bit) {
+        counts[i] = bytes[bit / ONE_BYTE] & (0x80 >> (bit % ONE_BYTE)) ?
+                                                    BENCH_LONG : BENCH_SHORT;
+        counts[i + 1] = BENCH_SHORT;
+    }
+    return i;
+}
+
+/**
+ * @brief pulses to bytes.
+ */
+static void s_bench_decode(void *arg, long n) {
+    uint8_t counts[MAXTIMINGS], bytes[DHT_BYTES];
+    int transitions = s_bench_waveform(counts);
+
+    while (n-- > 0) {
+        bench_keep(counts);
+        pin_dht_11_decode(counts, transitions, bytes);
+        bench_keep(bytes);
+    }
+}
+
+/**
+ * @brief pulses to humidity and temperature, checksum included.
+ */
+static void s_bench_decode_convert(void *arg, long n) {
+    uint8_t counts[MAXTIMINGS], bytes[DHT_BYTES];
+    int transitions = s_bench_waveform(counts);
+    dht_data_st data;
+
+    while (n-- > 0) {
+        bench_keep(counts);
+        if (pin_dht_11_convert(bytes, pin_dht_11_decode(counts, transitions, bytes),
+                               &data) != 0)
+            exit(EPROTO);
+        bench_keep(&data);
+    }
+}
+
+int main() {
+    bench_run("dht11", "decode", s_bench_decode, NULL, NULL);
+    bench_run("dht11", "decode+convert", s_bench_decode_convert, NULL, NULL);
     return 0;
 }
 
@@ -19,7 +19,8 @@ typedef struct dht_data {
 int pin_dht_11_read(dht_data_st *data);
 
 /**
- * @brief initialize the module.
+ * @brief initialize the module, the line idles high between reads.
+ *        wiringPi is set up by the caller.
  */
 void pin_dht_11_init();
 #endif
\ No newline at end of file
@@ -0,0 +1,486 @@
+/**
+ * @file pin_gpio.c
+ * @brief memory mapped GPIO, implementation.
+ *        The BCM2835 family keeps one set, clear and level register per
+ *        bank of 32 pins, so a mask is applied with a single access.
+ *        Edges come from wiringPi interrupt threads, through an event
+ *        queue to the event loop. Built with GPIO_CDEV, only the pin
+ *        translation is used and pin_gpio_cdev.c does the rest.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <event2/event.h>
+#include <wiringPi.h>
+
+#include "../event_queue.h"
+#include "../bus_trace.h"
+#include "pin_gpio.h"
+
+#ifdef SIM
+#include "../sim/sim.h"
+#define GPIO_READ(reg)          sim_gpio_read_reg(g_gpio, reg)
+#define GPIO_WRITE(reg, value)  sim_gpio_write_reg(g_gpio, reg, value)
+#else
+#define GPIO_READ(reg)          (g_gpio[reg])
+#define GPIO_WRITE(reg, value)  (g_gpio[reg] = (value))
+#endif
+
+#define GPIO_FSEL0          (0x00 / 4)  /**< Function select, 10 pins each */
+#define GPIO_SET0           (0x1C / 4)  /**< Output set, bank 0 */
+#define GPIO_CLR0           (0x28 / 4)  /**< Output clear, bank 0 */
+#define GPIO_LEV0           (0x34 / 4)  /**< Pin level, bank 0 */
+
+#define GPIO_FSEL_PINS      (10)        /**< Pins per function select register */
+#define GPIO_FSEL_BITS      (3)         /**< Bits per pin in function select */
+#define GPIO_FSEL_MASK      (0x07)      /**< Function select of one pin */
+#define GPIO_BANK_PINS      (32)        /**< Pins in one bank */
+
+#define WPI_PINS            (32)        /**< Known wiringPi pins */
+#define EDGE_QUEUE_SIZE     (32)        /**< Pending edges of all pins */
+
+/**
+ * @brief wiringPi pin to BCM pin, board revision 2 and later.
+ */
+static const int g_wpi_to_bcm[WPI_PINS] = {
+    17, 18, 27, 22, 23, 24, 25,  4,
+     2,  3,  8,  7, 10,  9, 11, 14,
+    15, 28, 29, 30, 31,  5,  6, 13,
+    19, 26, 12, 16, 20, 21,  0,  1
+};
+
+/**
+ * @brief Translate wiringPi pins into one mask.
+ * @param pins wiringPi pin numbers.
+ * @param count number of pins.
+ * @return mask of the BCM pins.
+ */
+pin_gpio_mask_t pin_gpio_mask(const int *pins, int count) {
+    pin_gpio_mask_t mask = 0;
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        if (pins[i] < 0 || pins[i] >= WPI_PINS)
+            exit(EINVAL);
+        mask |= (pin_gpio_mask_t)1 << g_wpi_to_bcm[pins[i]];
+    }
+    return mask;
+}
+
+#ifndef GPIO_CDEV
+
+/**
+ * @brief one watched input pin.
+ */
+typedef struct pin_gpio_watch {
+    int pin;                            /**< wiringPi pin number */
+    int edge;                           /**< watched edges */
+    pin_gpio_mask_t mask;               /**< register bit of the pin */
+    pin_gpio_edge_cb cb;                /**< call back on the loop */
+    void *arg;                          /**< argument of the call back */
+} pin_gpio_watch_st;
+
+static volatile uint32_t *g_gpio = NULL;    /**< Mapped registers */
+
+static pin_gpio_watch_st g_watches[PIN_GPIO_MAX_WATCHES]; /**< Watched pins */
+static int g_watch_count = 0;               /**< Watched pins in use */
+static event_queue_st *g_edge_queue = NULL; /**< Edges from the ISRs */
+static struct event *g_edge_event = NULL;   /**< Watching the edge queue */
+
+/**
+ * @brief Map a GPIO register block.
+ * @param path device or plain file.
+ */
+static void s_pin_gpio_map(const char *path);
+
+/**
+ * @brief Queue one edge, from the wiringPi interrupt thread.
+ * @param index watch index.
+ */
+static void s_pin_gpio_isr(int index);
+
+/**
+ * @brief Hand the queued edges to their call backs, on the event loop.
+ */
+static void s_pin_gpio_edge_callback(evutil_socket_t fd, short flags, void *arg);
+
+/**
+ * @brief wiringPi handlers take no argument, one trampoline per watch.
+ */
+#define PIN_GPIO_ISR(n) static void s_pin_gpio_isr_##n(void) { s_pin_gpio_isr(n); }
+PIN_GPIO_ISR(0)
+PIN_GPIO_ISR(1)
+PIN_GPIO_ISR(2)
+PIN_GPIO_ISR(3)
+PIN_GPIO_ISR(4)
+PIN_GPIO_ISR(5)
+PIN_GPIO_ISR(6)
+PIN_GPIO_ISR(7)
+
+static void (*const g_isrs[PIN_GPIO_MAX_WATCHES])(void) = {
+    s_pin_gpio_isr_0, s_pin_gpio_isr_1, s_pin_gpio_isr_2, s_pin_gpio_isr_3,
+    s_pin_gpio_isr_4, s_pin_gpio_isr_5, s_pin_gpio_isr_6, s_pin_gpio_isr_7
+};
+
+/**
+ * @brief Map the GPIO registers, calling it again does nothing.
+ */
+void pin_gpio_setup() {
+    // a replay answers from the trace, there may be no registers at all.
+    if (bus_trace_mode() == BUS_TRACE_REPLAY)
+        return;
+#ifdef SIM
+    // the simulated board keeps the registers, nothing to map.
+    if (g_gpio == NULL)
+        g_gpio = sim_gpio_block();
+#else
+    s_pin_gpio_map(PIN_GPIO_DEVICE);
+#endif
+}
+
+/**
+ * @brief Map a plain file in place of the GPIO registers, for testing.
+ * @param path a file of at least PIN_GPIO_BLOCK_SIZE bytes.
+ */
+void pin_gpio_setup_file(const char *path) {
+    s_pin_gpio_map(path);
+}
+
+/**
+ * @brief Unmap the GPIO registers, edges are no longer delivered.
+ */
+void pin_gpio_fini() {
+    // wiringPi can't release an interrupt, its threads stay; drop what they push.
+    g_watch_count = 0;
+    if (g_edge_event != NULL) {
+        event_free(g_edge_event);
+        g_edge_event = NULL;
+    }
+
+    if (g_gpio == NULL)
+        return;
+#ifdef SIM
+    if (g_gpio == sim_gpio_block()) {
+        g_gpio = NULL;
+        return;
+    }
+#endif
+    munmap((void *)g_gpio, PIN_GPIO_BLOCK_SIZE);
+    g_gpio = NULL;
+}
+
+/**
+ * @brief Select the function of every pin in the mask.
+ * @param mask pins to change.
+ * @param mode PIN_GPIO_INPUT or PIN_GPIO_OUTPUT.
+ */
+void pin_gpio_mode(pin_gpio_mask_t mask, int mode) {
+    uint64_t start;
+    uint32_t fsel;
+    int pin, shift;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        bus_trace_replay(BUS_TRACE_GPIO_MODE, 0, mask, NULL, 0);
+        return;
+    }
+    if (g_gpio == NULL)
+        exit(ENODEV);
+
+    start = bus_trace_start();
+    for (pin = 0; pin < GPIO_BANK_PINS; ++pin) {
+        if (!(mask & ((pin_gpio_mask_t)1 << pin)))
+            continue;
+        shift = pin % GPIO_FSEL_PINS * GPIO_FSEL_BITS;
+        fsel = GPIO_READ(GPIO_FSEL0 + pin / GPIO_FSEL_PINS);
+        fsel &= ~(GPIO_FSEL_MASK << shift);
+        fsel |= (mode & GPIO_FSEL_MASK) << shift;
+        GPIO_WRITE(GPIO_FSEL0 + pin / GPIO_FSEL_PINS, fsel);
+    }
+    bus_trace_record(start, BUS_TRACE_GPIO_MODE, 0, mask, mode, NULL, 0);
+}
+
+/**
+ * @brief Drive every pin in the mask high, in one write.
+ * @param mask pins to set.
+ */
+void pin_gpio_set(pin_gpio_mask_t mask) {
+    uint64_t start;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        bus_trace_replay(BUS_TRACE_GPIO_SET, 0, mask, NULL, 0);
+        return;
+    }
+    if (g_gpio == NULL)
+        exit(ENODEV);
+    start = bus_trace_start();
+    GPIO_WRITE(GPIO_SET0, mask);
+    bus_trace_record(start, BUS_TRACE_GPIO_SET, 0, mask, 0, NULL, 0);
+}
+
+/**
+ * @brief Drive every pin in the mask low, in one write.
+ * @param mask pins to clear.
+ */
+void pin_gpio_clear(pin_gpio_mask_t mask) {
+    uint64_t start;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        bus_trace_replay(BUS_TRACE_GPIO_CLEAR, 0, mask, NULL, 0);
+        return;
+    }
+    if (g_gpio == NULL)
+        exit(ENODEV);
+    start = bus_trace_start();
+    GPIO_WRITE(GPIO_CLR0, mask);
+    bus_trace_record(start, BUS_TRACE_GPIO_CLEAR, 0, mask, 0, NULL, 0);
+}
+
+/**
+ * @brief Drive the pins in the mask to the given levels.
+ *        One write to the set and one to the clear register, at most.
+ * @param mask pins to change.
+ * @param levels wanted level of each pin in the mask.
+ */
+void pin_gpio_write(pin_gpio_mask_t mask, pin_gpio_mask_t levels) {
+    uint64_t start;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        bus_trace_replay(BUS_TRACE_GPIO_WRITE, 0, mask, NULL, 0);
+        return;
+    }
+    if (g_gpio == NULL)
+        exit(ENODEV);
+    start = bus_trace_start();
+    if (mask & levels)
+        GPIO_WRITE(GPIO_SET0, mask & levels);
+    if (mask & ~levels)
+        GPIO_WRITE(GPIO_CLR0, mask & ~levels);
+    bus_trace_record(start, BUS_TRACE_GPIO_WRITE, 0, mask, levels, NULL, 0);
+}
+
+/**
+ * @brief Read the level of the pins in the mask, in one read.
+ * @param mask pins to read.
+ * @return levels of the pins in the mask, other bits are 0.
+ */
+pin_gpio_mask_t pin_gpio_read(pin_gpio_mask_t mask) {
+    pin_gpio_mask_t levels;
+    uint64_t start;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY)
+        return bus_trace_replay(BUS_TRACE_GPIO_READ, 0, mask, NULL, 0);
+    if (g_gpio == NULL)
+        exit(ENODEV);
+    start = bus_trace_start();
+    levels = GPIO_READ(GPIO_LEV0) & mask;
+    bus_trace_record(start, BUS_TRACE_GPIO_READ, 0, mask, levels, NULL, 0);
+    return levels;
+}
+
+/**
+ * @brief Call back on edges of an input pin.
+ *        Edges are queued until pin_gpio_edge_start.
+ * @param pin wiringPi pin number.
+ * @param edge PIN_GPIO_EDGE_RISING, _FALLING or _BOTH.
+ * @param cb call back on the event loop.
+ * @param arg argument of the call back.
+ */
+void pin_gpio_watch_edge(int pin, int edge, pin_gpio_edge_cb cb, void *arg) {
+    static const int modes[] = {0, INT_EDGE_RISING, INT_EDGE_FALLING, INT_EDGE_BOTH};
+    pin_gpio_watch_st *watch;
+
+    if (g_watch_count >= PIN_GPIO_MAX_WATCHES || edge < PIN_GPIO_EDGE_RISING ||
+            edge > PIN_GPIO_EDGE_BOTH)
+        exit(EINVAL);
+
+    pin_gpio_setup();
+    if (g_edge_queue == NULL) {
+        g_edge_queue = event_queue_init(EDGE_QUEUE_SIZE);
+        if (wiringPiSetup() < LOW)
+            exit(errno);
+    }
+
+    watch = &g_watches[g_watch_count];
+    watch->pin = pin;
+    watch->edge = edge;
+    watch->mask = pin_gpio_mask(&pin, 1);
+    watch->cb = cb;
+    watch->arg = arg;
+
+    if (wiringPiISR(pin, modes[edge], g_isrs[g_watch_count]) < 0)
+        exit(errno);
+    // published after the watch is complete, for the interrupt thread.
+    __atomic_store_n(&g_watch_count, g_watch_count + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Deliver the edges of every watched pin on the event loop,
+ *        calling it again does nothing.
+ * @param base event base.
+ */
+void pin_gpio_edge_start(struct event_base *base) {
+    if (g_edge_event != NULL)
+        return;
+
+    if (g_edge_queue == NULL)
+        g_edge_queue = event_queue_init(EDGE_QUEUE_SIZE);
+
+    g_edge_event = event_new(base, event_queue_fd(g_edge_queue),
+                             EV_READ | EV_PERSIST, s_pin_gpio_edge_callback, NULL);
+    if (g_edge_event == NULL) {
+        fprintf(stderr, "Couldn't create an event: exiting\n");
+        exit(errno);
+    }
+    event_add(g_edge_event, NULL);
+}
+
+static void s_pin_gpio_isr(int index) {
+    pin_gpio_watch_st *watch = &g_watches[index];
+    int level;
+
+    if (index >= __atomic_load_n(&g_watch_count, __ATOMIC_ACQUIRE))
+        return;
+
+    // with a single edge the level is known, reading may catch a bounce.
+    if (watch->edge == PIN_GPIO_EDGE_BOTH)
+        level = pin_gpio_read(watch->mask) != 0;
+    else
+        level = watch->edge == PIN_GPIO_EDGE_RISING;
+
+    // only queue, the edge is time stamped here and handled on the loop.
+    event_queue_push(g_edge_queue, index, level);
+}
+
+static void s_pin_gpio_edge_callback(evutil_socket_t fd, short flags, void *arg) {
+    event_queue_item_st item;
+    pin_gpio_watch_st *watch;
+
+    event_queue_ack(g_edge_queue);
+    while (event_queue_pop(g_edge_queue, &item) == 0) {
+        if (item.type >= g_watch_count)
+            continue;
+        watch = &g_watches[item.type];
+        watch->cb(watch->pin, item.value, item.timestamp_us, watch->arg);
+    }
+}
+
+static void s_pin_gpio_map(const char *path) {
+    void *block;
+    int fd;
+
+    if (g_gpio != NULL)
+        return;
+
+    fd = open(path, O_RDWR | O_SYNC | O_CLOEXEC);
+    if (fd < 0)
+        exit(errno);
+
+    block = mmap(NULL, PIN_GPIO_BLOCK_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+    // the mapping stays valid without the descriptor.
+    close(fd);
+    if (block == MAP_FAILED)
+        exit(errno);
+
+    g_gpio = (volatile uint32_t *)block;
+}
+
+#ifdef XTEST
+
+#include <string.h>
+
+#define TEST_FILE       "/tmp/pin_gpio_test"    /**< Stand-in register block */
+
+static int g_failed = 0;                /**< Failed checks */
+static int g_edges = 0;                 /**< Edges delivered */
+static int g_last_level = -1;           /**< Level of the last edge */
+
+/**
+ * @brief compare one register of the stand-in block.
+ */
+static void s_test_check(const char *what, uint32_t got, uint32_t expected) {
+    printf("%-12s 0x%08x (expected 0x%08x)\n", what, got, expected);
+    if (got != expected)
+        g_failed++;
+}
+
+/**
+ * @brief count the delivered edges.
+ */
+static void s_test_edge(int pin, int level, uint64_t timestamp_us, void *arg) {
+    g_edges++;
+    g_last_level = level;
+    if (pin != 29 || arg != &g_edges || timestamp_us == 0)
+        g_failed++;
+}
+
+int main() {
+    static const int leds[] = {7, 0, 2, 3, 25};
+    static const int motor[] = {21, 22, 23};
+    char zero[PIN_GPIO_BLOCK_SIZE];
+    pin_gpio_mask_t led_mask, motor_mask;
+    struct event_base *base;
+    FILE *fp;
+
+    // a plain file stands in for the registers.
+    memset(zero, 0, sizeof(zero));
+    fp = fopen(TEST_FILE, "w");
+    fwrite(zero, 1, sizeof(zero), fp);
+    fclose(fp);
+    pin_gpio_setup_file(TEST_FILE);
+
+    led_mask = pin_gpio_mask(leds, 5);
+    motor_mask = pin_gpio_mask(motor, 3);
+    // wiringPi 7, 0, 2, 3, 25 are BCM 4, 17, 27, 22, 26.
+    s_test_check("led mask", led_mask, (1u << 4) | (1u << 17) | (1u << 27) |
+                                        (1u << 22) | (1u << 26));
+    // wiringPi 21, 22, 23 are BCM 5, 6, 13.
+    s_test_check("motor mask", motor_mask, (1u << 5) | (1u << 6) | (1u << 13));
+
+    pin_gpio_mode(led_mask, PIN_GPIO_OUTPUT);
+    // BCM 4 in FSEL0, 17 in FSEL1, 22, 26 and 27 in FSEL2.
+    s_test_check("fsel0", g_gpio[GPIO_FSEL0], 1u << 12);
+    s_test_check("fsel1", g_gpio[GPIO_FSEL0 + 1], 1u << 21);
+    s_test_check("fsel2", g_gpio[GPIO_FSEL0 + 2], (1u << 6) | (1u << 18) | (1u << 21));
+    pin_gpio_mode(1u << 22, PIN_GPIO_INPUT);
+    s_test_check("fsel2 input", g_gpio[GPIO_FSEL0 + 2], (1u << 18) | (1u << 21));
+
+    pin_gpio_set(led_mask);
+    s_test_check("set", g_gpio[GPIO_SET0], led_mask);
+    pin_gpio_clear(motor_mask);
+    s_test_check("clear", g_gpio[GPIO_CLR0], motor_mask);
+
+    pin_gpio_write(motor_mask, 1u << 5);
+    s_test_check("write set", g_gpio[GPIO_SET0], 1u << 5);
+    s_test_check("write clear", g_gpio[GPIO_CLR0], (1u << 6) | (1u << 13));
+
+    g_gpio[GPIO_LEV0] = 0xFFFF0000;
+    s_test_check("read", pin_gpio_read(led_mask), (1u << 17) | (1u << 27) |
+                                                  (1u << 22) | (1u << 26));
+
+    // interrupts are raised by hand, wiringPi stands in for the kernel.
+    base = event_base_new();
+    pin_gpio_watch_edge(29, PIN_GPIO_EDGE_FALLING, s_test_edge, &g_edges);
+    pin_gpio_watch_edge(28, PIN_GPIO_EDGE_BOTH, s_test_edge, NULL);
+    s_pin_gpio_isr(0);
+    s_pin_gpio_isr(0);
+    pin_gpio_edge_start(base);
+    event_base_loop(base, EVLOOP_NONBLOCK);
+    s_test_check("edges", g_edges, 2);
+    s_test_check("level", g_last_level, 0);
+
+    pin_gpio_fini();
+    event_base_free(base);
+    unlink(TEST_FILE);
+    printf("%s\n", g_failed ? "FAILED" : "SUCCESS!");
+    return g_failed;
+}
+
+#endif /* XTEST */
+
+#endif /* GPIO_CDEV */
@@ -0,0 +1,131 @@
+/**
+ * @file pin_gpio.h
+ * @brief GPIO access, declaration.
+ *        Several pins are set, cleared or read with one register access.
+ *        Pins are given in wiringPi numbers and translated once into a
+ *        mask of the first GPIO bank.
+ *        Two backends, chosen at build time: the registers mapped through
+ *        /dev/gpiomem with wiringPi interrupts (default), or the GPIO
+ *        character device with kernel timestamped edges (GPIO_CDEV).
+ *        Built with SIM, the registers are those of the simulated board.
+ * @author Xiangyu Guo
+ */
+#ifndef __PIN_GPIO_H__
+#define __PIN_GPIO_H__
+
+#include <stdint.h>
+
+#ifdef GPIO_CDEV
+#define PIN_GPIO_DEVICE     "/dev/gpiochip0" /**< GPIO character device */
+#else
+#define PIN_GPIO_DEVICE     "/dev/gpiomem"   /**< GPIO registers, no root needed */
+#endif
+#define PIN_GPIO_BLOCK_SIZE (4096)          /**< Size of the mapped block */
+#define PIN_GPIO_INPUT      (0)             /**< Function select: input */
+#define PIN_GPIO_OUTPUT     (1)             /**< Function select: output */
+
+#define PIN_GPIO_EDGE_RISING    (1)         /**< Watch rising edges */
+#define PIN_GPIO_EDGE_FALLING   (2)         /**< Watch falling edges */
+#define PIN_GPIO_EDGE_BOTH      (3)         /**< Watch both edges */
+#define PIN_GPIO_MAX_WATCHES    (8)         /**< Watched input pins */
+
+typedef uint32_t pin_gpio_mask_t;           /**< One bit per BCM pin */
+
+/**
+ * @brief edge call back, runs on the event loop.
+ * @param pin wiringPi pin number.
+ * @param level level after the edge, 1 rising, 0 falling.
+ * @param timestamp_us CLOCK_MONOTONIC time of the edge, in us.
+ * @param arg the argument given when watching.
+ */
+typedef void (*pin_gpio_edge_cb)(int pin, int level, uint64_t timestamp_us,
+                                 void *arg);
+
+struct event_base;
+
+/* ==============================================
+	gpio initialize and finish function
+   ============================================== */
+/**
+ * @brief Map the GPIO registers, calling it again does nothing.
+ */
+void pin_gpio_setup();
+
+/**
+ * @brief Map a plain file in place of the GPIO registers, for testing.
+ *        With GPIO_CDEV it is the gpiochip to use, e.g. one of gpio-sim.
+ * @param path a file of at least PIN_GPIO_BLOCK_SIZE bytes.
+ */
+void pin_gpio_setup_file(const char *path);
+
+/**
+ * @brief Unmap the GPIO registers, edges are no longer delivered.
+ */
+void pin_gpio_fini();
+
+/* =================
+    gpio function
+   ================= */
+/**
+ * @brief Translate wiringPi pins into one mask.
+ * @param pins wiringPi pin numbers.
+ * @param count number of pins.
+ * @return mask of the BCM pins.
+ */
+pin_gpio_mask_t pin_gpio_mask(const int *pins, int count);
+
+/**
+ * @brief Select the function of every pin in the mask.
+ * @param mask pins to change.
+ * @param mode PIN_GPIO_INPUT or PIN_GPIO_OUTPUT.
+ */
+void pin_gpio_mode(pin_gpio_mask_t mask, int mode);
+
+/**
+ * @brief Drive every pin in the mask high, in one write.
+ * @param mask pins to set.
+ */
+void pin_gpio_set(pin_gpio_mask_t mask);
+
+/**
+ * @brief Drive every pin in the mask low, in one write.
+ * @param mask pins to clear.
+ */
+void pin_gpio_clear(pin_gpio_mask_t mask);
+
+/**
+ * @brief Drive the pins in the mask to the given levels.
+ *        One write to the set and one to the clear register, at most.
+ * @param mask pins to change.
+ * @param levels wanted level of each pin in the mask.
+ */
+void pin_gpio_write(pin_gpio_mask_t mask, pin_gpio_mask_t levels);
+
+/**
+ * @brief Read the level of the pins in the mask, in one read.
+ * @param mask pins to read.
+ * @return levels of the pins in the mask, other bits are 0.
+ */
+pin_gpio_mask_t pin_gpio_read(pin_gpio_mask_t mask);
+
+/* =================
+    edge function
+   ================= */
+/**
+ * @brief Call back on edges of an input pin.
+ *        Edges are queued until pin_gpio_edge_start.
+ * @param pin wiringPi pin number.
+ * @param edge PIN_GPIO_EDGE_RISING, _FALLING or _BOTH.
+ * @param cb call back on the event loop.
+ * @param arg argument of the call back.
+ */
+void pin_gpio_watch_edge(int pin, int edge, pin_gpio_edge_cb cb, void *arg);
+
+/**
+ * @brief Deliver the edges of every watched pin on the event loop,
+ *        calling it again does nothing.
+ * @param base event base.
+ */
+void pin_gpio_edge_start(struct event_base *base);
+
+#endif
@@ -0,0 +1,557 @@
+/**
+ * @file pin_gpio_cdev.c
+ * @brief GPIO character device, implementation.
+ *        Built with GPIO_CDEV in place of the memory mapped backend.
+ *        Output lines are requested once per pin_gpio_mode call and
+ *        driven with one ioctl per request. All watched inputs share one
+ *        line request, its fd delivers kernel timestamped edges to the
+ *        event loop, no interrupt thread involved.
+ * @author Xiangyu Guo
+ */
+#ifdef GPIO_CDEV
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include <event2/event.h>
+
+#include "../bus_trace.h"
+#include "pin_gpio.h"
+
+#define CDEV_CONSUMER       "smarthomed"    /**< Owner shown by gpioinfo */
+#define CDEV_MAX_REQUESTS   (8)             /**< Output/input line requests */
+#define CDEV_MAX_LINES      (32)            /**< Lines of the first bank */
+#define CDEV_READ_EVENTS    (16)            /**< Edges read at once */
+#define NSEC_PER_USEC       (1000)          /**< Nanoseconds per microsecond */
+
+/**
+ * @brief one line request and the lines it holds.
+ */
+typedef struct pin_gpio_request {
+    pin_gpio_mask_t mask;                   /**< BCM lines held */
+    int fd;                                 /**< request fd */
+    int lines;                              /**< number of lines */
+    unsigned int offsets[CDEV_MAX_LINES];   /**< line of each request bit */
+} pin_gpio_request_st;
+
+/**
+ * @brief one watched input pin.
+ */
+typedef struct pin_gpio_watch {
+    int pin;                                /**< wiringPi pin number */
+    int edge;                               /**< watched edges */
+    pin_gpio_mask_t mask;                   /**< BCM line of the pin */
+    pin_gpio_edge_cb cb;                    /**< call back on the loop */
+    void *arg;                              /**< argument of the call back */
+} pin_gpio_watch_st;
+
+static int g_chip = -1;                     /**< gpiochip fd */
+static pin_gpio_request_st g_requests[CDEV_MAX_REQUESTS]; /**< Mode requests */
+static int g_request_count = 0;             /**< Mode requests in use */
+static pin_gpio_request_st g_edge_request = {0, -1}; /**< All watched lines */
+
+static pin_gpio_watch_st g_watches[PIN_GPIO_MAX_WATCHES]; /**< Watched pins */
+static int g_watch_count = 0;               /**< Watched pins in use */
+static struct event_base *g_base = NULL;    /**< Loop receiving the edges */
+static struct event *g_edge_event = NULL;   /**< Watching the edge request */
+
+/**
+ * @brief Open a gpiochip.
+ * @param path device path.
+ */
+static void s_pin_gpio_open(const char *path);
+
+/**
+ * @brief Lay the lines out in a request, in ascending order.
+ * @param request [out] the request, not requested yet.
+ * @param mask BCM lines.
+ */
+static void s_pin_gpio_layout(pin_gpio_request_st *request, pin_gpio_mask_t mask);
+
+/**
+ * @brief Request the lines laid out from the chip.
+ * @param request a laid out request.
+ * @param config flags and attributes of the lines.
+ */
+static void s_pin_gpio_request(pin_gpio_request_st *request,
+                               const struct gpio_v2_line_config *config);
+
+/**
+ * @brief Translate BCM lines into bits of a request.
+ * @param request a valid request.
+ * @param mask BCM lines.
+ * @return bits of the request, in the order of its lines.
+ */
+static uint64_t s_pin_gpio_bits(const pin_gpio_request_st *request,
+                                pin_gpio_mask_t mask);
+
+/**
+ * @brief Set the values of the masked lines of every request.
+ * @param mask BCM lines to drive.
+ * @param levels wanted levels.
+ */
+static void s_pin_gpio_drive(pin_gpio_mask_t mask, pin_gpio_mask_t levels);
+
+/**
+ * @brief Request every watched line again, in one request.
+ */
+static void s_pin_gpio_edge_request();
+
+/**
+ * @brief Read the pending edges and call back, on the event loop.
+ */
+static void s_pin_gpio_edge_callback(evutil_socket_t fd, short flags, void *arg);
+
+/**
+ * @brief Map the GPIO registers, calling it again does nothing.
+ */
+void pin_gpio_setup() {
+    // a replay answers from the trace, there may be no chip at all.
+    if (bus_trace_mode() == BUS_TRACE_REPLAY)
+        return;
+    s_pin_gpio_open(PIN_GPIO_DEVICE);
+}
+
+/**
+ * @brief Map a plain file in place of the GPIO registers, for testing.
+ *        With GPIO_CDEV it is the gpiochip to use, e.g. one of gpio-sim.
+ * @param path a file of at least PIN_GPIO_BLOCK_SIZE bytes.
+ */
+void pin_gpio_setup_file(const char *path) {
+    s_pin_gpio_open(path);
+}
+
+/**
+ * @brief Unmap the GPIO registers, edges are no longer delivered.
+ */
+void pin_gpio_fini() {
+    int i;
+
+    if (g_edge_event != NULL) {
+        event_free(g_edge_event);
+        g_edge_event = NULL;
+    }
+    if (g_edge_request.fd >= 0)
+        close(g_edge_request.fd);
+    s_pin_gpio_layout(&g_edge_request, 0);
+    g_watch_count = 0;
+    g_base = NULL;
+
+    for (i = 0; i < g_request_count; ++i)
+        close(g_requests[i].fd);
+    g_request_count = 0;
+
+    if (g_chip >= 0)
+        close(g_chip);
+    g_chip = -1;
+}
+
+/**
+ * @brief Select the function of every pin in the mask.
+ *        A line keeps the direction it was first requested with.
+ * @param mask pins to change.
+ * @param mode PIN_GPIO_INPUT or PIN_GPIO_OUTPUT.
+ */
+void pin_gpio_mode(pin_gpio_mask_t mask, int mode) {
+    struct gpio_v2_line_config config;
+    pin_gpio_mask_t requested;
+    uint64_t start;
+    int i;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        bus_trace_replay(BUS_TRACE_GPIO_MODE, 0, mask, NULL, 0);
+        return;
+    }
+    if (g_chip < 0)
+        exit(ENODEV);
+
+    start = bus_trace_start();
+    requested = mask;
+    for (i = 0; i < g_request_count; ++i)
+        mask &= ~g_requests[i].mask;
+    mask &= ~g_edge_request.mask;
+    if (mask == 0) {
+        bus_trace_record(start, BUS_TRACE_GPIO_MODE, 0, requested, mode, NULL, 0);
+        return;
+    }
+    if (g_request_count >= CDEV_MAX_REQUESTS)
+        exit(ENOSPC);
+
+    // outputs start low, like after a clear on the registers.
+    memset(&config, 0, sizeof(config));
+    config.flags = mode == PIN_GPIO_OUTPUT ? GPIO_V2_LINE_FLAG_OUTPUT :
+                                             GPIO_V2_LINE_FLAG_INPUT;
+    s_pin_gpio_layout(&g_requests[g_request_count], mask);
+    s_pin_gpio_request(&g_requests[g_request_count], &config);
+    g_request_count++;
+    bus_trace_record(start, BUS_TRACE_GPIO_MODE, 0, requested, mode, NULL, 0);
+}
+
+/**
+ * @brief Drive every pin in the mask high, in one write.
+ * @param mask pins to set.
+ */
+void pin_gpio_set(pin_gpio_mask_t mask) {
+    uint64_t start;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        bus_trace_replay(BUS_TRACE_GPIO_SET, 0, mask, NULL, 0);
+        return;
+    }
+    start = bus_trace_start();
+    s_pin_gpio_drive(mask, mask);
+    bus_trace_record(start, BUS_TRACE_GPIO_SET, 0, mask, 0, NULL, 0);
+}
+
+/**
+ * @brief Drive every pin in the mask low, in one write.
+ * @param mask pins to clear.
+ */
+void pin_gpio_clear(pin_gpio_mask_t mask) {
+    uint64_t start;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        bus_trace_replay(BUS_TRACE_GPIO_CLEAR, 0, mask, NULL, 0);
+        return;
+    }
+    start = bus_trace_start();
+    s_pin_gpio_drive(mask, 0);
+    bus_trace_record(start, BUS_TRACE_GPIO_CLEAR, 0, mask, 0, NULL, 0);
+}
+
+/**
+ * @brief Drive the pins in the mask to the given levels.
+ *        One write to the set and one to the clear register, at most.
+ * @param mask pins to change.
+ * @param levels wanted level of each pin in the mask.
+ */
+void pin_gpio_write(pin_gpio_mask_t mask, pin_gpio_mask_t levels) {
+    uint64_t start;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        bus_trace_replay(BUS_TRACE_GPIO_WRITE, 0, mask, NULL, 0);
+        return;
+    }
+    start = bus_trace_start();
+    s_pin_gpio_drive(mask, levels);
+    bus_trace_record(start, BUS_TRACE_GPIO_WRITE, 0, mask, levels, NULL, 0);
+}
+
+/**
+ * @brief Read the level of the pins in the mask, in one read.
+ * @param mask pins to read.
+ * @return levels of the pins in the mask, other bits are 0.
+ */
+pin_gpio_mask_t pin_gpio_read(pin_gpio_mask_t mask) {
+    struct gpio_v2_line_values values;
+    pin_gpio_request_st *request;
+    pin_gpio_mask_t levels = 0;
+    uint64_t start;
+    int i, line;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY)
+        return bus_trace_replay(BUS_TRACE_GPIO_READ, 0, mask, NULL, 0);
+    if (g_chip < 0)
+        exit(ENODEV);
+
+    start = bus_trace_start();
+    for (i = 0; i <= g_request_count; ++i) {
+        request = i < g_request_count ? &g_requests[i] : &g_edge_request;
+        values.mask = s_pin_gpio_bits(request, mask);
+        if (values.mask == 0)
+            continue;
+        if (ioctl(request->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+            exit(errno);
+        for (line = 0; line < request->lines; ++line) {
+            if (values.bits & values.mask & ((uint64_t)1 << line))
+                levels |= (pin_gpio_mask_t)1 << request->offsets[line];
+        }
+    }
+    bus_trace_record(start, BUS_TRACE_GPIO_READ, 0, mask, levels, NULL, 0);
+    return levels;
+}
+
+/**
+ * @brief Call back on edges of an input pin.
+ *        Edges are queued until pin_gpio_edge_start.
+ * @param pin wiringPi pin number.
+ * @param edge PIN_GPIO_EDGE_RISING, _FALLING or _BOTH.
+ * @param cb call back on the event loop.
+ * @param arg argument of the call back.
+ */
+void pin_gpio_watch_edge(int pin, int edge, pin_gpio_edge_cb cb, void *arg) {
+    pin_gpio_watch_st *watch;
+
+    if (g_watch_count >= PIN_GPIO_MAX_WATCHES || edge < PIN_GPIO_EDGE_RISING ||
+            edge > PIN_GPIO_EDGE_BOTH)
+        exit(EINVAL);
+
+    pin_gpio_setup();
+
+    watch = &g_watches[g_watch_count++];
+    watch->pin = pin;
+    watch->edge = edge;
+    watch->mask = pin_gpio_mask(&pin, 1);
+    watch->cb = cb;
+    watch->arg = arg;
+
+    // lines can't join a request, the whole set is requested again.
+    if (g_base != NULL)
+        s_pin_gpio_edge_request();
+}
+
+/**
+ * @brief Deliver the edges of every watched pin on the event loop,
+ *        calling it again does nothing.
+ * @param base event base.
+ */
+void pin_gpio_edge_start(struct event_base *base) {
+    if (g_base != NULL)
+        return;
+
+    pin_gpio_setup();
+    g_base = base;
+    s_pin_gpio_edge_request();
+}
+
+static void s_pin_gpio_open(const char *path) {
+    if (g_chip >= 0)
+        return;
+
+    g_chip = open(path, O_RDWR | O_CLOEXEC);
+    if (g_chip < 0)
+        exit(errno);
+}
+
+static void s_pin_gpio_layout(pin_gpio_request_st *request, pin_gpio_mask_t mask) {
+    unsigned int line;
+
+    memset(request, 0, sizeof(pin_gpio_request_st));
+    request->fd = -1;
+    request->mask = mask;
+    for (line = 0; line < CDEV_MAX_LINES; ++line) {
+        if (mask & ((pin_gpio_mask_t)1 << line))
+            request->offsets[request->lines++] = line;
+    }
+}
+
+static void s_pin_gpio_request(pin_gpio_request_st *request,
+                               const struct gpio_v2_line_config *config) {
+    struct gpio_v2_line_request line_request;
+    int i;
+
+    memset(&line_request, 0, sizeof(line_request));
+    for (i = 0; i < request->lines; ++i)
+        line_request.offsets[i] = request->offsets[i];
+    snprintf(line_request.consumer, GPIO_MAX_NAME_SIZE, "%s", CDEV_CONSUMER);
+    line_request.config = *config;
+    line_request.num_lines = request->lines;
+
+    if (ioctl(g_chip, GPIO_V2_GET_LINE_IOCTL, &line_request) < 0)
+        exit(errno);
+
+    request->fd = line_request.fd;
+}
+
+static uint64_t s_pin_gpio_bits(const pin_gpio_request_st *request,
+                                pin_gpio_mask_t mask) {
+    uint64_t bits = 0;
+    int line;
+
+    if ((request->mask & mask) == 0)
+        return 0;
+
+    for (line = 0; line < request->lines; ++line) {
+        if (mask & ((pin_gpio_mask_t)1 << request->offsets[line]))
+            bits |= (uint64_t)1 << line;
+    }
+    return bits;
+}
+
+static void s_pin_gpio_drive(pin_gpio_mask_t mask, pin_gpio_mask_t levels) {
+    struct gpio_v2_line_values values;
+    int i;
+
+    if (g_chip < 0)
+        exit(ENODEV);
+
+    // set and clear go together, one ioctl per request touched.
+    for (i = 0; i < g_request_count; ++i) {
+        values.mask = s_pin_gpio_bits(&g_requests[i], mask);
+        if (values.mask == 0)
+            continue;
+        values.bits = s_pin_gpio_bits(&g_requests[i], mask & levels);
+        if (ioctl(g_requests[i].fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0)
+            exit(errno);
+    }
+}
+
+static void s_pin_gpio_edge_request() {
+    struct gpio_v2_line_config config;
+    pin_gpio_mask_t mask = 0, rising = 0, falling = 0;
+    int i;
+
+    if (g_edge_event != NULL) {
+        event_free(g_edge_event);
+        g_edge_event = NULL;
+    }
+    if (g_edge_request.fd >= 0)
+        close(g_edge_request.fd);
+
+    for (i = 0; i < g_watch_count; ++i) {
+        mask |= g_watches[i].mask;
+        if (g_watches[i].edge == PIN_GPIO_EDGE_RISING)
+            rising |= g_watches[i].mask;
+        else if (g_watches[i].edge == PIN_GPIO_EDGE_FALLING)
+            falling |= g_watches[i].mask;
+    }
+    s_pin_gpio_layout(&g_edge_request, mask);
+    if (mask == 0)
+        return;
+
+    // both edges by default, single edge lines override it.
+    memset(&config, 0, sizeof(config));
+    config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING |
+                   GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    if (rising) {
+        config.attrs[config.num_attrs].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+        config.attrs[config.num_attrs].attr.flags = GPIO_V2_LINE_FLAG_INPUT |
+                                                    GPIO_V2_LINE_FLAG_EDGE_RISING;
+        config.attrs[config.num_attrs].mask = s_pin_gpio_bits(&g_edge_request, rising);
+        config.num_attrs++;
+    }
+    if (falling) {
+        config.attrs[config.num_attrs].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+        config.attrs[config.num_attrs].attr.flags = GPIO_V2_LINE_FLAG_INPUT |
+                                                    GPIO_V2_LINE_FLAG_EDGE_FALLING;
+        config.attrs[config.num_attrs].mask = s_pin_gpio_bits(&g_edge_request, falling);
+        config.num_attrs++;
+    }
+    s_pin_gpio_request(&g_edge_request, &config);
+
+    g_edge_event = event_new(g_base, g_edge_request.fd, EV_READ | EV_PERSIST,
+                             s_pin_gpio_edge_callback, NULL);
+    if (g_edge_event == NULL) {
+        fprintf(stderr, "Couldn't create an event: exiting\n");
+        exit(errno);
+    }
+    event_add(g_edge_event, NULL);
+}
+
+static void s_pin_gpio_edge_callback(evutil_socket_t fd, short flags, void *arg) {
+    struct gpio_v2_line_event events[CDEV_READ_EVENTS];
+    pin_gpio_watch_st *watch;
+    ssize_t size;
+    int i, n;
+
+    // the kernel hands out whole events, as many as are pending.
+    size = read(fd, events, sizeof(events));
+    if (size < 0)
+        return;
+
+    for (n = 0; n < size / (ssize_t)sizeof(events[0]); ++n) {
+        for (i = 0; i < g_watch_count; ++i) {
+            watch = &g_watches[i];
+            if (watch->mask != (pin_gpio_mask_t)1 << events[n].offset)
+                continue;
+            watch->cb(watch->pin, events[n].id == GPIO_V2_LINE_EVENT_RISING_EDGE,
+                      events[n].timestamp_ns / NSEC_PER_USEC, watch->arg);
+        }
+    }
+}
+
+#ifdef XTEST
+
+#define TEST_OUTPUT_PIN     (30)    /**< wiringPi 30 is line 0 */
+#define TEST_INPUT_PIN      (31)    /**< wiringPi 31 is line 1 */
+#define TEST_PULL_SIZE      (256)   /**< Path of a gpio-sim pull attribute */
+
+static int g_failed = 0;            /**< Failed checks */
+static int g_edges = 0;             /**< Edges delivered */
+static int g_last_level = -1;       /**< Level of the last edge */
+
+/**
+ * @brief count the delivered edges.
+ */
+static void s_test_edge(int pin, int level, uint64_t timestamp_us, void *arg) {
+    printf("edge on pin %d, level %d at %llu us\n", pin, level,
+           (unsigned long long)timestamp_us);
+    g_edges++;
+    g_last_level = level;
+}
+
+/**
+ * @brief pull a gpio-sim line, as a device would drive it.
+ */
+static void s_test_pull(const char *sim, int line, const char *pull) {
+    char path[TEST_PULL_SIZE];
+    FILE *fp;
+
+    snprintf(path, TEST_PULL_SIZE, "%s/sim_gpio%d/pull", sim, line);
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        perror(path);
+        exit(errno);
+    }
+    fputs(pull, fp);
+    fclose(fp);
+}
+
+/**
+ * @brief Run against gpio-sim: unittest/pin_gpio /dev/gpiochipN
+ *        /sys/devices/platform/gpio-sim.0/gpiochipN
+ */
+int main(int argc, char **argv) {
+    static const int output = TEST_OUTPUT_PIN;
+    struct timeval wait = {0, 100000};
+    struct event_base *base;
+    pin_gpio_mask_t mask;
+
+    if (argc < 3) {
+        printf("usage: %s <gpio-sim chip> <gpio-sim sysfs dir>, skipped\n", argv[0]);
+        return 0;
+    }
+
+    base = event_base_new();
+    pin_gpio_setup_file(argv[1]);
+
+    mask = pin_gpio_mask(&output, 1);
+    pin_gpio_mode(mask, PIN_GPIO_OUTPUT);
+    pin_gpio_set(mask);
+    if (pin_gpio_read(mask) != mask)
+        g_failed++;
+    pin_gpio_clear(mask);
+    if (pin_gpio_read(mask) != 0)
+        g_failed++;
+
+    s_test_pull(argv[2], 1, "pull-down");
+    pin_gpio_watch_edge(TEST_INPUT_PIN, PIN_GPIO_EDGE_BOTH, s_test_edge, NULL);
+    pin_gpio_edge_start(base);
+
+    s_test_pull(argv[2], 1, "pull-up");
+    event_base_loopexit(base, &wait);
+    event_base_dispatch(base);
+    if (g_edges != 1 || g_last_level != 1)
+        g_failed++;
+
+    s_test_pull(argv[2], 1, "pull-down");
+    event_base_loopexit(base, &wait);
+    event_base_dispatch(base);
+    if (g_edges != 2 || g_last_level != 0)
+        g_failed++;
+
+    pin_gpio_fini();
+    event_base_free(base);
+    printf("%s\n", g_failed ? "FAILED" : "SUCCESS!");
+    return g_failed;
+}
+
+#endif /* XTEST */
+
+#endif /* GPIO_CDEV */
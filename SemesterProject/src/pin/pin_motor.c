@@ -8,29 +8,33 @@
 #include <stdlib.h>
 #include <wiringPi.h>
 
+#include "pin_gpio.h"
 #include "pin_motor.h"
 
 #define MOTOR_1_LEFT        (21)    /**< Control pin 7 on L293D,using GPIO 21 */
 #define MOTOR_1_RIGTH       (22)    /**< Control pin 2 on L293D,using GPIO 22 */
 #define MOTOR_1_ENABLE      (23)    /**< Control pin 1 on L293D,using GPIO 23 */
 
+#define MOTOR_PINS          (3)     /**< Pins driving the L293D */
+
 static int initialized = LOW;       /**< Singleton value */
+static pin_gpio_mask_t g_motor_all; /**< All control pins */
+static pin_gpio_mask_t g_motor_on;  /**< Pins high while turning, RIGHT stays low */
 
 /**
  * @brief setting up the module.
  */
 void motor_setup_up() {
-    // Initialize, setup all ports and register interrupt handler.
-    if (wiringPiSetup() < LOW)
-        exit(errno);
-    
-    pinMode(MOTOR_1_LEFT, OUTPUT);
-    pinMode(MOTOR_1_RIGTH, OUTPUT);
-    pinMode(MOTOR_1_ENABLE, OUTPUT);
+    static const int pins[MOTOR_PINS] = {MOTOR_1_LEFT, MOTOR_1_RIGTH, MOTOR_1_ENABLE};
+    static const int on_pins[] = {MOTOR_1_LEFT, MOTOR_1_ENABLE};
+
+    // Initialize, translate the pins once for the register writes.
+    pin_gpio_setup();
+    g_motor_all = pin_gpio_mask(pins, MOTOR_PINS);
+    g_motor_on = pin_gpio_mask(on_pins, 2);
 
-    digitalWrite(MOTOR_1_LEFT, LOW);
-    digitalWrite(MOTOR_1_RIGTH, LOW);
-    digitalWrite(MOTOR_1_ENABLE, LOW);
+    pin_gpio_clear(g_motor_all);
+    pin_gpio_mode(g_motor_all, PIN_GPIO_OUTPUT);
 
     initialized = HIGH;
 }
@@ -42,9 +46,8 @@ void motor_turn_on() {
     if (!initialized)
         exit(ENODEV);
 
-    digitalWrite(MOTOR_1_LEFT, HIGH);
-    digitalWrite(MOTOR_1_RIGTH, LOW);
-    digitalWrite(MOTOR_1_ENABLE, HIGH);
+    // RIGHT is never driven high, one write to the set register.
+    pin_gpio_set(g_motor_on);
 }
 
 /**
@@ -54,9 +57,7 @@ void motor_turn_off() {
     if (!initialized)
         exit(ENODEV);
 
-    digitalWrite(MOTOR_1_LEFT, LOW);
-    digitalWrite(MOTOR_1_RIGTH, LOW);
-    digitalWrite(MOTOR_1_ENABLE, LOW);
+    pin_gpio_clear(g_motor_all);
 }
 
 #ifdef XTEST
@@ -0,0 +1,40 @@
+/**
+ * @file probes.h
+ * @brief static tracepoints (USDT) of the daemon, provider "smarthomed".
+ *        Each probe is a single nop in the code and a note in the binary,
+ *        until perf or bpftrace attaches to it, e.g.
+ *
+ *        bpftrace -e 'usdt:./smarthomed:smarthomed:i2c_read_reg_start
+ *                     { @s[tid] = nsecs; }
+ *                     usdt:./smarthomed:smarthomed:i2c_read_reg_done
+ *                     { @us = hist((nsecs - @s[tid]) / 1000); }'
+ *
+ *        Built in when <sys/sdt.h> is found (systemtap-sdt-dev), left out
+ *        otherwise or with make NO_USDT=1. Arguments are not evaluated
+ *        when left out, give them no side effect.
+ * @author Xiangyu Guo
+ */
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+#if !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_USDT                   /**< Probes compiled in */
+#endif
+#endif
+
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+
+#define PROBE0(name)                DTRACE_PROBE(smarthomed, name)              /**< Probe, no argument */
+#define PROBE1(name, a)             DTRACE_PROBE1(smarthomed, name, a)          /**< Probe, 1 argument */
+#define PROBE2(name, a, b)          DTRACE_PROBE2(smarthomed, name, a, b)       /**< Probe, 2 arguments */
+#define PROBE3(name, a, b, c)       DTRACE_PROBE3(smarthomed, name, a, b, c)    /**< Probe, 3 arguments */
+#else
+#define PROBE0(name)                do { } while (0)    /**< Left out */
+#define PROBE1(name, a)             do { } while (0)    /**< Left out */
+#define PROBE2(name, a, b)          do { } while (0)    /**< Left out */
+#define PROBE3(name, a, b, c)       do { } while (0)    /**< Left out */
+#endif
+
+#endif
@@ -0,0 +1,420 @@
+/**
+ * @file rt_io.c
+ * @brief hardware I/O thread, implementation.
+ *        The thread dispatches an event base of its own: the scheduler
+ *        timer and the eventfd of the call queue. Results come back to the
+ *        event loop through the eventfd of the result queue, a completion
+ *        is never dropped, a sample is rather than stall the thread.
+ * @author Xiangyu Guo
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <event2/event.h>
+
+#include "spsc_queue.h"
+#include "tracing.h"
+#include "loop_lag.h"
+#include "rt_io.h"
+
+#define RT_IO_CALL              (0)         /**< Run fn on the I/O thread */
+#define RT_IO_DONE              (1)         /**< Run done on the event loop */
+#define RT_IO_SAMPLE            (2)         /**< A sample for the event loop */
+#define RT_IO_STOP              (3)         /**< Leave the I/O thread */
+
+#define RT_IO_STACK_SIZE        (256 * 1024)/**< Stack of the thread, not the default 8 MB */
+#define RT_IO_STACK_PREFAULT    (64 * 1024) /**< Stack touched before running */
+#define RT_IO_RETRY_NS          (1000000)   /**< Wait for room for a completion */
+
+/**
+ * @brief one message, either way.
+ */
+typedef struct rt_io_msg {
+    int type;                       /**< RT_IO_* */
+    int series;                     /**< sample: HISTORY_* series */
+    time_t time;                    /**< sample: unix time */
+    double value;                   /**< sample: value */
+    rt_io_fn fn;                    /**< call: run on the I/O thread */
+    rt_io_fn done;                  /**< call: run on the event loop */
+    void *arg;                      /**< call: argument */
+    unsigned long id;               /**< call: flow in the trace */
+} rt_io_msg_st;
+
+struct rt_io {
+    struct event_base *io_base;     /**< event base of the I/O thread */
+    struct event *call_event;       /**< calls waiting, on the I/O thread */
+    struct event *result_event;     /**< results waiting, on the event loop */
+    spsc_queue_st *calls;           /**< event loop to I/O thread */
+    spsc_queue_st *results;         /**< I/O thread to event loop */
+    scheduler_st *scheduler;        /**< periodic reads, on the I/O thread */
+    rt_io_sample_fn sample;         /**< takes the samples */
+    pthread_t thread;               /**< the I/O thread */
+    int started;                    /**< thread running */
+    int stopping;                   /**< results are not taken any more */
+    unsigned long call_id;          /**< last call made, event loop */
+    unsigned long calls_run;        /**< calls run, I/O thread */
+    unsigned long samples;          /**< samples taken, event loop */
+    unsigned long dropped;          /**< samples lost, I/O thread */
+};
+
+/**
+ * @brief Run the calls waiting, on the I/O thread.
+ */
+static void s_rt_io_call_cb(evutil_socket_t fd, short flags, void *arg);
+
+/**
+ * @brief Take the samples and completions waiting, on the event loop.
+ */
+static void s_rt_io_result_cb(evutil_socket_t fd, short flags, void *arg);
+
+/**
+ * @brief Body of the I/O thread.
+ */
+static void *s_rt_io_thread(void *arg);
+
+/**
+ * @brief Touch the stack the thread will use, no page fault later on.
+ */
+static void s_rt_io_prefault();
+
+/* ===========================================
+	rt_io initialize and finish function
+   =========================================== */
+/**
+ * @brief Initialize the I/O side, the thread is started by rt_io_start.
+ * @param base event loop the samples and completions are handed to.
+ * @param sample called on the event loop for every sample.
+ * @return a initialized module.
+ */
+rt_io_st *rt_io_init(struct event_base *base, rt_io_sample_fn sample) {
+    rt_io_st *rt = calloc(1, sizeof(rt_io_st));
+    struct event_config *config = event_config_new();
+
+    if (rt == NULL || config == NULL)
+        exit(ENOMEM);
+
+    rt->sample = sample;
+    rt->calls = spsc_queue_init(RT_IO_CALLS, sizeof(rt_io_msg_st));
+    rt->results = spsc_queue_init(RT_IO_RESULTS, sizeof(rt_io_msg_st));
+
+    // timers default to CLOCK_MONOTONIC_COARSE, a tick late or so on Linux.
+    event_config_set_flag(config, EVENT_BASE_FLAG_PRECISE_TIMER);
+    rt->io_base = event_base_new_with_config(config);
+    event_config_free(config);
+    if (rt->io_base == NULL)
+        exit(ENOMEM);
+    rt->scheduler = scheduler_init(rt->io_base);
+
+    rt->call_event = event_new(rt->io_base, spsc_queue_fd(rt->calls),
+                               EV_READ | EV_PERSIST, s_rt_io_call_cb, rt);
+    rt->result_event = event_new(base, spsc_queue_fd(rt->results),
+                                 EV_READ | EV_PERSIST, s_rt_io_result_cb, rt);
+    if (rt->call_event == NULL || rt->result_event == NULL)
+        exit(ENOMEM);
+    event_add(rt->call_event, NULL);
+    event_add(rt->result_event, NULL);
+    return rt;
+}
+
+/**
+ * @brief Stop the I/O thread and clean up, with its scheduler.
+ * @param rt a valid module.
+ */
+void rt_io_fini(rt_io_st *rt) {
+    rt_io_msg_st msg = { RT_IO_STOP };
+
+    if (rt == NULL)
+        return;
+
+    __atomic_store_n(&rt->stopping, 1, __ATOMIC_RELEASE);
+    if (rt->started) {
+        while (spsc_queue_push(rt->calls, &msg) == ENOSPC)
+            sched_yield();
+        pthread_join(rt->thread, NULL);
+    }
+
+    event_free(rt->result_event);
+    event_free(rt->call_event);
+    scheduler_fini(rt->scheduler);
+    event_base_free(rt->io_base);
+    spsc_queue_fini(rt->results);
+    spsc_queue_fini(rt->calls);
+    free(rt);
+}
+
+/* ================
+    rt_io function
+   ================ */
+/**
+ * @brief Scheduler of the I/O thread. Tasks are added before rt_io_start,
+ *        or later through rt_io_call, they run on the I/O thread.
+ * @param rt a valid module.
+ */
+scheduler_st *rt_io_scheduler(rt_io_st *rt) {
+    return rt->scheduler;
+}
+
+/**
+ * @brief Start the I/O thread. A real-time setting the process is not
+ *        allowed is reported and left out, the thread runs anyway.
+ * @param rt a valid module.
+ * @param cpu core to pin the thread to, -1 for any.
+ * @param priority SCHED_FIFO priority, 0 to keep the default policy.
+ * @param lock 1 to lock the memory of the process first, the pages mapped
+ *        later included: threads started afterwards should keep small stacks.
+ * @return 0 on success; errno when the thread could not be created.
+ */
+int rt_io_start(rt_io_st *rt, int cpu, int priority, int lock) {
+    struct sched_param param;
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+    int err;
+
+    // a page fault in the middle of a DHT11 read would be as bad as a preemption.
+    if (lock && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        fprintf(stderr, "I/O thread: mlockall: %s\n", strerror(errno));
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, RT_IO_STACK_SIZE);
+    if (cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    if (priority > 0) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
+    err = pthread_create(&rt->thread, &attr, s_rt_io_thread, rt);
+    if (err == EPERM || err == EINVAL) {
+        fprintf(stderr, "I/O thread: cpu %d, SCHED_FIFO %d: %s, running without\n",
+                cpu, priority, strerror(err));
+        pthread_attr_destroy(&attr);
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, RT_IO_STACK_SIZE);
+        err = pthread_create(&rt->thread, &attr, s_rt_io_thread, rt);
+    }
+    pthread_attr_destroy(&attr);
+
+    if (err == 0)
+        rt->started = 1;
+    return err;
+}
+
+/**
+ * @brief Run fn on the I/O thread, then done on the event loop.
+ *        Called from the event loop only.
+ * @param rt a valid module.
+ * @param fn run on the I/O thread.
+ * @param done run on the event loop once fn returned, may be NULL.
+ * @param arg argument of both.
+ * @return 0 on success; ENOSPC when too many calls are waiting.
+ */
+int rt_io_call(rt_io_st *rt, rt_io_fn fn, rt_io_fn done, void *arg) {
+    rt_io_msg_st msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = RT_IO_CALL;
+    msg.fn = fn;
+    msg.done = done;
+    msg.arg = arg;
+    msg.id = ++rt->call_id;
+    // the flow links the caller's span to the call and its completion.
+    tracing_flow(TRACING_FLOW_START, "io call", msg.id);
+    return spsc_queue_push(rt->calls, &msg);
+}
+
+/**
+ * @brief Hand a sample to the event loop, never blocks.
+ *        Called from the I/O thread only.
+ * @param rt a valid module.
+ * @param series HISTORY_* series.
+ * @param time unix time of the sample.
+ * @param value the sample.
+ * @return 0 on success; ENOSPC when dropped.
+ */
+int rt_io_sample(rt_io_st *rt, int series, time_t time, double value) {
+    rt_io_msg_st msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = RT_IO_SAMPLE;
+    msg.series = series;
+    msg.time = time;
+    msg.value = value;
+    if (spsc_queue_push(rt->results, &msg) == ENOSPC) {
+        __atomic_add_fetch(&rt->dropped, 1, __ATOMIC_RELAXED);
+        return ENOSPC;
+    }
+    return 0;
+}
+
+/**
+ * @brief Counters of the queues, read on the event loop.
+ * @param rt a valid module.
+ * @param stats [out] counters.
+ */
+void rt_io_get_stats(rt_io_st *rt, rt_io_stats_st *stats) {
+    stats->calls = __atomic_load_n(&rt->calls_run, __ATOMIC_RELAXED);
+    stats->samples = rt->samples;
+    stats->dropped = __atomic_load_n(&rt->dropped, __ATOMIC_RELAXED);
+}
+
+/* ================
+    inner function
+   ================ */
+static void s_rt_io_call_cb(evutil_socket_t fd, short flags, void *arg) {
+    rt_io_st *rt = arg;
+    struct timespec retry = { 0, RT_IO_RETRY_NS };
+    rt_io_msg_st msg;
+
+    spsc_queue_ack(rt->calls);
+    while (spsc_queue_pop(rt->calls, &msg) == 0) {
+        if (msg.type == RT_IO_STOP) {
+            event_base_loopbreak(rt->io_base);
+            return;
+        }
+
+        tracing_begin("io call", "io");
+        tracing_flow(TRACING_FLOW_STEP, "io call", msg.id);
+        msg.fn(msg.arg);
+        tracing_end();
+        __atomic_add_fetch(&rt->calls_run, 1, __ATOMIC_RELAXED);
+        if (msg.done == NULL)
+            continue;
+
+        // the caller waits for this one, wait for room unless shutting down.
+        msg.type = RT_IO_DONE;
+        while (spsc_queue_push(rt->results, &msg) == ENOSPC &&
+                !__atomic_load_n(&rt->stopping, __ATOMIC_ACQUIRE))
+            nanosleep(&retry, NULL);
+    }
+}
+
+static void s_rt_io_result_cb(evutil_socket_t fd, short flags, void *arg) {
+    rt_io_st *rt = arg;
+    rt_io_msg_st msg;
+
+    spsc_queue_ack(rt->results);
+    while (spsc_queue_pop(rt->results, &msg) == 0) {
+        if (msg.type == RT_IO_SAMPLE) {
+            rt->samples++;
+            if (rt->sample != NULL) {
+                loop_lag_enter("io sample");
+                rt->sample(msg.series, msg.time, msg.value);
+                loop_lag_leave();
+            }
+        } else {
+            tracing_begin("io done", "io");
+            tracing_flow(TRACING_FLOW_END, "io call", msg.id);
+            loop_lag_enter("io done");
+            msg.done(msg.arg);
+            loop_lag_leave();
+            tracing_end();
+        }
+    }
+}
+
+static void *s_rt_io_thread(void *arg) {
+    rt_io_st *rt = arg;
+
+    tracing_name_thread("io");
+    s_rt_io_prefault();
+    event_base_dispatch(rt->io_base);
+    return NULL;
+}
+
+static void s_rt_io_prefault() {
+    volatile unsigned char stack[RT_IO_STACK_PREFAULT];
+
+    memset((unsigned char *)stack, 0, sizeof(stack));
+}
+
+#ifdef XTEST
+
+#define TEST_RUN_MS         (500)       /**< Loop run */
+#define TEST_PERIOD_US      (10000)     /**< Sampling period */
+#define TEST_CALLS          (8)         /**< Calls made */
+
+static rt_io_st *g_rt = NULL;
+static pthread_t g_loop_thread;
+static unsigned long g_sampled = 0;     /**< samples taken on the loop */
+static int g_failed = 0;
+
+/**
+ * @brief a periodic read, on the I/O thread.
+ */
+static void s_test_read(void *arg) {
+    static int n = 0;
+
+    g_failed |= pthread_equal(pthread_self(), g_loop_thread);
+    rt_io_sample(g_rt, 0, time(NULL), n++);
+}
+
+static void s_test_sample(int series, time_t time, double value) {
+    // samples come on the loop thread, in order.
+    g_failed |= !pthread_equal(pthread_self(), g_loop_thread);
+    g_failed |= value != g_sampled;
+    g_sampled++;
+}
+
+/**
+ * @brief a call, on the I/O thread.
+ */
+static void s_test_call(void *arg) {
+    g_failed |= pthread_equal(pthread_self(), g_loop_thread);
+    (*(int *)arg)++;
+}
+
+/**
+ * @brief its completion, on the loop thread.
+ */
+static void s_test_done(void *arg) {
+    g_failed |= !pthread_equal(pthread_self(), g_loop_thread);
+    (*(int *)arg)++;
+}
+
+int main() {
+    struct event_base *base = event_base_new();
+    struct timeval run = {0, TEST_RUN_MS * 1000};
+    int counters[TEST_CALLS] = { 0 };
+    rt_io_stats_st stats;
+    int i;
+
+    g_loop_thread = pthread_self();
+    g_rt = rt_io_init(base, s_test_sample);
+    scheduler_add(rt_io_scheduler(g_rt), "read", SCHEDULER_BUS_NONE,
+                  TEST_PERIOD_US, TEST_PERIOD_US, 100, s_test_read, NULL);
+    g_failed |= rt_io_start(g_rt, 0, 10, 1) != 0;
+    for (i = 0; i < TEST_CALLS; ++i)
+        g_failed |= rt_io_call(g_rt, s_test_call, s_test_done, &counters[i]) != 0;
+
+    event_base_loopexit(base, &run);
+    event_base_dispatch(base);
+
+    rt_io_get_stats(g_rt, &stats);
+    printf("calls %lu samples %lu dropped %lu\n", stats.calls, stats.samples,
+           stats.dropped);
+    for (i = 0; i < TEST_CALLS; ++i)
+        g_failed |= counters[i] != 2;
+    g_failed |= stats.calls != TEST_CALLS || stats.dropped != 0;
+    g_failed |= stats.samples < TEST_RUN_MS * 1000 / TEST_PERIOD_US / 2;
+    g_failed |= stats.samples != g_sampled;
+
+    rt_io_fini(g_rt);
+    event_base_free(base);
+    printf("%s\n", g_failed ? "FAILED" : "SUCCESS!");
+    return g_failed;
+}
+
+#endif
@@ -0,0 +1,120 @@
+/**
+ * @file rt_io.h
+ * @brief hardware I/O thread, declaration.
+ *        Every bus transaction runs on a thread of its own, with its own
+ *        event loop and scheduler, away from the HTTP event loop. It can be
+ *        pinned to a core and run under SCHED_FIFO with its memory locked,
+ *        so network bursts no longer delay a DHT11 read or a conversion
+ *        wait. The two sides only talk through lock-free SPSC queues: calls
+ *        go to the I/O thread, samples and call completions come back.
+ * @author Xiangyu Guo
+ */
+#ifndef __RT_IO_H__
+#define __RT_IO_H__
+
+#include <time.h>
+
+#include "scheduler.h"
+
+#define RT_IO_CALLS             (64)        /**< Calls waiting at most */
+#define RT_IO_RESULTS           (1024)      /**< Samples and completions waiting */
+
+/**
+ * @brief module structure, hiding the detail to the public
+ */
+typedef struct rt_io rt_io_st;
+struct rt_io;
+struct event_base;
+
+/**
+ * @brief work run on one side or the other.
+ * @param arg argument given to rt_io_call.
+ */
+typedef void (*rt_io_fn)(void *arg);
+
+/**
+ * @brief a sample, handed to the event loop.
+ * @param series HISTORY_* series.
+ * @param time unix time of the sample.
+ * @param value the sample.
+ */
+typedef void (*rt_io_sample_fn)(int series, time_t time, double value);
+
+/**
+ * @brief counters of the queues.
+ */
+typedef struct rt_io_stats {
+    unsigned long calls;            /**< calls run */
+    unsigned long samples;          /**< samples handed over */
+    unsigned long dropped;          /**< samples lost, results full */
+} rt_io_stats_st;
+
+/* ===========================================
+	rt_io initialize and finish function
+   =========================================== */
+/**
+ * @brief Initialize the I/O side, the thread is started by rt_io_start.
+ * @param base event loop the samples and completions are handed to.
+ * @param sample called on the event loop for every sample.
+ * @return a initialized module.
+ */
+rt_io_st *rt_io_init(struct event_base *base, rt_io_sample_fn sample);
+
+/**
+ * @brief Stop the I/O thread and clean up, with its scheduler.
+ * @param rt a valid module.
+ */
+void rt_io_fini(rt_io_st *rt);
+
+/* ================
+    rt_io function
+   ================ */
+/**
+ * @brief Scheduler of the I/O thread. Tasks are added before rt_io_start,
+ *        or later through rt_io_call, they run on the I/O thread.
+ * @param rt a valid module.
+ */
+scheduler_st *rt_io_scheduler(rt_io_st *rt);
+
+/**
+ * @brief Start the I/O thread. A real-time setting the process is not
+ *        allowed is reported and left out, the thread runs anyway.
+ * @param rt a valid module.
+ * @param cpu core to pin the thread to, -1 for any.
+ * @param priority SCHED_FIFO priority, 0 to keep the default policy.
+ * @param lock 1 to lock the memory of the process first, the pages mapped
+ *        later included: threads started afterwards should keep small stacks.
+ * @return 0 on success; errno when the thread could not be created.
+ */
+int rt_io_start(rt_io_st *rt, int cpu, int priority, int lock);
+
+/**
+ * @brief Run fn on the I/O thread, then done on the event loop.
+ *        Called from the event loop only.
+ * @param rt a valid module.
+ * @param fn run on the I/O thread.
+ * @param done run on the event loop once fn returned, may be NULL.
+ * @param arg argument of both.
+ * @return 0 on success; ENOSPC when too many calls are waiting.
+ */
+int rt_io_call(rt_io_st *rt, rt_io_fn fn, rt_io_fn done, void *arg);
+
+/**
+ * @brief Hand a sample to the event loop, never blocks.
+ *        Called from the I/O thread only.
+ * @param rt a valid module.
+ * @param series HISTORY_* series.
+ * @param time unix time of the sample.
+ * @param value the sample.
+ * @return 0 on success; ENOSPC when dropped.
+ */
+int rt_io_sample(rt_io_st *rt, int series, time_t time, double value);
+
+/**
+ * @brief Counters of the queues, read on the event loop.
+ * @param rt a valid module.
+ * @param stats [out] counters.
+ */
+void rt_io_get_stats(rt_io_st *rt, rt_io_stats_st *stats);
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * @file sample_export.c
+ * @brief export the sample log of smarthomed as CSV, one block at a time,
+ *        so a log of months streams out in constant memory.
+ *        usage: sample_export <log dir> [series]
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "history.h"
+#include "sample_log.h"
+
+/**
+ * @brief print one sample, when of the series asked.
+ * @param arg series asked, -1 for all.
+ */
+static int export_sample(int series, uint64_t time_ms, double value, void *arg) {
+    int wanted = *(int *)arg;
+    const char *name = history_series_name(series);
+
+    if (wanted >= 0 && series != wanted)
+        return 0;
+    if (name != NULL)
+        printf("%" PRIu64 ",%s,%.10g\n", time_ms, name, value);
+    else
+        printf("%" PRIu64 ",%d,%.10g\n", time_ms, series, value);
+    // stop once nobody reads any more.
+    return ferror(stdout);
+}
+
+int main(int argc, char **argv) {
+    int series = -1, err;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <log dir> [series]\n", argv[0]);
+        return EINVAL;
+    }
+    if (argc == 3 && (series = history_series_find(argv[2])) < 0) {
+        fprintf(stderr, "unknown series %s\n", argv[2]);
+        return EINVAL;
+    }
+
+    printf("time_ms,series,value\n");
+    if ((err = sample_log_read(argv[1], export_sample, &series)) != 0) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(err));
+        return err;
+    }
+    return fflush(stdout) != 0 ? errno : 0;
+}
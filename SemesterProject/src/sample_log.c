@@ -0,0 +1,882 @@
+/**
+ * @file sample_log.c
+ * @brief crash-safe compressed on-disk log of samples, implementation.
+ *        A segment is a 16 bytes header followed by blocks. A block is a
+ *        12 bytes header (magic, series, version, count, length, CRC-32 of
+ *        the header and payload) and a bit packed payload: the first time
+ *        and value in full, then for each sample the delta of delta of its
+ *        time ('0', '10'+7, '110'+9, '1110'+12 or '1111'+64 bits) and its
+ *        value XORed with the previous one ('0' same, '10' inside the last
+ *        window, '11'+5 bits leading zeros+6 bits length). A sample taken
+ *        on time with an unchanged value takes 2 bits.
+ *        The payload is copied to the mapping before its header, a block
+ *        torn by a power cut fails its CRC and ends the segment.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sample_log.h"
+
+#define SAMPLE_LOG_MAGIC        "SHSL"  /**< Segment magic */
+#define SAMPLE_LOG_VERSION      (1)     /**< Segment format */
+#define SAMPLE_LOG_HEADER_SIZE  (16)    /**< Magic, version, sequence, reserved */
+#define SAMPLE_LOG_BLOCK_MAGIC  (0x4B42) /**< "BK" */
+#define SAMPLE_LOG_BLOCK_HEADER (12)    /**< Magic, series, version, count, length, crc */
+#define SAMPLE_LOG_SAMPLE_BITS  (160)   /**< Largest sample, 68 + 77 bits */
+#define SAMPLE_LOG_MAX_COUNT    (0xFFFF) /**< Samples in one block */
+#define SAMPLE_LOG_NAME         "%08u.seg" /**< Segment file, by sequence */
+#define SAMPLE_LOG_PATH_MAX     (256)   /**< Directory and file name */
+
+/**
+ * @brief compression state and pending block of one series.
+ */
+typedef struct sample_log_stream {
+    unsigned int count;                 /**< samples in the block */
+    unsigned int bits;                  /**< bits used in data */
+    uint64_t time;                      /**< time of the last sample */
+    int64_t delta;                      /**< last time delta */
+    uint64_t value;                     /**< bits of the last value */
+    int leading;                        /**< leading zeros of the window */
+    int trailing;                       /**< trailing zeros of the window */
+    unsigned char data[SAMPLE_LOG_BLOCK_BYTES]; /**< payload */
+} sample_log_stream_st;
+
+/**
+ * @brief the open log.
+ */
+struct sample_log
+{
+    char dir[SAMPLE_LOG_PATH_MAX];      /**< directory of the segments */
+    size_t segment_size;                /**< size of a segment */
+    int max_segments;                   /**< segments kept */
+    int sync_sec;                       /**< sync period */
+    int fd;                             /**< current segment */
+    unsigned char *map;                 /**< mapping of the segment */
+    unsigned int sequence;              /**< number of the segment */
+    size_t offset;                      /**< end of the last block */
+    size_t synced;                      /**< synced up to */
+    time_t synced_at;                   /**< time of the last sync */
+    sample_log_stats_st stats;          /**< counters */
+    sample_log_stream_st streams[SAMPLE_LOG_MAX_SERIES]; /**< per series */
+};
+
+/**
+ * @brief reading position in a payload.
+ */
+typedef struct sample_log_reader {
+    const unsigned char *data;          /**< payload */
+    unsigned int bits;                  /**< bits in the payload */
+    unsigned int pos;                   /**< next bit */
+} sample_log_reader_st;
+
+/**
+ * @brief Start a new segment after the current one.
+ */
+static int s_sample_log_rotate(sample_log_st *log);
+
+/**
+ * @brief Map one segment, recovering it when it exists already.
+ */
+static int s_sample_log_map(sample_log_st *log, int create);
+
+/**
+ * @brief Remove the segments past the maximum.
+ */
+static void s_sample_log_trim(sample_log_st *log);
+
+/**
+ * @brief Write the pending block of one series to the segment.
+ */
+static int s_sample_log_flush(sample_log_st *log, int series);
+
+/**
+ * @brief Compress one sample into the pending block.
+ */
+static void s_sample_log_encode(sample_log_stream_st *stream, uint64_t time,
+                                uint64_t value);
+
+/**
+ * @brief Decompress one block, calling back for each sample.
+ * @return 0 to go on, 1 when the call back stopped, -1 on a bad payload.
+ */
+static int s_sample_log_decode(int series, const unsigned char *data,
+                               unsigned int length, unsigned int count,
+                               sample_log_fn cb, void *arg);
+
+/**
+ * @brief Check a block header and its payload.
+ * @return length of the payload, -1 when not a whole block.
+ */
+static int s_sample_log_check(const unsigned char *header,
+                              const unsigned char *payload, size_t avail);
+
+/**
+ * @brief Sequences of the segments in a directory, ascending.
+ * @return number of segments, -1 on failure; *list is malloc'd.
+ */
+static int s_sample_log_list(const char *dir, unsigned int **list);
+
+static void s_sample_log_put_bits(sample_log_stream_st *stream, uint64_t value,
+                                  int n);
+static int s_sample_log_get_bits(sample_log_reader_st *reader, int n,
+                                 uint64_t *value);
+static uint32_t s_sample_log_crc(uint32_t crc, const unsigned char *data,
+                                 size_t len);
+static time_t s_sample_log_now();
+
+/* ==============================================
+	sample log initialize and finish function
+   ============================================== */
+/**
+ * @brief Open the log in a directory, created if missing. The last segment
+ *        is checked and appending resumes after its last whole block.
+ * @param dir directory of the segments.
+ * @param segment_size size of one segment, in bytes.
+ * @param max_segments segments kept, the oldest are removed.
+ * @param sync_sec blocks are written and synced at most this often.
+ * @return a opened log, NULL with errno set on failure.
+ */
+sample_log_st *sample_log_open(const char *dir, size_t segment_size,
+                               int max_segments, int sync_sec) {
+    sample_log_st *log;
+    unsigned int *list = NULL;
+    int count, err;
+
+    if (dir == NULL || strlen(dir) + 16 > SAMPLE_LOG_PATH_MAX || max_segments < 1 ||
+            segment_size < SAMPLE_LOG_HEADER_SIZE + SAMPLE_LOG_BLOCK_HEADER +
+                           SAMPLE_LOG_BLOCK_BYTES) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+        return NULL;
+
+    if ((log = calloc(1, sizeof(sample_log_st))) == NULL)
+        return NULL;
+    strcpy(log->dir, dir);
+    log->segment_size = segment_size;
+    log->max_segments = max_segments;
+    log->sync_sec = sync_sec;
+    log->fd = -1;
+    log->synced_at = s_sample_log_now();
+
+    // append to the newest segment, or start the first one.
+    if ((count = s_sample_log_list(dir, &list)) < 0) {
+        err = errno;
+        free(log);
+        errno = err;
+        return NULL;
+    }
+    log->sequence = count > 0 ? list[count - 1] : 1;
+    free(list);
+
+    if ((err = s_sample_log_map(log, count == 0)) != 0) {
+        free(log);
+        errno = err;
+        return NULL;
+    }
+    if (count == 0)
+        log->stats.segments = 1;
+    return log;
+}
+
+/**
+ * @brief Sync and close the log.
+ * @param log a valid log.
+ */
+void sample_log_close(sample_log_st *log) {
+    if (log == NULL)
+        return;
+    sample_log_sync(log);
+    munmap(log->map, log->segment_size);
+    close(log->fd);
+    free(log);
+}
+
+/* ====================
+    sample log function
+   ==================== */
+/**
+ * @brief Append one sample, syncs when the period is over.
+ * @param log a valid log.
+ * @param series [0 - SAMPLE_LOG_MAX_SERIES).
+ * @param time_ms time of the sample, in ms, not older than the last one.
+ * @param value the sample.
+ * @return 0 on success; otherwise an errno.
+ */
+int sample_log_append(sample_log_st *log, int series, uint64_t time_ms,
+                      double value) {
+    sample_log_stream_st *stream;
+    uint64_t bits;
+    int err;
+
+    if (log == NULL || series < 0 || series >= SAMPLE_LOG_MAX_SERIES)
+        return EINVAL;
+    stream = &log->streams[series];
+    if (stream->count != 0 && time_ms < stream->time)
+        return EINVAL;
+
+    if (stream->count == SAMPLE_LOG_MAX_COUNT ||
+            stream->bits + SAMPLE_LOG_SAMPLE_BITS > SAMPLE_LOG_BLOCK_BYTES * 8) {
+        if ((err = s_sample_log_flush(log, series)) != 0)
+            return err;
+    }
+
+    memcpy(&bits, &value, sizeof(bits));
+    s_sample_log_encode(stream, time_ms, bits);
+    log->stats.samples++;
+
+    if (s_sample_log_now() - log->synced_at >= log->sync_sec)
+        return sample_log_sync(log);
+    return 0;
+}
+
+/**
+ * @brief Write the pending blocks and sync them to the card.
+ * @param log a valid log.
+ * @return 0 on success; otherwise an errno.
+ */
+int sample_log_sync(sample_log_st *log) {
+    long page = sysconf(_SC_PAGESIZE);
+    size_t start;
+    int series, err;
+
+    for (series = 0; series < SAMPLE_LOG_MAX_SERIES; ++series) {
+        if ((err = s_sample_log_flush(log, series)) != 0)
+            return err;
+    }
+
+    // only the pages written since the last sync.
+    if (log->offset > log->synced) {
+        start = log->synced - log->synced % page;
+        if (msync(log->map + start, log->offset - start, MS_SYNC) != 0)
+            return errno;
+        log->synced = log->offset;
+        log->stats.syncs++;
+    }
+    log->synced_at = s_sample_log_now();
+    return 0;
+}
+
+/**
+ * @brief Get the counters of the log.
+ * @param log a valid log.
+ * @param stats [out] counters.
+ */
+void sample_log_get_stats(sample_log_st *log, sample_log_stats_st *stats) {
+    *stats = log->stats;
+}
+
+/**
+ * @brief Read every sample of a log directory, one block at a time.
+ *        Blocks come in the order they were written, the samples of one
+ *        series in time order.
+ * @param dir directory of the segments.
+ * @param cb called for each sample.
+ * @param arg argument of the call back.
+ * @return 0 on success; otherwise an errno.
+ */
+int sample_log_read(const char *dir, sample_log_fn cb, void *arg) {
+    unsigned char header[SAMPLE_LOG_BLOCK_HEADER];
+    unsigned char payload[SAMPLE_LOG_BLOCK_BYTES];
+    char path[SAMPLE_LOG_PATH_MAX + 16];
+    unsigned int *list = NULL;
+    int count, i, length, stop = 0;
+    FILE *fp;
+
+    if ((count = s_sample_log_list(dir, &list)) < 0)
+        return errno;
+
+    for (i = 0; i < count && !stop; ++i) {
+        snprintf(path, sizeof(path), "%s/" SAMPLE_LOG_NAME, dir, list[i]);
+        // a segment may be removed while it is read, go on with the next.
+        if ((fp = fopen(path, "rb")) == NULL)
+            continue;
+        if (fread(payload, 1, SAMPLE_LOG_HEADER_SIZE, fp) != SAMPLE_LOG_HEADER_SIZE ||
+                memcmp(payload, SAMPLE_LOG_MAGIC, 4) != 0) {
+            fclose(fp);
+            continue;
+        }
+        // the first block failing its check is the end of the segment.
+        while (!stop && fread(header, 1, sizeof(header), fp) == sizeof(header)) {
+            length = header[6] | header[7] << 8;
+            if (length > SAMPLE_LOG_BLOCK_BYTES ||
+                    fread(payload, 1, length, fp) != (size_t)length ||
+                    s_sample_log_check(header, payload,
+                                       SAMPLE_LOG_BLOCK_HEADER + length) < 0)
+                break;
+            stop = s_sample_log_decode(header[2], payload, length,
+                                       header[4] | header[5] << 8, cb, arg) > 0;
+        }
+        fclose(fp);
+    }
+    free(list);
+    return 0;
+}
+
+/* ================
+    inner function
+   ================ */
+static int s_sample_log_rotate(sample_log_st *log) {
+    int err;
+
+    // the closed segment keeps only its blocks.
+    if (msync(log->map, log->offset, MS_SYNC) != 0 ||
+            ftruncate(log->fd, log->offset) != 0)
+        return errno;
+    munmap(log->map, log->segment_size);
+    close(log->fd);
+    log->map = NULL;
+    log->fd = -1;
+
+    log->sequence++;
+    if ((err = s_sample_log_map(log, 1)) != 0)
+        return err;
+    log->stats.segments++;
+    s_sample_log_trim(log);
+    return 0;
+}
+
+static int s_sample_log_map(sample_log_st *log, int create) {
+    char path[SAMPLE_LOG_PATH_MAX + 16];
+    unsigned char *map;
+    struct stat st;
+    size_t end;
+    int fd, length, dirfd;
+
+    snprintf(path, sizeof(path), "%s/" SAMPLE_LOG_NAME, log->dir, log->sequence);
+    if ((fd = open(path, O_RDWR | O_CREAT | (create ? O_TRUNC : 0), 0644)) < 0)
+        return errno;
+    // a new segment is sparse, blocks fill it as they come.
+    if (fstat(fd, &st) != 0 ||
+            ((size_t)st.st_size < log->segment_size &&
+             ftruncate(fd, log->segment_size) != 0)) {
+        close(fd);
+        return errno;
+    }
+    map = mmap(NULL, log->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return errno;
+    }
+
+    log->fd = fd;
+    log->map = map;
+    log->offset = SAMPLE_LOG_HEADER_SIZE;
+    if (create || memcmp(map, SAMPLE_LOG_MAGIC, 4) != 0) {
+        memset(map, 0, SAMPLE_LOG_HEADER_SIZE);
+        memcpy(map, SAMPLE_LOG_MAGIC, 4);
+        map[4] = SAMPLE_LOG_VERSION;
+        memcpy(map + 8, &log->sequence, sizeof(log->sequence));
+    } else {
+        // resume after the last whole block.
+        while ((length = s_sample_log_check(map + log->offset,
+                        map + log->offset + SAMPLE_LOG_BLOCK_HEADER,
+                        log->segment_size - log->offset)) >= 0)
+            log->offset += SAMPLE_LOG_BLOCK_HEADER + length;
+        // clear a torn block, so no stale byte is taken for a block later.
+        for (end = log->segment_size; end > log->offset && map[end - 1] == 0; --end)
+            ;
+        if (end > log->offset) {
+            log->stats.dropped = end - log->offset;
+            memset(map + log->offset, 0, end - log->offset);
+        }
+    }
+    log->synced = 0;
+    if (msync(map, log->offset + log->stats.dropped, MS_SYNC) != 0)
+        return errno;
+    log->synced = log->offset;
+
+    // the entry of a new segment must survive a power cut too.
+    if (create && (dirfd = open(log->dir, O_RDONLY)) >= 0) {
+        fsync(dirfd);
+        close(dirfd);
+    }
+    return 0;
+}
+
+static void s_sample_log_trim(sample_log_st *log) {
+    char path[SAMPLE_LOG_PATH_MAX + 16];
+    unsigned int *list = NULL;
+    int count, i;
+
+    if ((count = s_sample_log_list(log->dir, &list)) < 0)
+        return;
+    for (i = 0; i < count; ++i) {
+        if (list[i] + log->max_segments > log->sequence)
+            break;
+        snprintf(path, sizeof(path), "%s/" SAMPLE_LOG_NAME, log->dir, list[i]);
+        unlink(path);
+    }
+    free(list);
+}
+
+static int s_sample_log_flush(sample_log_st *log, int series) {
+    sample_log_stream_st *stream = &log->streams[series];
+    unsigned char *block;
+    unsigned int length;
+    uint32_t crc;
+    int err;
+
+    if (stream->count == 0)
+        return 0;
+    length = (stream->bits + 7) / 8;
+    if (log->offset + SAMPLE_LOG_BLOCK_HEADER + length > log->segment_size &&
+            (err = s_sample_log_rotate(log)) != 0)
+        return err;
+
+    block = log->map + log->offset;
+    memcpy(block + SAMPLE_LOG_BLOCK_HEADER, stream->data, length);
+    block[0] = SAMPLE_LOG_BLOCK_MAGIC & 0xFF;
+    block[1] = SAMPLE_LOG_BLOCK_MAGIC >> 8;
+    block[2] = series;
+    block[3] = SAMPLE_LOG_VERSION;
+    block[4] = stream->count & 0xFF;
+    block[5] = stream->count >> 8;
+    block[6] = length & 0xFF;
+    block[7] = length >> 8;
+    crc = s_sample_log_crc(0, block, 8);
+    crc = s_sample_log_crc(crc, block + SAMPLE_LOG_BLOCK_HEADER, length);
+    block[8] = crc & 0xFF;
+    block[9] = crc >> 8 & 0xFF;
+    block[10] = crc >> 16 & 0xFF;
+    block[11] = crc >> 24;
+
+    log->offset += SAMPLE_LOG_BLOCK_HEADER + length;
+    log->stats.bytes += SAMPLE_LOG_BLOCK_HEADER + length;
+    log->stats.blocks++;
+
+    // the next block starts over with full values.
+    stream->count = 0;
+    stream->bits = 0;
+    memset(stream->data, 0, length);
+    return 0;
+}
+
+static void s_sample_log_encode(sample_log_stream_st *stream, uint64_t time,
+                                uint64_t value) {
+    int64_t delta, dod;
+    uint64_t xor;
+    int leading, trailing, length;
+
+    if (stream->count == 0) {
+        s_sample_log_put_bits(stream, time, 64);
+        s_sample_log_put_bits(stream, value, 64);
+        stream->delta = 0;
+        stream->leading = -1;
+    } else {
+        delta = time - stream->time;
+        dod = delta - stream->delta;
+        if (dod == 0) {
+            s_sample_log_put_bits(stream, 0, 1);
+        } else if (dod >= -64 && dod < 64) {
+            s_sample_log_put_bits(stream, 0x2, 2);
+            s_sample_log_put_bits(stream, dod, 7);
+        } else if (dod >= -256 && dod < 256) {
+            s_sample_log_put_bits(stream, 0x6, 3);
+            s_sample_log_put_bits(stream, dod, 9);
+        } else if (dod >= -2048 && dod < 2048) {
+            s_sample_log_put_bits(stream, 0xE, 4);
+            s_sample_log_put_bits(stream, dod, 12);
+        } else {
+            s_sample_log_put_bits(stream, 0xF, 4);
+            s_sample_log_put_bits(stream, dod, 64);
+        }
+        stream->delta = delta;
+
+        xor = value ^ stream->value;
+        if (xor == 0) {
+            s_sample_log_put_bits(stream, 0, 1);
+        } else {
+            leading = __builtin_clzll(xor);
+            trailing = __builtin_ctzll(xor);
+            if (stream->leading >= 0 && leading >= stream->leading &&
+                    trailing >= stream->trailing) {
+                s_sample_log_put_bits(stream, 0x2, 2);
+                s_sample_log_put_bits(stream, xor >> stream->trailing,
+                                      64 - stream->leading - stream->trailing);
+            } else {
+                if (leading > 31)
+                    leading = 31;
+                length = 64 - leading - trailing;
+                s_sample_log_put_bits(stream, 0x3, 2);
+                s_sample_log_put_bits(stream, leading, 5);
+                s_sample_log_put_bits(stream, length & 0x3F, 6);
+                s_sample_log_put_bits(stream, xor >> trailing, length);
+                stream->leading = leading;
+                stream->trailing = trailing;
+            }
+        }
+    }
+    stream->time = time;
+    stream->value = value;
+    stream->count++;
+}
+
+static int s_sample_log_decode(int series, const unsigned char *data,
+                               unsigned int length, unsigned int count,
+                               sample_log_fn cb, void *arg) {
+    sample_log_reader_st reader = {data, length * 8, 0};
+    uint64_t time = 0, value = 0, bits, flag;
+    int64_t delta = 0;
+    int leading = 0, trailing = 0, n;
+    unsigned int i;
+    double sample;
+
+    for (i = 0; i < count; ++i) {
+        if (i == 0) {
+            if (s_sample_log_get_bits(&reader, 64, &time) != 0 ||
+                    s_sample_log_get_bits(&reader, 64, &value) != 0)
+                return -1;
+        } else {
+            // '0', '10', '110', '1110' or '1111' selects the width.
+            for (n = 0; n < 4; ++n) {
+                if (s_sample_log_get_bits(&reader, 1, &flag) != 0)
+                    return -1;
+                if (flag == 0)
+                    break;
+            }
+            if (n > 0) {
+                static const int widths[] = {0, 7, 9, 12, 64};
+                if (s_sample_log_get_bits(&reader, widths[n], &bits) != 0)
+                    return -1;
+                if (widths[n] < 64 && (bits >> (widths[n] - 1) & 1))
+                    bits |= ~0ULL << widths[n];
+                delta += (int64_t)bits;
+            }
+            time += delta;
+
+            if (s_sample_log_get_bits(&reader, 1, &flag) != 0)
+                return -1;
+            if (flag) {
+                if (s_sample_log_get_bits(&reader, 1, &flag) != 0)
+                    return -1;
+                if (flag) {
+                    if (s_sample_log_get_bits(&reader, 5, &bits) != 0)
+                        return -1;
+                    leading = bits;
+                    if (s_sample_log_get_bits(&reader, 6, &bits) != 0)
+                        return -1;
+                    trailing = 64 - leading - (bits == 0 ? 64 : (int)bits);
+                    if (trailing < 0)
+                        return -1;
+                }
+                if (s_sample_log_get_bits(&reader, 64 - leading - trailing, &bits) != 0)
+                    return -1;
+                value ^= bits << trailing;
+            }
+        }
+        memcpy(&sample, &value, sizeof(sample));
+        if (cb(series, time, sample, arg) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int s_sample_log_check(const unsigned char *header,
+                              const unsigned char *payload, size_t avail) {
+    int length;
+    uint32_t crc;
+
+    if (avail < SAMPLE_LOG_BLOCK_HEADER ||
+            (header[0] | header[1] << 8) != SAMPLE_LOG_BLOCK_MAGIC ||
+            header[2] >= SAMPLE_LOG_MAX_SERIES || header[3] != SAMPLE_LOG_VERSION)
+        return -1;
+    length = header[6] | header[7] << 8;
+    if (length > SAMPLE_LOG_BLOCK_BYTES ||
+            (size_t)length > avail - SAMPLE_LOG_BLOCK_HEADER)
+        return -1;
+    crc = s_sample_log_crc(0, header, 8);
+    crc = s_sample_log_crc(crc, payload, length);
+    if (crc != ((uint32_t)header[8] | header[9] << 8 | header[10] << 16 |
+                (uint32_t)header[11] << 24))
+        return -1;
+    return length;
+}
+
+static int s_sample_log_list(const char *dir, unsigned int **list) {
+    struct dirent **names;
+    unsigned int sequence;
+    char end;
+    int count, i, n = 0;
+
+    // zero padded names, alphabetical order is the sequence order.
+    if ((count = scandir(dir, &names, NULL, alphasort)) < 0)
+        return -1;
+    *list = malloc(sizeof(unsigned int) * (count + 1));
+    for (i = 0; i < count; ++i) {
+        if (*list != NULL &&
+                sscanf(names[i]->d_name, "%8u.se%c", &sequence, &end) == 2 &&
+                end == 'g' && strlen(names[i]->d_name) == 12)
+            (*list)[n++] = sequence;
+        free(names[i]);
+    }
+    free(names);
+    if (*list == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return n;
+}
+
+static void s_sample_log_put_bits(sample_log_stream_st *stream, uint64_t value,
+                                  int n) {
+    int room, take;
+
+    // most significant bit first, a byte at a time.
+    while (n > 0) {
+        room = 8 - stream->bits % 8;
+        take = n < room ? n : room;
+        stream->data[stream->bits / 8] |=
+            (value >> (n - take) & ((1u << take) - 1)) << (room - take);
+        stream->bits += take;
+        n -= take;
+    }
+}
+
+static int s_sample_log_get_bits(sample_log_reader_st *reader, int n,
+                                 uint64_t *value) {
+    uint64_t v = 0;
+
+    if (reader->pos + n > reader->bits)
+        return -1;
+    while (n-- > 0) {
+        v = v << 1 | (reader->data[reader->pos / 8] >> (7 - reader->pos % 8) & 1);
+        reader->pos++;
+    }
+    *value = v;
+    return 0;
+}
+
+static uint32_t s_sample_log_crc(uint32_t crc, const unsigned char *data,
+                                 size_t len) {
+    static uint32_t table[256];
+    uint32_t c;
+    int i, k;
+
+    if (table[1] == 0) {
+        for (i = 0; i < 256; ++i) {
+            for (c = i, k = 0; k < 8; ++k)
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    while (len-- > 0)
+        crc = table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static time_t s_sample_log_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+#if defined(XTEST) || defined(BENCH)
+
+#define TEST_DIR            "/tmp/sample_log_test"  /**< Log directory */
+#define TEST_START_MS       (1700000000000ULL)      /**< First sample */
+
+/**
+ * @brief Remove a test log.
+ */
+static void s_test_clean(const char *dir) {
+    char path[SAMPLE_LOG_PATH_MAX + 16];
+    unsigned int *list = NULL;
+    int count, i;
+
+    if ((count = s_sample_log_list(dir, &list)) > 0) {
+        for (i = 0; i < count; ++i) {
+            snprintf(path, sizeof(path), "%s/" SAMPLE_LOG_NAME, dir, list[i]);
+            unlink(path);
+        }
+    }
+    free(list);
+    rmdir(dir);
+}
+
+/**
+ * @brief value of series s at second i: a slow temperature, a noisy ADC
+ *        channel and a pressure that never moves.
+ */
+static double s_test_value(int s, long i) {
+    if (s == 0)
+        return 21.0 + (i / 600 % 5) * 0.1;
+    if (s == 1)
+        return 2048 + (i * 7919 % 17);
+    return 101325;
+}
+
+#endif
+
+#ifdef XTEST
+
+#define TEST_SAMPLES        (20000)     /**< Samples per series */
+
+/**
+ * @brief What was read back.
+ */
+typedef struct test_read {
+    long count[SAMPLE_LOG_MAX_SERIES];  /**< samples per series */
+    uint64_t prev[SAMPLE_LOG_MAX_SERIES]; /**< time of the last sample */
+    long wrong;                         /**< samples not as written */
+    uint64_t last;                      /**< newest time seen */
+} test_read_st;
+
+static int s_test_read(int series, uint64_t time_ms, double value, void *arg) {
+    test_read_st *read = arg;
+    long i = (time_ms - TEST_START_MS) / 1000;
+
+    // the samples of a series come in order, 1 s apart.
+    if (time_ms != TEST_START_MS + (uint64_t)i * 1000 ||
+            value != s_test_value(series, i) ||
+            (read->count[series] != 0 && time_ms != read->prev[series] + 1000))
+        read->wrong++;
+    read->count[series]++;
+    read->prev[series] = time_ms;
+    if (time_ms > read->last)
+        read->last = time_ms;
+    return 0;
+}
+
+/**
+ * @brief Flip the last byte written in the newest segment.
+ */
+static void s_test_tear(const char *dir) {
+    char path[SAMPLE_LOG_PATH_MAX + 16];
+    unsigned int *list = NULL;
+    unsigned char byte;
+    off_t end;
+    int fd, count;
+
+    count = s_sample_log_list(dir, &list);
+    snprintf(path, sizeof(path), "%s/" SAMPLE_LOG_NAME, dir, list[count - 1]);
+    free(list);
+    fd = open(path, O_RDWR);
+    for (end = lseek(fd, 0, SEEK_END); end > 0; --end) {
+        pread(fd, &byte, 1, end - 1);
+        if (byte != 0)
+            break;
+    }
+    byte ^= 0x5A;
+    pwrite(fd, &byte, 1, end - 1);
+    close(fd);
+}
+
+int main() {
+    sample_log_stats_st stats;
+    test_read_st read;
+    sample_log_st *log;
+    int s, failed = 0;
+    long i;
+
+    // round trip, 3 series of one sample a second.
+    s_test_clean(TEST_DIR);
+    log = sample_log_open(TEST_DIR, SAMPLE_LOG_SEGMENT_SIZE, 4, 3600);
+    if (log == NULL) {
+        perror(TEST_DIR);
+        return 1;
+    }
+    for (i = 0; i < TEST_SAMPLES; ++i) {
+        for (s = 0; s < 3; ++s)
+            failed |= sample_log_append(log, s, TEST_START_MS + i * 1000,
+                                        s_test_value(s, i)) != 0;
+    }
+    failed |= sample_log_append(log, 0, TEST_START_MS, 0) != EINVAL;
+    sample_log_get_stats(log, &stats);
+    sample_log_close(log);
+    printf("%lu samples in %lu bytes, %.3f bytes/sample, %lu blocks\n",
+           stats.samples, stats.bytes, (double)stats.bytes / stats.samples,
+           stats.blocks);
+    failed |= stats.samples != 3 * TEST_SAMPLES ||
+              stats.bytes > 2 * stats.samples;
+
+    memset(&read, 0, sizeof(read));
+    sample_log_read(TEST_DIR, s_test_read, &read);
+    failed |= read.count[0] != TEST_SAMPLES || read.count[1] != TEST_SAMPLES ||
+              read.count[2] != TEST_SAMPLES || read.wrong != 0;
+    printf("round trip: %ld %ld %ld samples, %ld wrong\n",
+           read.count[0], read.count[1], read.count[2], read.wrong);
+
+    // a torn last block is dropped, the log goes on after the one before.
+    log = sample_log_open(TEST_DIR, SAMPLE_LOG_SEGMENT_SIZE, 4, 3600);
+    for (i = TEST_SAMPLES; i < TEST_SAMPLES + 100; ++i)
+        sample_log_append(log, 0, TEST_START_MS + i * 1000, s_test_value(0, i));
+    sample_log_close(log);
+    s_test_tear(TEST_DIR);
+
+    log = sample_log_open(TEST_DIR, SAMPLE_LOG_SEGMENT_SIZE, 4, 3600);
+    sample_log_get_stats(log, &stats);
+    failed |= stats.dropped == 0;
+    sample_log_close(log);
+    memset(&read, 0, sizeof(read));
+    sample_log_read(TEST_DIR, s_test_read, &read);
+    failed |= read.count[0] != TEST_SAMPLES || read.wrong != 0;
+    printf("torn block: %lu bytes dropped, %ld samples left\n",
+           stats.dropped, read.count[0]);
+    s_test_clean(TEST_DIR);
+
+    // small segments rotate, only the newest 3 are kept.
+    log = sample_log_open(TEST_DIR, 4096, 3, 3600);
+    for (i = 0; i < TEST_SAMPLES; ++i)
+        sample_log_append(log, 1, TEST_START_MS + i * 1000, s_test_value(1, i));
+    sample_log_get_stats(log, &stats);
+    sample_log_close(log);
+    memset(&read, 0, sizeof(read));
+    sample_log_read(TEST_DIR, s_test_read, &read);
+    failed |= stats.segments <= 3 || read.count[1] == 0 ||
+              read.count[1] >= TEST_SAMPLES || read.wrong != 0 ||
+              read.last != TEST_START_MS + (TEST_SAMPLES - 1) * 1000ULL;
+    printf("rotation: %lu segments, %ld samples kept\n",
+           stats.segments, read.count[1]);
+    s_test_clean(TEST_DIR);
+
+    printf("%s\n", failed ? "FAILED" : "SUCCESS!");
+    return failed;
+}
+
+#endif
+
+#ifdef BENCH
+#include "bench.h"
+
+/**
+ * @brief one sample, compressed and written as blocks fill.
+ */
+static void s_bench_append(void *arg, long n) {
+    static long i = 0;
+    sample_log_st *log = arg;
+
+    while (n-- > 0) {
+        sample_log_append(log, i % 3, TEST_START_MS + i / 3 * 1000,
+                          s_test_value(i % 3, i / 3));
+        ++i;
+    }
+}
+
+int main() {
+    sample_log_st *log;
+
+    s_test_clean(TEST_DIR);
+    if ((log = sample_log_open(TEST_DIR, SAMPLE_LOG_SEGMENT_SIZE, 4, 3600)) == NULL) {
+        perror(TEST_DIR);
+        exit(errno);
+    }
+    bench_run("sample_log", "append", s_bench_append, log, NULL);
+    sample_log_close(log);
+    s_test_clean(TEST_DIR);
+    return 0;
+}
+
+#endif
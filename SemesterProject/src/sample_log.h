@@ -0,0 +1,115 @@
+/**
+ * @file sample_log.h
+ * @brief crash-safe compressed on-disk log of samples, declaration.
+ *        Samples are appended to memory mapped segment files in a
+ *        directory. Each series is compressed on its own, timestamps as
+ *        delta of delta and values XORed with the previous one, and written
+ *        as a checksummed block once the block is full or the log is synced.
+ *        Syncs are batched, a crash loses at most the samples since the last
+ *        one; a torn block is dropped when the log is opened again.
+ *        A full segment is closed and a new one started, the oldest ones
+ *        are removed past the maximum.
+ * @author Xiangyu Guo
+ */
+#ifndef __SAMPLE_LOG_H__
+#define __SAMPLE_LOG_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SAMPLE_LOG_MAX_SERIES       (32)        /**< Series, numbered from 0 */
+#define SAMPLE_LOG_BLOCK_BYTES      (512)       /**< Payload of one block */
+#define SAMPLE_LOG_SEGMENT_SIZE     (1 << 20)   /**< Default segment size */
+#define SAMPLE_LOG_MAX_SEGMENTS     (64)        /**< Default segments kept */
+#define SAMPLE_LOG_SYNC_SEC         (60)        /**< Default sync period */
+
+/**
+ * @brief module structure, hiding the detail to the public
+ */
+typedef struct sample_log sample_log_st;
+struct sample_log;
+
+/**
+ * @brief counters of an open log.
+ */
+typedef struct sample_log_stats {
+    unsigned long samples;          /**< samples appended */
+    unsigned long bytes;            /**< bytes of the blocks written */
+    unsigned long blocks;           /**< blocks written */
+    unsigned long syncs;            /**< syncs to the card */
+    unsigned long segments;         /**< segments started */
+    unsigned long dropped;          /**< bytes of torn blocks dropped on open */
+} sample_log_stats_st;
+
+/**
+ * @brief called for each sample read back.
+ * @param series series the sample was appended to.
+ * @param time_ms time of the sample, in ms.
+ * @param value the sample.
+ * @param arg argument of the reader.
+ * @return 0 to go on, otherwise the reading stops.
+ */
+typedef int (*sample_log_fn)(int series, uint64_t time_ms, double value,
+                             void *arg);
+
+/* ==============================================
+	sample log initialize and finish function
+   ============================================== */
+/**
+ * @brief Open the log in a directory, created if missing. The last segment
+ *        is checked and appending resumes after its last whole block.
+ * @param dir directory of the segments.
+ * @param segment_size size of one segment, in bytes.
+ * @param max_segments segments kept, the oldest are removed.
+ * @param sync_sec blocks are written and synced at most this often.
+ * @return a opened log, NULL with errno set on failure.
+ */
+sample_log_st *sample_log_open(const char *dir, size_t segment_size,
+                               int max_segments, int sync_sec);
+
+/**
+ * @brief Sync and close the log.
+ * @param log a valid log.
+ */
+void sample_log_close(sample_log_st *log);
+
+/* ====================
+    sample log function
+   ==================== */
+/**
+ * @brief Append one sample, syncs when the period is over.
+ * @param log a valid log.
+ * @param series [0 - SAMPLE_LOG_MAX_SERIES).
+ * @param time_ms time of the sample, in ms, not older than the last one.
+ * @param value the sample.
+ * @return 0 on success; otherwise an errno.
+ */
+int sample_log_append(sample_log_st *log, int series, uint64_t time_ms,
+                      double value);
+
+/**
+ * @brief Write the pending blocks and sync them to the card.
+ * @param log a valid log.
+ * @return 0 on success; otherwise an errno.
+ */
+int sample_log_sync(sample_log_st *log);
+
+/**
+ * @brief Get the counters of the log.
+ * @param log a valid log.
+ * @param stats [out] counters.
+ */
+void sample_log_get_stats(sample_log_st *log, sample_log_stats_st *stats);
+
+/**
+ * @brief Read every sample of a log directory, one block at a time.
+ *        Blocks come in the order they were written, the samples of one
+ *        series in time order.
+ * @param dir directory of the segments.
+ * @param cb called for each sample.
+ * @param arg argument of the call back.
+ * @return 0 on success; otherwise an errno.
+ */
+int sample_log_read(const char *dir, sample_log_fn cb, void *arg);
+
+#endif
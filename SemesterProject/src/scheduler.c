@@ -0,0 +1,463 @@
+/**
+ * @file scheduler.c
+ * @brief deadline-aware sampling scheduler, implementation.
+ *        Planning works on a 1 ms grid over the cycle of all the periods
+ *        (their least common multiple, at most SCHEDULER_PLAN_MS). The
+ *        reads of the planned tasks are marked on it, then every phase of
+ *        the new task is scored by the cells its reads would share: a cell
+ *        shared with the same bus weighs more than any number of others.
+ *        The first phase of the lowest score wins, later tasks never move
+ *        the phases given before.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <event2/event.h>
+
+#include "scheduler.h"
+#include "tracing.h"
+
+#define USEC_PER_MSEC           (1000)      /**< Microseconds per millisecond */
+#define USEC_PER_SEC            (1000000)   /**< Microseconds per second */
+#define NSEC_PER_USEC           (1000)      /**< Nanoseconds per microsecond */
+#define SCHEDULER_SAME_BUS      (1LL << 32) /**< Score of a cell shared on a bus */
+
+/**
+ * @brief one periodic task.
+ */
+typedef struct scheduler_task {
+    const char *name;                   /**< shown in the stats */
+    int bus;                            /**< SCHEDULER_BUS_* */
+    long period_us;                     /**< period */
+    long deadline_us;                   /**< relative deadline */
+    long cost_us;                       /**< expected duration */
+    long phase_us;                      /**< offset from the origin */
+    scheduler_fn fn;                    /**< the task */
+    void *arg;                          /**< argument of the task */
+    long long release_us;               /**< next release */
+    unsigned long runs;                 /**< reads done */
+    unsigned long missed;               /**< past their deadline */
+    unsigned long skipped;              /**< releases dropped */
+    long long jitter_sum_us;            /**< sum of start delays */
+    long jitter_max_us;                 /**< largest start delay */
+    long long run_sum_us;               /**< sum of durations */
+    long run_max_us;                    /**< largest duration */
+} scheduler_task_st;
+
+/**
+ * @brief the scheduler.
+ */
+struct scheduler
+{
+    struct event *timer;                /**< wakes up at the next release */
+    long long origin_us;                /**< phases count from here */
+    int count;                          /**< tasks added */
+    scheduler_task_st tasks[SCHEDULER_MAX_TASKS]; /**< tasks */
+};
+
+static const char *g_bus_names[SCHEDULER_BUSES] = {
+    "i2c", "spi", "gpio", "none"
+};
+
+/**
+ * @brief Run the due tasks, earliest deadline first, then sleep until
+ *        the next release.
+ */
+static void s_scheduler_run(evutil_socket_t fd, short flags, void *arg);
+
+/**
+ * @brief Arm the timer for the earliest release.
+ */
+static void s_scheduler_arm(scheduler_st *scheduler, long long now_us);
+
+/**
+ * @brief Pick the phase of a new task.
+ * @return phase in us.
+ */
+static long s_scheduler_plan(scheduler_st *scheduler, const scheduler_task_st *task);
+
+/**
+ * @brief Greatest common divisor.
+ */
+static long s_scheduler_gcd(long a, long b);
+
+/**
+ * @brief CLOCK_MONOTONIC in us.
+ */
+static long long s_scheduler_now_us();
+
+/* ==============================================
+	scheduler initialize and finish function
+   ============================================== */
+/**
+ * @brief Initialize a scheduler on the event loop.
+ * @param base event base.
+ * @return a initialized scheduler.
+ */
+scheduler_st *scheduler_init(struct event_base *base) {
+    scheduler_st *scheduler = calloc(1, sizeof(scheduler_st));
+
+    if (scheduler == NULL)
+        exit(ENOMEM);
+    scheduler->timer = evtimer_new(base, s_scheduler_run, scheduler);
+    if (scheduler->timer == NULL)
+        exit(ENOMEM);
+    scheduler->origin_us = s_scheduler_now_us();
+    return scheduler;
+}
+
+/**
+ * @brief Clean up the scheduler, its tasks are not run any more.
+ * @param scheduler a valid scheduler.
+ */
+void scheduler_fini(scheduler_st *scheduler) {
+    if (scheduler == NULL)
+        return;
+    event_free(scheduler->timer);
+    free(scheduler);
+}
+
+/* ====================
+    scheduler function
+   ==================== */
+/**
+ * @brief Add a periodic task, planned around the ones added before.
+ * @param scheduler a valid scheduler.
+ * @param name shown in the stats, kept as given.
+ * @param bus SCHEDULER_BUS_*.
+ * @param period_us period.
+ * @param deadline_us a read ending later than this after its release
+ *        is counted as missed.
+ * @param cost_us expected duration of one read.
+ * @param fn the task.
+ * @param arg argument of the task.
+ * @return task number; -1 with too many tasks or a bad period.
+ */
+int scheduler_add(scheduler_st *scheduler, const char *name, int bus,
+                  long period_us, long deadline_us, long cost_us,
+                  scheduler_fn fn, void *arg) {
+    scheduler_task_st *task;
+    long long now, elapsed;
+
+    if (scheduler->count == SCHEDULER_MAX_TASKS || period_us <= 0 ||
+            bus < 0 || bus >= SCHEDULER_BUSES || fn == NULL)
+        return -1;
+
+    task = &scheduler->tasks[scheduler->count];
+    memset(task, 0, sizeof(*task));
+    task->name = name;
+    task->bus = bus;
+    task->period_us = period_us;
+    task->deadline_us = deadline_us > 0 ? deadline_us : period_us;
+    task->cost_us = cost_us;
+    task->fn = fn;
+    task->arg = arg;
+    task->phase_us = s_scheduler_plan(scheduler, task);
+
+    // the first release of its phase still to come.
+    now = s_scheduler_now_us();
+    elapsed = now - scheduler->origin_us - task->phase_us;
+    task->release_us = scheduler->origin_us + task->phase_us +
+                       (elapsed > 0 ? (elapsed + period_us - 1) / period_us * period_us : 0);
+
+    scheduler->count++;
+    s_scheduler_arm(scheduler, now);
+    return scheduler->count - 1;
+}
+
+/**
+ * @brief Number of tasks added.
+ * @param scheduler a valid scheduler.
+ */
+int scheduler_tasks(scheduler_st *scheduler) {
+    return scheduler->count;
+}
+
+/**
+ * @brief Get the plan and timing of one task.
+ * @param scheduler a valid scheduler.
+ * @param task number returned by scheduler_add.
+ * @param stats [out] plan and timing.
+ */
+void scheduler_get_stats(scheduler_st *scheduler, int task,
+                         scheduler_stats_st *stats) {
+    const scheduler_task_st *t;
+
+    memset(stats, 0, sizeof(*stats));
+    if (task < 0 || task >= scheduler->count)
+        return;
+    t = &scheduler->tasks[task];
+    stats->name = t->name;
+    stats->bus = t->bus;
+    stats->period_us = t->period_us;
+    stats->deadline_us = t->deadline_us;
+    stats->phase_us = t->phase_us;
+    stats->runs = t->runs;
+    stats->missed = t->missed;
+    stats->skipped = t->skipped;
+    stats->jitter_max_us = t->jitter_max_us;
+    stats->run_max_us = t->run_max_us;
+    if (t->runs != 0) {
+        stats->jitter_avg_us = t->jitter_sum_us / t->runs;
+        stats->run_avg_us = t->run_sum_us / t->runs;
+    }
+}
+
+/**
+ * @brief Name of a bus, e.g. "i2c".
+ * @param bus SCHEDULER_BUS_*.
+ */
+const char *scheduler_bus_name(int bus) {
+    if (bus < 0 || bus >= SCHEDULER_BUSES)
+        return "unknown";
+    return g_bus_names[bus];
+}
+
+/* ================
+    inner function
+   ================ */
+static void s_scheduler_run(evutil_socket_t fd, short flags, void *arg) {
+    scheduler_st *scheduler = arg;
+    scheduler_task_st *task, *next;
+    long long now, start, end;
+    unsigned int ran = 0;
+    long jitter, run;
+    int i;
+
+    // each task runs once a wake up, an overrun must not starve the loop.
+    for (;;) {
+        // earliest deadline among the released tasks.
+        now = s_scheduler_now_us();
+        next = NULL;
+        for (i = 0; i < scheduler->count; ++i) {
+            task = &scheduler->tasks[i];
+            if ((ran & (1u << i)) == 0 && task->release_us <= now && (next == NULL ||
+                    task->release_us + task->deadline_us <
+                    next->release_us + next->deadline_us))
+                next = task;
+        }
+        if (next == NULL)
+            break;
+
+        ran |= 1u << (next - scheduler->tasks);
+        start = now;
+        tracing_begin(next->name, "task");
+        next->fn(next->arg);
+        tracing_end();
+        end = s_scheduler_now_us();
+
+        jitter = start - next->release_us;
+        run = end - start;
+        next->runs++;
+        next->jitter_sum_us += jitter;
+        next->run_sum_us += run;
+        if (jitter > next->jitter_max_us)
+            next->jitter_max_us = jitter;
+        if (run > next->run_max_us)
+            next->run_max_us = run;
+        if (end > next->release_us + next->deadline_us)
+            next->missed++;
+
+        // an overrun drops the releases already gone, not to run in a burst.
+        next->release_us += next->period_us;
+        while (next->release_us + next->period_us <= end) {
+            next->release_us += next->period_us;
+            next->skipped++;
+        }
+    }
+    s_scheduler_arm(scheduler, now);
+}
+
+static void s_scheduler_arm(scheduler_st *scheduler, long long now_us) {
+    long long first = 0, wait;
+    struct timeval tv;
+    int i;
+
+    if (scheduler->count == 0)
+        return;
+    for (i = 0; i < scheduler->count; ++i) {
+        if (i == 0 || scheduler->tasks[i].release_us < first)
+            first = scheduler->tasks[i].release_us;
+    }
+    wait = first > now_us ? first - now_us : 0;
+    tv.tv_sec = wait / USEC_PER_SEC;
+    tv.tv_usec = wait % USEC_PER_SEC;
+    evtimer_add(scheduler->timer, &tv);
+}
+
+static long s_scheduler_plan(scheduler_st *scheduler, const scheduler_task_st *task) {
+    const scheduler_task_st *t;
+    unsigned char *same, *any;
+    long cycle, period, cost, phase, best = 0, cell, k, c;
+    long long score, best_score = -1;
+    int i;
+
+    // periods below the grid, or nothing to avoid yet.
+    period = task->period_us / USEC_PER_MSEC;
+    if (period < 2 || scheduler->count == 0)
+        return 0;
+
+    cycle = period;
+    for (i = 0; i < scheduler->count; ++i) {
+        k = scheduler->tasks[i].period_us / USEC_PER_MSEC;
+        if (k < 1)
+            continue;
+        cycle = cycle / s_scheduler_gcd(cycle, k) * k;
+        if (cycle > SCHEDULER_PLAN_MS) {
+            cycle = SCHEDULER_PLAN_MS;
+            break;
+        }
+    }
+    if (cycle < period)
+        cycle = period;
+
+    same = calloc(cycle, 1);
+    any = calloc(cycle, 1);
+    if (same == NULL || any == NULL)
+        exit(ENOMEM);
+
+    // the cells read by every task planned so far.
+    for (i = 0; i < scheduler->count; ++i) {
+        t = &scheduler->tasks[i];
+        k = t->period_us / USEC_PER_MSEC;
+        if (k < 1)
+            continue;
+        cost = (t->cost_us + USEC_PER_MSEC - 1) / USEC_PER_MSEC;
+        for (phase = t->phase_us / USEC_PER_MSEC; phase < cycle; phase += k) {
+            for (c = 0; c < cost && c < k; ++c) {
+                cell = (phase + c) % cycle;
+                if (any[cell] < 255)
+                    any[cell]++;
+                if (t->bus == task->bus && same[cell] < 255)
+                    same[cell]++;
+            }
+        }
+    }
+
+    cost = (task->cost_us + USEC_PER_MSEC - 1) / USEC_PER_MSEC;
+    if (cost < 1)
+        cost = 1;
+    for (phase = 0; phase < period && best_score != 0; ++phase) {
+        score = 0;
+        for (k = phase; k < cycle; k += period) {
+            for (c = 0; c < cost && c < period; ++c) {
+                cell = (k + c) % cycle;
+                score += same[cell] * SCHEDULER_SAME_BUS + any[cell];
+            }
+        }
+        if (best_score < 0 || score < best_score) {
+            best_score = score;
+            best = phase;
+        }
+    }
+
+    free(same);
+    free(any);
+    return best * USEC_PER_MSEC;
+}
+
+static long s_scheduler_gcd(long a, long b) {
+    long t;
+
+    while (b != 0) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static long long s_scheduler_now_us() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * USEC_PER_SEC + ts.tv_nsec / NSEC_PER_USEC;
+}
+
+#ifdef XTEST
+
+#define TEST_RUN_MS         (600)       /**< Loop run */
+
+/**
+ * @brief spin for the cost of a read.
+ */
+static void s_test_busy(void *arg) {
+    long long until = s_scheduler_now_us() + *(long *)arg;
+
+    while (s_scheduler_now_us() < until)
+        ;
+}
+
+/**
+ * @brief Print the plan and timing of one task.
+ */
+static void s_test_print(scheduler_st *scheduler, int task) {
+    scheduler_stats_st stats;
+
+    scheduler_get_stats(scheduler, task, &stats);
+    printf("%-8s %-4s period %6ld phase %6ld runs %3lu missed %3lu skipped %3lu "
+           "jitter %5ld/%5ld us run %5ld us\n", stats.name,
+           scheduler_bus_name(stats.bus), stats.period_us, stats.phase_us,
+           stats.runs, stats.missed, stats.skipped, stats.jitter_avg_us,
+           stats.jitter_max_us, stats.run_avg_us);
+}
+
+int main() {
+    static long cost_5ms = 5000, cost_2ms = 2000, cost_30ms = 30000;
+    struct event_base *base = event_base_new();
+    scheduler_st *scheduler = scheduler_init(base);
+    struct timeval run = {0, TEST_RUN_MS * USEC_PER_MSEC};
+    scheduler_stats_st a, b, c, d;
+    long gap;
+    int failed = 0;
+
+    scheduler_add(scheduler, "adc", SCHEDULER_BUS_SPI, 20000, 10000, 5000,
+                  s_test_busy, &cost_5ms);
+    scheduler_add(scheduler, "adc2", SCHEDULER_BUS_SPI, 20000, 10000, 5000,
+                  s_test_busy, &cost_5ms);
+    scheduler_add(scheduler, "pressure", SCHEDULER_BUS_I2C, 40000, 20000, 2000,
+                  s_test_busy, &cost_2ms);
+    scheduler_get_stats(scheduler, 0, &a);
+    scheduler_get_stats(scheduler, 1, &b);
+    scheduler_get_stats(scheduler, 2, &c);
+
+    // the second read of the bus lands where the first one is over.
+    gap = (b.phase_us - a.phase_us + a.period_us) % a.period_us;
+    failed |= gap < 5000 || gap > 15000;
+    // the third one fits the gaps of both.
+    failed |= c.phase_us % 20000 < 10000 || c.phase_us % 20000 >= 18000;
+
+    event_base_loopexit(base, &run);
+    event_base_dispatch(base);
+    s_test_print(scheduler, 0);
+    s_test_print(scheduler, 1);
+    s_test_print(scheduler, 2);
+    scheduler_get_stats(scheduler, 0, &a);
+    scheduler_get_stats(scheduler, 2, &c);
+    failed |= a.runs < TEST_RUN_MS / 20 - 2 || c.runs < TEST_RUN_MS / 40 - 2;
+
+    // a task longer than its period misses and drops releases.
+    scheduler_add(scheduler, "slow", SCHEDULER_BUS_GPIO, 20000, 10000, 30000,
+                  s_test_busy, &cost_30ms);
+    scheduler_get_stats(scheduler, 0, &b);
+    failed |= b.phase_us != a.phase_us;
+    event_base_loopexit(base, &run);
+    event_base_dispatch(base);
+    s_test_print(scheduler, 3);
+    scheduler_get_stats(scheduler, 3, &d);
+    failed |= d.runs == 0 || d.missed != d.runs || d.skipped == 0;
+
+    failed |= scheduler_add(scheduler, "bad", SCHEDULER_BUS_I2C, 0, 0, 0,
+                            s_test_busy, &cost_2ms) != -1;
+
+    scheduler_fini(scheduler);
+    event_base_free(base);
+    printf("%s\n", failed ? "FAILED" : "SUCCESS!");
+    return failed;
+}
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * @file scheduler.h
+ * @brief deadline-aware sampling scheduler, declaration.
+ *        Every periodic sensor read is a task with a period, a relative
+ *        deadline, an expected cost and the bus it uses. One timer on the
+ *        event loop runs the due tasks earliest deadline first, so reads
+ *        never overlap. A task added is given the phase whose reads land
+ *        in the gaps left by the tasks already planned, so it does not
+ *        delay them; reads of one bus are kept apart first.
+ * @author Xiangyu Guo
+ */
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#define SCHEDULER_MAX_TASKS     (16)        /**< Tasks of one scheduler */
+#define SCHEDULER_PLAN_MS       (60000)     /**< Longest cycle planned */
+
+#define SCHEDULER_BUS_I2C       (0)         /**< BMP180, LCD */
+#define SCHEDULER_BUS_SPI       (1)         /**< MCP3208 */
+#define SCHEDULER_BUS_GPIO      (2)         /**< DHT11, pins */
+#define SCHEDULER_BUS_NONE      (3)         /**< No bus, computing only */
+#define SCHEDULER_BUSES         (4)         /**< Number of buses */
+
+/**
+ * @brief module structure, hiding the detail to the public
+ */
+typedef struct scheduler scheduler_st;
+struct scheduler;
+struct event_base;
+
+/**
+ * @brief a task, reads its sensor once.
+ * @param arg argument given to scheduler_add.
+ */
+typedef void (*scheduler_fn)(void *arg);
+
+/**
+ * @brief plan and timing of one task.
+ */
+typedef struct scheduler_stats {
+    const char *name;               /**< name given to scheduler_add */
+    int bus;                        /**< SCHEDULER_BUS_* */
+    long period_us;                 /**< period */
+    long deadline_us;               /**< deadline after each release */
+    long phase_us;                  /**< offset of the releases, as planned */
+    unsigned long runs;             /**< reads done */
+    unsigned long missed;           /**< reads ending past their deadline */
+    unsigned long skipped;          /**< releases dropped, overrun */
+    long jitter_avg_us;             /**< mean start delay after release */
+    long jitter_max_us;             /**< largest start delay */
+    long run_avg_us;                /**< mean duration */
+    long run_max_us;                /**< largest duration */
+} scheduler_stats_st;
+
+/* ==============================================
+	scheduler initialize and finish function
+   ============================================== */
+/**
+ * @brief Initialize a scheduler on the event loop.
+ * @param base event base.
+ * @return a initialized scheduler.
+ */
+scheduler_st *scheduler_init(struct event_base *base);
+
+/**
+ * @brief Clean up the scheduler, its tasks are not run any more.
+ * @param scheduler a valid scheduler.
+ */
+void scheduler_fini(scheduler_st *scheduler);
+
+/* ====================
+    scheduler function
+   ==================== */
+/**
+ * @brief Add a periodic task, planned around the ones added before.
+ * @param scheduler a valid scheduler.
+ * @param name shown in the stats, kept as given.
+ * @param bus SCHEDULER_BUS_*.
+ * @param period_us period.
+ * @param deadline_us a read ending later than this after its release
+ *        is counted as missed.
+ * @param cost_us expected duration of one read.
+ * @param fn the task.
+ * @param arg argument of the task.
+ * @return task number; -1 with too many tasks or a bad period.
+ */
+int scheduler_add(scheduler_st *scheduler, const char *name, int bus,
+                  long period_us, long deadline_us, long cost_us,
+                  scheduler_fn fn, void *arg);
+
+/**
+ * @brief Number of tasks added.
+ * @param scheduler a valid scheduler.
+ */
+int scheduler_tasks(scheduler_st *scheduler);
+
+/**
+ * @brief Get the plan and timing of one task.
+ * @param scheduler a valid scheduler.
+ * @param task number returned by scheduler_add.
+ * @param stats [out] plan and timing.
+ */
+void scheduler_get_stats(scheduler_st *scheduler, int task,
+                         scheduler_stats_st *stats);
+
+/**
+ * @brief Name of a bus, e.g. "i2c".
+ * @param bus SCHEDULER_BUS_*.
+ */
+const char *scheduler_bus_name(int bus);
+
+#endif
@@ -7,14 +7,16 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
-#include <wiringPi.h>
 #include <event2/event.h>
 
 #include "screen.h"
+#include "history.h"
+#include "loop_lag.h"
 
 #include "i2c/i2c_lcd1620.h"
 #include "i2c/i2c_bmp180.h"
 #include "pin/pin_dht_11.h"
+#include "pin/pin_debounce.h"
 #include "spi/spi_mcp3208.h"
 
 #define BUTTON_UP       (6)             /**< The pin of up button*/
@@ -22,14 +24,34 @@
 #define BUTTON_LEFT     (26)            /**< The pin of left button*/
 #define BUTTON_RIGHT    (4)             /**< The pin of right button*/
 
-#define INTERRUPT_INTERVAL  (200)       /**< Bouncing Interval */
+#define BUTTON_SETTLE_US    (10000)     /**< Contacts stop bouncing within */
+#define BUTTON_LONG_US      (600000)    /**< Held this long, the press repeats */
+#define BUTTON_REPEAT_US    (150000)    /**< Repeat period of a held button */
+
+#define INPUT_UP        (0)             /**< Input event of up button */
+#define INPUT_DOWN      (1)             /**< Input event of down button */
+#define INPUT_LEFT      (2)             /**< Input event of left button */
+#define INPUT_RIGHT     (3)             /**< Input event of right button */
+#define TOTAL_INPUTS    (4)             /**< Total input events */
 
 #define TOTAL_PAGES     (4)             /**< Total avaiable pages*/
 
-struct screen_module {
-    int index;                              /**< Current page number */
+/**
+ * @brief one rendered page, both lines of the display.
+ */
+typedef struct screen_frame {
     char info[LCD1620_CHARS_PER_LINE + 1];  /**< First line info */
     char msg[LCD1620_CHARS_PER_LINE + 1];   /**< Second line message */
+} screen_frame_st;
+
+/**
+ * @brief everything runs on the I/O thread. Pages render into the frame,
+ *        which is drawn into the next frame of the LCD without touching
+ *        the bus; the scheduled flush sends what changed over i2c.
+ */
+struct screen_module {
+    int index;                              /**< Current page number */
+    screen_frame_st frame;                  /**< Frame being rendered */
     lcd1620_module_st *screen_display;      /**< LCD Display object */
 };
 
@@ -42,6 +64,12 @@ typedef struct screen_page {
 
 static screen_module_st *instance = NULL;
 
+static rt_io_st *g_rt = NULL;           /**< I/O thread, renders the pages */
+
+static double g_samples[HISTORY_SERIES];    /**< Latest sample of each series */
+
+static int g_sampled[HISTORY_SERIES];       /**< A sample came, I/O thread */
+
 /**
  * @brief Inner initializing function of the screen display
  * @return a initialized instance
@@ -49,28 +77,23 @@ static screen_module_st *instance = NULL;
 static screen_module_st *s_screen_display_init();
 
 /* ====================
- * Interrupt functions.
+ * Input functions.
  * ==================== */
 
 /**
- * @brief interrupt service handler of button up event
- */
-static void isr_button_up(void);
-
-/**
- * @brief interrupt service handler of button up event
- */
-static void isr_button_down(void);
-
-/**
- * @brief interrupt service handler of button up event
+ * @brief pass a button press from the event loop to the I/O thread.
+ * @param pin wiringPi pin of the button.
+ * @param events filtered events of the button.
+ * @param timestamp_us time of the event.
+ * @param arg the input event, INPUT_UP to INPUT_RIGHT.
  */
-static void isr_button_left(void);
+static void s_screen_button(int pin, int events, uint64_t timestamp_us, void *arg);
 
 /**
- * @brief interrupt service handler of button up event
+ * @brief apply a button press on the I/O thread, then redraw.
+ * @param arg the input event, INPUT_UP to INPUT_RIGHT.
  */
-static void isr_button_right(void);
+static void s_screen_input(void *arg);
 
 /* ==========================================
  * call back function on specify data display
@@ -125,132 +148,128 @@ void screen_display_clean_up() {
     if (instance != NULL) {
         lcd1620_module_fini(instance->screen_display);
         free(instance);
+        instance = NULL;
     }
 }
 
+/**
+ * @brief deliver button presses through the event loop to the I/O thread.
+ * @param base event base.
+ * @param rt I/O thread, the only one rendering pages.
+ */
+void screen_display_setup_event(struct event_base *base, rt_io_st *rt) {
+    // buttons pull the pin low, a held one repeats.
+    static const pin_debounce_config_st button = {
+        PIN_DEBOUNCE_STABLE, 0, BUTTON_SETTLE_US, BUTTON_LONG_US, BUTTON_REPEAT_US
+    };
+
+    screen_display_get_instance();
+    g_rt = rt;
+    pin_debounce_watch(base, BUTTON_UP, &button,
+                       s_screen_button, (void *)(intptr_t)INPUT_UP);
+    pin_debounce_watch(base, BUTTON_DOWN, &button,
+                       s_screen_button, (void *)(intptr_t)INPUT_DOWN);
+    pin_debounce_watch(base, BUTTON_LEFT, &button,
+                       s_screen_button, (void *)(intptr_t)INPUT_LEFT);
+    pin_debounce_watch(base, BUTTON_RIGHT, &button,
+                       s_screen_button, (void *)(intptr_t)INPUT_RIGHT);
+}
+
+/**
+ * @brief keep the latest sample of a series for the pages.
+ * @param series HISTORY_* series.
+ * @param value the sample.
+ */
+void screen_display_sample(int series, double value) {
+    if (series < 0 || series >= HISTORY_SERIES)
+        return;
+    g_samples[series] = value;
+    g_sampled[series] = 1;
+}
+
 void screen_update_display() {
-    static int last_index = 0;
     // use the callback func in g_display_menu
     if (instance != NULL) {
+        // pages may only fill one line, start from a blank frame.
+        memset(&instance->frame, 0, sizeof(screen_frame_st));
         g_pages[instance->index].call_back(g_pages[instance->index].data);
 
-        if (last_index != instance->index ||
-                g_pages[instance->index].data != 0) {
-            last_index = instance->index;
-            lcd1620_module_clear(instance->screen_display);
-        }
-
         g_pages[instance->index].data = 0;
 
-        // pass the screen_display and data to callback func.
-        lcd1620_module_write_string(instance->screen_display, 0, 0, 
-                                    instance->info, strlen(instance->info));
-        lcd1620_module_write_string(instance->screen_display, 0, 1, 
-                                instance->msg, strlen(instance->msg));
+        // no bus traffic, the next flush sends it.
+        lcd1620_module_draw_line(instance->screen_display, 0, instance->frame.info);
+        lcd1620_module_draw_line(instance->screen_display, 1, instance->frame.msg);
     }
 }
 
+/**
+ * @brief send the cells changed since the last flush to the LCD.
+ */
+void screen_flush_display() {
+    if (instance != NULL)
+        lcd1620_module_flush(instance->screen_display);
+}
+
 static screen_module_st *s_screen_display_init() {
     instance = (screen_module_st *)malloc(sizeof(screen_module_st));
     if (instance == NULL)
         exit(ENOMEM);
 
     instance->index = 0;
-    memset(instance->info, 0, LCD1620_CHARS_PER_LINE);
+    memset(&instance->frame, 0, sizeof(instance->frame));
     instance->screen_display = lcd1620_module_init();
     if (instance->screen_display == NULL)
         exit(ENOMEM);
 
-    if (wiringPiSetup() < LOW)
-        exit(errno);
-
-    if (wiringPiISR(BUTTON_UP, INT_EDGE_FALLING, &isr_button_up) < 0)
-        exit(errno);
-    
-    if (wiringPiISR(BUTTON_DOWN, INT_EDGE_FALLING, &isr_button_down) < 0)
-        exit(errno);
-
-    if (wiringPiISR(BUTTON_LEFT, INT_EDGE_FALLING, &isr_button_left) < 0)
-        exit(errno);
-
-    if (wiringPiISR(BUTTON_RIGHT, INT_EDGE_FALLING, &isr_button_right) < 0)
-        exit(errno);
-
     return instance;
 }
 
-static void isr_button_up(void) {
-    static unsigned long s_last_interrupt = 0;
-    unsigned long current_interrupt = millis();
-
-    // Deal with bouncing issue
-    if ((current_interrupt - s_last_interrupt > INTERRUPT_INTERVAL) &&
-        instance != NULL) {
+static void s_screen_button(int pin, int events, uint64_t timestamp_us, void *arg) {
+    // a held button acts again on every repeat.
+    if (instance == NULL || !(events & (PIN_DEBOUNCE_PRESS | PIN_DEBOUNCE_REPEAT)))
+        return;
 
-        g_pages[instance->index].data = 1;
-        
-        // Update time
-        s_last_interrupt = current_interrupt;
-    }
+    // pages and frames belong to the I/O thread, a press lost to a full queue
+    // is as good as a bounce.
+    loop_lag_enter("button");
+    rt_io_call(g_rt, s_screen_input, NULL, arg);
+    loop_lag_leave();
 }
 
-static void isr_button_down(void) {
-    static unsigned long s_last_interrupt = 0;
-    unsigned long current_interrupt = millis();
-
-    // Deal with bouncing issue
-    if ((current_interrupt - s_last_interrupt > INTERRUPT_INTERVAL) &&
-        instance != NULL) {
+static void s_screen_input(void *arg) {
+    int input = (int)(intptr_t)arg;
 
+    switch (input) {
+    case INPUT_UP:
+        g_pages[instance->index].data = 1;
+        break;
+    case INPUT_DOWN:
         g_pages[instance->index].data = -1;
-        
-        // Update time
-        s_last_interrupt = current_interrupt;
-    }
-}
-
-static void isr_button_left(void) {
-    static unsigned long s_last_interrupt = 0;
-    unsigned long current_interrupt = millis();
-
-    // Deal with bouncing issue
-    if ((current_interrupt - s_last_interrupt > INTERRUPT_INTERVAL) &&
-        instance != NULL) {
-
+        break;
+    case INPUT_LEFT:
         instance->index--;
         if (instance->index < 0)
             instance->index = TOTAL_PAGES - 1;
         g_pages[instance->index].data = 0;
-
-        // Update time
-        s_last_interrupt = current_interrupt;
-    }
-}
-
-static void isr_button_right(void) {
-    static unsigned long s_last_interrupt = 0;
-    unsigned long current_interrupt = millis();
-
-    // Deal with bouncing issue
-    if ((current_interrupt - s_last_interrupt > INTERRUPT_INTERVAL) &&
-        instance != NULL) {
-
+        break;
+    case INPUT_RIGHT:
         instance->index++;
         if (instance->index >= TOTAL_PAGES)
             instance->index = 0;
         g_pages[instance->index].data = 0;
-
-        // Update time
-        s_last_interrupt = current_interrupt;
+        break;
     }
+
+    // render the new page right away, the next flush shows it.
+    screen_update_display();
 }
 
 static void display_bmp180(int data) {
     static const char *info[] = {"Temperature:", "Altitude:", "Pressure:"};
     static const char *surfix[] = {"*C", "m", "Pa"};
+    static const int series[] = {HISTORY_BMP180_TEMPERATURE, HISTORY_BMP180_ALTITUDE,
+                                 HISTORY_BMP180_PRESSURE};
     static int item = 0;
-    bmp180_data_st value;
-    bmp180_module_st *bmp180;
 
     if (instance == NULL)
         return;
@@ -262,24 +281,22 @@ static void display_bmp180(int data) {
     if (item > 2)
         item = 0;
 
-    bmp180 = bmp180_module_init(0);
-    if (bmp180_read_data(bmp180, &value) == 0) {
-        snprintf(instance->info, LCD1620_CHARS_PER_LINE, "%s", info[item]);
-        snprintf(instance->msg, LCD1620_CHARS_PER_LINE, "%.2f %s",
-                                    *(&(value.temperature) + item),
-                                    surfix[item]);
+    // the BMP180 keeps one instance, sampled by its own task.
+    if (g_sampled[series[item]]) {
+        snprintf(instance->frame.info, LCD1620_CHARS_PER_LINE, "%s", info[item]);
+        snprintf(instance->frame.msg, LCD1620_CHARS_PER_LINE, "%.2f %s",
+                                    g_samples[series[item]], surfix[item]);
     } else {
-        snprintf(instance->info, LCD1620_CHARS_PER_LINE, "No Data");
+        snprintf(instance->frame.info, LCD1620_CHARS_PER_LINE, "No Data");
     }
 }
 
 static void display_dht11(int data) {
     static const char *info[] = {"Temperature:", "Humidity:"};
     static const char *surfix[] = {"*C", "%"};
+    static const int series[] = {HISTORY_DHT11_TEMPERATURE, HISTORY_DHT11_HUMIDITY};
     static int item = 0;
 
-    dht_data_st value;
-
     if (instance == NULL)
         return;
 
@@ -290,33 +307,36 @@ static void display_dht11(int data) {
     if (item > 1)
         item = 0;
 
-    pin_dht_11_init();
-    pin_dht_11_read(&value);
-    snprintf(instance->info, LCD1620_CHARS_PER_LINE, "%s", info[item]);
-    snprintf(instance->msg, LCD1620_CHARS_PER_LINE, "%.2f %s",
-                                *(&(value.temperature) + item),
-                                surfix[item]);
+    // a reading blocks for tens of ms, show the last scheduled one.
+    if (g_sampled[series[item]]) {
+        snprintf(instance->frame.info, LCD1620_CHARS_PER_LINE, "%s", info[item]);
+        snprintf(instance->frame.msg, LCD1620_CHARS_PER_LINE, "%.2f %s",
+                                    g_samples[series[item]], surfix[item]);
+    } else {
+        snprintf(instance->frame.info, LCD1620_CHARS_PER_LINE, "No Data");
+    }
 }
 
 static void display_mcp3208(int data) {
     static int channel = 0;
-    int value;
-    mcp3208_module_st *mcp3208;
 
     if (instance == NULL)
         return;
 
     channel += data;
 
-    if (channel < MCP3208_CHANNEL_0)
-        channel = MCP3208_CHANNEL_7;
-    if (channel > MCP3208_CHANNEL_7)
-        channel = MCP3208_CHANNEL_0;
-
-    mcp3208 = mcp3208_module_get_instance();
-    value = mcp3208_read_data(mcp3208, channel);
-    snprintf(instance->info, LCD1620_CHARS_PER_LINE, "Channel: %d", channel);
-    snprintf(instance->msg, LCD1620_CHARS_PER_LINE, "Value: %04d", value);
+    if (channel < 0)
+        channel = MCP3208_TOTAL_CHANNELS - 1;
+    if (channel >= MCP3208_TOTAL_CHANNELS)
+        channel = 0;
+
+    // the ADC scans own the SPI bus, show their filtered value.
+    snprintf(instance->frame.info, LCD1620_CHARS_PER_LINE, "Channel: %d", channel);
+    if (g_sampled[HISTORY_MCP3208_CHANNEL_0 + channel])
+        snprintf(instance->frame.msg, LCD1620_CHARS_PER_LINE, "Value: %06.1f",
+                 g_samples[HISTORY_MCP3208_CHANNEL_0 + channel]);
+    else
+        snprintf(instance->frame.msg, LCD1620_CHARS_PER_LINE, "No Data");
 }
 
 static void display_time(int data) {
@@ -327,11 +347,11 @@ static void display_time(int data) {
         return;
 
     format_time = localtime(&current_time);
-    snprintf(instance->info, LCD1620_CHARS_PER_LINE, "Time:%02d:%02d:%02d", 
+    snprintf(instance->frame.info, LCD1620_CHARS_PER_LINE, "Time:%02d:%02d:%02d", 
                             format_time->tm_hour,
                             format_time->tm_min,
                             format_time->tm_sec);
-    snprintf(instance->msg, LCD1620_CHARS_PER_LINE, "Date:%02d/%02d/%04d",
+    snprintf(instance->frame.msg, LCD1620_CHARS_PER_LINE, "Date:%02d/%02d/%04d",
                             format_time->tm_mon + 1,
                             format_time->tm_mday,
                             format_time->tm_year + 1900);
@@ -339,10 +359,75 @@ static void display_time(int data) {
 
 #ifdef YTEST
 
+#include <wiringPi.h>
+
+static void s_test_tick(void *data) {
+    screen_update_display();
+}
+
+static void s_test_flush(void *data) {
+    screen_flush_display();
+}
+
+static void s_test_dht11(void *data) {
+    dht_data_st value;
+
+    if (pin_dht_11_read(&value) == 0) {
+        screen_display_sample(HISTORY_DHT11_TEMPERATURE, value.temperature);
+        screen_display_sample(HISTORY_DHT11_HUMIDITY, value.humidity);
+    }
+}
+
+static void s_test_bmp180(void *data) {
+    bmp180_data_st value = { 0 };
+
+    if (bmp180_read_data((bmp180_module_st *)data, &value) == 0) {
+        screen_display_sample(HISTORY_BMP180_TEMPERATURE, value.temperature);
+        screen_display_sample(HISTORY_BMP180_ALTITUDE, value.altitude);
+        screen_display_sample(HISTORY_BMP180_PRESSURE, value.pressure);
+    }
+}
+
+static void s_test_mcp3208(void *data) {
+    int i;
+
+    for (i = 0; i < MCP3208_TOTAL_CHANNELS; ++i)
+        screen_display_sample(HISTORY_MCP3208_CHANNEL_0 + i, mcp3208_read_channel(i));
+}
+
 int main() {
+    struct timeval stop = {10, 0};
+    struct event_base *base = event_base_new();
+    rt_io_st *rt = rt_io_init(base, NULL);
+    bmp180_module_st *bmp180;
+
+    if (wiringPiSetup() == -1)
+        exit(errno);
+    pin_dht_11_init();
+    bmp180 = bmp180_module_init(BMP180_STANDARD);
     screen_display_get_instance();
-    delay(10000);
+    screen_display_setup_event(base, rt);
+
+    // refresh once a second on the I/O thread, as the daemon does.
+    scheduler_add(rt_io_scheduler(rt), "display", SCHEDULER_BUS_NONE,
+                  1000000, 200000, 1000, s_test_tick, NULL);
+    scheduler_add(rt_io_scheduler(rt), "lcd", SCHEDULER_BUS_I2C,
+                  100000, 50000, 5000, s_test_flush, NULL);
+    scheduler_add(rt_io_scheduler(rt), "dht11", SCHEDULER_BUS_GPIO,
+                  2000000, 500000, 25000, s_test_dht11, NULL);
+    scheduler_add(rt_io_scheduler(rt), "bmp180", SCHEDULER_BUS_I2C,
+                  1000000, 200000, 10000, s_test_bmp180, bmp180);
+    scheduler_add(rt_io_scheduler(rt), "mcp3208", SCHEDULER_BUS_SPI,
+                  1000000, 100000, 1000, s_test_mcp3208, NULL);
+    if (rt_io_start(rt, -1, 0, 0) != 0)
+        exit(EXIT_FAILURE);
+    event_base_loopexit(base, &stop);
+    event_base_dispatch(base);
+
+    rt_io_fini(rt);
+    bmp180_module_fini(bmp180);
     screen_display_clean_up();
+    event_base_free(base);
     return 0;
 }
 
@@ -6,6 +6,8 @@
 #ifndef __SCREEN_H__
 #define __SCREEN_H__
 
+#include "rt_io.h"
+
 typedef struct screen_module screen_module_st;
 struct screen_module;
 
@@ -21,8 +23,31 @@ screen_module_st *screen_display_get_instance();
 void screen_display_clean_up();
 
 /**
- * @brief updating the display.
+ * @brief deliver button presses through the event loop to the I/O thread,
+ *        each one renders the page there right away.
+ * @param base event base.
+ * @param rt I/O thread, the only one rendering pages.
+ */
+void screen_display_setup_event(struct event_base *base, rt_io_st *rt);
+
+/**
+ * @brief keep the latest sample of a series for the pages, which render
+ *        from it instead of reading the sensor. On the I/O thread only.
+ * @param series HISTORY_* series.
+ * @param value the sample.
+ */
+void screen_display_sample(int series, double value);
+
+/**
+ * @brief render the current page into the next frame of the LCD, nothing
+ *        is sent. On the I/O thread only.
  */
 void screen_update_display();
 
+/**
+ * @brief send what changed on the LCD, the only i2c traffic of the screen.
+ *        On the I/O thread only, as a scheduled i2c task.
+ */
+void screen_flush_display();
+
 #endif
\ No newline at end of file
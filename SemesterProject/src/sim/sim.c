@@ -0,0 +1,504 @@
+/**
+ * @file sim.c
+ * @brief simulated board, clock, GPIO and DHT11.
+ *        The virtual clock only moves forward by the delays and bus
+ *        transactions of the code under test, so timing dependent
+ *        drivers (the DHT11 counts loop turns) decode the same waveform
+ *        on every run, however loaded the machine is.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "wiringPi.h"
+#include "sim.h"
+
+#define WPI_PINS            (32)        /**< Known wiringPi pins */
+
+#define GPIO_LATENCY_US     (1)         /**< A digitalRead and a loop turn */
+#define I2C_LATENCY_US      (100)       /**< A register access at 100 kHz */
+#define SPI_LATENCY_US      (30)        /**< One SPI_IOC_MESSAGE */
+
+#define PULSE_BOUNCES       (3)         /**< Bounces on a simulated press */
+#define PULSE_BOUNCE_US     (300)       /**< Time between bounces */
+#define PULSE_HOLD_MS       (100)       /**< Time a simulated press is held */
+
+#define DHT11_START_US      (18000)     /**< Host start signal, at least */
+#define DHT11_WAIT_US       (30)        /**< Before the sensor answers */
+#define DHT11_RESPONSE_US   (80)        /**< Response low, then high */
+#define DHT11_BIT_LOW_US    (50)        /**< Low before every bit */
+#define DHT11_ZERO_US       (27)        /**< High of a 0 */
+#define DHT11_ONE_US        (70)        /**< High of a 1 */
+#define DHT11_BYTES         (5)         /**< 4 data bytes and the checksum */
+
+#define USEC_PER_MSEC       (1000)      /**< Microseconds per millisecond */
+#define NSEC_PER_USEC       (1000)      /**< Nanoseconds per microsecond */
+#define USEC_PER_SEC        (1000000)   /**< Microseconds per second */
+
+/**
+ * @brief wiringPi pin to BCM pin, board revision 2 and later.
+ */
+static const int g_wpi_to_bcm[WPI_PINS] = {
+    17, 18, 27, 22, 23, 24, 25,  4,
+     2,  3,  8,  7, 10,  9, 11, 14,
+    15, 28, 29, 30, 31,  5,  6, 13,
+    19, 26, 12, 16, 20, 21,  0,  1
+};
+
+/**
+ * @brief the DHT11 on its data pin.
+ */
+typedef struct sim_dht11 {
+    unsigned char bytes[DHT11_BYTES];   /**< Next answer, checksum last */
+    uint64_t low_us;                    /**< Host pulled the line low at */
+    uint64_t start_us;                  /**< Answer starts at, 0 if none */
+    int output;                         /**< Host drives the line */
+} sim_dht11_st;
+
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;   /**< sim_init guard */
+static uint64_t g_now_us = 0;                       /**< Virtual clock */
+static int g_realtime = 0;                          /**< Sleep for the virtual time */
+static uint32_t g_latency_us[SIM_BUSES];            /**< Cost of one transaction */
+static sim_stats_st g_stats[SIM_BUSES];             /**< Counters of each bus */
+static uint64_t g_slept_us = 0;                     /**< Time spent in delays */
+
+static uint32_t g_gpio[SIM_GPIO_WORDS] __attribute__((aligned(4096))); /**< Registers */
+static void (*g_isrs[WPI_PINS])(void);              /**< Interrupt handlers */
+static int g_isr_modes[WPI_PINS];                   /**< INT_EDGE_* of each pin */
+static int g_pulse_ms = 0;                          /**< Press period, 0 none */
+static pthread_t g_pulse_thread;                    /**< Presses the inputs */
+static int g_pulse_started = 0;                     /**< Thread running */
+
+static sim_dht11_st g_dht11;                        /**< The DHT11 */
+
+/**
+ * @brief Read the environment and reset the models, once.
+ */
+static void s_sim_init();
+
+/**
+ * @brief Read a number from the environment.
+ * @param name variable name.
+ * @param value default value.
+ */
+static long s_sim_env(const char *name, long value);
+
+/**
+ * @brief Sleep in real time.
+ * @param us microseconds.
+ */
+static void s_sim_sleep(uint64_t us);
+
+/**
+ * @brief BCM bit of a wiringPi pin.
+ * @param pin wiringPi pin number.
+ */
+static uint32_t s_sim_bit(int pin);
+
+/**
+ * @brief Set the answer of the DHT11, checksum included.
+ */
+static void s_sim_dht11_set(int humidity, int temperature);
+
+/**
+ * @brief Level the DHT11 drives at a given time.
+ * @param now_us virtual time.
+ * @return 1 high or released, 0 low.
+ */
+static int s_sim_dht11_level(uint64_t now_us);
+
+/**
+ * @brief Press every input with a handler in turn, forever.
+ */
+static void *s_sim_pulse_thread(void *arg);
+
+/* ===============
+    sim function
+   =============== */
+/**
+ * @brief Read the environment, calling it again does nothing.
+ */
+void sim_init() {
+    pthread_once(&g_once, s_sim_init);
+}
+
+/**
+ * @brief Current virtual time.
+ * @return microseconds since the simulation started.
+ */
+uint64_t sim_now_us() {
+    return __atomic_load_n(&g_now_us, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Let virtual time pass, sleeping too with SIM_REALTIME.
+ * @param us microseconds.
+ */
+void sim_advance_us(uint64_t us) {
+    __atomic_add_fetch(&g_now_us, us, __ATOMIC_RELAXED);
+    if (g_realtime)
+        s_sim_sleep(us);
+}
+
+/**
+ * @brief Set the cost of one transaction.
+ * @param bus SIM_BUS_GPIO, _I2C or _SPI.
+ * @param latency_us microseconds per transaction.
+ */
+void sim_set_latency(int bus, uint32_t latency_us) {
+    sim_init();
+    if (bus < 0 || bus >= SIM_BUSES)
+        exit(EINVAL);
+    g_latency_us[bus] = latency_us;
+}
+
+/**
+ * @brief Transactions seen on a bus since the start or the last reset.
+ * @param bus SIM_BUS_GPIO, _I2C or _SPI.
+ * @param stats [out] counters.
+ */
+void sim_get_stats(int bus, sim_stats_st *stats) {
+    if (bus < 0 || bus >= SIM_BUSES || stats == NULL)
+        exit(EINVAL);
+    stats->transactions = __atomic_load_n(&g_stats[bus].transactions, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&g_stats[bus].bytes, __ATOMIC_RELAXED);
+    stats->busy_us = __atomic_load_n(&g_stats[bus].busy_us, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Reset the counters of every bus.
+ */
+void sim_reset_stats() {
+    int bus;
+
+    for (bus = 0; bus < SIM_BUSES; ++bus) {
+        __atomic_store_n(&g_stats[bus].transactions, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_stats[bus].bytes, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_stats[bus].busy_us, 0, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Remember the counters, to check a budget against later.
+ * @param mark [out] counters now.
+ */
+void sim_usage_mark(sim_usage_st *mark) {
+    int bus;
+
+    for (bus = 0; bus < SIM_BUSES; ++bus)
+        mark->transactions[bus] = __atomic_load_n(&g_stats[bus].transactions,
+                                                  __ATOMIC_RELAXED);
+    mark->slept_us = __atomic_load_n(&g_slept_us, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Check one operation against its budget, and print both.
+ * @param what operation checked.
+ * @param mark counters before the operation.
+ * @param bus SIM_BUS_GPIO, _I2C or _SPI, the one the operation uses.
+ * @param transactions most transactions allowed on the bus.
+ * @param slept_us most time allowed in delays.
+ * @return 0 within the budget, 1 over it.
+ */
+int sim_usage_check(const char *what, const sim_usage_st *mark, int bus,
+                    uint64_t transactions, uint64_t slept_us) {
+    sim_usage_st now;
+    uint64_t used, slept;
+    int over;
+
+    if (bus < 0 || bus >= SIM_BUSES || mark == NULL)
+        exit(EINVAL);
+
+    sim_usage_mark(&now);
+    used = now.transactions[bus] - mark->transactions[bus];
+    slept = now.slept_us - mark->slept_us;
+    over = used > transactions || slept > slept_us;
+
+    printf("budget %-24s %6llu/%-6llu transactions %8llu/%-8llu us slept %s\n",
+           what, (unsigned long long)used, (unsigned long long)transactions,
+           (unsigned long long)slept, (unsigned long long)slept_us,
+           over ? "OVER" : "ok");
+    return over;
+}
+
+/**
+ * @brief Charge one transaction to a bus, from the device models.
+ * @param bus SIM_BUS_GPIO, _I2C or _SPI.
+ * @param bytes bytes moved.
+ */
+void sim_transaction(int bus, int bytes) {
+    sim_init();
+    __atomic_add_fetch(&g_stats[bus].transactions, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_stats[bus].bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_stats[bus].busy_us, g_latency_us[bus], __ATOMIC_RELAXED);
+    sim_advance_us(g_latency_us[bus]);
+}
+
+/* ===============
+    gpio function
+   =============== */
+/**
+ * @brief The simulated register block, SIM_GPIO_WORDS words.
+ * @return the block, never NULL.
+ */
+volatile uint32_t *sim_gpio_block() {
+    sim_init();
+    return g_gpio;
+}
+
+/**
+ * @brief Read one register.
+ * @param block the register block.
+ * @param reg word index.
+ * @return register value.
+ */
+uint32_t sim_gpio_read_reg(volatile uint32_t *block, int reg) {
+    sim_transaction(SIM_BUS_GPIO, 1);
+    return __atomic_load_n(&block[reg], __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Write one register, set and clear change the levels.
+ * @param block the register block.
+ * @param reg word index.
+ * @param value register value.
+ */
+void sim_gpio_write_reg(volatile uint32_t *block, int reg, uint32_t value) {
+    sim_transaction(SIM_BUS_GPIO, 1);
+    __atomic_store_n(&block[reg], value, __ATOMIC_RELAXED);
+
+    // inputs move with the outside world only, outputs follow the writes.
+    if (reg == SIM_GPIO_SET0)
+        __atomic_or_fetch(&block[SIM_GPIO_LEV0], value, __ATOMIC_RELAXED);
+    else if (reg == SIM_GPIO_CLR0)
+        __atomic_and_fetch(&block[SIM_GPIO_LEV0], ~value, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Drive an input pin from outside, raising its interrupt.
+ * @param pin wiringPi pin number.
+ * @param level new level.
+ */
+void sim_gpio_input(int pin, int level) {
+    uint32_t bit = s_sim_bit(pin), old;
+    void (*isr)(void);
+    int mode;
+
+    if (level)
+        old = __atomic_fetch_or(&g_gpio[SIM_GPIO_LEV0], bit, __ATOMIC_RELAXED);
+    else
+        old = __atomic_fetch_and(&g_gpio[SIM_GPIO_LEV0], ~bit, __ATOMIC_RELAXED);
+    if (!(old & bit) == !level)
+        return;
+
+    isr = __atomic_load_n(&g_isrs[pin], __ATOMIC_ACQUIRE);
+    mode = g_isr_modes[pin];
+    if (isr != NULL && (mode == INT_EDGE_BOTH ||
+                        mode == (level ? INT_EDGE_RISING : INT_EDGE_FALLING)))
+        isr();
+}
+
+/* =================
+    device function
+   ================= */
+/**
+ * @brief Set what the DHT11 measures.
+ * @param humidity relative humidity, in 0.1 %.
+ * @param temperature temperature, in 0.1 *C.
+ */
+void sim_dht11_set(int humidity, int temperature) {
+    sim_init();
+    s_sim_dht11_set(humidity, temperature);
+}
+
+/* ===================
+    wiringPi function
+   =================== */
+int wiringPiSetup(void) {
+    sim_init();
+    return 0;
+}
+
+void pinMode(int pin, int mode) {
+    sim_init();
+    if (pin == SIM_DHT11_PIN) {
+        // released, the pull-up brings the line high.
+        if (g_dht11.output && mode == INPUT)
+            digitalWrite(pin, HIGH);
+        g_dht11.output = mode == OUTPUT;
+    }
+}
+
+void digitalWrite(int pin, int value) {
+    uint32_t bit = s_sim_bit(pin);
+    uint64_t now = sim_now_us();
+
+    if (pin == SIM_DHT11_PIN) {
+        if (!value) {
+            g_dht11.low_us = now;
+            g_dht11.start_us = 0;
+        } else if (g_dht11.low_us != 0 && g_dht11.start_us == 0 &&
+                   now - g_dht11.low_us >= DHT11_START_US) {
+            g_dht11.start_us = now + DHT11_WAIT_US;
+        }
+    }
+
+    sim_gpio_write_reg(g_gpio, value ? SIM_GPIO_SET0 : SIM_GPIO_CLR0, bit);
+}
+
+int digitalRead(int pin) {
+    uint32_t bit = s_sim_bit(pin);
+
+    if (pin == SIM_DHT11_PIN && !g_dht11.output && g_dht11.start_us != 0) {
+        sim_transaction(SIM_BUS_GPIO, 1);
+        return s_sim_dht11_level(sim_now_us());
+    }
+    return (sim_gpio_read_reg(g_gpio, SIM_GPIO_LEV0) & bit) != 0;
+}
+
+int wpiPinToGpio(int wpiPin) {
+    return g_wpi_to_bcm[wpiPin & (WPI_PINS - 1)];
+}
+
+int wiringPiISR(int pin, int mode, void (*function)(void)) {
+    sim_init();
+    if (pin < 0 || pin >= WPI_PINS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // inputs idle high, pulled up like the buttons and the sensors.
+    __atomic_or_fetch(&g_gpio[SIM_GPIO_LEV0], s_sim_bit(pin), __ATOMIC_RELAXED);
+    g_isr_modes[pin] = mode;
+    __atomic_store_n(&g_isrs[pin], function, __ATOMIC_RELEASE);
+
+    if (g_pulse_ms > 0 && !g_pulse_started) {
+        if ((errno = pthread_create(&g_pulse_thread, NULL, s_sim_pulse_thread, NULL)) != 0)
+            return -1;
+        g_pulse_started = 1;
+    }
+    return 0;
+}
+
+void delay(unsigned int howLong) {
+    __atomic_add_fetch(&g_slept_us, (uint64_t)howLong * USEC_PER_MSEC, __ATOMIC_RELAXED);
+    sim_advance_us((uint64_t)howLong * USEC_PER_MSEC);
+}
+
+void delayMicroseconds(unsigned int howLong) {
+    __atomic_add_fetch(&g_slept_us, howLong, __ATOMIC_RELAXED);
+    sim_advance_us(howLong);
+}
+
+unsigned int millis(void) {
+    return sim_now_us() / USEC_PER_MSEC;
+}
+
+unsigned int micros(void) {
+    return sim_now_us();
+}
+
+/* ================
+    inner function
+   ================ */
+static void s_sim_init() {
+    g_realtime = s_sim_env("SIM_REALTIME", 0) != 0;
+    g_pulse_ms = s_sim_env("SIM_PULSE_MS", 0);
+    g_latency_us[SIM_BUS_GPIO] = s_sim_env("SIM_GPIO_LATENCY_US", GPIO_LATENCY_US);
+    g_latency_us[SIM_BUS_I2C] = s_sim_env("SIM_I2C_LATENCY_US", I2C_LATENCY_US);
+    g_latency_us[SIM_BUS_SPI] = s_sim_env("SIM_SPI_LATENCY_US", SPI_LATENCY_US);
+
+    // the clock starts away from 0, which marks "never" in the models.
+    g_now_us = USEC_PER_SEC;
+    s_sim_dht11_set(450, 220);
+}
+
+static long s_sim_env(const char *name, long value) {
+    const char *env = getenv(name);
+
+    return env != NULL && *env != '\0' ? strtol(env, NULL, 0) : value;
+}
+
+static void s_sim_sleep(uint64_t us) {
+    struct timespec ts;
+
+    ts.tv_sec = us / USEC_PER_SEC;
+    ts.tv_nsec = us % USEC_PER_SEC * NSEC_PER_USEC;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        ;
+}
+
+static uint32_t s_sim_bit(int pin) {
+    return (uint32_t)1 << g_wpi_to_bcm[pin & (WPI_PINS - 1)];
+}
+
+static void s_sim_dht11_set(int humidity, int temperature) {
+    unsigned char *bytes = g_dht11.bytes;
+
+    bytes[0] = humidity / 10;
+    bytes[1] = humidity % 10;
+    bytes[2] = temperature / 10;
+    bytes[3] = temperature % 10;
+    bytes[4] = bytes[0] + bytes[1] + bytes[2] + bytes[3];
+}
+
+static int s_sim_dht11_level(uint64_t now_us) {
+    uint64_t t;
+    int bit, high;
+
+    if (now_us < g_dht11.start_us)
+        return HIGH;
+    t = now_us - g_dht11.start_us;
+
+    if (t < DHT11_RESPONSE_US)
+        return LOW;
+    t -= DHT11_RESPONSE_US;
+    if (t < DHT11_RESPONSE_US)
+        return HIGH;
+    t -= DHT11_RESPONSE_US;
+
+    // 40 bits, most significant first, each a low and a high telling its value.
+    for (bit = 0; bit < DHT11_BYTES * 8; ++bit) {
+        if (t < DHT11_BIT_LOW_US)
+            return LOW;
+        t -= DHT11_BIT_LOW_US;
+        high = (g_dht11.bytes[bit / 8] >> (7 - bit % 8)) & 1 ?
+                                DHT11_ONE_US : DHT11_ZERO_US;
+        if (t < high)
+            return HIGH;
+        t -= high;
+    }
+
+    // the last low, then the line is released.
+    return t < DHT11_BIT_LOW_US ? LOW : HIGH;
+}
+
+static void *s_sim_pulse_thread(void *arg) {
+    int pin = 0, i;
+
+    for (;;) {
+        s_sim_sleep((uint64_t)g_pulse_ms * USEC_PER_MSEC);
+
+        for (i = 0; i < WPI_PINS; ++i) {
+            pin = (pin + 1) % WPI_PINS;
+            if (__atomic_load_n(&g_isrs[pin], __ATOMIC_ACQUIRE) != NULL)
+                break;
+        }
+
+        // inputs are active low, a press bounces before it settles.
+        for (i = 0; i < PULSE_BOUNCES; ++i) {
+            sim_gpio_input(pin, LOW);
+            s_sim_sleep(PULSE_BOUNCE_US);
+            sim_gpio_input(pin, HIGH);
+            s_sim_sleep(PULSE_BOUNCE_US);
+        }
+        sim_gpio_input(pin, LOW);
+        s_sim_sleep(PULSE_HOLD_MS * USEC_PER_MSEC);
+        sim_gpio_input(pin, HIGH);
+    }
+    return NULL;
+}
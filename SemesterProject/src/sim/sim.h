@@ -0,0 +1,203 @@
+/**
+ * @file sim.h
+ * @brief simulated board, declaration.
+ *        Built with SIM, the wiringPi headers in this folder replace the
+ *        real ones and every bus call lands on a device model: BMP180 and
+ *        PCF8574 LCD on I2C, MCP3208 on SPI, DHT11 and the GPIO registers.
+ *        Time is virtual: delays and bus transactions advance a clock
+ *        instead of sleeping, so everything runs at full speed.
+ *
+ *        Environment, read once:
+ *        SIM_GPIO_LATENCY_US, SIM_I2C_LATENCY_US, SIM_SPI_LATENCY_US
+ *        cost of one transaction on each bus;
+ *        SIM_REALTIME=1 sleeps for the virtual time as well;
+ *        SIM_PULSE_MS presses every watched input in turn, with bounces;
+ *        SIM_ADC_NOISE noise of the conversions, in LSB.
+ * @author Xiangyu Guo
+ */
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdint.h>
+#include <linux/spi/spidev.h>
+
+#define SIM_BUS_GPIO        (0)         /**< GPIO registers and pins */
+#define SIM_BUS_I2C         (1)         /**< I2C bus */
+#define SIM_BUS_SPI         (2)         /**< SPI bus */
+#define SIM_BUSES           (3)         /**< Simulated buses */
+
+#define SIM_GPIO_WORDS      (1024)      /**< 32 bits registers in the block */
+#define SIM_GPIO_SET0       (0x1C / 4)  /**< Output set, bank 0 */
+#define SIM_GPIO_CLR0       (0x28 / 4)  /**< Output clear, bank 0 */
+#define SIM_GPIO_LEV0       (0x34 / 4)  /**< Pin level, bank 0 */
+
+#define SIM_DHT11_PIN       (28)        /**< wiringPi pin of the DHT11 */
+#define SIM_LCD_COLUMNS     (16)        /**< Characters per LCD line */
+
+/**
+ * @brief transactions seen on one bus.
+ */
+typedef struct sim_stats {
+    uint64_t transactions;              /**< calls reaching the bus */
+    uint64_t bytes;                     /**< bytes moved, registers for GPIO */
+    uint64_t busy_us;                   /**< virtual time spent */
+} sim_stats_st;
+
+/**
+ * @brief what the code under test did, from a mark on.
+ */
+typedef struct sim_usage {
+    uint64_t transactions[SIM_BUSES];   /**< calls reaching each bus */
+    uint64_t slept_us;                  /**< virtual time spent in delays */
+} sim_usage_st;
+
+/* ===============
+    sim function
+   =============== */
+/**
+ * @brief Read the environment, calling it again does nothing.
+ */
+void sim_init();
+
+/**
+ * @brief Current virtual time.
+ * @return microseconds since the simulation started.
+ */
+uint64_t sim_now_us();
+
+/**
+ * @brief Let virtual time pass, sleeping too with SIM_REALTIME.
+ * @param us microseconds.
+ */
+void sim_advance_us(uint64_t us);
+
+/**
+ * @brief Set the cost of one transaction.
+ * @param bus SIM_BUS_GPIO, _I2C or _SPI.
+ * @param latency_us microseconds per transaction.
+ */
+void sim_set_latency(int bus, uint32_t latency_us);
+
+/**
+ * @brief Transactions seen on a bus since the start or the last reset.
+ * @param bus SIM_BUS_GPIO, _I2C or _SPI.
+ * @param stats [out] counters.
+ */
+void sim_get_stats(int bus, sim_stats_st *stats);
+
+/**
+ * @brief Reset the counters of every bus.
+ */
+void sim_reset_stats();
+
+/**
+ * @brief Remember the counters, to check a budget against later.
+ * @param mark [out] counters now.
+ */
+void sim_usage_mark(sim_usage_st *mark);
+
+/**
+ * @brief Check one operation against its budget, and print both.
+ * @param what operation checked.
+ * @param mark counters before the operation.
+ * @param bus SIM_BUS_GPIO, _I2C or _SPI, the one the operation uses.
+ * @param transactions most transactions allowed on the bus.
+ * @param slept_us most time allowed in delays.
+ * @return 0 within the budget, 1 over it.
+ */
+int sim_usage_check(const char *what, const sim_usage_st *mark, int bus,
+                    uint64_t transactions, uint64_t slept_us);
+
+/**
+ * @brief Charge one transaction to a bus, from the device models.
+ * @param bus SIM_BUS_GPIO, _I2C or _SPI.
+ * @param bytes bytes moved.
+ */
+void sim_transaction(int bus, int bytes);
+
+/* ===============
+    gpio function
+   =============== */
+/**
+ * @brief The simulated register block, SIM_GPIO_WORDS words.
+ * @return the block, never NULL.
+ */
+volatile uint32_t *sim_gpio_block();
+
+/**
+ * @brief Read one register.
+ * @param block the register block.
+ * @param reg word index.
+ * @return register value.
+ */
+uint32_t sim_gpio_read_reg(volatile uint32_t *block, int reg);
+
+/**
+ * @brief Write one register, set and clear change the levels.
+ * @param block the register block.
+ * @param reg word index.
+ * @param value register value.
+ */
+void sim_gpio_write_reg(volatile uint32_t *block, int reg, uint32_t value);
+
+/**
+ * @brief Drive an input pin from outside, raising its interrupt.
+ * @param pin wiringPi pin number.
+ * @param level new level.
+ */
+void sim_gpio_input(int pin, int level);
+
+/* =================
+    device function
+   ================= */
+/**
+ * @brief Set what the DHT11 measures.
+ * @param humidity relative humidity, in 0.1 %.
+ * @param temperature temperature, in 0.1 *C.
+ */
+void sim_dht11_set(int humidity, int temperature);
+
+/**
+ * @brief Set the raw values of the BMP180, see the datasheet.
+ * @param ut uncompensated temperature.
+ * @param up uncompensated pressure, at oversampling 0.
+ */
+void sim_bmp180_set(long ut, long up);
+
+/**
+ * @brief Set the voltage on one MCP3208 input.
+ * @param chip chip enable, 0 or 1.
+ * @param channel channel number[0-7].
+ * @param value 0-4095.
+ */
+void sim_adc_set(int chip, int channel, int value);
+
+/**
+ * @brief Copy one line of the LCD as shown on the glass.
+ * @param line line number.
+ * @param buf [out] SIM_LCD_COLUMNS characters and a null.
+ */
+void sim_lcd_line(int line, char *buf);
+
+/* ==============
+    bus function
+   ============== */
+/**
+ * @brief write(2) on an I2C device opened by wiringPiI2CSetup.
+ * @param fd file descriptor.
+ * @param buf bytes going to write.
+ * @param len number of bytes.
+ * @return len on success, -1 with errno otherwise.
+ */
+int sim_i2c_write(int fd, const unsigned char *buf, int len);
+
+/**
+ * @brief SPI_IOC_MESSAGE on a device opened by wiringPiSPISetup.
+ * @param fd file descriptor.
+ * @param xfer transfers of the message.
+ * @param count number of transfers.
+ * @return 0 on success, -1 with errno otherwise.
+ */
+int sim_spi_message(int fd, const struct spi_ioc_transfer *xfer, int count);
+
+#endif
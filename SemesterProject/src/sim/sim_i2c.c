@@ -0,0 +1,396 @@
+/**
+ * @file sim_i2c.c
+ * @brief simulated board, I2C devices.
+ *        The BMP180 answers with the example of its datasheet, 15.0 *C and
+ *        69964 Pa. The LCD is an HD44780 behind a PCF8574, nibbles are
+ *        latched on the falling edge of En as on the real backpack.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "wiringPiI2C.h"
+#include "sim.h"
+
+#define BMP180_ADDRESS      (0x77)      /**< BMP180 address */
+#define BMP180_CALIB        (0xAA)      /**< First calibration register */
+#define BMP180_CHIP_ID_REG  (0xD0)      /**< Chip id register */
+#define BMP180_CHIP_ID      (0x55)      /**< Chip id */
+#define BMP180_CTRL_REG     (0xF4)      /**< Measurement control */
+#define BMP180_OUT_MSB      (0xF6)      /**< Result, 3 bytes */
+#define BMP180_SCO          (0x20)      /**< Conversion running */
+#define BMP180_TEMPERATURE  (0x2E)      /**< Start a temperature conversion */
+#define BMP180_PRESSURE     (0x34)      /**< Start a pressure conversion */
+#define BMP180_OSS_MASK     (0xC0)      /**< Oversampling bits */
+#define BMP180_UT           (27898)     /**< Datasheet example, 15.0 *C */
+#define BMP180_UP           (23843)     /**< Datasheet example, 69964 Pa */
+
+#define LCD_ADDRESS         (0x27)      /**< PCF8574 address */
+#define LCD_RS              (0x01)      /**< Register select bit */
+#define LCD_EN              (0x04)      /**< Enable bit */
+#define LCD_DDRAM_SIZE      (0x80)      /**< DDRAM address space */
+#define LCD_LINE_OFFSET     (0x40)      /**< DDRAM address of the second line */
+#define LCD_LINE_LENGTH     (0x28)      /**< DDRAM cells per line */
+#define LCD_CLEAR           (0x01)      /**< Clear display */
+#define LCD_HOME            (0x02)      /**< Return home */
+#define LCD_FUNCTION_SET    (0x20)      /**< Function set */
+#define LCD_8BIT            (0x10)      /**< Function set: 8 bits interface */
+#define LCD_SET_CGRAM       (0x40)      /**< Set CGRAM address */
+#define LCD_SET_DDRAM       (0x80)      /**< Set DDRAM address */
+
+#define SIM_I2C_DEVICES     (8)         /**< Devices open at the same time */
+
+/**
+ * @brief BMP180 registers.
+ */
+typedef struct sim_bmp180 {
+    unsigned char regs[256];            /**< Register file */
+    long ut;                            /**< Uncompensated temperature */
+    long up;                            /**< Uncompensated pressure, OSS 0 */
+} sim_bmp180_st;
+
+/**
+ * @brief HD44780 behind a PCF8574.
+ */
+typedef struct sim_lcd {
+    int port;                           /**< Last byte on the PCF8574 */
+    int four_bits;                      /**< Interface in 4 bits mode */
+    int half;                           /**< High nibble received */
+    int high;                           /**< The high nibble */
+    int addr;                           /**< DDRAM address counter */
+    char ddram[LCD_DDRAM_SIZE];         /**< Display data */
+} sim_lcd_st;
+
+/**
+ * @brief one open device.
+ */
+typedef struct sim_i2c_device {
+    int fd;                             /**< Descriptor given out */
+    int address;                        /**< 7 bits address */
+    int reg;                            /**< Register pointer */
+} sim_i2c_device_st;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER; /**< One bus */
+static sim_i2c_device_st g_devices[SIM_I2C_DEVICES];       /**< Open devices */
+static int g_device_count = 0;                             /**< Slots used */
+static sim_bmp180_st g_bmp180;                             /**< The BMP180 */
+static sim_lcd_st g_lcd;                                   /**< The LCD */
+static int g_ready = 0;                                    /**< Models reset */
+
+/**
+ * @brief Reset the models, on the bus lock.
+ */
+static void s_sim_i2c_reset();
+
+/**
+ * @brief Find an open device, on the bus lock.
+ * @param fd file descriptor.
+ * @return the device, NULL with errno EBADF.
+ */
+static sim_i2c_device_st *s_sim_i2c_find(int fd);
+
+/**
+ * @brief One byte written to a device, after the register pointer.
+ */
+static void s_sim_i2c_write_byte(sim_i2c_device_st *device, int value);
+
+/**
+ * @brief One byte read from a device.
+ */
+static int s_sim_i2c_read_byte(sim_i2c_device_st *device);
+
+/**
+ * @brief Put the result of a conversion in the output registers.
+ */
+static void s_sim_bmp180_convert(int ctrl);
+
+/**
+ * @brief The PCF8574 port changes, latch a nibble on the falling En.
+ */
+static void s_sim_lcd_port(int value);
+
+/**
+ * @brief Execute one instruction or data byte.
+ */
+static void s_sim_lcd_execute(int value, int rs);
+
+/* =================
+    device function
+   ================= */
+/**
+ * @brief Set the raw values of the BMP180, see the datasheet.
+ * @param ut uncompensated temperature.
+ * @param up uncompensated pressure, at oversampling 0.
+ */
+void sim_bmp180_set(long ut, long up) {
+    pthread_mutex_lock(&g_lock);
+    s_sim_i2c_reset();
+    g_bmp180.ut = ut;
+    g_bmp180.up = up;
+    pthread_mutex_unlock(&g_lock);
+}
+
+/**
+ * @brief Copy one line of the LCD as shown on the glass.
+ * @param line line number.
+ * @param buf [out] SIM_LCD_COLUMNS characters and a null.
+ */
+void sim_lcd_line(int line, char *buf) {
+    pthread_mutex_lock(&g_lock);
+    s_sim_i2c_reset();
+    memcpy(buf, &g_lcd.ddram[(line & 1) * LCD_LINE_OFFSET], SIM_LCD_COLUMNS);
+    buf[SIM_LCD_COLUMNS] = '\0';
+    pthread_mutex_unlock(&g_lock);
+}
+
+/* ==============
+    bus function
+   ============== */
+/**
+ * @brief write(2) on an I2C device opened by wiringPiI2CSetup.
+ * @param fd file descriptor.
+ * @param buf bytes going to write.
+ * @param len number of bytes.
+ * @return len on success, -1 with errno otherwise.
+ */
+int sim_i2c_write(int fd, const unsigned char *buf, int len) {
+    sim_i2c_device_st *device;
+    int i;
+
+    pthread_mutex_lock(&g_lock);
+    if ((device = s_sim_i2c_find(fd)) == NULL) {
+        pthread_mutex_unlock(&g_lock);
+        return -1;
+    }
+
+    // the first byte of a plain write sets the register pointer.
+    for (i = 0; i < len; ++i) {
+        if (i == 0 && device->address == BMP180_ADDRESS)
+            device->reg = buf[0];
+        else
+            s_sim_i2c_write_byte(device, buf[i]);
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    sim_transaction(SIM_BUS_I2C, len);
+    return len;
+}
+
+/* ===================
+    wiringPi function
+   =================== */
+int wiringPiI2CSetup(const int devId) {
+    int fd, i;
+
+    if (devId != BMP180_ADDRESS && devId != LCD_ADDRESS) {
+        errno = ENXIO;
+        return -1;
+    }
+
+    // a real descriptor, the drivers close it when done.
+    if ((fd = open("/dev/null", O_RDWR | O_CLOEXEC)) < 0)
+        return -1;
+
+    pthread_mutex_lock(&g_lock);
+    s_sim_i2c_reset();
+    // a closed descriptor comes back with the next open, take its slot.
+    for (i = 0; i < g_device_count && g_devices[i].fd != fd; ++i)
+        ;
+    if (i >= SIM_I2C_DEVICES) {
+        pthread_mutex_unlock(&g_lock);
+        close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+    if (i == g_device_count)
+        g_device_count++;
+    g_devices[i].fd = fd;
+    g_devices[i].address = devId;
+    g_devices[i].reg = 0;
+    pthread_mutex_unlock(&g_lock);
+    return fd;
+}
+
+int wiringPiI2CRead(int fd) {
+    sim_i2c_device_st *device;
+    int value;
+
+    pthread_mutex_lock(&g_lock);
+    if ((device = s_sim_i2c_find(fd)) == NULL) {
+        pthread_mutex_unlock(&g_lock);
+        return -1;
+    }
+    value = s_sim_i2c_read_byte(device);
+    pthread_mutex_unlock(&g_lock);
+
+    sim_transaction(SIM_BUS_I2C, 1);
+    return value;
+}
+
+int wiringPiI2CWrite(int fd, int data) {
+    unsigned char byte = data;
+
+    return sim_i2c_write(fd, &byte, 1) == 1 ? 0 : -1;
+}
+
+int wiringPiI2CReadReg8(int fd, int reg) {
+    sim_i2c_device_st *device;
+    int value;
+
+    pthread_mutex_lock(&g_lock);
+    if ((device = s_sim_i2c_find(fd)) == NULL) {
+        pthread_mutex_unlock(&g_lock);
+        return -1;
+    }
+    if (device->address == BMP180_ADDRESS)
+        device->reg = reg & 0xFF;
+    else
+        s_sim_i2c_write_byte(device, reg);
+    value = s_sim_i2c_read_byte(device);
+    pthread_mutex_unlock(&g_lock);
+
+    sim_transaction(SIM_BUS_I2C, 2);
+    return value;
+}
+
+int wiringPiI2CWriteReg8(int fd, int reg, int data) {
+    unsigned char buf[2];
+
+    buf[0] = reg;
+    buf[1] = data;
+    if (sim_i2c_write(fd, buf, 2) == 2)
+        return 0;
+    return -1;
+}
+
+/* ================
+    inner function
+   ================ */
+static void s_sim_i2c_reset() {
+    static const short calibration[] = {
+        408, -72, -14383, 32741, 32757, 23153, 6190, 4, -32768, -8711, 2868
+    };
+    int i;
+
+    if (g_ready)
+        return;
+
+    // the datasheet example, AC1 to MD, most significant byte first.
+    for (i = 0; i < sizeof(calibration) / sizeof(calibration[0]); ++i) {
+        g_bmp180.regs[BMP180_CALIB + 2 * i] = (unsigned short)calibration[i] >> 8;
+        g_bmp180.regs[BMP180_CALIB + 2 * i + 1] = calibration[i] & 0xFF;
+    }
+    g_bmp180.regs[BMP180_CHIP_ID_REG] = BMP180_CHIP_ID;
+    g_bmp180.ut = BMP180_UT;
+    g_bmp180.up = BMP180_UP;
+
+    memset(g_lcd.ddram, ' ', sizeof(g_lcd.ddram));
+    g_ready = 1;
+}
+
+static sim_i2c_device_st *s_sim_i2c_find(int fd) {
+    int i;
+
+    s_sim_i2c_reset();
+    for (i = 0; i < g_device_count; ++i) {
+        if (g_devices[i].fd == fd)
+            return &g_devices[i];
+    }
+    errno = EBADF;
+    return NULL;
+}
+
+static void s_sim_i2c_write_byte(sim_i2c_device_st *device, int value) {
+    if (device->address == LCD_ADDRESS) {
+        s_sim_lcd_port(value & 0xFF);
+        return;
+    }
+
+    g_bmp180.regs[device->reg] = value;
+    if (device->reg == BMP180_CTRL_REG)
+        s_sim_bmp180_convert(value);
+    device->reg = (device->reg + 1) & 0xFF;
+}
+
+static int s_sim_i2c_read_byte(sim_i2c_device_st *device) {
+    int value;
+
+    if (device->address == LCD_ADDRESS)
+        return g_lcd.port;
+
+    value = g_bmp180.regs[device->reg];
+    device->reg = (device->reg + 1) & 0xFF;
+    return value;
+}
+
+static void s_sim_bmp180_convert(int ctrl) {
+    unsigned char *out = &g_bmp180.regs[BMP180_OUT_MSB];
+    long raw;
+
+    // conversions finish at once, the drivers wait on the real clock.
+    g_bmp180.regs[BMP180_CTRL_REG] = ctrl & ~BMP180_SCO;
+    if (ctrl == BMP180_TEMPERATURE) {
+        out[0] = g_bmp180.ut >> 8;
+        out[1] = g_bmp180.ut & 0xFF;
+    } else if ((ctrl & ~BMP180_OSS_MASK) == BMP180_PRESSURE) {
+        // more oversampling adds bits at the bottom, the value stays.
+        raw = g_bmp180.up << 8;
+        out[0] = raw >> 16;
+        out[1] = (raw >> 8) & 0xFF;
+        out[2] = raw & 0xFF;
+    }
+}
+
+static void s_sim_lcd_port(int value) {
+    int nibble;
+
+    if ((g_lcd.port & LCD_EN) && !(value & LCD_EN)) {
+        nibble = g_lcd.port & 0xF0;
+        if (!g_lcd.four_bits) {
+            // D0-D3 are not wired, they read as 0 in 8 bits mode.
+            s_sim_lcd_execute(nibble, g_lcd.port & LCD_RS);
+        } else if (!g_lcd.half) {
+            g_lcd.high = nibble;
+            g_lcd.half = 1;
+        } else {
+            g_lcd.half = 0;
+            s_sim_lcd_execute(g_lcd.high | (nibble >> 4), g_lcd.port & LCD_RS);
+        }
+    }
+    g_lcd.port = value;
+}
+
+static void s_sim_lcd_execute(int value, int rs) {
+    int line;
+
+    if (rs) {
+        g_lcd.ddram[g_lcd.addr] = value;
+        // the counter runs over the 40 cells of a line into the other one.
+        line = g_lcd.addr / LCD_LINE_OFFSET;
+        g_lcd.addr = g_lcd.addr % LCD_LINE_OFFSET + 1 < LCD_LINE_LENGTH ?
+                        g_lcd.addr + 1 : (line ^ 1) * LCD_LINE_OFFSET;
+        return;
+    }
+
+    // the highest bit set tells the instruction.
+    if (value & LCD_SET_DDRAM) {
+        g_lcd.addr = value & (LCD_DDRAM_SIZE - 1);
+    } else if (value & LCD_SET_CGRAM) {
+        return;
+    } else if (value & LCD_FUNCTION_SET) {
+        g_lcd.four_bits = !(value & LCD_8BIT);
+        g_lcd.half = 0;
+    } else if (value & ~(LCD_HOME | LCD_CLEAR)) {
+        return;
+    } else if (value & LCD_HOME) {
+        g_lcd.addr = 0;
+    } else if (value & LCD_CLEAR) {
+        memset(g_lcd.ddram, ' ', sizeof(g_lcd.ddram));
+        g_lcd.addr = 0;
+    }
+}
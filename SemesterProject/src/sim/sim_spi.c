@@ -0,0 +1,186 @@
+/**
+ * @file sim_spi.c
+ * @brief simulated board, MCP3208 on both chip enables.
+ *        Every 3 bytes frame starting with the start bit is converted,
+ *        in single or pseudo-differential mode, with a little noise so
+ *        oversampling has something to average.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "wiringPiSPI.h"
+#include "sim.h"
+
+#define SIM_SPI_CHIPS       (2)         /**< Chip enables */
+#define MCP3208_CHANNELS    (8)         /**< Inputs of one ADC */
+#define MCP3208_FRAME_SIZE  (3)         /**< Bytes per conversion */
+#define MCP3208_START_BIT   (0x04)      /**< Start of a conversion */
+#define MCP3208_SINGLE_BIT  (0x02)      /**< Single ended input */
+#define MCP3208_MAX_VALUE   (4095)      /**< Full scale */
+#define MCP3208_NOISE       (1)         /**< Default noise, in LSB */
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER; /**< One bus */
+static int g_fds[SIM_SPI_CHIPS] = { -1, -1 };  /**< Descriptor of each chip */
+static int g_values[SIM_SPI_CHIPS][MCP3208_CHANNELS]; /**< Input voltages */
+static int g_noise = -1;                        /**< Noise in LSB, -1 unset */
+static uint32_t g_seed = 1;                     /**< Noise generator */
+
+/**
+ * @brief Set the inputs and the noise, on the bus lock.
+ */
+static void s_sim_spi_reset();
+
+/**
+ * @brief Run the conversions of one transfer, on the bus lock.
+ * @param chip chip enable.
+ * @param tx bytes sent.
+ * @param rx [out] bytes received, may be tx.
+ * @param len number of bytes.
+ */
+static void s_sim_spi_transfer(int chip, const unsigned char *tx,
+                               unsigned char *rx, int len);
+
+/* =================
+    device function
+   ================= */
+/**
+ * @brief Set the voltage on one MCP3208 input.
+ * @param chip chip enable, 0 or 1.
+ * @param channel channel number[0-7].
+ * @param value 0-4095.
+ */
+void sim_adc_set(int chip, int channel, int value) {
+    pthread_mutex_lock(&g_lock);
+    s_sim_spi_reset();
+    g_values[chip & 1][channel & (MCP3208_CHANNELS - 1)] = value;
+    pthread_mutex_unlock(&g_lock);
+}
+
+/* ==============
+    bus function
+   ============== */
+/**
+ * @brief SPI_IOC_MESSAGE on a device opened by wiringPiSPISetup.
+ * @param fd file descriptor.
+ * @param xfer transfers of the message.
+ * @param count number of transfers.
+ * @return 0 on success, -1 with errno otherwise.
+ */
+int sim_spi_message(int fd, const struct spi_ioc_transfer *xfer, int count) {
+    int chip, i, bytes = 0;
+
+    pthread_mutex_lock(&g_lock);
+    for (chip = 0; chip < SIM_SPI_CHIPS && g_fds[chip] != fd; ++chip)
+        ;
+    if (chip >= SIM_SPI_CHIPS) {
+        pthread_mutex_unlock(&g_lock);
+        errno = EBADF;
+        return -1;
+    }
+
+    // one message is one system call, however many transfers it holds.
+    for (i = 0; i < count; ++i) {
+        s_sim_spi_transfer(chip, (const unsigned char *)(uintptr_t)xfer[i].tx_buf,
+                           (unsigned char *)(uintptr_t)xfer[i].rx_buf, xfer[i].len);
+        bytes += xfer[i].len;
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    sim_transaction(SIM_BUS_SPI, bytes);
+    return 0;
+}
+
+/* ===================
+    wiringPi function
+   =================== */
+int wiringPiSPIGetFd(int channel) {
+    return g_fds[channel & 1];
+}
+
+int wiringPiSPIDataRW(int channel, unsigned char *data, int len) {
+    pthread_mutex_lock(&g_lock);
+    if (g_fds[channel & 1] < 0) {
+        pthread_mutex_unlock(&g_lock);
+        errno = EBADF;
+        return -1;
+    }
+    s_sim_spi_transfer(channel & 1, data, data, len);
+    pthread_mutex_unlock(&g_lock);
+
+    sim_transaction(SIM_BUS_SPI, len);
+    return len;
+}
+
+int wiringPiSPISetup(int channel, int speed) {
+    int fd;
+
+    // a real descriptor, the drivers close it when done.
+    if ((fd = open("/dev/null", O_RDWR | O_CLOEXEC)) < 0)
+        return -1;
+
+    pthread_mutex_lock(&g_lock);
+    s_sim_spi_reset();
+    g_fds[channel & 1] = fd;
+    pthread_mutex_unlock(&g_lock);
+    return fd;
+}
+
+/* ================
+    inner function
+   ================ */
+static void s_sim_spi_reset() {
+    const char *env;
+    int chip, channel;
+
+    if (g_noise >= 0)
+        return;
+
+    // distinct inputs, so a swapped channel or chip shows.
+    for (chip = 0; chip < SIM_SPI_CHIPS; ++chip) {
+        for (channel = 0; channel < MCP3208_CHANNELS; ++channel)
+            g_values[chip][channel] = 1024 + 256 * channel + 128 * chip;
+    }
+
+    env = getenv("SIM_ADC_NOISE");
+    g_noise = env != NULL ? atoi(env) : MCP3208_NOISE;
+    if (g_noise < 0)
+        g_noise = 0;
+}
+
+static void s_sim_spi_transfer(int chip, const unsigned char *tx,
+                               unsigned char *rx, int len) {
+    int i, channel, value;
+
+    for (i = 0; i + MCP3208_FRAME_SIZE <= len; i += MCP3208_FRAME_SIZE) {
+        if (!(tx[i] & MCP3208_START_BIT)) {
+            memset(rx + i, 0, MCP3208_FRAME_SIZE);
+            continue;
+        }
+
+        channel = ((tx[i] & 1) << 2) | (tx[i + 1] >> 6);
+        value = g_values[chip][channel];
+        // pseudo-differential pairs are even and odd neighbours.
+        if (!(tx[i] & MCP3208_SINGLE_BIT))
+            value -= g_values[chip][channel ^ 1];
+
+        if (g_noise > 0) {
+            g_seed = g_seed * 1103515245 + 12345;
+            value += (int)((g_seed >> 16) % (2 * g_noise + 1)) - g_noise;
+        }
+        if (value < 0)
+            value = 0;
+        if (value > MCP3208_MAX_VALUE)
+            value = MCP3208_MAX_VALUE;
+
+        // a null bit, then the 12 bits most significant first.
+        rx[i] = 0;
+        rx[i + 1] = value >> 8;
+        rx[i + 2] = value & 0xFF;
+    }
+}
@@ -0,0 +1,34 @@
+/**
+ * @file wiringPi.h
+ * @brief wiringPi core, on the simulated board.
+ *        Same names and values as the real header, for the calls this
+ *        project makes. Only on the include path when built with SIM.
+ * @author Xiangyu Guo
+ */
+#ifndef __SIM_WIRINGPI_H__
+#define __SIM_WIRINGPI_H__
+
+#define LOW                 (0)
+#define HIGH                (1)
+
+#define INPUT               (0)
+#define OUTPUT              (1)
+
+#define INT_EDGE_SETUP      (0)
+#define INT_EDGE_FALLING    (1)
+#define INT_EDGE_RISING     (2)
+#define INT_EDGE_BOTH       (3)
+
+int wiringPiSetup(void);
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+int digitalRead(int pin);
+int wpiPinToGpio(int wpiPin);
+int wiringPiISR(int pin, int mode, void (*function)(void));
+
+void delay(unsigned int howLong);
+void delayMicroseconds(unsigned int howLong);
+unsigned int millis(void);
+unsigned int micros(void);
+
+#endif
@@ -0,0 +1,16 @@
+/**
+ * @file wiringPiI2C.h
+ * @brief wiringPi I2C, on the simulated board.
+ *        Devices answer on the BMP180 (0x77) and LCD (0x27) addresses.
+ * @author Xiangyu Guo
+ */
+#ifndef __SIM_WIRINGPI_I2C_H__
+#define __SIM_WIRINGPI_I2C_H__
+
+int wiringPiI2CSetup(const int devId);
+int wiringPiI2CRead(int fd);
+int wiringPiI2CWrite(int fd, int data);
+int wiringPiI2CReadReg8(int fd, int reg);
+int wiringPiI2CWriteReg8(int fd, int reg, int data);
+
+#endif
@@ -0,0 +1,14 @@
+/**
+ * @file wiringPiSPI.h
+ * @brief wiringPi SPI, on the simulated board.
+ *        An MCP3208 answers on both chip enables.
+ * @author Xiangyu Guo
+ */
+#ifndef __SIM_WIRINGPI_SPI_H__
+#define __SIM_WIRINGPI_SPI_H__
+
+int wiringPiSPIGetFd(int channel);
+int wiringPiSPIDataRW(int channel, unsigned char *data, int len);
+int wiringPiSPISetup(int channel, int speed);
+
+#endif
@@ -9,6 +9,7 @@
  * @author Xiangyu Guo
  */
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -23,254 +24,543 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-#include <wiringPi.h>
-
 #include "spi/spi_mcp3208.h"
+#include "adc_filter.h"
 #include "i2c/i2c_bmp180.h"
 #include "i2c/i2c_lcd1620.h"
 #include "pin/pin_motor.h"
 #include "pin/pin_dht_11.h"
+#include "pin/pin_gpio.h"
+#include "pin/pin_debounce.h"
 
 #include "screen.h"
+#include "history.h"
+#include "sample_log.h"
+#include "scheduler.h"
+#include "rt_io.h"
+#include "hw_init.h"
+#include "tracing.h"
+#include "loop_lag.h"
+#include "notifier.h"
 #include "web_server.h"
 
 #define MOTION_DETECTOR     (29)        /**< wiringPi pin number of motion detector */
 #define MECURY_SWITCH       (27)        /**< wiringPi pin number of mecury switch */
 #define ALARM_LIGHT         (24)        /**< wiringPi pin number of alarm light */
 
-#define INTERRUPT_INTERVAL  (200)       /**< Bouncing Interval */
+#define MOTION_LOCKOUT_US   (200000)    /**< A motion retriggers no sooner */
 
 #define TIMEOUT_SEC         (3)         /**< Temperature Event Time out */
 
 #define TEMPERATURE_LOWEST  (10)        /**< Lowest temperature to turn on the fan */
 #define TEMPERATURE_RANGE   (30)        /**< Temperature range conver from ADC */
 
-void reqcb(struct evhttp_request * req, void * arg)
-{
-    printf("Send one request\n");
-}
+#define SAMPLE_INTERVAL_US  (100000)    /**< ADC scan period */
+#define SAMPLE_MEDIAN_N     (5)         /**< Median window over ADC scans */
+#define SAMPLE_EXTRA_BITS   (1)         /**< Bits oversampled per channel, 4 conversions */
+
+#define ADC_PERIOD_US       (SAMPLE_INTERVAL_US)    /**< ADC filter period */
+#define ADC_DEADLINE_US     (20000)     /**< ADC filter deadline */
+#define ADC_COST_US         (8000)      /**< 32 conversions of one chip at 100 kHz */
+#define MCP3208_PERIOD_US   (1000000)   /**< History of the ADC channels */
+#define MCP3208_DEADLINE_US (100000)    /**< ADC history deadline */
+#define MCP3208_COST_US     (100)       /**< Filtered values, no conversion */
+#define BMP180_PERIOD_US    (1000000)   /**< History of the BMP180 */
+#define BMP180_DEADLINE_US  (200000)    /**< BMP180 history deadline */
+#define BMP180_COST_US      (30000)     /**< Two conversions, ultra high resolution */
+#define DHT11_PERIOD_US     (2000000)   /**< A reading blocks for some 20 ms */
+#define DHT11_DEADLINE_US   (500000)    /**< DHT11 history deadline */
+#define DHT11_COST_US       (25000)     /**< Start signal and 40 bits */
+#define MOTOR_PERIOD_US     (TIMEOUT_SEC * 1000000) /**< Thermostat period */
+#define MOTOR_DEADLINE_US   (500000)    /**< Thermostat deadline */
+#define MOTOR_COST_US       (30000)     /**< Ultra high resolution read */
+#define DISPLAY_PERIOD_US   (1000000)   /**< Display refresh period */
+#define DISPLAY_DEADLINE_US (200000)    /**< Display refresh deadline */
+#define DISPLAY_COST_US     (1000)      /**< Rendering a page, nothing sent */
+#define LCD_PERIOD_US       (100000)    /**< A button press shows within */
+#define LCD_DEADLINE_US     (50000)     /**< LCD flush deadline */
+#define LCD_COST_US         (5000)      /**< A whole frame sent to the LCD */
+
+#define SAMPLE_LOG_ENV      "SMARTHOMED_LOG_DIR"        /**< Sample log directory */
+
+#define RT_CPU_ENV          "SMARTHOMED_RT_CPU"         /**< Core of the I/O thread */
+#define RT_PRIORITY_ENV     "SMARTHOMED_RT_PRIORITY"    /**< Its SCHED_FIFO priority */
+#define RT_PRIORITY_DEFAULT (49)        /**< Below the IRQ threads (50), bus completions run there */
+#define RT_LOCK_ENV         "SMARTHOMED_RT_LOCK"        /**< Lock the memory when 1 */
+
+#define TRACE_ENV           "SMARTHOMED_TRACE"          /**< Trace from the start */
+
+#define WEBHOOKS_ENV        "SMARTHOMED_WEBHOOKS"       /**< Comma separated urls */
+#define WEBHOOKS_DEFAULT    "http://10.0.1.200:18089"   /**< Default motion webhook */
+
+static notifier_st *g_notifier = NULL;        /**< Motion webhooks */
 
-static int s_motion_fd = -1;
+static adc_filter_st *g_adc_filters[MCP3208_CHIPS];  /**< Filtered channels of each chip */
+
+static int g_adc_fed[MCP3208_CHIPS];        /**< Filter got a scan, I/O thread */
+
+static sample_log_st *g_sample_log = NULL;  /**< Samples kept on the card */
+
+static rt_io_st *g_rt_io = NULL;            /**< Thread of every bus transaction */
+
+static hw_init_st *g_hw_init = NULL;        /**< Devices being brought up */
+
+static bmp180_module_st *g_bmp180 = NULL;   /**< BMP180 of the history and thermostat */
 
 /**
- * @brief Interrupt handler
+ * @brief a periodic read, scheduled once its device is up.
  */
-void isr_motion_detector (void) {
-    int brightness;
-    int brightness_threshold;
-    static unsigned long s_last_interrupt = 0;
-    unsigned long current_interrupt = millis();
-
-    // mcp3208_module_st *mcp3208 = NULL;
-    
-    // Deal with bouncing issue
-    if (current_interrupt - s_last_interrupt > INTERRUPT_INTERVAL && s_motion_fd == -1) {
-        // mcp3208 = mcp3208_module_get_instance();
-
-        // Receive the brightness (Ch5)
-        // brightness = mcp3208_read_data(mcp3208, MCP3208_CHANNEL_5);
-
-        // Compare with the threshold (Ch6)
-        // brightness_threshold = mcp3208_read_data(mcp3208, MCP3208_CHANNEL_6);
-
-        //printf("Mercury Switcher: %d\nBrightness: %d\nBrightness threshold: %d\n", 
-        //        digitalRead(MECURY_SWITCH), brightness, brightness_threshold);
-        // Check with Mercury Switcher.
-        //if (digitalRead(MECURY_SWITCH) == 0 && brightness < brightness_threshold) {
-        //    digitalWrite(ALARM_LIGHT, 1);
-        //} else {
-        //    digitalWrite(ALARM_LIGHT, 0);
-        //}
-        s_motion_fd = 1;
-
-        // Update time
-        s_last_interrupt = current_interrupt;
-    }
-}
+typedef struct sensor_task {
+    const char *name;                   /**< shown in the stats */
+    int bus;                            /**< SCHEDULER_BUS_* */
+    long period_us;                     /**< period */
+    long deadline_us;                   /**< relative deadline */
+    long cost_us;                       /**< expected duration */
+    scheduler_fn fn;                    /**< the read */
+    void *arg;                          /**< its argument */
+} sensor_task_st;
 
 static void setup_alram_system() {
-
-    if (wiringPiSetup() < LOW)
-        exit(errno);
+    static const int alarm_light = ALARM_LIGHT;
 
     // pinMode(MECURY_SWITCH, INPUT);
-    pinMode(ALARM_LIGHT, OUTPUT);
-
-    if (wiringPiISR(MOTION_DETECTOR, INT_EDGE_FALLING, &isr_motion_detector) < 0)
-        exit(errno);
+    pin_gpio_mode(pin_gpio_mask(&alarm_light, 1), PIN_GPIO_OUTPUT);
 }
 
-static void 
-update_display_callback(evutil_socket_t fd, short flags, void *data) {
+static void update_display_task(void *data) {
     screen_update_display();
 }
 
-static void 
-check_temperature_callback(evutil_socket_t fd, short flags, void *data) {
-    mcp3208_module_st *mcp3208 = mcp3208_module_get_instance();
-    bmp180_module_st *bmp180 = bmp180_module_init(BMP180_ULTRA_HIGH_RESOLUTION);
+/**
+ * @brief send what changed on the LCD, on the I/O thread.
+ */
+static void flush_display_task(void *data) {
+    screen_flush_display();
+}
+
+/**
+ * @brief oversample every channel of a chip into its filter, on the I/O thread.
+ * @param data chip number.
+ */
+static void sample_adc_task(void *data) {
+    unsigned int chip = (unsigned int)(intptr_t)data;
+    mcp3208_module_st *mcp3208 = mcp3208_module_get_chip(chip);
+    int values[MCP3208_CHANNELS_PER_CHIP];
+    int i;
+
+    for (i = 0; i < MCP3208_CHANNELS_PER_CHIP; ++i)
+        values[i] = mcp3208_read_oversampled(mcp3208, i, MCP3208_SINGLE,
+                                             SAMPLE_EXTRA_BITS);
+    adc_filter_push(g_adc_filters[chip], values);
+    g_adc_fed[chip] = 1;
+}
+
+/**
+ * @brief filtered value of a channel, on the I/O thread.
+ * @param channel unified channel number[0-15].
+ * @return 0 to MCP3208_MAX_VALUE, the extra bits as a fraction.
+ */
+static double adc_value(unsigned int channel) {
+    return adc_filter_get(g_adc_filters[channel / MCP3208_CHANNELS_PER_CHIP],
+                          channel % MCP3208_CHANNELS_PER_CHIP) /
+           (1 << SAMPLE_EXTRA_BITS);
+}
+
+static void check_temperature_task(void *data) {
+    bmp180_module_st *bmp180 = __atomic_load_n(&g_bmp180, __ATOMIC_ACQUIRE);
     bmp180_data_st value;
     double temperature_threshold = 0;
 
-    bmp180_read_data(bmp180, &value);
+    // the threshold is not known before the first scan, nor the
+    // temperature before the BMP180 is up.
+    if (!g_adc_fed[MCP3208_CHIP_0] || bmp180 == NULL)
+        return;
+
+    if (bmp180_read_data(bmp180, &value) != 0)
+        return;
     
-    // Read temerpature thresh_hold (Ch7).
-    temperature_threshold = mcp3208_read_data(mcp3208, MCP3208_CHANNEL_7);
+    // Read filtered temerpature thresh_hold (Ch7).
+    temperature_threshold = adc_value(MCP3208_CHANNEL_7);
     temperature_threshold = temperature_threshold / MCP3208_MAX_VALUE *
                                      TEMPERATURE_RANGE + TEMPERATURE_LOWEST;
 
-    printf("====Temperature====\n");
-    printf("Current:%.2f\n", value.temperature);
-    printf("Setting:%.2f\n", temperature_threshold);
+    // no printing on the I/O thread, a stalled stdout would stall every
+    // read. Both values are in the history, bmp180_temperature and mcp3208_7.
     if (value.temperature > temperature_threshold)
         motor_turn_on();
     else
         motor_turn_off();
+}
 
-    bmp180_module_fini(bmp180);
+/**
+ * @brief keep one sample in memory, and on the card when logging,
+ *        on the event loop.
+ */
+static void record_sample(int series, time_t now, double value) {
+    int err;
+
+    history_push(series, now, value);
+    if (g_sample_log != NULL &&
+            (err = sample_log_append(g_sample_log, series,
+                                     (uint64_t)now * 1000, value)) != 0)
+        fprintf(stderr, "Sample log: %s\n", strerror(err));
 }
 
-static void on_connection_close(struct evhttp_connection* connection, void* arg) {
-    fprintf(stderr, "remote connection closed\n");
-    //event_base_loopexit((struct event_base*)arg, NULL);
+/**
+ * @brief hand a sample to the event loop and to the screen, on the I/O thread.
+ */
+static void publish_sample(int series, time_t now, double value) {
+    rt_io_sample(g_rt_io, series, now, value);
+    screen_display_sample(series, value);
 }
 
-void on_request_close(struct evhttp_request* rsp, void* arg)
-{
-} 
+/**
+ * @brief keep the filtered ADC channels in the history, on the I/O thread.
+ */
+static void sample_mcp3208_task(void *data) {
+    time_t now = time(NULL);
+    int i;
 
-int on_header_respond(struct evhttp_request* rsp, void* arg)
-{
-    fprintf(stderr, "< HTTP/1.1 %d %s\n", evhttp_request_get_response_code(rsp), evhttp_request_get_response_code_line(rsp));
-    struct evkeyvalq* headers = evhttp_request_get_input_headers(rsp);
-    struct evkeyval* header;
-    fprintf(stderr, "< \n");
-    return 0;
+    for (i = 0; i < MCP3208_TOTAL_CHANNELS; ++i) {
+        if (g_adc_fed[i / MCP3208_CHANNELS_PER_CHIP])
+            publish_sample(HISTORY_MCP3208_CHANNEL_0 + i, now, adc_value(i));
+    }
 }
 
-void on_chunk_data(struct evhttp_request* rsp, void* arg)
-{
-    char buf[4096];
-    struct evbuffer* evbuf = evhttp_request_get_input_buffer(rsp);
-    int n = 0;
-    while ((n = evbuffer_remove(evbuf, buf, 4096)) > 0)
-    {
-        fwrite(buf, n, 1, stdout);
+/**
+ * @brief read the BMP180 for the history, on the I/O thread.
+ */
+static void sample_bmp180_task(void *data) {
+    bmp180_data_st pressure;
+    time_t now = time(NULL);
+
+    if (bmp180_read_data(g_bmp180, &pressure) == 0) {
+        publish_sample(HISTORY_BMP180_TEMPERATURE, now, pressure.temperature);
+        publish_sample(HISTORY_BMP180_PRESSURE, now, pressure.pressure);
+        publish_sample(HISTORY_BMP180_ALTITUDE, now, pressure.altitude);
     }
 }
 
-void on_request_error(enum evhttp_request_error error, void* arg)
-{
-    fprintf(stderr, "request failed\n");
-    event_base_loopexit((struct event_base*)arg, NULL);
+/**
+ * @brief read the DHT11 for the history, on the I/O thread.
+ */
+static void sample_dht11_task(void *data) {
+    dht_data_st climate;
+    time_t now = time(NULL);
+
+    if (pin_dht_11_read(&climate) == 0) {
+        publish_sample(HISTORY_DHT11_TEMPERATURE, now, climate.temperature);
+        publish_sample(HISTORY_DHT11_HUMIDITY, now, climate.humidity);
+    }
 }
 
-static void motion_detect_callback(evutil_socket_t fd, short flags, void *data) {
-    if (s_motion_fd == -1)
+static void motion_detect_callback(int pin, int events, uint64_t timestamp_us,
+                                   void *data) {
+    if (!(events & PIN_DEBOUNCE_PRESS))
         return;
 
-    s_motion_fd = -1;
-
+    loop_lag_enter("motion");
     printf("====Event: Motion====\n");
 
-    struct event_base *base = (struct event_base *) data;
+    notifier_notify(g_notifier, "motion");
+    loop_lag_leave();
+}
 
-    char *url = "http://10.0.1.200:18089";
-    struct evhttp_uri* uri = evhttp_uri_parse(url);
+/**
+ * @brief Connect the motion notifier to every configured webhook.
+ * @param base event base.
+ */
+static void setup_notifier(struct event_base *base) {
+    const char *env = getenv(WEBHOOKS_ENV);
+    char *urls = strdup(env != NULL ? env : WEBHOOKS_DEFAULT);
+    char *url, *save = NULL;
+
+    if (urls == NULL)
+        exit(ENOMEM);
+
+    g_notifier = notifier_init(base);
+    for (url = strtok_r(urls, ",", &save); url != NULL;
+            url = strtok_r(NULL, ",", &save)) {
+        if (notifier_add_target(g_notifier, url) != 0)
+            fprintf(stderr, "Ignoring webhook %s\n", url);
+    }
+    free(urls);
+}
 
-    struct evhttp_connection *conn;
-    struct evhttp_request *req;
+/**
+ * @brief open both ADCs, on the SPI bring-up thread.
+ */
+static void probe_mcp3208(void *data) {
+    mcp3208_module_get_chip(MCP3208_CHIP_0);
+    mcp3208_module_get_chip(MCP3208_CHIP_1);
+}
 
-    const char* host = evhttp_uri_get_host(uri);
-    int port = evhttp_uri_get_port(uri);
-    
-    conn = evhttp_connection_base_new(base, NULL, host, port);
+/**
+ * @brief read the calibration of the BMP180 once, on the I2C bring-up thread.
+ *        The thermostat wants the finest resolution, the history shares it.
+ */
+static void probe_bmp180(void *data) {
+    __atomic_store_n(&g_bmp180, bmp180_module_init(BMP180_ULTRA_HIGH_RESOLUTION),
+                     __ATOMIC_RELEASE);
+}
 
-    evhttp_connection_set_closecb(conn, on_connection_close, base);
-    req = evhttp_request_new(on_request_close, base);
+/**
+ * @brief let the DHT11 line idle, on the GPIO bring-up thread.
+ */
+static void probe_dht11(void *data) {
+    pin_dht_11_init();
+}
 
-    evhttp_request_set_header_cb(req, on_header_respond);
-    evhttp_request_set_chunked_cb(req, on_chunk_data);
-    evhttp_request_set_error_cb(req, on_request_error);
+/**
+ * @brief initialize the LCD, some 200 ms, on the I2C bring-up thread.
+ */
+static void probe_lcd(void *data) {
+    screen_display_get_instance();
+}
 
-    evhttp_add_header(evhttp_request_get_output_headers(req), "Host", host);
-    //evhttp_add_header(req->output_headers, "Connection", "close");
+/**
+ * @brief Register the periodic tasks of a device, every one goes through the
+ *        scheduler so reads on one bus keep out of each other's way.
+ *        On the I/O thread, which owns the scheduler, or before it starts.
+ * @param data sensor tasks, up to one without a name.
+ */
+static void add_tasks(void *data) {
+    const sensor_task_st *task;
+
+    for (task = data; task->name != NULL; ++task) {
+        if (scheduler_add(rt_io_scheduler(g_rt_io), task->name, task->bus,
+                          task->period_us, task->deadline_us, task->cost_us,
+                          task->fn, task->arg) < 0) {
+            fprintf(stderr, "Couldn't schedule %s: exiting\n", task->name);
+            exit(ENOSPC);
+        }
+    }
+}
 
-    //evhttp_connection_set_timeout(req->evcon, 600);
-    evhttp_make_request(conn, req, EVHTTP_REQ_GET, "/");
-    //printf("evhttp_make_request: %i\n",
-    //       evhttp_make_request(conn, req, EVHTTP_REQ_GET, "/"));
+/**
+ * @brief A device is up, start reading it.
+ * @param data sensor tasks, up to one without a name.
+ */
+static void tasks_ready(void *data) {
+    if (rt_io_call(g_rt_io, add_tasks, NULL, data) != 0) {
+        fprintf(stderr, "Couldn't schedule: exiting\n");
+        exit(ENOSPC);
+    }
 }
 
-static void setup_motor_event(struct event_base *base) {
-    struct timeval tv;
-    struct event *temperature_check_event;
-    tv.tv_sec = TIMEOUT_SEC;
-    tv.tv_usec = 0;
-    temperature_check_event = event_new(base, -1, 
-                EV_TIMEOUT | EV_PERSIST, check_temperature_callback, NULL);
-
-    if (!temperature_check_event) {
-        fprintf(stderr, "Couldn't create an event_base: exiting\n");
-        exit(errno);
+/**
+ * @brief Bring a device up in parallel with the others, its tasks are
+ *        scheduled once it is.
+ */
+static void bring_up(const char *name, int bus, hw_init_fn probe,
+                     hw_init_fn ready, const void *data) {
+    if (hw_init_add(g_hw_init, name, bus, probe, ready, (void *)data) != 0) {
+        fprintf(stderr, "Couldn't bring %s up: exiting\n", name);
+        exit(ENOSPC);
+    }
+}
+
+static void setup_history_event(struct event_base *base) {
+    static const sensor_task_st mcp3208[] = {
+        { "adc_filter_0", SCHEDULER_BUS_SPI, ADC_PERIOD_US, ADC_DEADLINE_US,
+          ADC_COST_US, sample_adc_task, (void *)(intptr_t)MCP3208_CHIP_0 },
+        { "adc_filter_1", SCHEDULER_BUS_SPI, ADC_PERIOD_US, ADC_DEADLINE_US,
+          ADC_COST_US, sample_adc_task, (void *)(intptr_t)MCP3208_CHIP_1 },
+        // publishes the filtered values, the scans above do the SPI.
+        { "mcp3208", SCHEDULER_BUS_NONE, MCP3208_PERIOD_US,
+          MCP3208_DEADLINE_US, MCP3208_COST_US, sample_mcp3208_task }, { NULL }
+    };
+    static const sensor_task_st bmp180[] = {
+        { "bmp180", SCHEDULER_BUS_I2C, BMP180_PERIOD_US,
+          BMP180_DEADLINE_US, BMP180_COST_US, sample_bmp180_task }, { NULL }
+    };
+    static const sensor_task_st dht11[] = {
+        { "dht11", SCHEDULER_BUS_GPIO, DHT11_PERIOD_US,
+          DHT11_DEADLINE_US, DHT11_COST_US, sample_dht11_task }, { NULL }
+    };
+    const char *dir = getenv(SAMPLE_LOG_ENV);
+    int i;
+
+    for (i = 0; i < MCP3208_CHIPS; ++i)
+        g_adc_filters[i] = adc_filter_init(ADC_FILTER_MEDIAN, SAMPLE_MEDIAN_N);
+
+    if (dir != NULL && *dir != '\0') {
+        g_sample_log = sample_log_open(dir, SAMPLE_LOG_SEGMENT_SIZE,
+                                       SAMPLE_LOG_MAX_SEGMENTS, SAMPLE_LOG_SYNC_SEC);
+        if (g_sample_log == NULL) {
+            fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+            exit(errno);
+        }
     }
-    event_add(temperature_check_event, &tv);
+
+    bring_up("mcp3208", SCHEDULER_BUS_SPI, probe_mcp3208, tasks_ready, mcp3208);
+    bring_up("bmp180", SCHEDULER_BUS_I2C, probe_bmp180, tasks_ready, bmp180);
+    bring_up("dht11", SCHEDULER_BUS_GPIO, probe_dht11, tasks_ready, dht11);
+}
+
+static void setup_motor_event(struct event_base *base) {
+    static const sensor_task_st thermostat[] = {
+        { "thermostat", SCHEDULER_BUS_I2C, MOTOR_PERIOD_US,
+          MOTOR_DEADLINE_US, MOTOR_COST_US, check_temperature_task }, { NULL }
+    };
 
     motor_setup_up();
+
+    // it waits for the filter, fed along with the history of the ADC.
+    add_tasks((void *)thermostat);
+}
+
+/**
+ * @brief The LCD is up, take the buttons and refresh it.
+ * @param data event base.
+ */
+static void display_ready(void *data) {
+    static const sensor_task_st display[] = {
+        { "display", SCHEDULER_BUS_NONE, DISPLAY_PERIOD_US,
+          DISPLAY_DEADLINE_US, DISPLAY_COST_US, update_display_task },
+        { "lcd", SCHEDULER_BUS_I2C, LCD_PERIOD_US,
+          LCD_DEADLINE_US, LCD_COST_US, flush_display_task }, { NULL }
+    };
+
+    screen_display_setup_event((struct event_base *)data, g_rt_io);
+    tasks_ready((void *)display);
 }
 
 static void setup_update_event(struct event_base *base) {
-    struct timeval tv;
-    struct event *update_display_event;
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-    update_display_event = event_new(base, -1, 
-                EV_TIMEOUT | EV_PERSIST, update_display_callback, NULL);
-
-    if (!update_display_event) {
-        fprintf(stderr, "Couldn't create an event_base: exiting\n");
-        exit(errno);
-    }
-    event_add(update_display_event, &tv);
+    bring_up("lcd", SCHEDULER_BUS_I2C, probe_lcd, display_ready, base);
 }
 
 static void setup_motion_event(struct event_base *base) {
-    struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = 500;
-    struct event *motion_event = event_new(base, -1, EV_TIMEOUT | EV_PERSIST, motion_detect_callback, base);
+    // the sensor output is clean, report at once and skip its retriggers.
+    static const pin_debounce_config_st motion = {
+        PIN_DEBOUNCE_LOCKOUT, 0, MOTION_LOCKOUT_US, 0, 0
+    };
 
-    event_add(motion_event, &tv);
+    pin_debounce_watch(base, MOTION_DETECTOR, &motion, motion_detect_callback, NULL);
+}
+
+/**
+ * @brief Start the I/O thread, on the core and at the SCHED_FIFO priority
+ *        given by the environment, with the memory locked when asked.
+ *        Tasks join it as their device is up.
+ */
+static void setup_rt_io() {
+    const char *cpu = getenv(RT_CPU_ENV);
+    const char *priority = getenv(RT_PRIORITY_ENV);
+    const char *lock = getenv(RT_LOCK_ENV);
+    int err;
+
+    err = rt_io_start(g_rt_io, cpu != NULL ? atoi(cpu) : -1,
+                      priority != NULL ? atoi(priority) : RT_PRIORITY_DEFAULT,
+                      lock != NULL && atoi(lock) == 1);
+    if (err != 0) {
+        fprintf(stderr, "Couldn't start the I/O thread: %s\n", strerror(err));
+        exit(err);
+    }
+}
+
+/**
+ * @brief Probe the devices, the web server answers meanwhile.
+ */
+static void setup_hw_init() {
+    int err = hw_init_start(g_hw_init);
+
+    if (err != 0) {
+        fprintf(stderr, "Couldn't bring the devices up: %s\n", strerror(err));
+        exit(err);
+    }
+}
+
+/**
+ * @brief leave the event loop on SIGINT/SIGTERM, so exit handlers
+ *        (a bus trace being recorded) get to run.
+ */
+static void stop_callback(evutil_socket_t sig, short events, void *arg) {
+    event_base_loopexit((struct event_base *)arg, NULL);
 }
 
 int main(int argc, char **argv)
 {
+    struct event_config *config;
     struct event_base *base;
+    struct event *sigint_event, *sigterm_event;
 
     if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
         return errno;
 
+    tracing_name_thread("event loop");
+    // the bring-up is only traced when asked for before it.
+    if (getenv(TRACE_ENV) != NULL)
+        tracing_enable(1);
+
+    // wiringPi and the GPIO registers, once for every driver.
+    hw_init_platform();
+
     setup_alram_system();
 
     //screen_display_get_instance();
 
-    base = event_base_new();
+    // timers default to CLOCK_MONOTONIC_COARSE, which loop_lag would count as lag.
+    config = event_config_new();
+    if (config == NULL)
+        exit(ENOMEM);
+    event_config_set_flag(config, EVENT_BASE_FLAG_PRECISE_TIMER);
+    base = event_base_new_with_config(config);
+    event_config_free(config);
     if (!base) {
         fprintf(stderr, "Couldn't create an event_base: exiting\n");
         return 1;
     }
 
+    loop_lag_init(base);
+
+    g_rt_io = rt_io_init(base, record_sample);
+
+    g_hw_init = hw_init_init(base);
+
     //setup_motor_event(base);
 
     //setup_update_event(base);
 
+    setup_notifier(base);
+
     setup_motion_event(base);
 
+    setup_history_event(base);
+
     web_server_init(base);
 
+    web_server_set_rt_io(g_rt_io);
+
+    setup_rt_io();
+
+    setup_hw_init();
+
+    sigint_event = evsignal_new(base, SIGINT, stop_callback, base);
+    sigterm_event = evsignal_new(base, SIGTERM, stop_callback, base);
+    if (sigint_event == NULL || sigterm_event == NULL)
+        exit(ENOMEM);
+    event_add(sigint_event, NULL);
+    event_add(sigterm_event, NULL);
+
     event_base_dispatch(base);
 
+    loop_lag_fini();
+
+    hw_init_fini(g_hw_init);
+
+    rt_io_fini(g_rt_io);
+
+    // its connections and retry timers live on the base.
+    notifier_fini(g_notifier);
+
+    sample_log_close(g_sample_log);
+
     //mcp3208_module_clean_up();
 
+    event_free(sigint_event);
+    event_free(sigterm_event);
+    event_base_free(base);
+
     return 0;
 }
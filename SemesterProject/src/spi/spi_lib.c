@@ -0,0 +1,137 @@
+/**
+ * @file spi_lib.c
+ * @brief implemetation of SPI operations
+ * @author Xiangyu Guo
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include <wiringPiSPI.h>
+
+#include "spi_lib.h"
+#include "../bus_trace.h"
+#include "../tracing.h"
+#include "../probes.h"
+
+#ifdef SIM
+#include "../sim/sim.h"
+#define SPI_MESSAGE(fd, xfer, n)    sim_spi_message(fd, xfer, n)
+#else
+#define SPI_MESSAGE(fd, xfer, n)    ioctl(fd, SPI_IOC_MESSAGE(n), xfer)
+#endif
+
+#define SPI_BITS_PER_WORD       (8)     /**< Bits per word on the bus */
+
+/**
+ * @brief Setup one SPI chip select on the Raspberrypi.
+ * @param chip chip enable number(0-1).
+ * @param speed communication frequency, in Hz.
+ * @return fd file descriptor to the spidev device.
+ * @note  exit with an error number when the device can't be opened.
+ */
+int spi_setup(int chip, int speed) {
+    uint64_t start;
+    int fd;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY)
+        return bus_trace_replay(BUS_TRACE_SPI_SETUP, chip, speed, NULL, 0);
+
+    start = bus_trace_start();
+    if ((fd = wiringPiSPISetup(chip, speed)) == -1) {
+        fprintf(stderr, "wiringPiSPISetup Failed: %s\n", strerror(errno));
+        exit(errno);
+    }
+    if (start != 0) {
+        bus_trace_bind(fd, chip);
+        bus_trace_record(start, BUS_TRACE_SPI_SETUP, chip, speed, fd, NULL, 0);
+    }
+    return fd;
+}
+
+/**
+ * @brief Full duplex transfer on one chip select.
+ * @param chip chip enable number(0-1).
+ * @param buf [in/out] data going to send, replaced by the data received.
+ * @param len length of the buffer.
+ * @note  exit with an error number when the transfer fails.
+ */
+void spi_transfer(int chip, unsigned char *buf, int len) {
+    uint64_t start;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        bus_trace_replay(BUS_TRACE_SPI_TRANSFER, chip, len, buf, len);
+        return;
+    }
+
+    tracing_begin("spi_transfer", "spi");
+    start = bus_trace_start();
+    PROBE2(spi_transfer_start, chip, len);
+    if (wiringPiSPIDataRW(chip, buf, len) == -1) {
+        fprintf(stderr, "SPI Read/Write Failed: %s\n", strerror(errno));
+        exit(errno);
+    }
+    PROBE2(spi_transfer_done, chip, len);
+    bus_trace_record(start, BUS_TRACE_SPI_TRANSFER, chip, len, 0, buf, len);
+    tracing_end();
+}
+
+/**
+ * @brief Transfer several independent frames in a single system call.
+ * @param fd file descriptor returned by spi_setup.
+ * @param speed communication frequency, in Hz.
+ * @param buf [in/out] count frames of len bytes each, back to back.
+ * @param len length of one frame.
+ * @param count number of frames.
+ * @note  chip select is released between frames, so each frame is seen
+ *        by the device as a separate transaction.
+ *        exit with an error number when the transfer fails.
+ */
+void spi_transfer_batch(int fd, int speed, unsigned char *buf,
+                        int len, int count) {
+    struct spi_ioc_transfer xfer[SPI_BATCH_MAX_FRAMES];
+    int i, frames;
+    uint64_t start;
+
+    if (bus_trace_mode() == BUS_TRACE_REPLAY) {
+        bus_trace_replay(BUS_TRACE_SPI_BATCH, bus_trace_key(fd), len, buf, len * count);
+        return;
+    }
+
+    tracing_begin("spi_transfer_batch", "spi");
+    start = bus_trace_start();
+    while (count > 0) {
+        frames = count < SPI_BATCH_MAX_FRAMES ? count : SPI_BATCH_MAX_FRAMES;
+
+        memset(xfer, 0, sizeof(xfer[0]) * frames);
+        for (i = 0; i < frames; ++i) {
+            xfer[i].tx_buf = (uintptr_t)(buf + i * len);
+            xfer[i].rx_buf = (uintptr_t)(buf + i * len);
+            xfer[i].len = len;
+            xfer[i].speed_hz = speed;
+            xfer[i].bits_per_word = SPI_BITS_PER_WORD;
+            // release chip select between frames, not after the last one.
+            xfer[i].cs_change = (i != frames - 1);
+        }
+
+        PROBE2(spi_batch_start, fd, frames);
+        if (SPI_MESSAGE(fd, xfer, frames) < 0) {
+            fprintf(stderr, "SPI Batch Transfer Failed: %s\n", strerror(errno));
+            exit(errno);
+        }
+        PROBE2(spi_batch_done, fd, frames);
+
+        buf += frames * len;
+        count -= frames;
+        if (start != 0) {
+            bus_trace_record(start, BUS_TRACE_SPI_BATCH, bus_trace_key(fd), len,
+                             frames, buf - frames * len, frames * len);
+            start = bus_trace_start();
+        }
+    }
+    tracing_end();
+}
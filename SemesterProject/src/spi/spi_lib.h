@@ -0,0 +1,43 @@
+/**
+ * @file spi_lib.h
+ * @brief definition of SPI operations.
+ * @author Xiangyu Guo
+ */
+#ifndef __SPI_LIB_H__
+#define __SPI_LIB_H__
+
+#define SPI_BATCH_MAX_FRAMES    (64)    /**< Frames per SPI_IOC_MESSAGE */
+
+/**
+ * @brief Setup one SPI chip select on the Raspberrypi.
+ * @param chip chip enable number(0-1).
+ * @param speed communication frequency, in Hz.
+ * @return fd file descriptor to the spidev device.
+ * @note  exit with an error number when the device can't be opened.
+ */
+int spi_setup(int chip, int speed);
+
+/**
+ * @brief Full duplex transfer on one chip select.
+ * @param chip chip enable number(0-1).
+ * @param buf [in/out] data going to send, replaced by the data received.
+ * @param len length of the buffer.
+ * @note  exit with an error number when the transfer fails.
+ */
+void spi_transfer(int chip, unsigned char *buf, int len);
+
+/**
+ * @brief Transfer several independent frames in a single system call.
+ * @param fd file descriptor returned by spi_setup.
+ * @param speed communication frequency, in Hz.
+ * @param buf [in/out] count frames of len bytes each, back to back.
+ * @param len length of one frame.
+ * @param count number of frames.
+ * @note  chip select is released between frames, so each frame is seen
+ *        by the device as a separate transaction.
+ *        exit with an error number when the transfer fails.
+ */
+void spi_transfer_batch(int fd, int speed, unsigned char *buf,
+                        int len, int count);
+
+#endif
@@ -10,22 +10,29 @@
 #include <stdlib.h>
 #include <unistd.h>
 
-#include <wiringPiSPI.h>
-
+#include "spi_lib.h"
 #include "spi_mcp3208.h"
+#include "../tracing.h"
+
+#ifdef BENCH
+#include "../bench.h"
+#endif
 
 #define MCP3208_MIN_SPEED           (100000)/**< MCP3208 Minium Frequency */
-#define MCP3208_CHIP_NUMBER         (0)     /**< MCP3208 CHIP EABLE0(CE0) */
 #define MCP3208_CHANNEL_NUMBERS     (0x07)  /**< MCP3208 total channels */
 #define MCP3208_START_BIT           (0x04)  /**< MCP3208 Start signal */
 #define MCP3208_SINGLE_BIT          (0x02)  /**< MCP3208 Single mode */
 #define MCP3208_MASK_04BITS         (0x0F)  /**< MCP3208 lower 4 bits mask */
+#define MCP3208_FRAME_SIZE          (3)     /**< Bytes per conversion */
+
+#define MCP3208_OVERSAMPLE_BATCH    (SPI_BATCH_MAX_FRAMES) /**< Frames per message */
 
 #define SHIFT_02BITS                (2)     /**< Shifting 02 bits */
+#define SHIFT_03BITS                (3)     /**< Shifting 03 bits */
 #define SHIFT_06BITS                (6)     /**< Shifting 06 bits */
 #define SHIFT_08BITS                (8)     /**< Shifting 08 bits */
 
-static mcp3208_module_st *g_instance = NULL;    /**< instance of mcp3208 */
+static mcp3208_module_st *g_instances[MCP3208_CHIPS] = { NULL }; /**< instance per chip enable */
 
 /** 
  * @brief chip number, file descriptor, and speed
@@ -49,22 +56,55 @@ static mcp3208_module_st *mcp3208_module_init(unsigned int chip_number,
                                               unsigned int speed);
 
 /**
- * @brief Get an instance of the module MCP3208
+ * @brief Fill one conversion frame, see Figure 6-1 in the datasheet.
+ * @param buff [out] MCP3208_FRAME_SIZE bytes.
+ * @param channel valid channel number[0-7].
+ * @param mode MCP3208_SINGLE or MCP3208_DIFFERENTIAL.
+ */
+static void s_mcp3208_frame(unsigned char *buff, unsigned int channel,
+                            int mode);
+
+/**
+ * @brief Extract the 12 bits result from a received frame.
+ * @param buff [in] MCP3208_FRAME_SIZE bytes.
+ * @return 0-4095.
+ */
+static int s_mcp3208_unpack(const unsigned char *buff);
+
+/**
+ * @brief Get an instance of the module MCP3208 on CE0
  * @return mcp3208 a initialized, valid mcp3208_module_st.
  */
 mcp3208_module_st *mcp3208_module_get_instance() {
-    if (g_instance == NULL)
-        g_instance = mcp3208_module_init(MCP3208_CHIP_NUMBER, MCP3208_MIN_SPEED);
-    return g_instance;
+    return mcp3208_module_get_chip(MCP3208_CHIP_0);
 }
 
 /**
- * @brief Clean up the module mcp3208
+ * @brief Get an instance of the module MCP3208 on the given chip enable
+ * @param chip_number chip number on Raspberrypi pin, 0 or 1.
+ * @return mcp3208 a initialized, valid mcp3208_module_st.
+ */
+mcp3208_module_st *mcp3208_module_get_chip(unsigned int chip_number) {
+    chip_number &= 1;
+
+    if (g_instances[chip_number] == NULL)
+        g_instances[chip_number] = mcp3208_module_init(chip_number,
+                                                       MCP3208_MIN_SPEED);
+    return g_instances[chip_number];
+}
+
+/**
+ * @brief Clean up all the mcp3208 modules
  */
 void mcp3208_module_clean_up() {
-    if (g_instance != NULL) {
-        close(g_instance->fd);
-        free(g_instance);
+    int i;
+
+    for (i = 0; i < MCP3208_CHIPS; ++i) {
+        if (g_instances[i] != NULL) {
+            close(g_instances[i]->fd);
+            free(g_instances[i]);
+            g_instances[i] = NULL;
+        }
     }
 }
 
@@ -75,27 +115,144 @@ void mcp3208_module_clean_up() {
  * @return 0-4096 on success; otherwise exit with an error number.
  */
 int mcp3208_read_data(mcp3208_module_st *mcp3208, unsigned int channel) {
-    unsigned char buff[3];
-    int ret = 0;
+    return mcp3208_read_mode(mcp3208, channel, MCP3208_SINGLE);
+}
+
+/**
+ * @brief Read one conversion in the given input mode.
+ * @param mcp3208 initialized module.
+ * @param channel channel number[0-7] in single mode,
+ *                or one of MCP3208_DIFF_* in differential mode.
+ * @param mode MCP3208_SINGLE or MCP3208_DIFFERENTIAL.
+ * @return 0-4096 on success; otherwise exit with an error number.
+ */
+int mcp3208_read_mode(mcp3208_module_st *mcp3208, unsigned int channel,
+                      int mode) {
+    unsigned char buff[MCP3208_FRAME_SIZE];
 
     if (mcp3208 == NULL)
         return 0;
 
-    channel &= MCP3208_CHANNEL_NUMBERS;
+    tracing_begin("mcp3208_read_data", "adc");
+    s_mcp3208_frame(buff, channel, mode);
+    spi_transfer(mcp3208->chip_number, buff, MCP3208_FRAME_SIZE);
+    tracing_end();
 
-    buff[0] = MCP3208_START_BIT | MCP3208_SINGLE_BIT | (channel >> SHIFT_02BITS);
-    buff[1] = channel << SHIFT_06BITS;
-    buff[2] = 0;
+    return s_mcp3208_unpack(buff);
+}
+
+/**
+ * @brief Oversample and decimate to gain effective bits.
+ * @param mcp3208 initialized module.
+ * @param channel channel number[0-7] or one of MCP3208_DIFF_*.
+ * @param mode MCP3208_SINGLE or MCP3208_DIFFERENTIAL.
+ * @param extra_bits effective bits to gain[0-4], costs 4^extra_bits
+ *                   conversions, all sent in batched SPI messages.
+ * @return 0 to MCP3208_OVERSAMPLED_MAX(extra_bits) on success;
+ *         otherwise exit with an error number.
+ * @note the gain only holds when the input carries at least 1 LSB of noise.
+ */
+int mcp3208_read_oversampled(mcp3208_module_st *mcp3208, unsigned int channel,
+                             int mode, unsigned int extra_bits) {
+    unsigned char buff[MCP3208_OVERSAMPLE_BATCH * MCP3208_FRAME_SIZE];
+    int i, frames, samples;
+    long sum = 0;
+
+    if (mcp3208 == NULL)
+        return 0;
+
+    if (extra_bits > MCP3208_MAX_EXTRA_BITS)
+        extra_bits = MCP3208_MAX_EXTRA_BITS;
+
+    // 4^n conversions for n extra bits, decimated by 2^n.
+    samples = 1 << (extra_bits << 1);
 
-    if(wiringPiSPIDataRW(mcp3208->chip_number, buff, 3) == -1) {
-        fprintf(stderr, "MCP3208 Read/Write Failed: %s\n", strerror(errno));
-        exit(errno);
+    tracing_begin("mcp3208_read_oversampled", "adc");
+    while (samples > 0) {
+        frames = samples < MCP3208_OVERSAMPLE_BATCH ?
+                                samples : MCP3208_OVERSAMPLE_BATCH;
+        for (i = 0; i < frames; ++i)
+            s_mcp3208_frame(buff + i * MCP3208_FRAME_SIZE, channel, mode);
+
+        spi_transfer_batch(mcp3208->fd, mcp3208->speed, buff,
+                           MCP3208_FRAME_SIZE, frames);
+
+        for (i = 0; i < frames; ++i)
+            sum += s_mcp3208_unpack(buff + i * MCP3208_FRAME_SIZE);
+        samples -= frames;
     }
+    tracing_end();
+
+    return sum >> extra_bits;
+}
+
+/**
+ * @brief Read all 8 channels of one ADC in a single SPI message.
+ * @param mcp3208 initialized module.
+ * @param values [out] MCP3208_CHANNELS_PER_CHIP values, indexed by channel.
+ * @return 0 on success; otherwise EFAULT.
+ */
+int mcp3208_scan(mcp3208_module_st *mcp3208, int *values) {
+    unsigned char buff[MCP3208_CHANNELS_PER_CHIP * MCP3208_FRAME_SIZE];
+    int channel;
+
+    if (mcp3208 == NULL || values == NULL)
+        return EFAULT;
+
+    tracing_begin("mcp3208_scan", "adc");
+    for (channel = 0; channel < MCP3208_CHANNELS_PER_CHIP; ++channel)
+        s_mcp3208_frame(buff + channel * MCP3208_FRAME_SIZE, channel,
+                        MCP3208_SINGLE);
+
+    spi_transfer_batch(mcp3208->fd, mcp3208->speed, buff,
+                       MCP3208_FRAME_SIZE, MCP3208_CHANNELS_PER_CHIP);
+    tracing_end();
+
+    for (channel = 0; channel < MCP3208_CHANNELS_PER_CHIP; ++channel)
+        values[channel] = s_mcp3208_unpack(buff + channel * MCP3208_FRAME_SIZE);
+
+    return 0;
+}
+
+/**
+ * @brief Read one channel from the unified channel namespace.
+ * @param channel valid channel number[0-15], 8-15 are the channels on CE1.
+ * @return 0-4096 on success; otherwise exit with an error number.
+ */
+int mcp3208_read_channel(unsigned int channel) {
+    channel %= MCP3208_TOTAL_CHANNELS;
+
+    return mcp3208_read_data(mcp3208_module_get_chip(channel >> SHIFT_03BITS),
+                             channel & MCP3208_CHANNEL_NUMBERS);
+}
+
+/**
+ * @brief Scan the unified channel namespace across all the ADCs.
+ * @param values [out] count values, indexed by unified channel number.
+ * @param count number of channels to read[1-16].
+ * @return number of channels filled.
+ * @note Both chip enables share the SPI0 controller, so the kernel
+ *       serializes their messages anyway. Each chip costs one batched
+ *       message, instead of one system call per channel.
+ */
+int mcp3208_scan_all(int *values, unsigned int count) {
+    int chip_values[MCP3208_CHANNELS_PER_CHIP];
+    unsigned int chip, channel, filled = 0;
+
+    if (values == NULL)
+        return 0;
 
-    buff[1] = MCP3208_MASK_04BITS & buff[1];
-    ret = (buff[1] << SHIFT_08BITS) | buff[2];
+    if (count > MCP3208_TOTAL_CHANNELS)
+        count = MCP3208_TOTAL_CHANNELS;
 
-    return ret;
+    for (chip = 0; filled < count; ++chip) {
+        mcp3208_scan(mcp3208_module_get_chip(chip), chip_values);
+        for (channel = 0; channel < MCP3208_CHANNELS_PER_CHIP &&
+                          filled < count; ++channel)
+            values[filled++] = chip_values[channel];
+    }
+
+    return filled;
 }
 
 static mcp3208_module_st *mcp3208_module_init(unsigned int chip_number, 
@@ -108,10 +265,7 @@ static mcp3208_module_st *mcp3208_module_init(unsigned int chip_number,
 
     chip_number &= 1;
 
-    if ((fd = wiringPiSPISetup(chip_number, speed)) == -1) {
-        fprintf(stderr, "wiringPiSPISetup Failed: %s\n", strerror(errno));
-        exit(errno);
-    }
+    fd = spi_setup(chip_number, speed);
 
     mcp3208 = (mcp3208_module_st *)malloc(sizeof(mcp3208_module_st));
 
@@ -127,18 +281,173 @@ static mcp3208_module_st *mcp3208_module_init(unsigned int chip_number,
     return mcp3208;
 }
 
+static void s_mcp3208_frame(unsigned char *buff, unsigned int channel,
+                            int mode) {
+    channel &= MCP3208_CHANNEL_NUMBERS;
+
+    buff[0] = MCP3208_START_BIT | (channel >> SHIFT_02BITS);
+    if (mode == MCP3208_SINGLE)
+        buff[0] |= MCP3208_SINGLE_BIT;
+    buff[1] = channel << SHIFT_06BITS;
+    buff[2] = 0;
+}
+
+static int s_mcp3208_unpack(const unsigned char *buff) {
+    return ((MCP3208_MASK_04BITS & buff[1]) << SHIFT_08BITS) | buff[2];
+}
+
 #ifdef XTEST
 
+#ifdef SIM
+#include "../sim/sim.h"
+
+/**
+ * @brief compare a conversion with the simulated input, noise is 1 LSB.
+ */
+static int s_test_check(int value, int expected) {
+    return value < expected - 1 || value > expected + 1;
+}
+
+#define BUDGET_READ         (1)         /**< A conversion is one message */
+#define BUDGET_SCAN         (1)         /**< A chip is one message */
+#define BUDGET_OVERSAMPLED  ((1 << (MCP3208_MAX_EXTRA_BITS << 1)) / SPI_BATCH_MAX_FRAMES)
+#endif
+
 int main() {
     int channel;
     int value;
+    int failed = 0;
+    int values[MCP3208_TOTAL_CHANNELS];
     mcp3208_module_st *mcp3208 = mcp3208_module_get_instance();
+#ifdef SIM
+    sim_usage_st mark;
+
+    setenv("SIM_ADC_NOISE", "1", 1);
+    for (channel = 0; channel < MCP3208_TOTAL_CHANNELS; channel++)
+        sim_adc_set(channel / MCP3208_CHANNELS_PER_CHIP,
+                    channel % MCP3208_CHANNELS_PER_CHIP, 100 * (channel + 1));
+#endif
     for (channel = MCP3208_CHANNEL_0; channel <= MCP3208_CHANNEL_7; channel++) {
         value = mcp3208_read_data(mcp3208, channel);
         printf("Value on channel: %d is %d\n", channel, value);
+#ifdef SIM
+        failed |= s_test_check(value, 100 * (channel + 1));
+#endif
+    }
+
+    for (channel = MCP3208_DIFF_0_1; channel <= MCP3208_DIFF_7_6; channel++) {
+        value = mcp3208_read_mode(mcp3208, channel, MCP3208_DIFFERENTIAL);
+        printf("Differential pair: %d is %d\n", channel, value);
+#ifdef SIM
+        // odd pairs put the higher input on IN+, 100 above IN-.
+        failed |= s_test_check(value, channel & 1 ? 100 : 0);
+#endif
+    }
+
+#ifdef SIM
+    sim_usage_mark(&mark);
+    mcp3208_read_data(mcp3208, MCP3208_CHANNEL_0);
+    failed |= sim_usage_check("mcp3208 read", &mark, SIM_BUS_SPI, BUDGET_READ, 0);
+    sim_usage_mark(&mark);
+#endif
+    value = mcp3208_read_oversampled(mcp3208, MCP3208_CHANNEL_7,
+                                     MCP3208_SINGLE, MCP3208_MAX_EXTRA_BITS);
+    printf("Oversampled channel: %d is %d of %.0f\n", MCP3208_CHANNEL_7, value,
+            MCP3208_OVERSAMPLED_MAX(MCP3208_MAX_EXTRA_BITS));
+#ifdef SIM
+    failed |= sim_usage_check("mcp3208 read 4 extra bits", &mark, SIM_BUS_SPI,
+                              BUDGET_OVERSAMPLED, 0);
+    failed |= s_test_check(value >> MCP3208_MAX_EXTRA_BITS, 800);
+
+    sim_usage_mark(&mark);
+    mcp3208_scan(mcp3208, values);
+    failed |= sim_usage_check("mcp3208 scan", &mark, SIM_BUS_SPI, BUDGET_SCAN, 0);
+    mcp3208_module_get_chip(MCP3208_CHIP_1);
+    sim_usage_mark(&mark);
+#endif
+
+    mcp3208_scan_all(values, MCP3208_TOTAL_CHANNELS);
+#ifdef SIM
+    failed |= sim_usage_check("mcp3208 scan all", &mark, SIM_BUS_SPI,
+                              BUDGET_SCAN * MCP3208_CHIPS, 0);
+#endif
+    for (channel = 0; channel < MCP3208_TOTAL_CHANNELS; channel++) {
+        printf("Scan on chip %d channel: %d is %d\n",
+                channel / MCP3208_CHANNELS_PER_CHIP,
+                channel % MCP3208_CHANNELS_PER_CHIP, values[channel]);
+#ifdef SIM
+        failed |= s_test_check(values[channel], 100 * (channel + 1));
+#endif
     }
 
+#ifdef SIM
+    printf("%s\n", failed ? "FAILED" : "SUCCESS!");
+#endif
     mcp3208_module_clean_up();
+    return failed;
+}
+
+#endif
+
+#ifdef BENCH
+
+/**
+ * @brief commands of a whole chip, the mode changing every time.
+ */
+static void s_bench_frame(void *arg, long n) {
+    unsigned char buff[MCP3208_CHANNELS_PER_CHIP * MCP3208_FRAME_SIZE];
+    unsigned int channel;
+
+    while (n-- > 0) {
+        for (channel = 0; channel < MCP3208_CHANNELS_PER_CHIP; ++channel)
+            s_mcp3208_frame(buff + channel * MCP3208_FRAME_SIZE,
+                            (channel + n) & MCP3208_CHANNEL_NUMBERS, n & 1);
+        bench_keep(buff);
+    }
+}
+
+/**
+ * @brief results of a whole chip.
+ */
+static void s_bench_unpack(void *arg, long n) {
+    unsigned char buff[MCP3208_CHANNELS_PER_CHIP * MCP3208_FRAME_SIZE];
+    int values[MCP3208_CHANNELS_PER_CHIP];
+    unsigned int channel;
+
+    for (channel = 0; channel < sizeof(buff); ++channel)
+        buff[channel] = channel * 37;
+
+    while (n-- > 0) {
+        bench_keep(buff);
+        for (channel = 0; channel < MCP3208_CHANNELS_PER_CHIP; ++channel)
+            values[channel] = s_mcp3208_unpack(buff + channel * MCP3208_FRAME_SIZE);
+        bench_keep(values);
+    }
+}
+
+/**
+ * @brief commands and results of an oversampled read, 4 extra bits.
+ */
+static void s_bench_oversample(void *arg, long n) {
+    unsigned char buff[MCP3208_FRAME_SIZE];
+    int i, samples = 1 << (MCP3208_MAX_EXTRA_BITS << 1);
+    long sum;
+
+    while (n-- > 0) {
+        sum = 0;
+        for (i = 0; i < samples; ++i) {
+            s_mcp3208_frame(buff, MCP3208_DIFF_0_1, MCP3208_DIFFERENTIAL);
+            bench_keep(buff);
+            sum += s_mcp3208_unpack(buff);
+        }
+        bench_keep(&sum);
+    }
+}
+
+int main() {
+    bench_run("mcp3208", "frame 8 channels", s_bench_frame, NULL, NULL);
+    bench_run("mcp3208", "unpack 8 channels", s_bench_unpack, NULL, NULL);
+    bench_run("mcp3208", "frame+unpack x256", s_bench_oversample, NULL, NULL);
     return 0;
 }
 
@@ -21,17 +21,46 @@ struct mcp3208_module;
 #define MCP3208_CHANNEL_5           (5)             /**< Channel 5 on ADC */
 #define MCP3208_CHANNEL_6           (6)             /**< Channel 6 on ADC */
 #define MCP3208_CHANNEL_7           (7)             /**< Channel 7 on ADC */
+
+#define MCP3208_CHIP_0              (0)             /**< ADC on chip enable 0(CE0) */
+#define MCP3208_CHIP_1              (1)             /**< ADC on chip enable 1(CE1) */
+#define MCP3208_CHIPS               (2)             /**< ADCs on the Raspberrypi */
+#define MCP3208_CHANNELS_PER_CHIP   (8)             /**< Channels on one ADC */
+#define MCP3208_TOTAL_CHANNELS      (MCP3208_CHIPS * MCP3208_CHANNELS_PER_CHIP)
+                                                    /**< Unified channels, CE0 0-7, CE1 8-15 */
+
+#define MCP3208_DIFFERENTIAL        (0)             /**< Pseudo-differential pair mode */
+#define MCP3208_SINGLE              (1)             /**< Single-ended mode */
+#define MCP3208_DIFF_0_1            (0)             /**< IN+ CH0, IN- CH1 */
+#define MCP3208_DIFF_1_0            (1)             /**< IN+ CH1, IN- CH0 */
+#define MCP3208_DIFF_2_3            (2)             /**< IN+ CH2, IN- CH3 */
+#define MCP3208_DIFF_3_2            (3)             /**< IN+ CH3, IN- CH2 */
+#define MCP3208_DIFF_4_5            (4)             /**< IN+ CH4, IN- CH5 */
+#define MCP3208_DIFF_5_4            (5)             /**< IN+ CH5, IN- CH4 */
+#define MCP3208_DIFF_6_7            (6)             /**< IN+ CH6, IN- CH7 */
+#define MCP3208_DIFF_7_6            (7)             /**< IN+ CH7, IN- CH6 */
+
+#define MCP3208_MAX_EXTRA_BITS      (4)             /**< Up to 4^4 samples per value */
+#define MCP3208_OVERSAMPLED_MAX(bits) (MCP3208_MAX_VALUE * (1 << (bits)))
+                                                    /**< Max value with extra bits */
 /* ==============================================
 	device module initialize and finish function 
    ============================================== */
 /**
- * @brief Get an instance of the module MCP3208
+ * @brief Get an instance of the module MCP3208 on CE0
  * @return mcp3208 a initialized, valid mcp3208_module_st.
  */
 mcp3208_module_st *mcp3208_module_get_instance();
 
 /**
- * @brief Clean up the module mcp3208
+ * @brief Get an instance of the module MCP3208 on the given chip enable
+ * @param chip_number chip number on Raspberrypi pin, 0 or 1.
+ * @return mcp3208 a initialized, valid mcp3208_module_st.
+ */
+mcp3208_module_st *mcp3208_module_get_chip(unsigned int chip_number);
+
+/**
+ * @brief Clean up all the mcp3208 modules
  */
 void mcp3208_module_clean_up();
 
@@ -45,4 +74,52 @@ void mcp3208_module_clean_up();
  * @return 0-4096 on success; otherwise exit with an error number.
  */
 int mcp3208_read_data(mcp3208_module_st *mcp3208, unsigned int channel);
-#endif
\ No newline at end of file
+
+/**
+ * @brief Read one conversion in the given input mode.
+ * @param mcp3208 initialized module.
+ * @param channel channel number[0-7] in single mode,
+ *                or one of MCP3208_DIFF_* in differential mode.
+ * @param mode MCP3208_SINGLE or MCP3208_DIFFERENTIAL.
+ * @return 0-4096 on success; otherwise exit with an error number.
+ */
+int mcp3208_read_mode(mcp3208_module_st *mcp3208, unsigned int channel,
+                      int mode);
+
+/**
+ * @brief Oversample and decimate to gain effective bits.
+ * @param mcp3208 initialized module.
+ * @param channel channel number[0-7] or one of MCP3208_DIFF_*.
+ * @param mode MCP3208_SINGLE or MCP3208_DIFFERENTIAL.
+ * @param extra_bits effective bits to gain[0-4], costs 4^extra_bits
+ *                   conversions, all sent in batched SPI messages.
+ * @return 0 to MCP3208_OVERSAMPLED_MAX(extra_bits) on success;
+ *         otherwise exit with an error number.
+ * @note the gain only holds when the input carries at least 1 LSB of noise.
+ */
+int mcp3208_read_oversampled(mcp3208_module_st *mcp3208, unsigned int channel,
+                             int mode, unsigned int extra_bits);
+
+/**
+ * @brief Read all 8 channels of one ADC in a single SPI message.
+ * @param mcp3208 initialized module.
+ * @param values [out] MCP3208_CHANNELS_PER_CHIP values, indexed by channel.
+ * @return 0 on success; otherwise EFAULT.
+ */
+int mcp3208_scan(mcp3208_module_st *mcp3208, int *values);
+
+/**
+ * @brief Read one channel from the unified channel namespace.
+ * @param channel valid channel number[0-15], 8-15 are the channels on CE1.
+ * @return 0-4096 on success; otherwise exit with an error number.
+ */
+int mcp3208_read_channel(unsigned int channel);
+
+/**
+ * @brief Scan the unified channel namespace across all the ADCs.
+ * @param values [out] count values, indexed by unified channel number.
+ * @param count number of channels to read[1-16].
+ * @return number of channels filled.
+ */
+int mcp3208_scan_all(int *values, unsigned int count);
+#endif
@@ -0,0 +1,62 @@
+/**
+ * @file spsc_queue.h
+ * @brief lock-free single-producer single-consumer queue, declaration.
+ *        One thread pushes fixed size items, one other thread pops them
+ *        when the eventfd becomes readable. Neither side ever blocks.
+ * @author Xiangyu Guo
+ */
+#ifndef __SPSC_QUEUE_H__
+#define __SPSC_QUEUE_H__
+
+#include <stddef.h>
+
+/**
+ * @brief module structure, hiding the detail to the public
+ */
+typedef struct spsc_queue spsc_queue_st;
+struct spsc_queue;
+
+/**
+ * @brief Initialize a bounded queue and its eventfd.
+ * @param capacity number of items, rounded up to a power of two.
+ * @param size size of one item, in bytes.
+ * @return a initialized queue.
+ */
+spsc_queue_st *spsc_queue_init(unsigned int capacity, size_t size);
+
+/**
+ * @brief Clean up the queue.
+ * @param queue a valid queue.
+ */
+void spsc_queue_fini(spsc_queue_st *queue);
+
+/**
+ * @brief Get the eventfd to watch, readable while items are pending.
+ * @param queue a valid queue.
+ * @return file descriptor of the eventfd.
+ */
+int spsc_queue_fd(spsc_queue_st *queue);
+
+/**
+ * @brief Push one item, only the producer thread may push.
+ * @param queue a valid queue.
+ * @param item the item, copied in.
+ * @return 0 on success; ENOSPC when the queue is full.
+ */
+int spsc_queue_push(spsc_queue_st *queue, const void *item);
+
+/**
+ * @brief Pop the oldest item, only the consumer thread may pop.
+ * @param queue a valid queue.
+ * @param item [out] the item.
+ * @return 0 on success; EAGAIN when the queue is empty.
+ */
+int spsc_queue_pop(spsc_queue_st *queue, void *item);
+
+/**
+ * @brief Reset the eventfd once woken up, before popping the items.
+ * @param queue a valid queue.
+ */
+void spsc_queue_ack(spsc_queue_st *queue);
+
+#endif
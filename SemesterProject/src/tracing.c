@@ -0,0 +1,298 @@
+/**
+ * @file tracing.c
+ * @brief spans of the daemon, implementation.
+ *        A thread gets its ring on its first event. Only the thread writes
+ *        it: the event first, then the head. A reader copies the events
+ *        behind the head, then reads the head again and leaves out the
+ *        ones the thread may have overwritten meanwhile.
+ * @author Xiangyu Guo
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "tracing.h"
+
+#define RING_MASK               (TRACING_RING_EVENTS - 1)   /**< Slot of an event */
+
+/**
+ * @brief the events of one thread.
+ */
+typedef struct tracing_ring {
+    char name[TRACING_NAME_SIZE];   /**< thread name */
+    int tid;                        /**< thread number */
+    unsigned int head;              /**< next event, written by its thread */
+    unsigned int since;             /**< first event kept, set on enable */
+    tracing_event_st events[TRACING_RING_EVENTS]; /**< the ring */
+} tracing_ring_st;
+
+int g_tracing_on = 0;               /**< Set by tracing_enable */
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER; /**< Registration */
+static tracing_ring_st *g_rings[TRACING_MAX_THREADS];  /**< Threads traced */
+static int g_count = 0;             /**< Rings in use */
+static __thread tracing_ring_st *g_ring = NULL;    /**< Ring of the thread */
+static __thread int g_untraced = 0; /**< No ring left for the thread */
+
+/**
+ * @brief Ring of the calling thread, made on first use.
+ * @return NULL when every ring is taken.
+ */
+static tracing_ring_st *s_tracing_ring();
+
+/* ==================
+    tracing function
+   ================== */
+/**
+ * @brief Turn tracing on or off. Turning it on forgets the events so far.
+ * @param on 1 to trace, 0 to stop.
+ */
+void tracing_enable(int on) {
+    int i, count = __atomic_load_n(&g_count, __ATOMIC_ACQUIRE);
+
+    if (on) {
+        for (i = 0; i < count; ++i)
+            __atomic_store_n(&g_rings[i]->since,
+                             __atomic_load_n(&g_rings[i]->head, __ATOMIC_ACQUIRE),
+                             __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&g_tracing_on, on != 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Name the calling thread in the trace.
+ * @param name copied, cut to TRACING_NAME_SIZE - 1 characters.
+ */
+void tracing_name_thread(const char *name) {
+    tracing_ring_st *ring = s_tracing_ring();
+
+    if (ring == NULL)
+        return;
+    pthread_mutex_lock(&g_lock);
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    pthread_mutex_unlock(&g_lock);
+}
+
+/**
+ * @brief Append an event to the ring of the calling thread.
+ * @param phase TRACING_*.
+ * @param name span or flow name, a literal.
+ * @param cat category, a literal.
+ * @param id flow id, 0 on a span.
+ */
+void tracing_record(int phase, const char *name, const char *cat,
+                    unsigned long id) {
+    tracing_ring_st *ring = g_ring != NULL ? g_ring : s_tracing_ring();
+    tracing_event_st *event;
+    struct timespec now;
+    unsigned int head;
+
+    if (ring == NULL)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    head = ring->head;
+    event = &ring->events[head & RING_MASK];
+    event->ts_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    event->name = name;
+    event->cat = cat;
+    event->id = id;
+    event->tid = ring->tid;
+    event->phase = phase;
+    // publish the event, the slot is the reader's again.
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Copy the events kept, thread by thread, oldest first. Safe while
+ *        the threads keep tracing: events overwritten meanwhile are left out.
+ * @param events [out] room for max events.
+ * @param max TRACING_MAX_THREADS * TRACING_RING_EVENTS keeps them all.
+ * @return number of events copied.
+ */
+int tracing_collect(tracing_event_st *events, int max) {
+    int i, count = __atomic_load_n(&g_count, __ATOMIC_ACQUIRE);
+    unsigned int head, since, first, pos, lost;
+    tracing_ring_st *ring;
+    int n = 0, start;
+
+    for (i = 0; i < count && n < max; ++i) {
+        ring = g_rings[i];
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        since = __atomic_load_n(&ring->since, __ATOMIC_ACQUIRE);
+        // the slot of the next event is always left out, it may be written.
+        first = head - since >= TRACING_RING_EVENTS ? head - TRACING_RING_EVENTS + 1 : since;
+
+        start = n;
+        for (pos = first; pos != head && n < max; ++pos)
+            events[n++] = ring->events[pos & RING_MASK];
+
+        // events the thread went past while they were copied are torn.
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head - first >= TRACING_RING_EVENTS) {
+            lost = head - first - TRACING_RING_EVENTS + 1;
+            if (lost > (unsigned int)(n - start))
+                lost = n - start;
+            memmove(&events[start], &events[start + lost],
+                    (n - start - lost) * sizeof(tracing_event_st));
+            n -= lost;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Number of threads traced so far, tids run from 0 to it.
+ */
+int tracing_threads() {
+    return __atomic_load_n(&g_count, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Name of a traced thread.
+ * @param tid thread number.
+ * @return its name, "" when it has none.
+ */
+const char *tracing_thread_name(int tid) {
+    if (tid < 0 || tid >= tracing_threads())
+        return "";
+    return g_rings[tid]->name;
+}
+
+/* ================
+    inner function
+   ================ */
+static tracing_ring_st *s_tracing_ring() {
+    tracing_ring_st *ring;
+
+    if (g_ring != NULL || g_untraced)
+        return g_ring;
+
+    pthread_mutex_lock(&g_lock);
+    if (g_count == TRACING_MAX_THREADS) {
+        pthread_mutex_unlock(&g_lock);
+        g_untraced = 1;
+        return NULL;
+    }
+    ring = calloc(1, sizeof(tracing_ring_st));
+    if (ring == NULL)
+        exit(ENOMEM);
+    ring->tid = g_count;
+    g_rings[g_count] = ring;
+    __atomic_store_n(&g_count, g_count + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_lock);
+
+    g_ring = ring;
+    return ring;
+}
+
+#ifdef XTEST
+
+#define TEST_WRITERS        (2)         /**< Threads tracing */
+#define TEST_SPANS          (200000)    /**< Spans per thread */
+
+static int g_failed = 0;
+static int g_done = 0;              /**< Writers finished */
+
+static void *s_test_writer(void *arg) {
+    static const char *names[TEST_WRITERS] = { "writer 0", "writer 1" };
+    int i;
+
+    tracing_name_thread(names[(long)arg]);
+    for (i = 0; i < TEST_SPANS; ++i) {
+        tracing_begin("span", "test");
+        tracing_end();
+    }
+    __atomic_add_fetch(&g_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/**
+ * @brief events of a thread come in order, spans open and close in turn.
+ */
+static void s_test_check(const tracing_event_st *events, int n) {
+    int i;
+
+    for (i = 1; i < n; ++i) {
+        if (events[i].tid != events[i - 1].tid)
+            continue;
+        g_failed |= events[i].ts_us < events[i - 1].ts_us;
+        g_failed |= events[i].phase == events[i - 1].phase;
+        g_failed |= events[i].phase == TRACING_BEGIN &&
+                    strcmp(events[i].name, "span") != 0;
+    }
+}
+
+int main() {
+    static tracing_event_st events[TRACING_MAX_THREADS * TRACING_RING_EVENTS];
+    pthread_t threads[TEST_WRITERS];
+    int i, n, reads = 0;
+
+    // off by default, nothing is kept.
+    tracing_name_thread("main");
+    tracing_begin("off", "test");
+    tracing_end();
+    g_failed |= tracing_collect(events, TRACING_RING_EVENTS) != 0;
+
+    tracing_enable(1);
+    for (i = 0; i < TEST_WRITERS; ++i)
+        pthread_create(&threads[i], NULL, s_test_writer, (void *)(long)i);
+
+    // read while the rings wrap around.
+    while (__atomic_load_n(&g_done, __ATOMIC_ACQUIRE) < TEST_WRITERS) {
+        n = tracing_collect(events, TRACING_MAX_THREADS * TRACING_RING_EVENTS);
+        s_test_check(events, n);
+        reads++;
+    }
+
+    for (i = 0; i < TEST_WRITERS; ++i)
+        pthread_join(threads[i], NULL);
+
+    n = tracing_collect(events, TRACING_MAX_THREADS * TRACING_RING_EVENTS);
+    s_test_check(events, n);
+    g_failed |= n != TEST_WRITERS * (TRACING_RING_EVENTS - 1);
+    g_failed |= tracing_threads() != TEST_WRITERS + 1;
+    g_failed |= strcmp(tracing_thread_name(0), "main") != 0;
+    g_failed |= strncmp(tracing_thread_name(1), "writer", 6) != 0;
+    printf("%d reads while tracing, %d events kept\n", reads, n);
+
+    // turning it on again starts afresh.
+    tracing_enable(1);
+    g_failed |= tracing_collect(events, TRACING_MAX_THREADS * TRACING_RING_EVENTS) != 0;
+    tracing_begin("again", "test");
+    tracing_end();
+    n = tracing_collect(events, TRACING_MAX_THREADS * TRACING_RING_EVENTS);
+    g_failed |= n != 2 || events[0].tid != 0 || strcmp(events[0].name, "again") != 0;
+
+    printf("%s\n", g_failed ? "FAILED" : "SUCCESS!");
+    return g_failed;
+}
+
+#endif
+
+#ifdef BENCH
+#include "bench.h"
+
+/**
+ * @brief one span, begin and end.
+ */
+static void s_bench_span(void *arg, long n) {
+    while (n-- > 0) {
+        tracing_begin("span", "bench");
+        tracing_end();
+    }
+}
+
+int main() {
+    tracing_enable(0);
+    bench_run("tracing", "span off", s_bench_span, NULL, NULL);
+    tracing_enable(1);
+    bench_run("tracing", "span on", s_bench_span, NULL, NULL);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,120 @@
+/**
+ * @file tracing.h
+ * @brief spans of the daemon, declaration.
+ *        Every thread writes the begin and end of its spans into a ring of
+ *        its own, with no lock, so a span costs two clock reads while
+ *        tracing is on and one load while it is off. The rings are read
+ *        back as one list of events, in the shape of the Chrome trace
+ *        format: B and E for spans, s, t and f for flows linking the spans
+ *        of one request across threads.
+ *        Replayed bus transactions are not traced, their driver call is.
+ * @author Xiangyu Guo
+ */
+#ifndef __TRACING_H__
+#define __TRACING_H__
+
+#include <stdint.h>
+
+#define TRACING_MAX_THREADS     (16)        /**< Threads traced, others are not */
+#define TRACING_RING_EVENTS     (4096)      /**< Ring of a thread, one slot less is kept */
+#define TRACING_NAME_SIZE       (16)        /**< Thread name, with the nul */
+
+#define TRACING_BEGIN           ('B')       /**< Span begins */
+#define TRACING_END             ('E')       /**< Innermost span ends */
+#define TRACING_FLOW_START      ('s')       /**< Flow leaves this span */
+#define TRACING_FLOW_STEP       ('t')       /**< Flow goes through this span */
+#define TRACING_FLOW_END        ('f')       /**< Flow ends in this span */
+
+/**
+ * @brief one event, names are literals kept as given.
+ */
+typedef struct tracing_event {
+    uint64_t ts_us;                 /**< CLOCK_MONOTONIC */
+    const char *name;               /**< span or flow, NULL on an end */
+    const char *cat;                /**< category, e.g. "i2c" */
+    unsigned long id;               /**< flow id, 0 on a span */
+    int tid;                        /**< thread number */
+    int phase;                      /**< TRACING_* */
+} tracing_event_st;
+
+extern int g_tracing_on;            /**< Set by tracing_enable */
+
+/* ==================
+    tracing function
+   ================== */
+/**
+ * @brief Turn tracing on or off. Turning it on forgets the events so far.
+ * @param on 1 to trace, 0 to stop.
+ */
+void tracing_enable(int on);
+
+/**
+ * @brief Name the calling thread in the trace.
+ * @param name copied, cut to TRACING_NAME_SIZE - 1 characters.
+ */
+void tracing_name_thread(const char *name);
+
+/**
+ * @brief Append an event to the ring of the calling thread.
+ * @param phase TRACING_*.
+ * @param name span or flow name, a literal.
+ * @param cat category, a literal.
+ * @param id flow id, 0 on a span.
+ */
+void tracing_record(int phase, const char *name, const char *cat,
+                    unsigned long id);
+
+/**
+ * @brief Copy the events kept, thread by thread, oldest first. Safe while
+ *        the threads keep tracing: events overwritten meanwhile are left out.
+ * @param events [out] room for max events.
+ * @param max TRACING_MAX_THREADS * TRACING_RING_EVENTS keeps them all.
+ * @return number of events copied.
+ */
+int tracing_collect(tracing_event_st *events, int max);
+
+/**
+ * @brief Number of threads traced so far, tids run from 0 to it.
+ */
+int tracing_threads();
+
+/**
+ * @brief Name of a traced thread.
+ * @param tid thread number.
+ * @return its name, "" when it has none.
+ */
+const char *tracing_thread_name(int tid);
+
+/**
+ * @brief Begin a span on the calling thread.
+ * @param name a literal.
+ * @param cat a literal.
+ */
+static inline __attribute__((always_inline))
+void tracing_begin(const char *name, const char *cat) {
+    if (__atomic_load_n(&g_tracing_on, __ATOMIC_RELAXED))
+        tracing_record(TRACING_BEGIN, name, cat, 0);
+}
+
+/**
+ * @brief End the innermost span of the calling thread.
+ */
+static inline __attribute__((always_inline))
+void tracing_end() {
+    if (__atomic_load_n(&g_tracing_on, __ATOMIC_RELAXED))
+        tracing_record(TRACING_END, NULL, NULL, 0);
+}
+
+/**
+ * @brief Link the current span of the calling thread into a flow.
+ * @param phase TRACING_FLOW_*.
+ * @param name a literal, the same along the flow.
+ * @param id the same along the flow.
+ */
+static inline __attribute__((always_inline))
+void tracing_flow(int phase, const char *name, unsigned long id) {
+    if (__atomic_load_n(&g_tracing_on, __ATOMIC_RELAXED))
+        tracing_record(phase, name, "flow", id);
+}
+
+#endif
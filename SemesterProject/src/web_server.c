@@ -19,23 +19,100 @@
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
 
-#include <wiringPi.h>
-
 #include "spi/spi_mcp3208.h"
 #include "i2c/i2c_bmp180.h"
 #include "pin/pin_motor.h"
 #include "pin/pin_dht_11.h"
+#include "pin/pin_gpio.h"
 
+#include "event_queue.h"
+#include "history.h"
+#include "scheduler.h"
+#include "rt_io.h"
+#include "hw_init.h"
+#include "tracing.h"
+#include "loop_lag.h"
+#include "probes.h"
 #include "web_server.h"
 
+#ifdef BENCH
+#include "bench.h"
+#endif
+
 #define MAX_LIGHT_BOUNDRY       (4)     /**< LED from 0 - 4, 5 in total. */
 
 #define LED_STATUS_THRESHOLD    (100)   /**< LED off status */
 
 #define POWER_PIN               (24)    /**< wiringPi pin number of power */
 
+#define PORT_ENV                "SMARTHOMED_PORT"   /**< Port to listen on */
+#define PORT_DEFAULT            (80)    /**< Default port */
+
+#define HISTORY_MAX_POINTS      (HISTORY_SECOND_SLOTS) /**< Buckets in one reply */
+#define HISTORY_SPAN_DEFAULT    (3600)  /**< Range when no from is given */
+
+#define QUERY_WINDOW_DEFAULT    (3600)  /**< Window when none is given */
+#define QUERY_SPAN_DEFAULT      (86400) /**< Range when no from is given */
+#define QUERY_MAX_WINDOWS       (100000) /**< Windows in one reply */
+#define QUERY_CHUNK_WINDOWS     (64)    /**< Windows sent per chunk */
+
+#define USEC_PER_MSEC           (1000)  /**< Microseconds per millisecond */
+
+#define QUERY_COUNT             (0)     /**< agg=count */
+#define QUERY_SUM               (1)     /**< agg=sum */
+#define QUERY_MIN               (2)     /**< agg=min */
+#define QUERY_MAX               (3)     /**< agg=max */
+#define QUERY_AVG               (4)     /**< agg=avg */
+
 const int g_led_pins[MAX_LIGHT_BOUNDRY + 1] = {7, 0, 2, 3, 25}; /**< LED on GPIO*/
 
+static pin_gpio_mask_t g_led_masks[MAX_LIGHT_BOUNDRY + 1]; /**< LED register bits */
+static pin_gpio_mask_t g_led_all;       /**< Every LED, switched in one write */
+static pin_gpio_mask_t g_power_mask;    /**< Power register bit */
+static rt_io_st *g_rt_io = NULL;        /**< Thread of the sensor reads */
+static uint64_t g_listening_us = 0;     /**< Socket bound, CLOCK_MONOTONIC */
+
+static const char *g_history_levels[HISTORY_LEVELS] = {
+    "second", "minute", "hour"
+};                                      /**< res= of /history */
+
+static const char *g_query_aggs[] = {
+    "count", "sum", "min", "max", "avg"
+};                                      /**< agg= of /query */
+
+/**
+ * @brief a URI served, its handler runs in a span of the trace.
+ */
+typedef struct route {
+    const char *path;                   /**< URI, NULL for every other one */
+    void (*cb)(struct evhttp_request *, void *); /**< handler */
+    void *arg;                          /**< argument of the handler */
+} route_st;
+
+/**
+ * @brief a /scheduler, stats copied on the I/O thread.
+ */
+typedef struct scheduler_read {
+    struct evhttp_request *req;         /**< the request */
+    int tasks;                          /**< number of tasks */
+    scheduler_stats_st stats[SCHEDULER_MAX_TASKS]; /**< their stats */
+} scheduler_read_st;
+
+/**
+ * @brief a /query being streamed, one chunk of windows at a time.
+ */
+typedef struct query_stream {
+    struct evhttp_request *req;         /**< the request */
+    int series;                         /**< HISTORY_* series */
+    int level;                          /**< resolution aggregated */
+    int agg;                            /**< QUERY_* */
+    time_t window;                      /**< window width, in seconds */
+    time_t next;                        /**< start of the next window */
+    time_t to;                          /**< end of the range, inclusive */
+    unsigned long windows;              /**< windows sent */
+    struct timespec started;            /**< request received */
+} query_stream_st;
+
 /**
  * ===========================================
  * Call back functions handle the http request
@@ -51,12 +128,135 @@ static void temperature_request_cb(struct evhttp_request *req, void *arg);
 
 static void temp_humi_request_cb(struct evhttp_request *req, void *arg);
 
+static void history_request_cb(struct evhttp_request *req, void *arg);
+
+static void query_request_cb(struct evhttp_request *req, void *arg);
+
+static void scheduler_request_cb(struct evhttp_request *req, void *arg);
+
+static void trace_request_cb(struct evhttp_request *req, void *arg);
+
+static void lag_request_cb(struct evhttp_request *req, void *arg);
+
 static void dump_request_cb(struct evhttp_request *req, void *arg);
 
 /**
- * @brief setup the wiringPi
+ * @brief run the handler of a route in a span named after it.
+ * @param arg the route.
  */
-static void setup_wiringPi(void);
+static void route_request_cb(struct evhttp_request *req, void *arg);
+
+/**
+ * @brief setup the GPIO registers and the pin masks
+ */
+static void setup_gpio(void);
+
+/**
+ * @brief log how long the first request took to come, once.
+ */
+static void first_request(void);
+
+/**
+ * @brief copy the stats of the scheduler, on the I/O thread.
+ * @param arg the scheduler_read.
+ */
+static void scheduler_read(void *arg);
+
+/**
+ * @brief answer /scheduler once copied.
+ * @param arg the scheduler_read.
+ */
+static void scheduler_reply(void *arg);
+
+/**
+ * @brief JSON answer of /temp_humi/status
+ * @param evb buffer of the reply.
+ * @param value reading of the DHT11.
+ */
+static void format_temp_humi(struct evbuffer *evb, const dht_data_st *value);
+
+/**
+ * @brief send the next chunk of a /query, or its end.
+ * @param evcon connection the chunk went out on.
+ * @param arg the query_stream.
+ */
+static void query_send_chunk(struct evhttp_connection *evcon, void *arg);
+
+/**
+ * @brief free a /query whose client went away.
+ */
+static void query_close_cb(struct evhttp_connection *evcon, void *arg);
+
+/**
+ * @brief JSON of a chunk of /query windows.
+ * @param evb buffer of the reply.
+ * @param query the query, next is moved past the windows written.
+ * @param max windows to write at most.
+ */
+static void format_query_windows(struct evbuffer *evb, query_stream_st *query,
+                                 int max);
+
+/**
+ * @brief JSON answer of /scheduler
+ * @param evb buffer of the reply.
+ * @param read stats of the tasks.
+ * @param io counters of the I/O thread.
+ */
+static void format_scheduler(struct evbuffer *evb, const scheduler_read_st *read,
+                             const rt_io_stats_st *io);
+
+/**
+ * @brief JSON answer of /history
+ * @param evb buffer of the reply.
+ * @param series HISTORY_* series.
+ * @param level HISTORY_SECOND, _MINUTE or _HOUR.
+ * @param points buckets, oldest first.
+ * @param n number of buckets.
+ */
+static void format_history(struct evbuffer *evb, int series, int level,
+                           const history_point_st *points, int n);
+
+/**
+ * @brief Chrome trace JSON answer of /trace
+ * @param evb buffer of the reply.
+ * @param events events collected.
+ * @param n number of events.
+ */
+static void format_trace(struct evbuffer *evb, const tracing_event_st *events,
+                         int n);
+
+/**
+ * @brief JSON answer of /lag
+ * @param evb buffer of the reply.
+ * @param stats lag of the loop.
+ * @param callbacks labelled callbacks, most stall time first.
+ * @param n number of callbacks.
+ */
+static void format_lag(struct evbuffer *evb, const loop_lag_stats_st *stats,
+                       const loop_lag_callback_st *callbacks, int n);
+
+static const route_st g_routes[] = {
+    { "/power/on", power_request_cb, "on" },
+    { "/power/off", power_request_cb, "off" },
+    { "/power/status", power_request_cb, "status" },
+    //{ "/status", status_request_cb, NULL },
+    //{ "/switch/on", switch_request_cb, "on" },
+    //{ "/switch/off", switch_request_cb, "off" },
+    //{ "/motor/on", switch_request_cb, "on" },
+    //{ "/motor/off", switch_request_cb, "off" },
+    //{ "/temp/status", temperature_request_cb, NULL },
+    { "/temp_humi/status", temp_humi_request_cb, NULL },
+    { "/history", history_request_cb, NULL },
+    { "/query", query_request_cb, NULL },
+    { "/scheduler", scheduler_request_cb, NULL },
+    { "/trace/on", trace_request_cb, "on" },
+    { "/trace/off", trace_request_cb, "off" },
+    { "/trace", trace_request_cb, "dump" },
+    { "/lag", lag_request_cb, NULL },
+    /* The /dump URI will dump all requests to stdout and say 200 ok. */
+    { NULL, dump_request_cb, NULL },
+    { NULL, NULL, NULL }
+};                                      /**< URIs served */
 
 /**
  * @brief setting up the web server
@@ -65,10 +265,12 @@ static void setup_wiringPi(void);
 void web_server_init(struct event_base *base) {
     struct evhttp *http;
     struct evhttp_bound_socket *handle;
+    const char *env = getenv(PORT_ENV);
+    const route_st *route;
 
-    ev_uint16_t port = 80;
+    ev_uint16_t port = env != NULL ? atoi(env) : PORT_DEFAULT;
 
-    setup_wiringPi();
+    setup_gpio();
 
     /* Create a new evhttp object to handle requests. */
     http = evhttp_new(base);
@@ -77,28 +279,12 @@ void web_server_init(struct event_base *base) {
         exit(errno);
     }
 
-    evhttp_set_cb(http, "/power/on", power_request_cb, "on");
-
-    evhttp_set_cb(http, "/power/off", power_request_cb, "off");
-
-    evhttp_set_cb(http, "/power/status", power_request_cb, "status");
-    
-    //evhttp_set_cb(http, "/status", status_request_cb, NULL);
-
-    //evhttp_set_cb(http, "/switch/on", switch_request_cb, "on");
-
-    //evhttp_set_cb(http, "/switch/off", switch_request_cb, "off");
-
-    //evhttp_set_cb(http, "/motor/on", switch_request_cb, "on");
-
-    //evhttp_set_cb(http, "/motor/off", switch_request_cb, "off");
-
-    //evhttp_set_cb(http, "/temp/status", temperature_request_cb, NULL);
-
-    evhttp_set_cb(http, "/temp_humi/status", temp_humi_request_cb, NULL);
-
-    /* The /dump URI will dump all requests to stdout and say 200 ok. */
-    evhttp_set_gencb(http, dump_request_cb, NULL);
+    for (route = g_routes; route->cb != NULL; ++route) {
+        if (route->path != NULL)
+            evhttp_set_cb(http, route->path, route_request_cb, (void *)route);
+        else
+            evhttp_set_gencb(http, route_request_cb, (void *)route);
+    }
 
     /* Now we tell the evhttp what port to listen on */
     handle = evhttp_bind_socket_with_handle(http, "0.0.0.0", port);
@@ -106,21 +292,31 @@ void web_server_init(struct event_base *base) {
         fprintf(stderr, "couldn't bind to port %d. Exiting.\n", (int)port);
         exit(errno);
     }
+    g_listening_us = event_queue_now_us();
     printf("server started\n");
 }
 
+/**
+ * @brief run the sensor reads of the requests on the I/O thread, and serve
+ *        the plan and timing of its reads on /scheduler
+ * @param rt the I/O thread, NULL to read on the event loop.
+ */
+void web_server_set_rt_io(struct rt_io *rt) {
+    g_rt_io = rt;
+}
+
 static void
 power_request_cb(struct evhttp_request *req, void *arg)
 {
     struct evbuffer *evb = NULL;
 
     if (strcmp(arg, "on") == 0) {
-        digitalWrite(POWER_PIN, 1);
+        pin_gpio_set(g_power_mask);
     } else if (strcmp(arg, "off") == 0) {
-        digitalWrite(POWER_PIN, 0);
+        pin_gpio_clear(g_power_mask);
     } else {
         evb = evbuffer_new();
-        evbuffer_add_printf(evb, "%d\n", digitalRead(POWER_PIN));
+        evbuffer_add_printf(evb, "%d\n", pin_gpio_read(g_power_mask) != 0);
     }
     evhttp_send_reply(req, 200, "OK", evb);
     if (evb != NULL)
@@ -131,19 +327,37 @@ static void
 switch_request_cb(struct evhttp_request *req, void *arg)
 {
     struct evkeyvalq headers;
+    pin_gpio_mask_t mask;
     const char *q;
     int led;
     // Parse the query for later lookups
     evhttp_parse_query(evhttp_request_get_uri(req), &headers);
 
     q = evhttp_find_header (&headers, "led");
-    led = atoi(q);
+    if (q == NULL) {
+        evhttp_send_error(req, HTTP_BADREQUEST, NULL);
+        evhttp_clear_headers(&headers);
+        return;
+    }
 
-    if (strcmp(arg, "on")) {
-        digitalWrite(g_led_pins[led], 0);
+    // "all" switches every LED with one register write.
+    if (strcmp(q, "all") == 0) {
+        mask = g_led_all;
     } else {
-        digitalWrite(g_led_pins[led], 1);
+        led = atoi(q);
+        if (led < 0 || led > MAX_LIGHT_BOUNDRY) {
+            evhttp_send_error(req, HTTP_BADREQUEST, NULL);
+            evhttp_clear_headers(&headers);
+            return;
+        }
+        mask = g_led_masks[led];
     }
+
+    if (strcmp(arg, "on"))
+        pin_gpio_clear(mask);
+    else
+        pin_gpio_set(mask);
+    evhttp_clear_headers(&headers);
     evhttp_send_reply(req, 200, "OK", NULL);
 }
 
@@ -190,20 +404,274 @@ temperature_request_cb(struct evhttp_request *req, void *arg)
     evbuffer_free(evb);
 }
 
+/* Callback used for the /temp_humi/status URI: answered from the last
+ * reading of the dht11 task, the sensor is never read on demand. */
 static void
 temp_humi_request_cb(struct evhttp_request *req, void *arg)
 {
     struct evbuffer *evb = NULL;
     dht_data_st value;
+    time_t at;
 
-    pin_dht_11_init();
-    pin_dht_11_read(&value);
+    if (!history_latest(HISTORY_DHT11_TEMPERATURE, &at, &value.temperature) ||
+            !history_latest(HISTORY_DHT11_HUMIDITY, &at, &value.humidity)) {
+        evhttp_send_error(req, HTTP_SERVUNAVAIL, "No reading yet");
+        return;
+    }
 
     evb = evbuffer_new();
-    evbuffer_add_printf(evb, "{\"temperature\": %.2f, \"humidity\": %.2f}", 
-                        value.temperature, value.humidity);
+    format_temp_humi(evb, &value);
+    evhttp_send_reply(req, 200, "OK", evb);
+    PROBE1(http_reply, "/temp_humi/status");
+    evbuffer_free(evb);
+}
+
+/* Callback used for the /history URI:
+ * /history?series=dht11_temperature[&from=unix time][&to=unix time]
+ *          [&res=second|minute|hour], the last hour by default, at the finest
+ *          resolution fitting in HISTORY_MAX_POINTS buckets. */
+static void
+history_request_cb(struct evhttp_request *req, void *arg)
+{
+    static history_point_st points[HISTORY_MAX_POINTS];
+    struct evbuffer *evb = NULL;
+    struct evkeyvalq headers;
+    const char *q;
+    time_t from, to;
+    int series, level, n;
+
+    // Parse the query for later lookups
+    evhttp_parse_query(evhttp_request_get_uri(req), &headers);
+
+    series = history_series_find(evhttp_find_header(&headers, "series"));
+    q = evhttp_find_header(&headers, "to");
+    to = q != NULL ? atoll(q) : time(NULL);
+    q = evhttp_find_header(&headers, "from");
+    from = q != NULL ? atoll(q) : to - HISTORY_SPAN_DEFAULT + 1;
+
+    q = evhttp_find_header(&headers, "res");
+    if (q == NULL) {
+        level = history_level(from, to, HISTORY_MAX_POINTS);
+    } else {
+        for (level = HISTORY_LEVELS - 1; level >= 0; --level) {
+            if (strcmp(q, g_history_levels[level]) == 0)
+                break;
+        }
+    }
+
+    if (series < 0 || level < 0 || from > to) {
+        evhttp_send_error(req, HTTP_BADREQUEST, NULL);
+        evhttp_clear_headers(&headers);
+        return;
+    }
+    evhttp_clear_headers(&headers);
+
+    // the buckets are rolled up as samples come, nothing is rescanned here.
+    n = history_query(series, level, from, to, points, HISTORY_MAX_POINTS);
+
+    evb = evbuffer_new();
+    format_history(evb, series, level, points, n);
+    evhttp_add_header(evhttp_request_get_output_headers(req),
+                      "Content-Type", "application/json");
+    evhttp_send_reply(req, 200, "OK", evb);
+    evbuffer_free(evb);
+}
+
+/* Callback used for the /query URI:
+ * /query?series=dht11_temperature[&agg=count|sum|min|max|avg]
+ *        [&window=seconds, or with s, m, h or d][&from=unix time][&to=unix time]
+ * one aggregate per window, windows aligned on their width, the hourly
+ * average of the last day by default. Each window is aggregated from the
+ * summary tree of the history, the reply is streamed in chunks and ends
+ * with the time the query took. */
+static void
+query_request_cb(struct evhttp_request *req, void *arg)
+{
+    struct evkeyvalq headers;
+    query_stream_st *query;
+    const char *q;
+    char *unit;
+    time_t from;
+    long value;
+
+    if ((query = calloc(1, sizeof(query_stream_st))) == NULL) {
+        evhttp_send_error(req, HTTP_SERVUNAVAIL, NULL);
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &query->started);
+    query->req = req;
+    // Parse the query for later lookups
+    evhttp_parse_query(evhttp_request_get_uri(req), &headers);
+
+    query->series = history_series_find(evhttp_find_header(&headers, "series"));
+
+    query->agg = QUERY_AVG;
+    if ((q = evhttp_find_header(&headers, "agg")) != NULL) {
+        for (query->agg = QUERY_AVG; query->agg >= 0; --query->agg) {
+            if (strcmp(q, g_query_aggs[query->agg]) == 0)
+                break;
+        }
+    }
+
+    query->window = QUERY_WINDOW_DEFAULT;
+    if ((q = evhttp_find_header(&headers, "window")) != NULL) {
+        value = strtol(q, &unit, 10);
+        switch (*unit) {
+        case '\0': case 's': query->window = value; break;
+        case 'm': query->window = value * 60; break;
+        case 'h': query->window = value * 3600; break;
+        case 'd': query->window = value * 86400; break;
+        default: query->window = 0; break;
+        }
+    }
+
+    q = evhttp_find_header(&headers, "to");
+    query->to = q != NULL ? atoll(q) : time(NULL);
+    q = evhttp_find_header(&headers, "from");
+    from = q != NULL ? atoll(q) : query->to - QUERY_SPAN_DEFAULT + 1;
+    evhttp_clear_headers(&headers);
+
+    if (query->series < 0 || query->agg < 0 || query->window <= 0 ||
+            from < 0 || from > query->to ||
+            (query->to - from) / query->window >= QUERY_MAX_WINDOWS) {
+        evhttp_send_error(req, HTTP_BADREQUEST, NULL);
+        free(query);
+        return;
+    }
+    query->next = from - from % query->window;
+    query->level = history_window_level(query->window);
+
+    evhttp_add_header(evhttp_request_get_output_headers(req),
+                      "Content-Type", "application/json");
+    evhttp_send_reply_start(req, 200, "OK");
+    // a client leaving mid reply takes the connection, and the query, down.
+    evhttp_connection_set_closecb(evhttp_request_get_connection(req),
+                                  query_close_cb, query);
+    query_send_chunk(evhttp_request_get_connection(req), query);
+}
+
+/* Callback used for the /scheduler URI: every periodic sensor read with
+ * its bus, period, deadline and planned phase, how many reads ran, missed
+ * their deadline or were skipped, their start jitter and duration. */
+static void
+scheduler_request_cb(struct evhttp_request *req, void *arg)
+{
+    scheduler_read_st *read;
+
+    if (g_rt_io == NULL) {
+        evhttp_send_error(req, HTTP_NOTFOUND, NULL);
+        return;
+    }
+    if ((read = calloc(1, sizeof(scheduler_read_st))) == NULL) {
+        evhttp_send_error(req, HTTP_SERVUNAVAIL, NULL);
+        return;
+    }
+    read->req = req;
+    // the counters belong to the I/O thread, they are copied there.
+    if (rt_io_call(g_rt_io, scheduler_read, scheduler_reply, read) != 0) {
+        evhttp_send_error(req, HTTP_SERVUNAVAIL, NULL);
+        free(read);
+    }
+}
+
+static void
+query_send_chunk(struct evhttp_connection *evcon, void *arg)
+{
+    query_stream_st *query = arg;
+    struct evbuffer *evb = evbuffer_new();
+    struct timespec now;
+
+    loop_lag_enter("/query chunk");
+    if (query->windows == 0) {
+        evbuffer_add_printf(evb, "{\"series\": \"%s\", \"agg\": \"%s\", "
+                            "\"window\": %ld, \"resolution\": %d, \"windows\": [",
+                            history_series_name(query->series),
+                            g_query_aggs[query->agg], (long)query->window,
+                            history_resolution(query->level));
+    }
+
+    if (query->next <= query->to) {
+        format_query_windows(evb, query, QUERY_CHUNK_WINDOWS);
+        // the next chunk once this one is out, the loop serves others meanwhile.
+        evhttp_send_reply_chunk_with_cb(query->req, evb, query_send_chunk, query);
+        evbuffer_free(evb);
+        loop_lag_leave();
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    evbuffer_add_printf(evb, "], \"latency_us\": %ld}\n",
+                        (now.tv_sec - query->started.tv_sec) * 1000000L +
+                        (now.tv_nsec - query->started.tv_nsec) / 1000);
+    evhttp_connection_set_closecb(evcon, NULL, NULL);
+    evhttp_send_reply_chunk(query->req, evb);
+    evhttp_send_reply_end(query->req);
+    PROBE1(http_reply, "/query");
+    evbuffer_free(evb);
+    free(query);
+    loop_lag_leave();
+}
+
+static void
+query_close_cb(struct evhttp_connection *evcon, void *arg)
+{
+    query_stream_st *query = arg;
+
+    // a reply not ended is left to us once the connection dropped it.
+    if (evhttp_request_get_connection(query->req) == NULL)
+        evhttp_request_free(query->req);
+    free(query);
+}
+
+static void
+trace_request_cb(struct evhttp_request *req, void *arg)
+{
+    tracing_event_st *events;
+    struct evbuffer *evb;
+    int n;
+
+    if (strcmp(arg, "dump") != 0) {
+        tracing_enable(strcmp(arg, "on") == 0);
+        evhttp_send_reply(req, 200, "OK", NULL);
+        return;
+    }
+
+    events = malloc(TRACING_MAX_THREADS * TRACING_RING_EVENTS *
+                    sizeof(tracing_event_st));
+    if (events == NULL || (evb = evbuffer_new()) == NULL) {
+        free(events);
+        evhttp_send_error(req, HTTP_SERVUNAVAIL, NULL);
+        return;
+    }
+    n = tracing_collect(events, TRACING_MAX_THREADS * TRACING_RING_EVENTS);
+    format_trace(evb, events, n);
+    free(events);
+
+    evhttp_add_header(evhttp_request_get_output_headers(req),
+                      "Content-Type", "application/json");
     evhttp_send_reply(req, 200, "OK", evb);
+    evbuffer_free(evb);
+}
 
+static void
+lag_request_cb(struct evhttp_request *req, void *arg)
+{
+    loop_lag_callback_st callbacks[LOOP_LAG_CALLBACKS + 2];
+    loop_lag_stats_st stats;
+    struct evbuffer *evb;
+    int n;
+
+    if ((evb = evbuffer_new()) == NULL) {
+        evhttp_send_error(req, HTTP_SERVUNAVAIL, NULL);
+        return;
+    }
+    loop_lag_get_stats(&stats);
+    n = loop_lag_get_callbacks(callbacks, LOOP_LAG_CALLBACKS + 2);
+    format_lag(evb, &stats, callbacks, n);
+
+    evhttp_add_header(evhttp_request_get_output_headers(req),
+                      "Content-Type", "application/json");
+    evhttp_send_reply(req, 200, "OK", evb);
     evbuffer_free(evb);
 }
 
@@ -254,15 +722,306 @@ dump_request_cb(struct evhttp_request *req, void *arg)
 }
 
 static void
-setup_wiringPi(void) {
-    int i, led;
+route_request_cb(struct evhttp_request *req, void *arg)
+{
+    const route_st *route = arg;
+    const char *name = route->path != NULL ? route->path : "/dump";
 
-    if (wiringPiSetup() < 0)
-        exit(errno);
+    first_request();
+    tracing_begin(name, "http");
+    PROBE1(http_request_start, name);
+    loop_lag_enter(name);
+    route->cb(req, route->arg);
+    loop_lag_leave();
+    PROBE1(http_request_done, name);
+    tracing_end();
+}
+
+static void
+first_request(void) {
+    static int logged = 0;
+    uint64_t now, started;
+
+    if (logged)
+        return;
+    logged = 1;
+    now = event_queue_now_us();
+    started = hw_init_started_us();
+    // time-to-first-request, the devices may still be coming up.
+    printf("first request %lu ms after start, %lu ms after listening\n",
+           started ? (unsigned long)((now - started) / USEC_PER_MSEC) : 0,
+           (unsigned long)((now - g_listening_us) / USEC_PER_MSEC));
+}
+
+static void
+scheduler_read(void *arg) {
+    scheduler_read_st *read = arg;
+    scheduler_st *scheduler = rt_io_scheduler(g_rt_io);
+    int i;
+
+    read->tasks = scheduler_tasks(scheduler);
+    for (i = 0; i < read->tasks; ++i)
+        scheduler_get_stats(scheduler, i, &read->stats[i]);
+}
+
+static void
+scheduler_reply(void *arg) {
+    scheduler_read_st *read = arg;
+    struct evbuffer *evb = NULL;
+    rt_io_stats_st io;
+
+    rt_io_get_stats(g_rt_io, &io);
+    evb = evbuffer_new();
+    format_scheduler(evb, read, &io);
+    evhttp_add_header(evhttp_request_get_output_headers(read->req),
+                      "Content-Type", "application/json");
+    evhttp_send_reply(read->req, 200, "OK", evb);
+    PROBE1(http_reply, "/scheduler");
+    evbuffer_free(evb);
+    free(read);
+}
+
+static void
+format_temp_humi(struct evbuffer *evb, const dht_data_st *value) {
+    evbuffer_add_printf(evb, "{\"temperature\": %.2f, \"humidity\": %.2f}",
+                        value->temperature, value->humidity);
+}
+
+static void
+format_history(struct evbuffer *evb, int series, int level,
+               const history_point_st *points, int n) {
+    int i;
+
+    evbuffer_add_printf(evb, "{\"series\": \"%s\", \"resolution\": %d, \"points\": [",
+                        history_series_name(series), history_resolution(level));
+    for (i = 0; i < n; ++i) {
+        evbuffer_add_printf(evb, "%s{\"time\": %ld, \"count\": %u, "
+                            "\"min\": %.2f, \"avg\": %.2f, \"max\": %.2f}",
+                            i ? ", " : "", (long)points[i].start, points[i].count,
+                            points[i].min, points[i].avg, points[i].max);
+    }
+    evbuffer_add_printf(evb, "]}\n");
+}
+
+static void
+format_scheduler(struct evbuffer *evb, const scheduler_read_st *read,
+                 const rt_io_stats_st *io) {
+    const scheduler_stats_st *stats;
+    int i;
+
+    evbuffer_add_printf(evb, "{\"io\": {\"calls\": %lu, \"samples\": %lu, "
+                        "\"dropped\": %lu}, \"tasks\": [", io->calls,
+                        io->samples, io->dropped);
+    for (i = 0; i < read->tasks; ++i) {
+        stats = &read->stats[i];
+        evbuffer_add_printf(evb, "%s{\"name\": \"%s\", \"bus\": \"%s\", "
+                            "\"period_us\": %ld, \"deadline_us\": %ld, "
+                            "\"phase_us\": %ld, \"runs\": %lu, \"missed\": %lu, "
+                            "\"skipped\": %lu, \"jitter_avg_us\": %ld, "
+                            "\"jitter_max_us\": %ld, \"run_avg_us\": %ld, "
+                            "\"run_max_us\": %ld}",
+                            i ? ", " : "", stats->name, scheduler_bus_name(stats->bus),
+                            stats->period_us, stats->deadline_us, stats->phase_us,
+                            stats->runs, stats->missed, stats->skipped,
+                            stats->jitter_avg_us, stats->jitter_max_us,
+                            stats->run_avg_us, stats->run_max_us);
+    }
+    evbuffer_add_printf(evb, "]}\n");
+}
+
+static void
+format_query_windows(struct evbuffer *evb, query_stream_st *query, int max) {
+    history_point_st point;
+    double value = 0;
+
+    for (; max > 0 && query->next <= query->to; --max) {
+        history_aggregate(query->series, query->level, query->next,
+                          query->next + query->window - 1, &point);
+        switch (query->agg) {
+        case QUERY_COUNT: value = point.count; break;
+        case QUERY_SUM: value = point.avg * point.count; break;
+        case QUERY_MIN: value = point.min; break;
+        case QUERY_MAX: value = point.max; break;
+        case QUERY_AVG: value = point.avg; break;
+        }
+        // a window without samples has no min, max or average.
+        if (point.count == 0 && query->agg != QUERY_COUNT && query->agg != QUERY_SUM)
+            evbuffer_add_printf(evb, "%s[%ld, null]", query->windows ? ", " : "",
+                                (long)query->next);
+        else
+            evbuffer_add_printf(evb, "%s[%ld, %.10g]", query->windows ? ", " : "",
+                                (long)query->next, value);
+        query->windows++;
+        query->next += query->window;
+    }
+}
+
+static void
+format_trace(struct evbuffer *evb, const tracing_event_st *events, int n) {
+    int i, threads = tracing_threads();
+
+    evbuffer_add_printf(evb, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    for (i = 0; i < threads; ++i) {
+        evbuffer_add_printf(evb, "%s{\"name\": \"thread_name\", \"ph\": \"M\", "
+                            "\"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                            i ? ", " : "", i, tracing_thread_name(i));
+    }
+    for (i = 0; i < n; ++i) {
+        evbuffer_add_printf(evb, "%s{\"ph\": \"%c\", \"ts\": %llu, \"pid\": 1, "
+                            "\"tid\": %d", threads + i ? ", " : "", events[i].phase,
+                            (unsigned long long)events[i].ts_us, events[i].tid);
+        if (events[i].name != NULL)
+            evbuffer_add_printf(evb, ", \"name\": \"%s\", \"cat\": \"%s\"",
+                                events[i].name, events[i].cat);
+        if (events[i].id != 0)
+            evbuffer_add_printf(evb, ", \"id\": %lu", events[i].id);
+        // the end of a flow binds to the span it lands in.
+        if (events[i].phase == TRACING_FLOW_END)
+            evbuffer_add_printf(evb, ", \"bp\": \"e\"");
+        evbuffer_add_printf(evb, "}");
+    }
+    evbuffer_add_printf(evb, "]}\n");
+}
+
+static void
+format_lag(struct evbuffer *evb, const loop_lag_stats_st *stats,
+           const loop_lag_callback_st *callbacks, int n) {
+    const char *sep = "";
+    int i;
 
-    for (i = 0; i <= MAX_LIGHT_BOUNDRY; ++i) {
-        led = g_led_pins[i];
-        pinMode(led, OUTPUT);
-        digitalWrite(led, 0);
+    evbuffer_add_printf(evb, "{\"period_ms\": %d, \"stall_us\": %d, \"ticks\": %lu, "
+                        "\"avg_us\": %llu, \"max_us\": %llu, \"stalls\": %lu, "
+                        "\"histogram\": [", LOOP_LAG_PERIOD_MS, LOOP_LAG_STALL_US,
+                        stats->ticks,
+                        stats->ticks ? (unsigned long long)(stats->lag_sum_us / stats->ticks) : 0,
+                        (unsigned long long)stats->lag_max_us, stats->stalls);
+    // empty buckets are left out, a null bound is the open last one.
+    for (i = 0; i < LOOP_LAG_BUCKETS; ++i) {
+        if (stats->histogram[i] == 0)
+            continue;
+        if (loop_lag_bucket_us(i))
+            evbuffer_add_printf(evb, "%s{\"lt_us\": %llu, \"count\": %lu}", sep,
+                                (unsigned long long)loop_lag_bucket_us(i),
+                                stats->histogram[i]);
+        else
+            evbuffer_add_printf(evb, "%s{\"lt_us\": null, \"count\": %lu}", sep,
+                                stats->histogram[i]);
+        sep = ", ";
+    }
+    evbuffer_add_printf(evb, "], \"callbacks\": [");
+    for (i = 0; i < n; ++i) {
+        evbuffer_add_printf(evb, "%s{\"name\": \"%s\", \"runs\": %lu, "
+                            "\"run_avg_us\": %llu, \"run_max_us\": %llu, "
+                            "\"stalls\": %lu, \"stall_ms\": %llu}", i ? ", " : "",
+                            callbacks[i].name, callbacks[i].runs,
+                            callbacks[i].runs ?
+                                (unsigned long long)(callbacks[i].run_sum_us / callbacks[i].runs) : 0,
+                            (unsigned long long)callbacks[i].run_max_us,
+                            callbacks[i].stalls,
+                            (unsigned long long)(callbacks[i].stall_sum_us / USEC_PER_MSEC));
     }
+    evbuffer_add_printf(evb, "]}\n");
+}
+
+static void
+setup_gpio(void) {
+    static const int power = POWER_PIN;
+    int i;
+
+    pin_gpio_setup();
+
+    // translate the pins once, switching is a register write afterwards.
+    for (i = 0; i <= MAX_LIGHT_BOUNDRY; ++i)
+        g_led_masks[i] = pin_gpio_mask(&g_led_pins[i], 1);
+    g_led_all = pin_gpio_mask(g_led_pins, MAX_LIGHT_BOUNDRY + 1);
+    g_power_mask = pin_gpio_mask(&power, 1);
+
+    pin_gpio_clear(g_led_all);
+    pin_gpio_mode(g_led_all, PIN_GPIO_OUTPUT);
 }
+
+#ifdef BENCH
+
+static const dht_data_st g_bench_value = { 21.4, 55.3 }; /**< A reading */
+
+/**
+ * @brief the reply of /temp_humi/status, in a buffer of its own.
+ */
+static void s_bench_temp_humi(void *arg, long n) {
+    struct evbuffer *evb;
+
+    while (n-- > 0) {
+        evb = evbuffer_new();
+        format_temp_humi(evb, &g_bench_value);
+        bench_keep(evbuffer_pullup(evb, -1));
+        evbuffer_free(evb);
+    }
+}
+
+/**
+ * @brief the reply of /temp_humi/status, in a buffer drained and reused.
+ */
+static void s_bench_temp_humi_reused(void *arg, long n) {
+    struct evbuffer *evb = evbuffer_new();
+
+    while (n-- > 0) {
+        format_temp_humi(evb, &g_bench_value);
+        bench_keep(evbuffer_pullup(evb, -1));
+        evbuffer_drain(evb, evbuffer_get_length(evb));
+    }
+    evbuffer_free(evb);
+}
+
+/**
+ * @brief the reply of /power/status.
+ */
+static void s_bench_power(void *arg, long n) {
+    struct evbuffer *evb;
+
+    while (n-- > 0) {
+        evb = evbuffer_new();
+        evbuffer_add_printf(evb, "%d\n", (int)(n & 1));
+        bench_keep(evbuffer_pullup(evb, -1));
+        evbuffer_free(evb);
+    }
+}
+
+/**
+ * @brief the windows of /query, the hourly average of a week.
+ */
+static void s_bench_query_week(void *arg, long n) {
+    struct evbuffer *evb = evbuffer_new();
+    query_stream_st query;
+
+    memset(&query, 0, sizeof(query));
+    query.series = HISTORY_DHT11_TEMPERATURE;
+    query.agg = QUERY_AVG;
+    query.window = 3600;
+    query.level = history_window_level(query.window);
+    while (n-- > 0) {
+        query.next = 1700002800 - 7 * 86400;
+        query.to = 1700002800 - 1;
+        query.windows = 0;
+        while (query.next <= query.to)
+            format_query_windows(evb, &query, QUERY_CHUNK_WINDOWS);
+        bench_keep(evbuffer_pullup(evb, -1));
+        evbuffer_drain(evb, evbuffer_get_length(evb));
+    }
+    evbuffer_free(evb);
+}
+
+int main() {
+    time_t t;
+
+    // a week of one sample a minute.
+    for (t = 1700002800 - 7 * 86400; t < 1700002800; t += 60)
+        history_push(HISTORY_DHT11_TEMPERATURE, t, 20 + t % 7);
+
+    bench_run("web", "temp_humi json", s_bench_temp_humi, NULL, NULL);
+    bench_run("web", "temp_humi json reused", s_bench_temp_humi_reused, NULL, NULL);
+    bench_run("web", "power status", s_bench_power, NULL, NULL);
+    bench_run("web", "query week by hour", s_bench_query_week, NULL, NULL);
+    return 0;
+}
+
+#endif
@@ -12,4 +12,13 @@
  */
 void web_server_init(struct event_base *base);
 
+struct rt_io;
+
+/**
+ * @brief run the sensor reads of the requests on the I/O thread, and serve
+ *        the plan and timing of its reads on /scheduler
+ * @param rt the I/O thread, NULL to read on the event loop.
+ */
+void web_server_set_rt_io(struct rt_io *rt);
+
 #endif
\ No newline at end of file